@@ -0,0 +1,1011 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-document-image.c
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+/**
+ * SECTION:sopa-document-image
+ * @short_description: A compact, read-only image of a document
+ *
+ * A #SopaDocumentImage is a document in the binary format written by
+ * sopa_document_save_binary(): a table of the nodes in document
+ * order, with the indices of their parents and next siblings, a table
+ * of the attributes, and a table of the strings, where tags, names and
+ * values are interned and text contents are stored as they are.
+ *
+ * Images loaded with sopa_document_image_new_from_file() are mapped
+ * into memory, and the checks done when loading make it safe to read
+ * them in place: the accessors and sopa_document_image_query_selector_all()
+ * work on the mapped data, and return strings that point into it, so
+ * that read-only work does not create any #SopaNode. A #SopaDocument
+ * is only built on request, with sopa_document_image_create_document().
+ *
+ * Nodes are identified by their index in document order; the document
+ * itself is the node 0.
+ */
+
+#include <string.h>
+
+#include "sopa-document-image.h"
+#include "sopa-document-image-private.h"
+
+#include "sopa-comment.h"
+#include "sopa-data.h"
+#include "sopa-element.h"
+#include "sopa-element-private.h"
+#include "sopa-node-private.h"
+#include "sopa-selector-private.h"
+#include "sopa-text.h"
+
+G_DEFINE_BOXED_TYPE (SopaDocumentImage, sopa_document_image,
+                     sopa_document_image_ref,
+                     sopa_document_image_unref)
+
+G_DEFINE_QUARK (sopa-document-image-error-quark, sopa_document_image_error)
+
+#define IMAGE_MAGIC             "SOPA"
+#define IMAGE_BYTE_ORDER        0x01020304
+#define IMAGE_VERSION           1
+
+/* the string index of nodes without tag or content */
+#define NO_STRING               G_MAXUINT32
+
+typedef enum {
+  IMAGE_NODE_DOCUMENT,
+  IMAGE_NODE_ELEMENT,
+  IMAGE_NODE_TEXT,
+  IMAGE_NODE_COMMENT,
+  IMAGE_NODE_DATA
+} ImageNodeType;
+
+/* the layout of the image: the header is followed by the nodes, the
+ * attributes, the string table and the string data; all the integers
+ * are 32 bits wide, in the byte order of the machine that wrote them
+ */
+typedef struct
+{
+  gchar   magic[4];
+  guint32 byte_order;
+  guint32 version;
+  guint32 doctype;
+
+  guint32 n_nodes;
+  guint32 n_attributes;
+  guint32 n_strings;
+  guint32 string_data_size;
+} ImageHeader;
+
+typedef struct
+{
+  guint32 type;
+  guint32 parent;
+  guint32 next_sibling;
+
+  /* number of nodes in the sub-tree; the first child, if any, is the
+   * node that follows
+   */
+  guint32 subtree_size;
+
+  /* the tag of elements, or the content of text nodes */
+  guint32 string;
+
+  guint32 first_attribute;
+  guint32 n_attributes;
+} ImageNode;
+
+typedef struct
+{
+  guint32 name;
+  guint32 value;
+} ImageAttribute;
+
+typedef struct
+{
+  guint32 offset;
+  guint32 length;
+} ImageString;
+
+/* what the selector adapter works on */
+typedef struct
+{
+  SopaDocumentImage *image;
+  guint              index;
+} ImageSubject;
+
+struct _SopaDocumentImage
+{
+  volatile gint         ref_count;
+
+  GBytes               *bytes;
+
+  const ImageHeader    *header;
+  const ImageNode      *nodes;
+  const ImageAttribute *attributes;
+  const ImageString    *strings;
+  const gchar          *string_data;
+
+  /* built on the first query */
+  ImageSubject         *subjects;
+};
+
+/* writing */
+
+typedef struct
+{
+  GArray     *nodes;
+  GArray     *attributes;
+  GArray     *strings;
+  GByteArray *string_data;
+
+  /* interned string -> index + 1 */
+  GHashTable *interned;
+} ImageBuilder;
+
+static guint32
+builder_add_string (ImageBuilder *builder,
+                    const gchar  *str)
+{
+  ImageString entry;
+
+  entry.offset = builder->string_data->len;
+  entry.length = strlen (str);
+
+  g_byte_array_append (builder->string_data,
+                       (const guint8 *) str,
+                       entry.length + 1);
+  g_array_append_val (builder->strings, entry);
+
+  return builder->strings->len - 1;
+}
+
+static guint32
+builder_intern_string (ImageBuilder *builder,
+                       const gchar  *str)
+{
+  guint32 index_;
+
+  index_ = GPOINTER_TO_UINT (g_hash_table_lookup (builder->interned, str));
+  if (index_ > 0)
+    return index_ - 1;
+
+  index_ = builder_add_string (builder, str);
+  g_hash_table_insert (builder->interned,
+                       (gpointer) str,
+                       GUINT_TO_POINTER (index_ + 1));
+
+  return index_;
+}
+
+static void
+builder_add_node (ImageBuilder *builder,
+                  SopaNode     *node,
+                  guint32       parent)
+{
+  const SopaElementAttribute *attrs;
+  ImageAttribute attr;
+  ImageNode entry;
+  guint i, n_attrs;
+
+  entry.parent = parent;
+  entry.next_sibling = SOPA_DOCUMENT_IMAGE_NO_NODE;
+  entry.subtree_size = _sopa_node_get_subtree_size (node);
+  entry.string = NO_STRING;
+  entry.first_attribute = builder->attributes->len;
+  entry.n_attributes = 0;
+
+  if (SOPA_IS_DOCUMENT (node))
+    entry.type = IMAGE_NODE_DOCUMENT;
+  else if (SOPA_IS_ELEMENT (node))
+    {
+      entry.type = IMAGE_NODE_ELEMENT;
+      entry.string = builder_intern_string (builder,
+                                            sopa_element_get_tag (SOPA_ELEMENT (node)));
+
+      attrs = _sopa_element_get_attributes (SOPA_ELEMENT (node), &n_attrs);
+      for (i = 0; i < n_attrs; i++)
+        {
+          attr.name = builder_intern_string (builder, attrs[i].name);
+          attr.value = builder_intern_string (builder, attrs[i].value);
+          g_array_append_val (builder->attributes, attr);
+        }
+
+      entry.n_attributes = n_attrs;
+    }
+  else if (SOPA_IS_TEXT (node))
+    {
+      const gchar *content = sopa_text_get_content (SOPA_TEXT (node));
+
+      entry.type = IMAGE_NODE_TEXT;
+
+      /* text is rarely repeated, so it is not worth interning */
+      if (content != NULL)
+        entry.string = builder_add_string (builder, content);
+    }
+  else if (SOPA_IS_COMMENT (node))
+    entry.type = IMAGE_NODE_COMMENT;
+  else
+    entry.type = IMAGE_NODE_DATA;
+
+  g_array_append_val (builder->nodes, entry);
+}
+
+/*< private >
+ * _sopa_document_image_build:
+ * @document: a #SopaDocument
+ *
+ * Writes the image of @document, walking the tree once.
+ *
+ * Return value: (transfer full): the image
+ */
+GBytes *
+_sopa_document_image_build (SopaDocument *document)
+{
+  ImageBuilder builder;
+  ImageHeader header;
+  ImageNode *entry;
+  SopaNode *root, *node;
+  GByteArray *image;
+  GHashTable *indices;
+  SopaNode *prev;
+  guint32 index_;
+  SopaDocumentType doctype;
+
+  root = SOPA_NODE (document);
+
+  builder.nodes = g_array_sized_new (FALSE, FALSE, sizeof (ImageNode),
+                                     _sopa_node_get_subtree_size (root));
+  builder.attributes = g_array_new (FALSE, FALSE, sizeof (ImageAttribute));
+  builder.strings = g_array_new (FALSE, FALSE, sizeof (ImageString));
+  builder.string_data = g_byte_array_new ();
+  builder.interned = g_hash_table_new (g_str_hash, g_str_equal);
+
+  /* node -> index, for the parent and sibling links */
+  indices = g_hash_table_new (NULL, NULL);
+
+  for (node = root; node != NULL; node = _sopa_node_next_in_tree (node, root))
+    {
+      index_ = builder.nodes->len;
+      g_hash_table_insert (indices, node, GUINT_TO_POINTER (index_));
+
+      if (node == root)
+        builder_add_node (&builder, node, SOPA_DOCUMENT_IMAGE_NO_NODE);
+      else
+        builder_add_node (&builder, node,
+                          GPOINTER_TO_UINT (g_hash_table_lookup (indices,
+                                                                 sopa_node_get_parent (node))));
+
+      prev = node != root ? sopa_node_get_previous_sibling (node) : NULL;
+      if (prev != NULL)
+        {
+          entry = &g_array_index (builder.nodes, ImageNode,
+                                  GPOINTER_TO_UINT (g_hash_table_lookup (indices, prev)));
+          entry->next_sibling = index_;
+        }
+    }
+
+  g_object_get (document, "doctype", &doctype, NULL);
+
+  memset (&header, 0, sizeof (ImageHeader));
+  memcpy (header.magic, IMAGE_MAGIC, 4);
+  header.byte_order = IMAGE_BYTE_ORDER;
+  header.version = IMAGE_VERSION;
+  header.doctype = doctype;
+  header.n_nodes = builder.nodes->len;
+  header.n_attributes = builder.attributes->len;
+  header.n_strings = builder.strings->len;
+  header.string_data_size = builder.string_data->len;
+
+  image = g_byte_array_sized_new (sizeof (ImageHeader) +
+                                  builder.nodes->len * sizeof (ImageNode) +
+                                  builder.attributes->len * sizeof (ImageAttribute) +
+                                  builder.strings->len * sizeof (ImageString) +
+                                  builder.string_data->len);
+
+  g_byte_array_append (image, (const guint8 *) &header, sizeof (ImageHeader));
+  g_byte_array_append (image, (const guint8 *) builder.nodes->data,
+                       builder.nodes->len * sizeof (ImageNode));
+  g_byte_array_append (image, (const guint8 *) builder.attributes->data,
+                       builder.attributes->len * sizeof (ImageAttribute));
+  g_byte_array_append (image, (const guint8 *) builder.strings->data,
+                       builder.strings->len * sizeof (ImageString));
+  g_byte_array_append (image, builder.string_data->data, builder.string_data->len);
+
+  g_hash_table_unref (indices);
+  g_hash_table_unref (builder.interned);
+  g_array_free (builder.nodes, TRUE);
+  g_array_free (builder.attributes, TRUE);
+  g_array_free (builder.strings, TRUE);
+  g_byte_array_unref (builder.string_data);
+
+  return g_byte_array_free_to_bytes (image);
+}
+
+/* loading */
+
+static gboolean
+image_fail (GError     **error,
+            const gchar *reason)
+{
+  g_set_error (error,
+               SOPA_DOCUMENT_IMAGE_ERROR,
+               SOPA_DOCUMENT_IMAGE_ERROR_INVALID,
+               "Invalid document image: %s",
+               reason);
+
+  return FALSE;
+}
+
+/* checks everything the accessors rely on, so that they can read the
+ * image without further checks
+ */
+static gboolean
+image_validate (SopaDocumentImage *self,
+                gsize              size,
+                GError           **error)
+{
+  const ImageHeader *header = self->header;
+  const ImageNode *node;
+  const ImageString *str;
+  guint64 expected;
+  guint32 i;
+
+  expected = (guint64) sizeof (ImageHeader)
+           + (guint64) header->n_nodes * sizeof (ImageNode)
+           + (guint64) header->n_attributes * sizeof (ImageAttribute)
+           + (guint64) header->n_strings * sizeof (ImageString)
+           + header->string_data_size;
+
+  if (expected != size)
+    return image_fail (error, "the size does not match the header");
+
+  if (header->n_nodes == 0 ||
+      self->nodes[0].type != IMAGE_NODE_DOCUMENT ||
+      self->nodes[0].subtree_size != header->n_nodes)
+    return image_fail (error, "the first node is not the document");
+
+  if (header->doctype > SOPA_DOCUMENT_TYPE_HTML_5)
+    return image_fail (error, "the document type is unknown");
+
+  for (i = 0; i < header->n_strings; i++)
+    {
+      str = &self->strings[i];
+
+      if ((guint64) str->offset + str->length >= header->string_data_size ||
+          self->string_data[str->offset + str->length] != '\0')
+        return image_fail (error, "a string is out of bounds");
+    }
+
+  for (i = 0; i < header->n_attributes; i++)
+    {
+      if (self->attributes[i].name >= header->n_strings ||
+          self->attributes[i].value >= header->n_strings)
+        return image_fail (error, "an attribute is out of bounds");
+    }
+
+  for (i = 0; i < header->n_nodes; i++)
+    {
+      node = &self->nodes[i];
+
+      if (node->type > IMAGE_NODE_DATA ||
+          (node->type == IMAGE_NODE_DOCUMENT) != (i == 0))
+        return image_fail (error, "a node has an invalid type");
+
+      /* parents come before, siblings after the sub-tree */
+      if ((i == 0) != (node->parent == SOPA_DOCUMENT_IMAGE_NO_NODE) ||
+          (i > 0 && node->parent >= i) ||
+          node->subtree_size == 0 ||
+          (guint64) i + node->subtree_size > header->n_nodes ||
+          (node->subtree_size > 1 && self->nodes[i + 1].parent != i) ||
+          (node->next_sibling != SOPA_DOCUMENT_IMAGE_NO_NODE &&
+           (node->next_sibling != i + node->subtree_size ||
+            self->nodes[node->next_sibling].parent != node->parent)))
+        return image_fail (error, "a node has invalid links");
+
+      /* only elements and the document have children */
+      if (i > 0 &&
+          self->nodes[node->parent].type != IMAGE_NODE_ELEMENT &&
+          self->nodes[node->parent].type != IMAGE_NODE_DOCUMENT)
+        return image_fail (error, "a node has an invalid parent");
+
+      /* elements have a tag, text nodes may have a content */
+      if (node->string == NO_STRING
+          ? node->type == IMAGE_NODE_ELEMENT
+          : (node->string >= header->n_strings ||
+             (node->type != IMAGE_NODE_ELEMENT && node->type != IMAGE_NODE_TEXT)))
+        return image_fail (error, "a node has an invalid string");
+
+      if ((guint64) node->first_attribute + node->n_attributes > header->n_attributes ||
+          (node->type != IMAGE_NODE_ELEMENT && node->n_attributes > 0))
+        return image_fail (error, "a node has invalid attributes");
+    }
+
+  return TRUE;
+}
+
+/**
+ * sopa_document_image_new_from_bytes:
+ * @bytes: a #GBytes with an image written by sopa_document_save_binary()
+ * @error: return location for a #GError
+ *
+ * Loads a document image. The data of @bytes is checked once and then
+ * read in place; it is only copied when it is not suitably aligned.
+ *
+ * Return value: (transfer full): the image, or %NULL if @bytes does
+ *      not hold a valid image of this version of the format
+ *
+ * Since: 0.2
+ */
+SopaDocumentImage *
+sopa_document_image_new_from_bytes (GBytes  *bytes,
+                                    GError **error)
+{
+  SopaDocumentImage *self;
+  const ImageHeader *header;
+  const guint8 *data;
+  gsize size;
+
+  g_return_val_if_fail (bytes != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  data = g_bytes_get_data (bytes, &size);
+
+  if (size < sizeof (ImageHeader) || memcmp (data, IMAGE_MAGIC, 4) != 0)
+    {
+      image_fail (error, "not a document image");
+      return NULL;
+    }
+
+  self = g_slice_new0 (SopaDocumentImage);
+  self->ref_count = 1;
+
+  if (GPOINTER_TO_SIZE (data) % sizeof (guint32) != 0)
+    {
+      self->bytes = g_bytes_new (data, size);
+      data = g_bytes_get_data (self->bytes, NULL);
+    }
+  else
+    self->bytes = g_bytes_ref (bytes);
+
+  header = (const ImageHeader *) data;
+
+  if (header->byte_order != IMAGE_BYTE_ORDER)
+    {
+      g_set_error_literal (error,
+                           SOPA_DOCUMENT_IMAGE_ERROR,
+                           SOPA_DOCUMENT_IMAGE_ERROR_VERSION,
+                           "The document image was written on a machine "
+                           "with another byte order");
+      sopa_document_image_unref (self);
+      return NULL;
+    }
+
+  if (header->version != IMAGE_VERSION)
+    {
+      g_set_error (error,
+                   SOPA_DOCUMENT_IMAGE_ERROR,
+                   SOPA_DOCUMENT_IMAGE_ERROR_VERSION,
+                   "The document image was written with version %u of "
+                   "the format, but only version %u is supported",
+                   header->version,
+                   IMAGE_VERSION);
+      sopa_document_image_unref (self);
+      return NULL;
+    }
+
+  self->header = header;
+  self->nodes = (const ImageNode *) (header + 1);
+  self->attributes = (const ImageAttribute *) (self->nodes + header->n_nodes);
+  self->strings = (const ImageString *) (self->attributes + header->n_attributes);
+  self->string_data = (const gchar *) (self->strings + header->n_strings);
+
+  if (!image_validate (self, size, error))
+    {
+      sopa_document_image_unref (self);
+      return NULL;
+    }
+
+  return self;
+}
+
+/**
+ * sopa_document_image_new_from_file:
+ * @filename: the path of an image written by sopa_document_save_binary()
+ * @error: return location for a #GError
+ *
+ * Maps @filename into memory and loads the document image it holds;
+ * the file stays mapped for as long as the image is alive. The error
+ * is in the #G_FILE_ERROR domain if the file cannot be mapped.
+ *
+ * Return value: (transfer full): the image, or %NULL on error
+ *
+ * Since: 0.2
+ */
+SopaDocumentImage *
+sopa_document_image_new_from_file (const gchar  *filename,
+                                   GError      **error)
+{
+  SopaDocumentImage *self;
+  GMappedFile *file;
+  GBytes *bytes;
+
+  g_return_val_if_fail (filename != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  file = g_mapped_file_new (filename, FALSE, error);
+  if (file == NULL)
+    return NULL;
+
+  bytes = g_mapped_file_get_bytes (file);
+  g_mapped_file_unref (file);
+
+  self = sopa_document_image_new_from_bytes (bytes, error);
+  g_bytes_unref (bytes);
+
+  return self;
+}
+
+/**
+ * sopa_document_image_ref:
+ * @self: a #SopaDocumentImage
+ *
+ * Increases the reference count of @self.
+ *
+ * Return value: (transfer full): @self
+ *
+ * Since: 0.2
+ */
+SopaDocumentImage *
+sopa_document_image_ref (SopaDocumentImage *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+/**
+ * sopa_document_image_unref:
+ * @self: a #SopaDocumentImage
+ *
+ * Decreases the reference count of @self, releasing the data when it
+ * drops to zero.
+ *
+ * Since: 0.2
+ */
+void
+sopa_document_image_unref (SopaDocumentImage *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (!g_atomic_int_dec_and_test (&self->ref_count))
+    return;
+
+  g_free (self->subjects);
+  g_bytes_unref (self->bytes);
+
+  g_slice_free (SopaDocumentImage, self);
+}
+
+/**
+ * sopa_document_image_get_doctype:
+ * @self: a #SopaDocumentImage
+ *
+ * Retrieves the type of the document.
+ *
+ * Return value: a #SopaDocumentType
+ *
+ * Since: 0.2
+ */
+SopaDocumentType
+sopa_document_image_get_doctype (SopaDocumentImage *self)
+{
+  g_return_val_if_fail (self != NULL, SOPA_DOCUMENT_TYPE_UNKNOWN);
+
+  return self->header->doctype;
+}
+
+/**
+ * sopa_document_image_get_n_nodes:
+ * @self: a #SopaDocumentImage
+ *
+ * Retrieves the number of nodes, including the document.
+ *
+ * Return value: the number of nodes
+ *
+ * Since: 0.2
+ */
+guint
+sopa_document_image_get_n_nodes (SopaDocumentImage *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->header->n_nodes;
+}
+
+/**
+ * sopa_document_image_get_node_type:
+ * @self: a #SopaDocumentImage
+ * @node: the index of a node
+ *
+ * Retrieves the type of the #SopaNode that @node stands for, like
+ * %SOPA_TYPE_ELEMENT or %SOPA_TYPE_TEXT.
+ *
+ * Return value: a #GType
+ *
+ * Since: 0.2
+ */
+GType
+sopa_document_image_get_node_type (SopaDocumentImage *self,
+                                   guint              node)
+{
+  g_return_val_if_fail (self != NULL, G_TYPE_INVALID);
+  g_return_val_if_fail (node < self->header->n_nodes, G_TYPE_INVALID);
+
+  switch (self->nodes[node].type)
+    {
+    case IMAGE_NODE_DOCUMENT:
+      return SOPA_TYPE_DOCUMENT;
+    case IMAGE_NODE_ELEMENT:
+      return SOPA_TYPE_ELEMENT;
+    case IMAGE_NODE_TEXT:
+      return SOPA_TYPE_TEXT;
+    case IMAGE_NODE_COMMENT:
+      return SOPA_TYPE_COMMENT;
+    default:
+      return SOPA_TYPE_DATA;
+    }
+}
+
+/**
+ * sopa_document_image_get_parent:
+ * @self: a #SopaDocumentImage
+ * @node: the index of a node
+ *
+ * Retrieves the parent of @node.
+ *
+ * Return value: the index of the parent, or %SOPA_DOCUMENT_IMAGE_NO_NODE
+ *      for the document
+ *
+ * Since: 0.2
+ */
+guint
+sopa_document_image_get_parent (SopaDocumentImage *self,
+                                guint              node)
+{
+  g_return_val_if_fail (self != NULL, SOPA_DOCUMENT_IMAGE_NO_NODE);
+  g_return_val_if_fail (node < self->header->n_nodes, SOPA_DOCUMENT_IMAGE_NO_NODE);
+
+  return self->nodes[node].parent;
+}
+
+/**
+ * sopa_document_image_get_first_child:
+ * @self: a #SopaDocumentImage
+ * @node: the index of a node
+ *
+ * Retrieves the first child of @node.
+ *
+ * Return value: the index of the first child, or
+ *      %SOPA_DOCUMENT_IMAGE_NO_NODE if @node has no children
+ *
+ * Since: 0.2
+ */
+guint
+sopa_document_image_get_first_child (SopaDocumentImage *self,
+                                     guint              node)
+{
+  g_return_val_if_fail (self != NULL, SOPA_DOCUMENT_IMAGE_NO_NODE);
+  g_return_val_if_fail (node < self->header->n_nodes, SOPA_DOCUMENT_IMAGE_NO_NODE);
+
+  return self->nodes[node].subtree_size > 1 ? node + 1
+                                            : SOPA_DOCUMENT_IMAGE_NO_NODE;
+}
+
+/**
+ * sopa_document_image_get_next_sibling:
+ * @self: a #SopaDocumentImage
+ * @node: the index of a node
+ *
+ * Retrieves the sibling that follows @node.
+ *
+ * Return value: the index of the next sibling, or
+ *      %SOPA_DOCUMENT_IMAGE_NO_NODE if @node is the last child
+ *
+ * Since: 0.2
+ */
+guint
+sopa_document_image_get_next_sibling (SopaDocumentImage *self,
+                                      guint              node)
+{
+  g_return_val_if_fail (self != NULL, SOPA_DOCUMENT_IMAGE_NO_NODE);
+  g_return_val_if_fail (node < self->header->n_nodes, SOPA_DOCUMENT_IMAGE_NO_NODE);
+
+  return self->nodes[node].next_sibling;
+}
+
+static inline const gchar *
+image_get_string (SopaDocumentImage *self,
+                  guint32            index_)
+{
+  if (index_ == NO_STRING)
+    return NULL;
+
+  return self->string_data + self->strings[index_].offset;
+}
+
+/**
+ * sopa_document_image_get_tag:
+ * @self: a #SopaDocumentImage
+ * @node: the index of a node
+ *
+ * Retrieves the tag of @node, if it is an element.
+ *
+ * Return value: (transfer none): the tag, pointing into the image, or
+ *      %NULL if @node is not an element
+ *
+ * Since: 0.2
+ */
+const gchar *
+sopa_document_image_get_tag (SopaDocumentImage *self,
+                             guint              node)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (node < self->header->n_nodes, NULL);
+
+  if (self->nodes[node].type != IMAGE_NODE_ELEMENT)
+    return NULL;
+
+  return image_get_string (self, self->nodes[node].string);
+}
+
+/**
+ * sopa_document_image_get_content:
+ * @self: a #SopaDocumentImage
+ * @node: the index of a node
+ *
+ * Retrieves the content of @node, if it is a text node.
+ *
+ * Return value: (transfer none): the content, pointing into the image,
+ *      or %NULL
+ *
+ * Since: 0.2
+ */
+const gchar *
+sopa_document_image_get_content (SopaDocumentImage *self,
+                                 guint              node)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (node < self->header->n_nodes, NULL);
+
+  if (self->nodes[node].type != IMAGE_NODE_TEXT)
+    return NULL;
+
+  return image_get_string (self, self->nodes[node].string);
+}
+
+static const gchar *
+image_node_get_attribute (SopaDocumentImage *self,
+                          guint              node,
+                          const gchar       *name)
+{
+  const ImageNode *entry = &self->nodes[node];
+  const ImageAttribute *attr;
+  guint32 i;
+
+  for (i = 0; i < entry->n_attributes; i++)
+    {
+      attr = &self->attributes[entry->first_attribute + i];
+
+      if (strcmp (image_get_string (self, attr->name), name) == 0)
+        return image_get_string (self, attr->value);
+    }
+
+  return NULL;
+}
+
+/**
+ * sopa_document_image_get_attribute:
+ * @self: a #SopaDocumentImage
+ * @node: the index of a node
+ * @name: the attribute name
+ *
+ * Retrieves the value of an attribute of @node.
+ *
+ * Return value: (transfer none): the value, pointing into the image, or
+ *      %NULL if @node has no such attribute
+ *
+ * Since: 0.2
+ */
+const gchar *
+sopa_document_image_get_attribute (SopaDocumentImage *self,
+                                   guint              node,
+                                   const gchar       *name)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (node < self->header->n_nodes, NULL);
+  g_return_val_if_fail (name != NULL, NULL);
+
+  return image_node_get_attribute (self, node, name);
+}
+
+static const gchar *
+subject_get_tag (gconstpointer subject)
+{
+  const ImageSubject *s = subject;
+
+  return image_get_string (s->image, s->image->nodes[s->index].string);
+}
+
+static const gchar *
+subject_get_attribute (gconstpointer  subject,
+                       const gchar   *name)
+{
+  const ImageSubject *s = subject;
+
+  return image_node_get_attribute (s->image, s->index, name);
+}
+
+static gconstpointer
+subject_get_parent (gconstpointer subject)
+{
+  const ImageSubject *s = subject;
+  guint32 parent = s->image->nodes[s->index].parent;
+
+  /* the document is not an element */
+  if (parent == SOPA_DOCUMENT_IMAGE_NO_NODE ||
+      s->image->nodes[parent].type != IMAGE_NODE_ELEMENT)
+    return NULL;
+
+  return &s->image->subjects[parent];
+}
+
+static const SopaSelectorAdapter subject_adapter = {
+  subject_get_tag,
+  subject_get_attribute,
+  subject_get_parent
+};
+
+/**
+ * sopa_document_image_query_selector_all:
+ * @self: a #SopaDocumentImage
+ * @selector: a #SopaSelector
+ *
+ * Collects, in document order, the elements of the image that are
+ * matched by @selector, reading the image in place.
+ *
+ * Return value: (transfer full) (element-type guint): an array with
+ *      the indices of the matching elements; free it with
+ *      g_array_unref()
+ *
+ * Since: 0.2
+ */
+GArray *
+sopa_document_image_query_selector_all (SopaDocumentImage *self,
+                                        SopaSelector      *selector)
+{
+  GArray *result;
+  guint i;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (selector != NULL, NULL);
+
+  /* a handle per node for the selector to match, made once */
+  if (g_once_init_enter (&self->subjects))
+    {
+      ImageSubject *subjects;
+
+      subjects = g_new (ImageSubject, self->header->n_nodes);
+      for (i = 0; i < self->header->n_nodes; i++)
+        {
+          subjects[i].image = self;
+          subjects[i].index = i;
+        }
+
+      g_once_init_leave (&self->subjects, subjects);
+    }
+
+  result = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  for (i = 1; i < self->header->n_nodes; i++)
+    {
+      if (self->nodes[i].type == IMAGE_NODE_ELEMENT &&
+          _sopa_selector_match_subject (selector,
+                                        &subject_adapter,
+                                        &self->subjects[i]))
+        g_array_append_val (result, i);
+    }
+
+  return result;
+}
+
+/**
+ * sopa_document_image_create_document:
+ * @self: a #SopaDocumentImage
+ *
+ * Builds a #SopaDocument with the nodes of the image. The document
+ * does not depend on the image, which can be released afterwards.
+ *
+ * Return value: (transfer full): a new #SopaDocument, which is not
+ *      floating, as with sopa_parser_parse()
+ *
+ * Since: 0.2
+ */
+SopaDocument *
+sopa_document_image_create_document (SopaDocumentImage *self)
+{
+  const ImageNode *entry;
+  const ImageAttribute *attr;
+  SopaDocument *document;
+  SopaNode **nodes;
+  SopaNode *node;
+  guint32 i, j;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  /* the same kind of reference parsing returns */
+  document = g_object_ref_sink (sopa_document_new ());
+  g_object_set (document, "doctype", self->header->doctype, NULL);
+
+  nodes = g_new (SopaNode *, self->header->n_nodes);
+  nodes[0] = SOPA_NODE (document);
+
+  for (i = 1; i < self->header->n_nodes; i++)
+    {
+      entry = &self->nodes[i];
+
+      switch (entry->type)
+        {
+        case IMAGE_NODE_ELEMENT:
+          node = SOPA_NODE (sopa_element_new (image_get_string (self, entry->string)));
+
+          for (j = 0; j < entry->n_attributes; j++)
+            {
+              attr = &self->attributes[entry->first_attribute + j];
+              sopa_element_set_attribute (SOPA_ELEMENT (node),
+                                          image_get_string (self, attr->name),
+                                          image_get_string (self, attr->value));
+            }
+          break;
+
+        case IMAGE_NODE_TEXT:
+          node = SOPA_NODE (sopa_text_new ());
+          sopa_text_set_content (SOPA_TEXT (node),
+                                 image_get_string (self, entry->string));
+          break;
+
+        case IMAGE_NODE_COMMENT:
+          node = SOPA_NODE (sopa_comment_new ());
+          break;
+
+        default:
+          node = SOPA_NODE (sopa_data_new ());
+          break;
+        }
+
+      /* nodes are in document order, so children are added in order */
+      sopa_node_add_child (nodes[entry->parent], node);
+      nodes[i] = node;
+    }
+
+  g_free (nodes);
+
+  return document;
+}
@@ -0,0 +1,106 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-document-image.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#if !defined(SOPA_H_INSIDE) && !defined(SOPA_COMPILATION)
+#error "Only <sopa/sopa.h> can be included directly.h"
+#endif
+
+#ifndef __SOPA_DOCUMENT_IMAGE_H__
+#define __SOPA_DOCUMENT_IMAGE_H__
+
+#include <glib-object.h>
+#include <sopa/sopa-document.h>
+#include <sopa/sopa-selector.h>
+
+G_BEGIN_DECLS
+
+#define SOPA_TYPE_DOCUMENT_IMAGE (sopa_document_image_get_type ())
+
+/**
+ * SOPA_DOCUMENT_IMAGE_ERROR:
+ *
+ * Error domain for loading document images. Errors in this domain
+ * will be from the #SopaDocumentImageError enumeration.
+ */
+#define SOPA_DOCUMENT_IMAGE_ERROR (sopa_document_image_error_quark ())
+
+/**
+ * SOPA_DOCUMENT_IMAGE_NO_NODE:
+ *
+ * The index returned by the #SopaDocumentImage accessors when there is
+ * no such node, like the parent of the document.
+ *
+ * Since: 0.2
+ */
+#define SOPA_DOCUMENT_IMAGE_NO_NODE ((guint) -1)
+
+/**
+ * SopaDocumentImageError:
+ * @SOPA_DOCUMENT_IMAGE_ERROR_INVALID: the data is not a document image,
+ * or it is truncated or corrupted
+ * @SOPA_DOCUMENT_IMAGE_ERROR_VERSION: the image was written with another
+ * version of the format, or on a machine with another byte order
+ *
+ * Error codes returned when loading a document image.
+ *
+ * Since: 0.2
+ */
+typedef enum {
+  SOPA_DOCUMENT_IMAGE_ERROR_INVALID,
+  SOPA_DOCUMENT_IMAGE_ERROR_VERSION
+} SopaDocumentImageError;
+
+typedef struct _SopaDocumentImage SopaDocumentImage;
+
+GType sopa_document_image_get_type (void) G_GNUC_CONST;
+GQuark sopa_document_image_error_quark (void);
+
+SopaDocumentImage *                 sopa_document_image_new_from_bytes          (GBytes                 *bytes,
+                                                                                 GError                **error);
+SopaDocumentImage *                 sopa_document_image_new_from_file           (const gchar            *filename,
+                                                                                 GError                **error);
+SopaDocumentImage *                 sopa_document_image_ref                     (SopaDocumentImage      *self);
+void                                sopa_document_image_unref                   (SopaDocumentImage      *self);
+SopaDocumentType                    sopa_document_image_get_doctype             (SopaDocumentImage      *self);
+guint                               sopa_document_image_get_n_nodes             (SopaDocumentImage      *self);
+GType                               sopa_document_image_get_node_type           (SopaDocumentImage      *self,
+                                                                                 guint                   node);
+guint                               sopa_document_image_get_parent              (SopaDocumentImage      *self,
+                                                                                 guint                   node);
+guint                               sopa_document_image_get_first_child         (SopaDocumentImage      *self,
+                                                                                 guint                   node);
+guint                               sopa_document_image_get_next_sibling        (SopaDocumentImage      *self,
+                                                                                 guint                   node);
+const gchar *                       sopa_document_image_get_tag                 (SopaDocumentImage      *self,
+                                                                                 guint                   node);
+const gchar *                       sopa_document_image_get_content             (SopaDocumentImage      *self,
+                                                                                 guint                   node);
+const gchar *                       sopa_document_image_get_attribute           (SopaDocumentImage      *self,
+                                                                                 guint                   node,
+                                                                                 const gchar            *name);
+GArray *                            sopa_document_image_query_selector_all      (SopaDocumentImage      *self,
+                                                                                 SopaSelector           *selector);
+SopaDocument *                      sopa_document_image_create_document         (SopaDocumentImage      *self);
+
+G_END_DECLS
+
+#endif /* __SOPA_DOCUMENT_IMAGE_H__ */
@@ -0,0 +1,47 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-document-private.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#ifndef __SOPA_DOCUMENT_PRIVATE_H__
+#define __SOPA_DOCUMENT_PRIVATE_H__
+
+#include <glib.h>
+
+#include "sopa-document.h"
+#include "sopa-source-map-private.h"
+
+G_BEGIN_DECLS
+
+/* wraps markup parsed as the content of an element, so that it can
+ * have several top-level nodes
+ */
+#define SOPA_FRAGMENT_START_TAG "<__sopa_fragment__>"
+#define SOPA_FRAGMENT_END_TAG   "</__sopa_fragment__>"
+
+void                                _sopa_document_set_source_map               (SopaDocument             *self,
+                                                                                 SopaSourceMap            *map);
+SopaSourceMap *                     _sopa_document_get_source_map               (SopaDocument             *self);
+void                                _sopa_document_copy_settings                (SopaDocument             *self,
+                                                                                 SopaDocument             *source);
+
+G_END_DECLS
+
+#endif /* __SOPA_DOCUMENT_PRIVATE_H__ */
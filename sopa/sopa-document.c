@@ -20,8 +20,18 @@
  *    Emanuel Fernandes <efernandes@tektorque.com>
  */
 
+#include <string.h>
+
 #include "sopa-document.h"
 
+#include "sopa-document-private.h"
+#include "sopa-document-image.h"
+#include "sopa-document-image-private.h"
+#include "sopa-node-private.h"
+#include "sopa-parser.h"
+#include "sopa-patch-private.h"
+#include "sopa-source-map-private.h"
+
 G_DEFINE_TYPE (SopaDocument, sopa_document, SOPA_TYPE_ELEMENT)
 
 #define DOCUMENT_PRIVATE(o) \
@@ -30,12 +40,23 @@ G_DEFINE_TYPE (SopaDocument, sopa_document, SOPA_TYPE_ELEMENT)
 struct _SopaDocumentPrivate
 {
   SopaDocumentType    doctype;
+
+  /* selector source -> matching elements, valid as long as the
+   * tree version is the one the results were computed with
+   */
+  gboolean            query_cache_enabled;
+  GHashTable         *query_cache;
+  SopaNodeOrder      *query_cache_order;
+
+  /* where the parsed nodes are in the source, if tracked */
+  SopaSourceMap      *source_map;
 };
 
 enum {
   PROP_0,
 
   PROP_DOCTYPE,
+  PROP_QUERY_CACHE_ENABLED,
 
   PROP_LAST
 };
@@ -56,6 +77,10 @@ sopa_document_get_property (GObject    *object,
       g_value_set_enum (value, doc->priv->doctype);
       break;
 
+    case PROP_QUERY_CACHE_ENABLED:
+      g_value_set_boolean (value, doc->priv->query_cache_enabled);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -75,20 +100,49 @@ sopa_document_set_property (GObject      *object,
       doc->priv->doctype = g_value_get_enum (value);
       break;
 
+    case PROP_QUERY_CACHE_ENABLED:
+      sopa_document_set_query_cache_enabled (doc, g_value_get_boolean (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
 }
 
+static void
+sopa_document_clear_query_cache (SopaDocument *self)
+{
+  SopaDocumentPrivate *priv = self->priv;
+
+  if (priv->query_cache != NULL)
+    g_hash_table_remove_all (priv->query_cache);
+
+  if (priv->query_cache_order != NULL)
+    {
+      _sopa_node_order_unref (priv->query_cache_order);
+      priv->query_cache_order = NULL;
+    }
+}
+
 static void
 sopa_document_dispose (GObject *object)
 {
+  sopa_document_clear_query_cache (SOPA_DOCUMENT (object));
+
   G_OBJECT_CLASS (sopa_document_parent_class)->dispose (object);
 }
 
 static void
 sopa_document_finalize (GObject *object)
 {
+  SopaDocumentPrivate *priv = SOPA_DOCUMENT (object)->priv;
+
+  if (priv->query_cache != NULL)
+    g_hash_table_destroy (priv->query_cache);
+
+  if (priv->source_map != NULL)
+    _sopa_source_map_free (priv->source_map);
+
   G_OBJECT_CLASS (sopa_document_parent_class)->finalize (object);
 }
 
@@ -113,6 +167,21 @@ sopa_document_class_init (SopaDocumentClass *klass)
                        G_PARAM_CONSTRUCT |
                        G_PARAM_READWRITE);
 
+  /**
+   * SopaDocument:query-cache-enabled:
+   *
+   * Whether the results of sopa_document_query_selector_all() are
+   * cached until the document is changed
+   *
+   * Since: 0.2
+   */
+  obj_props[PROP_QUERY_CACHE_ENABLED] =
+    g_param_spec_boolean ("query-cache-enabled",
+                          "Query cache enabled",
+                          "Whether selector query results are cached",
+                          FALSE,
+                          G_PARAM_READWRITE);
+
   g_object_class_install_properties (object_class, PROP_LAST, obj_props);
 }
 
@@ -129,3 +198,578 @@ sopa_document_new (void)
                        "tag", "__DOCUMENT__",
                        NULL);
 }
+
+/**
+ * sopa_document_set_query_cache_enabled:
+ * @self: a #SopaDocument
+ * @enabled: whether to cache query results
+ *
+ * Enables or disables the caching of the results of
+ * sopa_document_query_selector_all(). Disabling the cache releases
+ * the results it holds.
+ *
+ * Since: 0.2
+ */
+void
+sopa_document_set_query_cache_enabled (SopaDocument *self,
+                                       gboolean      enabled)
+{
+  SopaDocumentPrivate *priv;
+
+  g_return_if_fail (SOPA_IS_DOCUMENT (self));
+
+  priv = self->priv;
+  enabled = !!enabled;
+
+  if (priv->query_cache_enabled == enabled)
+    return;
+
+  priv->query_cache_enabled = enabled;
+
+  if (enabled)
+    {
+      if (priv->query_cache == NULL)
+        priv->query_cache = g_hash_table_new_full (g_str_hash,
+                                                   g_str_equal,
+                                                   g_free,
+                                                   (GDestroyNotify) g_ptr_array_unref);
+    }
+  else
+    sopa_document_clear_query_cache (self);
+
+  g_object_notify_by_pspec (G_OBJECT (self), obj_props[PROP_QUERY_CACHE_ENABLED]);
+}
+
+/**
+ * sopa_document_get_query_cache_enabled:
+ * @self: a #SopaDocument
+ *
+ * Retrieves whether query results of @self are cached.
+ *
+ * Return value: %TRUE if the query cache is enabled
+ *
+ * Since: 0.2
+ */
+gboolean
+sopa_document_get_query_cache_enabled (SopaDocument *self)
+{
+  g_return_val_if_fail (SOPA_IS_DOCUMENT (self), FALSE);
+
+  return self->priv->query_cache_enabled;
+}
+
+/**
+ * sopa_document_begin_update:
+ * @self: a #SopaDocument
+ *
+ * Starts a batch of changes to @self, which ends with
+ * sopa_document_end_update().
+ *
+ * During the batch, adding and removing children does not go through
+ * the notification machinery of each node it changes: the
+ * #SopaNode:first-child and #SopaNode:last-child notifications are
+ * emitted once per changed node when the batch ends, and only when
+ * the child differs from the one before the batch. The tree can be
+ * read and queried as usual in the meantime.
+ *
+ * Batches can be nested; the notifications are emitted when the
+ * outermost one ends. Only the changes made from the thread that
+ * started the batch are part of it, and a batch still open when @self
+ * is disposed ends without emitting them.
+ *
+ * Since: 0.2
+ */
+void
+sopa_document_begin_update (SopaDocument *self)
+{
+  g_return_if_fail (SOPA_IS_DOCUMENT (self));
+
+  _sopa_node_begin_update (SOPA_NODE (self));
+}
+
+/**
+ * sopa_document_end_update:
+ * @self: a #SopaDocument
+ *
+ * Ends a batch of changes started with sopa_document_begin_update().
+ *
+ * Since: 0.2
+ */
+void
+sopa_document_end_update (SopaDocument *self)
+{
+  g_return_if_fail (SOPA_IS_DOCUMENT (self));
+
+  if (!_sopa_node_end_update (SOPA_NODE (self)))
+    g_critical ("sopa_document_end_update() was called on '%s' without "
+                "a matching sopa_document_begin_update().",
+                _sopa_node_get_debug_name (SOPA_NODE (self)));
+}
+
+/**
+ * sopa_document_query_selector_all:
+ * @self: a #SopaDocument
+ * @selector: a #SopaSelector
+ *
+ * Collects, in document order, all the elements of @self that are
+ * matched by @selector, as sopa_selector_query_all() does.
+ *
+ * When the query cache is enabled, the result is kept until the
+ * document is changed: adding or removing nodes anywhere in the
+ * document, or changing an attribute, drops all the cached results.
+ * Until then, asking again for a selector with the same source costs
+ * a hash table lookup.
+ *
+ * Return value: (transfer full) (element-type SopaElement): an array
+ *      with the matching elements, which may be shared with the
+ *      cache and must not be modified; release it with
+ *      g_ptr_array_unref()
+ *
+ * Since: 0.2
+ */
+GPtrArray *
+sopa_document_query_selector_all (SopaDocument *self,
+                                  SopaSelector *selector)
+{
+  SopaDocumentPrivate *priv;
+  SopaNode *node;
+  GPtrArray *result;
+  const gchar *source;
+
+  g_return_val_if_fail (SOPA_IS_DOCUMENT (self), NULL);
+  g_return_val_if_fail (selector != NULL, NULL);
+
+  priv = self->priv;
+  node = SOPA_NODE (self);
+
+  if (!priv->query_cache_enabled)
+    return sopa_selector_query_all (selector, node);
+
+  if (priv->query_cache_order == NULL ||
+      !_sopa_node_order_is_current (node, priv->query_cache_order))
+    {
+      sopa_document_clear_query_cache (self);
+      priv->query_cache_order = _sopa_node_ref_order (node);
+    }
+
+  source = sopa_selector_get_source (selector);
+
+  result = g_hash_table_lookup (priv->query_cache, source);
+  if (result == NULL)
+    {
+      result = sopa_selector_query_all (selector, node);
+      g_hash_table_insert (priv->query_cache, g_strdup (source), result);
+    }
+
+  return g_ptr_array_ref (result);
+}
+
+/*< private >
+ * _sopa_document_set_source_map:
+ * @self: a #SopaDocument
+ * @map: (transfer full): a #SopaSourceMap
+ *
+ * Sets the source offsets recorded by the parser that built @self.
+ */
+void
+_sopa_document_set_source_map (SopaDocument  *self,
+                               SopaSourceMap *map)
+{
+  if (self->priv->source_map != NULL)
+    _sopa_source_map_free (self->priv->source_map);
+
+  self->priv->source_map = map;
+}
+
+SopaSourceMap *
+_sopa_document_get_source_map (SopaDocument *self)
+{
+  return self->priv->source_map;
+}
+
+/*< private >
+ * _sopa_document_copy_settings:
+ * @self: a #SopaDocument
+ * @source: the #SopaDocument @self is a clone of
+ *
+ * Gives @self the document type and the settings of @source. The
+ * source offsets are not copied, as they are recorded per node.
+ */
+void
+_sopa_document_copy_settings (SopaDocument *self,
+                              SopaDocument *source)
+{
+  self->priv->doctype = source->priv->doctype;
+
+  if (source->priv->query_cache_enabled)
+    sopa_document_set_query_cache_enabled (self, TRUE);
+}
+
+/**
+ * sopa_document_get_source:
+ * @self: a #SopaDocument
+ *
+ * Retrieves the text @self was parsed from, which is only kept when
+ * the #SopaParser:track-offsets property of the parser was set; see
+ * sopa_node_get_source_range().
+ *
+ * Return value: (transfer none): the source of @self, or %NULL
+ *
+ * Since: 0.2
+ */
+GBytes *
+sopa_document_get_source (SopaDocument *self)
+{
+  g_return_val_if_fail (SOPA_IS_DOCUMENT (self), NULL);
+
+  if (self->priv->source_map == NULL)
+    return NULL;
+
+  return _sopa_source_map_get_source (self->priv->source_map);
+}
+
+/* the range between the start and the end tag of @element in the
+ * source, which the document has all of; empty element tags have none
+ */
+static gboolean
+sopa_document_get_content_range (SopaDocument *self,
+                                 SopaNode     *element,
+                                 gsize        *start,
+                                 gsize        *end)
+{
+  SopaSourceMap *map = self->priv->source_map;
+  const gchar *data;
+  gsize size, tag_start, tag_end, i;
+  gboolean empty_tag;
+
+  data = g_bytes_get_data (_sopa_source_map_get_source (map), &size);
+
+  if (element == SOPA_NODE (self))
+    {
+      *start = 0;
+      *end = size;
+      return TRUE;
+    }
+
+  if (!_sopa_source_map_lookup (map, element, &tag_start, &tag_end))
+    return FALSE;
+
+  *start = _sopa_source_skip_markup (data, size, tag_start, &empty_tag);
+  if (empty_tag)
+    return FALSE;
+
+  /* the end tag is the last markup of the element */
+  for (i = tag_end - 1; i > *start && data[i] != '<'; i--)
+    ;
+
+  *end = i;
+
+  return TRUE;
+}
+
+/* the deepest element whose content holds the whole edit */
+static SopaNode *
+sopa_document_find_edit_parent (SopaDocument *self,
+                                gsize         edit_start,
+                                gsize         edit_end)
+{
+  SopaNode *parent, *child;
+  gsize start, end;
+
+  parent = SOPA_NODE (self);
+  child = sopa_node_get_first_child (parent);
+
+  while (child != NULL)
+    {
+      if (!SOPA_IS_ELEMENT (child) ||
+          !_sopa_source_map_lookup (self->priv->source_map, child, &start, &end) ||
+          end <= edit_start)
+        {
+          child = sopa_node_get_next_sibling (child);
+          continue;
+        }
+
+      if (start > edit_start ||
+          !sopa_document_get_content_range (self, child, &start, &end) ||
+          edit_start < start || edit_end > end)
+        break;
+
+      parent = child;
+      child = sopa_node_get_first_child (parent);
+    }
+
+  return parent;
+}
+
+/**
+ * sopa_document_reparse_range:
+ * @self: a #SopaDocument
+ * @offset: the offset in the source where the edit starts
+ * @removed_len: the number of bytes removed at @offset
+ * @inserted: (array length=inserted_len): the text inserted at @offset
+ * @inserted_len: the length of @inserted, or -1 if it is nul-terminated
+ * @error: return location for a #GError
+ *
+ * Applies an edit of the source of @self, as returned by
+ * sopa_document_get_source(), and updates the tree to match it without
+ * parsing the whole source again.
+ *
+ * Only the content of the deepest element holding the whole edit
+ * between its start and end tags is parsed again, and its children
+ * are replaced by the new ones; the nodes outside of it are kept, and
+ * their source offsets are shifted. When the edited content is not
+ * well formed on its own, for instance when the edit closes the
+ * element, the enclosing elements are tried in turn, up to the whole
+ * document.
+ *
+ * @self must have been parsed with the #SopaParser:track-offsets
+ * property set, and must not have been changed since, other than with
+ * this function. If the edited source cannot be parsed, @self is left
+ * untouched.
+ *
+ * Return value: %TRUE on success, %FALSE if there was an error
+ *
+ * Since: 0.2
+ */
+gboolean
+sopa_document_reparse_range (SopaDocument  *self,
+                             gsize          offset,
+                             gsize          removed_len,
+                             const gchar   *inserted,
+                             gssize         inserted_len,
+                             GError       **error)
+{
+  SopaSourceMap *map;
+  SopaParser *parser;
+  SopaDocument *fragment = NULL;
+  SopaNode *parent, *root, *child;
+  GError *parse_error = NULL;
+  GString *text;
+  const gchar *data;
+  gsize size, start = 0, end = 0, prefix_len;
+
+  g_return_val_if_fail (SOPA_IS_DOCUMENT (self), FALSE);
+  g_return_val_if_fail (inserted != NULL || inserted_len == 0, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  map = self->priv->source_map;
+  g_return_val_if_fail (map != NULL, FALSE);
+  g_return_val_if_fail (_sopa_node_get_serial (SOPA_NODE (self))->parsed, FALSE);
+
+  data = g_bytes_get_data (_sopa_source_map_get_source (map), &size);
+  g_return_val_if_fail (offset <= size && removed_len <= size - offset, FALSE);
+
+  if (inserted_len < 0)
+    inserted_len = strlen (inserted);
+
+  parser = sopa_parser_new ();
+  sopa_parser_set_track_offsets (parser, TRUE);
+  text = g_string_new (NULL);
+
+  for (parent = sopa_document_find_edit_parent (self, offset, offset + removed_len);
+       parent != NULL;
+       parent = sopa_node_get_parent (parent))
+    {
+      sopa_document_get_content_range (self, parent, &start, &end);
+
+      /* the document is parsed whole, to check it has a single root */
+      g_string_truncate (text, 0);
+      if (parent != SOPA_NODE (self))
+        g_string_append (text, SOPA_FRAGMENT_START_TAG);
+      g_string_append_len (text, data + start, offset - start);
+      g_string_append_len (text, inserted, inserted_len);
+      g_string_append_len (text,
+                           data + offset + removed_len,
+                           end - offset - removed_len);
+      if (parent != SOPA_NODE (self))
+        g_string_append (text, SOPA_FRAGMENT_END_TAG);
+
+      g_clear_error (&parse_error);
+      fragment = sopa_parser_parse (parser, text->str, text->len, &parse_error);
+      if (fragment != NULL)
+        break;
+    }
+
+  g_string_free (text, TRUE);
+  g_object_unref (parser);
+
+  if (fragment == NULL)
+    {
+      g_propagate_error (error, parse_error);
+      return FALSE;
+    }
+
+  root = SOPA_NODE (fragment);
+  prefix_len = 0;
+  if (parent != SOPA_NODE (self))
+    {
+      root = sopa_node_get_first_child (root);
+      prefix_len = strlen (SOPA_FRAGMENT_START_TAG);
+    }
+
+  /* the offsets go first, the replaced nodes are found by position */
+  _sopa_source_map_splice (map, parent, start, end,
+                           fragment->priv->source_map,
+                           root,
+                           prefix_len,
+                           prefix_len + end - start + inserted_len - removed_len);
+
+  sopa_element_destroy_all_children (SOPA_ELEMENT (parent));
+
+  while ((child = sopa_node_get_first_child (root)) != NULL)
+    {
+      g_object_ref (child);
+      sopa_element_remove_child (SOPA_ELEMENT (root), child);
+      sopa_element_add_child (SOPA_ELEMENT (parent), child);
+      g_object_unref (child);
+    }
+
+  g_object_unref (fragment);
+
+  /* the changes above cleared it, but the offsets are up to date */
+  for (; parent != NULL; parent = sopa_node_get_parent (parent))
+    _sopa_node_get_serial (parent)->parsed = TRUE;
+
+  return TRUE;
+}
+
+/**
+ * sopa_document_diff:
+ * @self: a #SopaDocument
+ * @other: the #SopaDocument to compare @self with
+ *
+ * Computes the changes turning @self into @other, as a patch that can
+ * be applied with sopa_document_apply_patch() to @self, or to any
+ * document equal to it.
+ *
+ * Identical sub-trees are found by their structural hash, see
+ * sopa_node_get_hash(), and left out of the script; sub-trees with
+ * different hashes are told apart without being walked, and equal
+ * hashes are confirmed with sopa_node_equal(), so that a collision
+ * never pairs different sub-trees. The children of matched nodes are
+ * matched in linear time: identical sub-trees first, by hash, then
+ * elements by tag and id attribute and other nodes by type, in
+ * order. Matched children out of order are moved around the longest
+ * run already in order, and inserted sub-trees identical to deleted
+ * ones elsewhere become moves.
+ *
+ * The script is not guaranteed to be the shortest one, but applying
+ * it always turns @self into a document equal to @other.
+ *
+ * Return value: (transfer full): a new #SopaPatch, to be released
+ *      with sopa_patch_unref()
+ *
+ * Since: 0.2
+ */
+SopaPatch *
+sopa_document_diff (SopaDocument *self,
+                    SopaDocument *other)
+{
+  g_return_val_if_fail (SOPA_IS_DOCUMENT (self), NULL);
+  g_return_val_if_fail (SOPA_IS_DOCUMENT (other), NULL);
+
+  return _sopa_patch_diff (self, other);
+}
+
+/**
+ * sopa_document_apply_patch:
+ * @self: a #SopaDocument
+ * @patch: a #SopaPatch made by sopa_document_diff()
+ * @error: return location for a #GError
+ *
+ * Changes @self as described by @patch. @self must be equal to the
+ * document the patch was made from, which is checked with their
+ * structural hashes before anything is changed.
+ *
+ * Return value: %TRUE on success, %FALSE if there was an error
+ *
+ * Since: 0.2
+ */
+gboolean
+sopa_document_apply_patch (SopaDocument  *self,
+                           SopaPatch     *patch,
+                           GError       **error)
+{
+  g_return_val_if_fail (SOPA_IS_DOCUMENT (self), FALSE);
+  g_return_val_if_fail (patch != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return _sopa_patch_apply (patch, self, error);
+}
+
+/**
+ * sopa_document_save_binary:
+ * @self: a #SopaDocument
+ * @filename: the path of the file to write
+ * @error: return location for a #GError
+ *
+ * Saves @self to @filename in a compact binary format, which can be
+ * loaded again much faster than the markup can be parsed: the nodes
+ * are stored in document order with the indices of their parents and
+ * siblings, next to tables of interned strings and of text contents.
+ *
+ * The format is versioned, and it is only read back on machines with
+ * the same byte order. The file is replaced atomically, as with
+ * g_file_set_contents().
+ *
+ * Return value: %TRUE on success, %FALSE if there was an error
+ *
+ * Since: 0.2
+ */
+gboolean
+sopa_document_save_binary (SopaDocument  *self,
+                           const gchar   *filename,
+                           GError       **error)
+{
+  GBytes *image;
+  gboolean retval;
+
+  g_return_val_if_fail (SOPA_IS_DOCUMENT (self), FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  image = _sopa_document_image_build (self);
+
+  retval = g_file_set_contents (filename,
+                                g_bytes_get_data (image, NULL),
+                                g_bytes_get_size (image),
+                                error);
+
+  g_bytes_unref (image);
+
+  return retval;
+}
+
+/**
+ * sopa_document_load_binary:
+ * @filename: the path of a file written by sopa_document_save_binary()
+ * @error: return location for a #GError
+ *
+ * Loads a document saved with sopa_document_save_binary(). To only
+ * read the document, sopa_document_image_new_from_file() is cheaper:
+ * it works on the mapped file without creating any node.
+ *
+ * Return value: (transfer full): a new #SopaDocument, which is not
+ *      floating, or %NULL if there was an error
+ *
+ * Since: 0.2
+ */
+SopaDocument *
+sopa_document_load_binary (const gchar  *filename,
+                           GError      **error)
+{
+  SopaDocumentImage *image;
+  SopaDocument *document;
+
+  g_return_val_if_fail (filename != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  image = sopa_document_image_new_from_file (filename, error);
+  if (image == NULL)
+    return NULL;
+
+  document = sopa_document_image_create_document (image);
+  sopa_document_image_unref (image);
+
+  return document;
+}
@@ -30,6 +30,8 @@
 #include <glib-object.h>
 #include <sopa/sopa-element.h>
 #include <sopa/sopa-enum-types.h>
+#include <sopa/sopa-patch.h>
+#include <sopa/sopa-selector.h>
 
 G_BEGIN_DECLS
 
@@ -117,6 +119,31 @@ GType sopa_document_get_type (void) G_GNUC_CONST;
 
 SopaDocument *sopa_document_new (void);
 
+void                                sopa_document_set_query_cache_enabled       (SopaDocument             *self,
+                                                                                 gboolean                  enabled);
+gboolean                            sopa_document_get_query_cache_enabled       (SopaDocument             *self);
+void                                sopa_document_begin_update                  (SopaDocument             *self);
+void                                sopa_document_end_update                    (SopaDocument             *self);
+GPtrArray *                         sopa_document_query_selector_all            (SopaDocument             *self,
+                                                                                 SopaSelector             *selector);
+GBytes *                            sopa_document_get_source                    (SopaDocument             *self);
+gboolean                            sopa_document_reparse_range                 (SopaDocument             *self,
+                                                                                 gsize                     offset,
+                                                                                 gsize                     removed_len,
+                                                                                 const gchar              *inserted,
+                                                                                 gssize                    inserted_len,
+                                                                                 GError                  **error);
+SopaPatch *                         sopa_document_diff                          (SopaDocument             *self,
+                                                                                 SopaDocument             *other);
+gboolean                            sopa_document_apply_patch                   (SopaDocument             *self,
+                                                                                 SopaPatch                *patch,
+                                                                                 GError                  **error);
+gboolean                            sopa_document_save_binary                   (SopaDocument             *self,
+                                                                                 const gchar              *filename,
+                                                                                 GError                  **error);
+SopaDocument *                      sopa_document_load_binary                   (const gchar              *filename,
+                                                                                 GError                  **error);
+
 G_END_DECLS
 
 #endif /* __SOPA_DOCUMENT_H__ */
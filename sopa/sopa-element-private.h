@@ -0,0 +1,51 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-element-private.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#ifndef __SOPA_ELEMENT_PRIVATE_H__
+#define __SOPA_ELEMENT_PRIVATE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _SopaElementAttribute SopaElementAttribute;
+
+struct _SopaElementAttribute
+{
+  gchar *name;
+  gchar *value;
+};
+
+/* internal helpers */
+void                                _sopa_element_copy_data                     (SopaElement              *self,
+                                                                                 SopaElement              *source,
+                                                                                 gboolean                  share);
+void                                _sopa_element_share_data                    (SopaElement              *self,
+                                                                                 SopaElement              *source);
+const SopaElementAttribute *        _sopa_element_get_attributes                (SopaElement              *self,
+                                                                                 guint                    *n_attributes);
+void                                _sopa_element_collect_attribute_values      (SopaElement              *self,
+                                                                                 GPtrArray                *values);
+
+G_END_DECLS
+
+#endif /* __SOPA_ELEMENT_PRIVATE_H__ */
@@ -20,10 +20,15 @@
  *    Emanuel Fernandes <efernandes@tektorque.com>
  */
 
+#include <string.h>
+
 #include "sopa-element.h"
+#include "sopa-element-private.h"
 
+#include "sopa-mutation-observer-private.h"
 #include "sopa-node-private.h"
 #include "sopa-text.h"
+#include "sopa-writer-private.h"
 
 G_DEFINE_TYPE (SopaElement, sopa_element, SOPA_TYPE_NODE)
 
@@ -32,8 +37,20 @@ G_DEFINE_TYPE (SopaElement, sopa_element, SOPA_TYPE_NODE)
 
 struct _SopaElementPrivate
 {
+  /* a #GRefString, shared with the copy-on-write clones */
   gchar         *tag;
-  GHashTable    *attributes;
+
+  /* SopaElementAttribute, in the order they were added; elements
+   * have few attributes, so a linear search beats hashing. %NULL
+   * until the first attribute is added. the names and values are
+   * #GRefString<!-- -->s
+   */
+  GArray        *attributes;
+
+  /* whether @attributes may be shared with a copy-on-write clone, in
+   * which case it is copied before being changed
+   */
+  volatile gint  attributes_shared;
 };
 
 enum {
@@ -46,6 +63,24 @@ enum {
 
 static GParamSpec *obj_props[PROP_LAST];
 
+/* tags are case-insensitive, and kept in lower case; elements made by
+ * _sopa_element_copy_data() are created without one
+ */
+static gchar *
+ref_string_new_ascii_down (const gchar *str)
+{
+  gchar *result, *p;
+
+  if (str == NULL)
+    return NULL;
+
+  result = g_ref_string_new (str);
+  for (p = result; *p != '\0'; p++)
+    *p = g_ascii_tolower (*p);
+
+  return result;
+}
+
 static void
 sopa_element_get_property (GObject    *object,
                            guint       property_id,
@@ -76,9 +111,9 @@ sopa_element_set_property (GObject      *object,
   switch (property_id)
     {
     case PROP_TAG:
-      g_free (elem->priv->tag);
-      elem->priv->tag = g_ascii_strdown (g_value_get_string (value),
-                                         -1);
+      if (elem->priv->tag != NULL)
+        g_ref_string_release (elem->priv->tag);
+      elem->priv->tag = ref_string_new_ascii_down (g_value_get_string (value));
       break;
 
     default:
@@ -91,9 +126,11 @@ sopa_element_finalize (GObject *object)
 {
   SopaElement *elem = SOPA_ELEMENT (object);
 
-  g_hash_table_destroy (elem->priv->attributes);
+  if (elem->priv->attributes != NULL)
+    g_array_unref (elem->priv->attributes);
 
-  g_free (elem->priv->tag);
+  if (elem->priv->tag != NULL)
+    g_ref_string_release (elem->priv->tag);
 
   G_OBJECT_CLASS (sopa_element_parent_class)->finalize (object);
 }
@@ -128,14 +165,82 @@ sopa_element_class_init (SopaElementClass *klass)
 static void
 sopa_element_init (SopaElement *self)
 {
-  SopaElementPrivate *priv;
+  self->priv = ELEMENT_PRIVATE (self);
+}
 
-  priv = self->priv = ELEMENT_PRIVATE (self);
+static void
+clear_attribute (gpointer data)
+{
+  SopaElementAttribute *attr = data;
 
-  priv->attributes = g_hash_table_new_full (g_str_hash,
-                                            g_str_equal,
-                                            g_free,
-                                            g_free);
+  g_ref_string_release (attr->name);
+  g_ref_string_release (attr->value);
+}
+
+static GArray *
+attributes_new (guint reserved_size)
+{
+  GArray *attributes;
+
+  attributes = g_array_sized_new (FALSE, FALSE,
+                                  sizeof (SopaElementAttribute),
+                                  reserved_size);
+  g_array_set_clear_func (attributes, clear_attribute);
+
+  return attributes;
+}
+
+/* gives @self its own attributes, if they are shared with a clone */
+static void
+unshare_attributes (SopaElement *self)
+{
+  GArray *shared = self->priv->attributes;
+  GArray *attributes;
+  guint i;
+
+  if (!g_atomic_int_get (&self->priv->attributes_shared))
+    return;
+
+  attributes = attributes_new (shared->len);
+  for (i = 0; i < shared->len; i++)
+    {
+      SopaElementAttribute attr = g_array_index (shared, SopaElementAttribute, i);
+
+      attr.name = g_ref_string_acquire (attr.name);
+      attr.value = g_ref_string_acquire (attr.value);
+      g_array_append_val (attributes, attr);
+    }
+
+  g_array_unref (shared);
+  self->priv->attributes = attributes;
+  self->priv->attributes_shared = FALSE;
+}
+
+static SopaElementAttribute *
+find_attribute (SopaElement *self,
+                const gchar *key,
+                guint       *index_)
+{
+  GArray *attributes = self->priv->attributes;
+  guint i;
+
+  if (attributes == NULL)
+    return NULL;
+
+  for (i = 0; i < attributes->len; i++)
+    {
+      SopaElementAttribute *attr = &g_array_index (attributes, SopaElementAttribute, i);
+
+      if (strcmp (attr->name, key) == 0)
+        {
+          if (index_ != NULL)
+            *index_ = i;
+
+          return attr;
+        }
+    }
+
+  return NULL;
 }
 
 /**
@@ -381,9 +486,7 @@ sopa_element_add_attribute (SopaElement *self,
   g_return_if_fail (key != NULL);
   g_return_if_fail (value != NULL);
 
-  g_hash_table_insert (self->priv->attributes,
-                       (gpointer) g_strdup (key),
-                       (gpointer) g_strdup (value));
+  sopa_element_set_attribute (self, key, value);
 }
 
 /**
@@ -400,11 +503,35 @@ gboolean
 sopa_element_remove_attribute (SopaElement *self,
                                const gchar *key)
 {
-  g_return_if_fail (SOPA_IS_ELEMENT (self));
-  g_return_if_fail (key != NULL);
+  SopaElementAttribute *attr;
+  guint index_;
 
-  return g_hash_table_remove (self->priv->attributes,
-                              (gconstpointer) key);
+  g_return_val_if_fail (SOPA_IS_ELEMENT (self), FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+
+  if (G_UNLIKELY (_sopa_node_is_frozen (SOPA_NODE (self))))
+    {
+      g_critical ("The attribute '%s' of '%s' cannot be changed while "
+                  "its tree is being read from other threads.",
+                  key,
+                  _sopa_node_get_debug_name (SOPA_NODE (self)));
+      return FALSE;
+    }
+
+  attr = find_attribute (self, key, &index_);
+  if (attr == NULL)
+    return FALSE;
+
+  _sopa_mutation_observer_attribute_changed (SOPA_NODE (self),
+                                             key, attr->value);
+
+  unshare_attributes (self);
+  g_array_remove_index (self->priv->attributes, index_);
+
+  _sopa_node_invalidate_order (SOPA_NODE (self));
+  _sopa_node_mark_dirty (SOPA_NODE (self));
+
+  return TRUE;
 }
 
 /**
@@ -423,13 +550,45 @@ sopa_element_set_attribute (SopaElement *self,
                             const gchar *key,
                             const gchar *value)
 {
+  SopaElementAttribute *attr;
+  SopaElementAttribute new_attr;
+
   g_return_if_fail (SOPA_IS_ELEMENT (self));
   g_return_if_fail (key != NULL);
   g_return_if_fail (value != NULL);
 
-  g_hash_table_insert (self->priv->attributes,
-                       (gpointer) g_strdup (key),
-                       (gpointer) g_strdup (value));
+  if (G_UNLIKELY (_sopa_node_is_frozen (SOPA_NODE (self))))
+    {
+      g_critical ("The attribute '%s' of '%s' cannot be changed while "
+                  "its tree is being read from other threads.",
+                  key,
+                  _sopa_node_get_debug_name (SOPA_NODE (self)));
+      return;
+    }
+
+  unshare_attributes (self);
+  attr = find_attribute (self, key, NULL);
+
+  _sopa_mutation_observer_attribute_changed (SOPA_NODE (self), key,
+                                             attr != NULL ? attr->value : NULL);
+
+  if (attr != NULL)
+    {
+      g_ref_string_release (attr->value);
+      attr->value = g_ref_string_new (value);
+    }
+  else
+    {
+      if (self->priv->attributes == NULL)
+        self->priv->attributes = attributes_new (0);
+
+      new_attr.name = g_ref_string_new (key);
+      new_attr.value = g_ref_string_new (value);
+      g_array_append_val (self->priv->attributes, new_attr);
+    }
+
+  _sopa_node_invalidate_order (SOPA_NODE (self));
+  _sopa_node_mark_dirty (SOPA_NODE (self));
 }
 
 /**
@@ -446,11 +605,14 @@ const gchar *
 sopa_element_get_attribute (SopaElement *self,
                             const gchar *key)
 {
-  g_return_if_fail (SOPA_IS_ELEMENT (self));
-  g_return_if_fail (key != NULL);
+  SopaElementAttribute *attr;
 
-  return g_hash_table_lookup (self->priv->attributes,
-                              (gconstpointer) key);
+  g_return_val_if_fail (SOPA_IS_ELEMENT (self), NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+
+  attr = find_attribute (self, key, NULL);
+
+  return attr != NULL ? attr->value : NULL;
 }
 
 /**
@@ -464,9 +626,9 @@ sopa_element_get_attribute (SopaElement *self,
 guint
 sopa_element_get_n_attributes (SopaElement *self)
 {
-  g_return_if_fail (SOPA_IS_ELEMENT (self));
+  g_return_val_if_fail (SOPA_IS_ELEMENT (self), 0);
 
-  return g_hash_table_size (self->priv->attributes);
+  return self->priv->attributes != NULL ? self->priv->attributes->len : 0;
 }
 
 /**
@@ -485,70 +647,133 @@ sopa_element_has_attribute (SopaElement *self,
   g_return_if_fail (SOPA_IS_ELEMENT (self));
   g_return_if_fail (key != NULL);
 
-  return g_hash_table_contains (self->priv->attributes,
-                                (gconstpointer) key);
+  return find_attribute (self, key, NULL) != NULL;
 }
 
-static void
-element_to_string (SopaElement *element,
-                   GString *buffer,
-                   guint cur_indent,
-                   guint indent_width)
-{
-  SopaNodeIter iter;
-  GHashTableIter attr_iter;
-  gpointer attr_key, attr_value;
-  SopaNode *child;
-  gint i;
-  sopa_node_iter_init (&iter, SOPA_NODE (element));
-  while (sopa_node_iter_next (&iter, &child))
+/*< private >
+ * _sopa_element_collect_attribute_values:
+ * @self: a #SopaElement
+ * @values: (element-type utf8): the array to append to
+ *
+ * Appends the values of all the attributes of @self to @values. The
+ * values are owned by @self.
+ */
+void
+_sopa_element_collect_attribute_values (SopaElement *self,
+                                        GPtrArray   *values)
+{
+  const SopaElementAttribute *attrs;
+  guint i, n_attrs;
+
+  attrs = _sopa_element_get_attributes (self, &n_attrs);
+  for (i = 0; i < n_attrs; i++)
+    g_ptr_array_add (values, attrs[i].value);
+}
+
+/*< private >
+ * _sopa_element_copy_data:
+ * @self: a #SopaElement just created, without a tag nor attributes
+ * @source: the #SopaElement to copy
+ * @share: whether to share the strings and the attributes of @source
+ *   instead of copying them
+ *
+ * Gives @self the tag and the attributes of @source. When they are
+ * shared, the attributes are copied by whichever element changes
+ * them first.
+ */
+void
+_sopa_element_copy_data (SopaElement *self,
+                         SopaElement *source,
+                         gboolean     share)
+{
+  GArray *attributes = source->priv->attributes;
+  guint i;
+
+  if (share)
     {
-      /* Indent */
-      if (cur_indent > 0)
-        buffer = g_string_append_c (buffer, '\n');
-      for (i = 0; i < cur_indent; i++)
-        {
-          buffer = g_string_append_c (buffer, 0x20);
-        }
+      self->priv->tag = g_ref_string_acquire (source->priv->tag);
 
-      if (SOPA_IS_ELEMENT (child))
+      if (attributes != NULL)
         {
-          /* Tag begin */
-          g_string_append_printf (buffer, "<%s", SOPA_ELEMENT (child)->priv->tag);
-
-          /* Attributes */
-          g_hash_table_iter_init (&attr_iter,
-                                  SOPA_ELEMENT (child)->priv->attributes);
-          while (g_hash_table_iter_next (&attr_iter, &attr_key, &attr_value))
-            {
-              g_string_append_printf (buffer,
-                                      " %s=\"%s\"",
-                                      (gchar *) attr_key,
-                                      (gchar *) attr_value);
-            }
-          buffer = g_string_append_c (buffer, '>');
-
-          /* Childs */
-          if (sopa_node_get_n_children (child) > 0)
-            {
-              element_to_string (SOPA_ELEMENT (child),
-                                 buffer, cur_indent + indent_width,
-                                 indent_width);
-            }
-
-          /* Tag end */
-          buffer = g_string_append_c (buffer, '\n');
-          for (i = 0; i < cur_indent; i++)
-            {
-              buffer = g_string_append_c (buffer, 0x20);
-            }
-          g_string_append_printf (buffer, "</%s>", SOPA_ELEMENT (child)->priv->tag);
-        }
-      else if (SOPA_IS_TEXT (child))
-        {
-          buffer = g_string_append (buffer, sopa_text_get_content (SOPA_TEXT (child)));
+          g_atomic_int_set (&source->priv->attributes_shared, TRUE);
+
+          self->priv->attributes = g_array_ref (attributes);
+          self->priv->attributes_shared = TRUE;
         }
+
+      return;
+    }
+
+  self->priv->tag = g_ref_string_new (source->priv->tag);
+
+  if (attributes == NULL)
+    return;
+
+  self->priv->attributes = attributes_new (attributes->len);
+  for (i = 0; i < attributes->len; i++)
+    {
+      SopaElementAttribute attr = g_array_index (attributes, SopaElementAttribute, i);
+
+      attr.name = g_ref_string_new (attr.name);
+      attr.value = g_ref_string_new (attr.value);
+      g_array_append_val (self->priv->attributes, attr);
+    }
+}
+
+/*< private >
+ * _sopa_element_share_data:
+ * @self: a #SopaElement
+ * @source: a #SopaElement with the same tag and attributes as @self
+ *
+ * Replaces the tag and the attributes of @self with those of @source,
+ * so that equal elements of different trees keep a single copy of
+ * them. The tree of @self must not be observed yet.
+ */
+void
+_sopa_element_share_data (SopaElement *self,
+                          SopaElement *source)
+{
+  gchar *tag = self->priv->tag;
+  GArray *attributes = self->priv->attributes;
+
+  self->priv->tag = NULL;
+  self->priv->attributes = NULL;
+  self->priv->attributes_shared = FALSE;
+
+  _sopa_element_copy_data (self, source, TRUE);
+
+  if (tag != NULL)
+    g_ref_string_release (tag);
+
+  if (attributes != NULL)
+    g_array_unref (attributes);
+}
+
+/*< private >
+ * _sopa_element_get_attributes:
+ * @self: a #SopaElement
+ * @n_attributes: (out): return location for the number of attributes
+ *
+ * Retrieves the attributes of @self, in the order they were added.
+ *
+ * Return value: (transfer none) (array length=n_attributes): the
+ *      attributes, or %NULL if there are none
+ */
+const SopaElementAttribute *
+_sopa_element_get_attributes (SopaElement *self,
+                              guint       *n_attributes)
+{
+  GArray *attributes = self->priv->attributes;
+
+  if (attributes == NULL || attributes->len == 0)
+    {
+      *n_attributes = 0;
+      return NULL;
     }
+
+  *n_attributes = attributes->len;
+
+  return (const SopaElementAttribute *) attributes->data;
 }
 
 /**
@@ -558,6 +783,9 @@ element_to_string (SopaElement *element,
  *
  * Converts a #SopaElement to string
  *
+ * When @self is the root of its tree, the markup is remembered, and
+ * the next call only writes again the nodes that changed since.
+ *
  * Return value: (transfer full): a newly allocated string if successful,
  * or %NULL otherwise. The returned string is owned by caller and must free it
  * after use with #g_free().
@@ -566,11 +794,284 @@ gchar *
 sopa_element_to_string (SopaElement *self,
                         guint        indent_width)
 {
+  g_return_val_if_fail (SOPA_IS_ELEMENT (self), NULL);
+
+  return _sopa_writer_to_string (SOPA_NODE (self),
+                                 SOPA_SERIALIZE_MODE_PRETTY,
+                                 indent_width,
+                                 NULL);
+}
+
+/**
+ * sopa_element_serialize:
+ * @self: a #SopaElement
+ * @options: (allow-none): a #SopaSerializeOptions, or %NULL for the
+ *      pretty layout with the default indent width
+ * @length: (out) (allow-none): return location for the length of the
+ *      string, or %NULL
+ *
+ * Serializes the children of @self in the layout chosen by @options.
+ * Use %SOPA_SERIALIZE_MODE_MINIFIED for the smallest equivalent markup
+ * and %SOPA_SERIALIZE_MODE_FAITHFUL to keep the attributes as they
+ * were given, and the markup of the nodes that did not change since
+ * they were parsed as it is in the source.
+ *
+ * When @self is the root of its tree, the markup is remembered, and
+ * the next call in the same layout only writes again the nodes that
+ * changed since.
+ *
+ * When @options allow more than one thread, large documents are
+ * written from several threads at once; the tree must not be changed
+ * meanwhile, and adding or removing nodes fails with a critical
+ * warning until the function returns.
+ *
+ * Return value: (transfer full): a newly allocated string, free it
+ * with g_free()
+ *
+ * Since: 0.2
+ */
+gchar *
+sopa_element_serialize (SopaElement                *self,
+                        const SopaSerializeOptions *options,
+                        gsize                      *length)
+{
+  SopaSerializeMode mode = SOPA_SERIALIZE_MODE_PRETTY;
+  guint indent_width = 2;
+  guint n_threads = 1;
+
+  g_return_val_if_fail (SOPA_IS_ELEMENT (self), NULL);
+
+  if (options != NULL)
+    {
+      mode = sopa_serialize_options_get_mode (options);
+      indent_width = sopa_serialize_options_get_indent_width (options);
+      n_threads = sopa_serialize_options_get_n_threads (options);
+    }
+
+  if (n_threads != 1)
+    return _sopa_writer_to_string_parallel (SOPA_NODE (self),
+                                            mode,
+                                            indent_width,
+                                            n_threads,
+                                            length);
+
+  return _sopa_writer_to_string (SOPA_NODE (self), mode, indent_width, length);
+}
+
+/**
+ * sopa_element_to_json:
+ * @self: a #SopaElement
+ * @length: (out) (allow-none): return location for the length of the
+ *      string, or %NULL
+ *
+ * Exports @self and its descendants as JSON. Each node is an object
+ * with a "type" member: elements have a "tag", their "attributes", in
+ * order, as an object, and their "children" as an array; text nodes
+ * have their "text". Comments are left out. For example:
+ *
+ * |[
+ *   {"type":"element","tag":"p","attributes":{"class":"note"},
+ *    "children":[{"type":"text","text":"Hello"}]}
+ * ]|
+ *
+ * The JSON is written without white space, measured first and copied
+ * into a single allocation.
+ *
+ * Return value: (transfer full): a newly allocated string, free it
+ *      with g_free()
+ *
+ * Since: 0.2
+ */
+gchar *
+sopa_element_to_json (SopaElement *self,
+                      gsize       *length)
+{
+  g_return_val_if_fail (SOPA_IS_ELEMENT (self), NULL);
+
+  return _sopa_writer_to_json (SOPA_NODE (self), length);
+}
+
+/**
+ * sopa_element_write_json_to_stream:
+ * @self: a #SopaElement
+ * @stream: a #GOutputStream
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @error: return location for a #GError
+ *
+ * Writes the JSON sopa_element_to_json() returns to @stream, directly
+ * from the tree, through the same fixed-size buffer as
+ * sopa_element_write_to_stream().
+ *
+ * Return value: %TRUE on success, %FALSE if there was an error
+ *
+ * Since: 0.2
+ */
+gboolean
+sopa_element_write_json_to_stream (SopaElement   *self,
+                                   GOutputStream *stream,
+                                   GCancellable  *cancellable,
+                                   GError       **error)
+{
+  g_return_val_if_fail (SOPA_IS_ELEMENT (self), FALSE);
+  g_return_val_if_fail (G_IS_OUTPUT_STREAM (stream), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return _sopa_writer_write_json_to_stream (SOPA_NODE (self),
+                                            stream,
+                                            cancellable,
+                                            error);
+}
+
+/**
+ * sopa_element_write_to_stream:
+ * @self: a #SopaElement
+ * @stream: a #GOutputStream
+ * @indent_width: number of spaces
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @error: return location for a #GError
+ *
+ * Writes the same markup sopa_element_to_string() returns to @stream,
+ * directly from the tree. The output goes through a fixed-size buffer,
+ * in batches of buffers written at once, so the memory used does not
+ * depend on the size of the document. To write to a file descriptor,
+ * wrap it in a #GUnixOutputStream.
+ *
+ * Large attribute values and text contents are written straight from
+ * the nodes, so the tree cannot be changed, for instance from another
+ * thread, until the function returns.
+ *
+ * Return value: %TRUE on success, %FALSE if there was an error
+ *
+ * Since: 0.2
+ */
+gboolean
+sopa_element_write_to_stream (SopaElement   *self,
+                              GOutputStream *stream,
+                              guint          indent_width,
+                              GCancellable  *cancellable,
+                              GError       **error)
+{
+  g_return_val_if_fail (SOPA_IS_ELEMENT (self), FALSE);
+  g_return_val_if_fail (G_IS_OUTPUT_STREAM (stream), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return _sopa_writer_write_to_stream (SOPA_NODE (self),
+                                       SOPA_SERIALIZE_MODE_PRETTY,
+                                       indent_width,
+                                       stream,
+                                       cancellable,
+                                       error);
+}
+
+typedef struct
+{
+  GOutputStream *stream;
+  guint          indent_width;
+  SopaNode      *frozen_root;
+} WriteToStreamData;
+
+static void
+write_to_stream_data_free (WriteToStreamData *data)
+{
+  g_object_unref (data->stream);
+  g_slice_free (WriteToStreamData, data);
+}
+
+static void
+write_to_stream_thread (GTask        *task,
+                        gpointer      source_object,
+                        gpointer      task_data,
+                        GCancellable *cancellable)
+{
+  WriteToStreamData *data = task_data;
+  GError *error = NULL;
+
+  _sopa_writer_write_to_stream (SOPA_NODE (source_object),
+                                SOPA_SERIALIZE_MODE_PRETTY,
+                                data->indent_width,
+                                data->stream,
+                                cancellable,
+                                &error);
+
+  _sopa_node_thaw_tree (data->frozen_root);
+
+  if (error != NULL)
+    g_task_return_error (task, error);
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * sopa_element_write_to_stream_async:
+ * @self: a #SopaElement
+ * @stream: a #GOutputStream
+ * @indent_width: number of spaces
+ * @io_priority: the I/O priority of the request
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the
+ *      request is satisfied
+ * @user_data: (closure): the data to pass to @callback
+ *
+ * Asynchronously writes the markup of @self to @stream; see
+ * sopa_element_write_to_stream().
+ *
+ * The tree is read from another thread, and large attribute values
+ * and text contents are written straight from the nodes: until the
+ * operation finishes, adding or removing nodes, setting or removing
+ * attributes and setting the content of text nodes are refused with
+ * a critical warning.
+ *
+ * Since: 0.2
+ */
+void
+sopa_element_write_to_stream_async (SopaElement         *self,
+                                    GOutputStream       *stream,
+                                    guint                indent_width,
+                                    gint                 io_priority,
+                                    GCancellable        *cancellable,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+  WriteToStreamData *data;
+  GTask *task;
+
   g_return_if_fail (SOPA_IS_ELEMENT (self));
-  GString *buffer;
+  g_return_if_fail (G_IS_OUTPUT_STREAM (stream));
+
+  data = g_slice_new (WriteToStreamData);
+  data->stream = g_object_ref (stream);
+  data->indent_width = indent_width;
+  data->frozen_root = _sopa_node_freeze_tree (SOPA_NODE (self));
 
-  buffer = g_string_new ("");
-  element_to_string (self, buffer, 0, indent_width);
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, sopa_element_write_to_stream_async);
+  g_task_set_priority (task, io_priority);
+  g_task_set_task_data (task, data, (GDestroyNotify) write_to_stream_data_free);
+
+  g_task_run_in_thread (task, write_to_stream_thread);
+  g_object_unref (task);
+}
+
+/**
+ * sopa_element_write_to_stream_finish:
+ * @self: a #SopaElement
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError
+ *
+ * Finishes an operation started with
+ * sopa_element_write_to_stream_async().
+ *
+ * Return value: %TRUE on success, %FALSE if there was an error
+ *
+ * Since: 0.2
+ */
+gboolean
+sopa_element_write_to_stream_finish (SopaElement   *self,
+                                     GAsyncResult  *result,
+                                     GError       **error)
+{
+  g_return_val_if_fail (SOPA_IS_ELEMENT (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
 
-  return g_string_free (buffer, FALSE);
+  return g_task_propagate_boolean (G_TASK (result), error);
 }
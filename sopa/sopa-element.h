@@ -27,8 +27,9 @@
 #ifndef __SOPA_ELEMENT_H__
 #define __SOPA_ELEMENT_H__
 
-#include <glib-object.h>
+#include <gio/gio.h>
 #include <sopa/sopa-node.h>
+#include <sopa/sopa-serialize-options.h>
 
 G_BEGIN_DECLS
 
@@ -105,6 +106,30 @@ gboolean                            sopa_element_has_attribute
                                                                                  const gchar                *key);
 gchar *                             sopa_element_to_string                      (SopaElement                *self,
                                                                                  guint                       indent_width);
+gchar *                             sopa_element_serialize                      (SopaElement                *self,
+                                                                                 const SopaSerializeOptions *options,
+                                                                                 gsize                      *length);
+gboolean                            sopa_element_write_to_stream                (SopaElement                *self,
+                                                                                 GOutputStream              *stream,
+                                                                                 guint                       indent_width,
+                                                                                 GCancellable               *cancellable,
+                                                                                 GError                    **error);
+void                                sopa_element_write_to_stream_async          (SopaElement                *self,
+                                                                                 GOutputStream              *stream,
+                                                                                 guint                       indent_width,
+                                                                                 gint                        io_priority,
+                                                                                 GCancellable               *cancellable,
+                                                                                 GAsyncReadyCallback         callback,
+                                                                                 gpointer                    user_data);
+gboolean                            sopa_element_write_to_stream_finish         (SopaElement                *self,
+                                                                                 GAsyncResult               *result,
+                                                                                 GError                    **error);
+gchar *                             sopa_element_to_json                        (SopaElement                *self,
+                                                                                 gsize                      *length);
+gboolean                            sopa_element_write_json_to_stream           (SopaElement                *self,
+                                                                                 GOutputStream              *stream,
+                                                                                 GCancellable               *cancellable,
+                                                                                 GError                    **error);
 
 G_END_DECLS
 
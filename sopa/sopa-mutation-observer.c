@@ -0,0 +1,538 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-mutation-observer.c
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+/**
+ * SECTION:sopa-mutation-observer
+ * @short_description: Batched notification of tree mutations
+ *
+ * A #SopaMutationObserver records the mutations of the nodes it
+ * observes as #SopaMutationRecord<!-- -->s, and delivers them to its
+ * function in batches, whenever sopa_mutation_observer_flush() is
+ * called.
+ *
+ * Recording a mutation only copies the record into a buffer of the
+ * observer, so bulk edits of observed trees stay cheap, and a mutation
+ * costs a single check as long as there are no observers at all.
+ *
+ * An observer and the trees it observes must be used from one thread
+ * at a time.
+ */
+
+#include "sopa-mutation-observer.h"
+#include "sopa-mutation-observer-private.h"
+#include "sopa-node-private.h"
+
+G_DEFINE_TYPE (SopaMutationObserver, sopa_mutation_observer, G_TYPE_OBJECT)
+
+#define MUTATION_OBSERVER_PRIVATE(o) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((o), SOPA_TYPE_MUTATION_OBSERVER, SopaMutationObserverPrivate))
+
+#define OBSERVE_TYPES (SOPA_MUTATION_OBSERVE_CHILD_LIST | \
+                       SOPA_MUTATION_OBSERVE_ATTRIBUTES | \
+                       SOPA_MUTATION_OBSERVE_CHARACTER_DATA)
+
+typedef struct _SopaMutationRegistration SopaMutationRegistration;
+
+/* an observed node; it is listed both by the node and by the observer,
+ * so that whichever goes away first can unlink it from the other
+ */
+struct _SopaMutationRegistration
+{
+  SopaMutationObserver      *observer;
+  SopaNode                  *node;
+  SopaMutationObserverFlags  flags;
+};
+
+struct _SopaMutationObserverPrivate
+{
+  SopaMutationFunc      func;
+  gpointer              data;
+  GDestroyNotify        notify;
+
+  GSList               *registrations;
+
+  /* the records waiting to be delivered, and an empty array kept from
+   * the last delivery so that the next batch does not allocate one
+   */
+  GArray               *records;
+  GArray               *spare;
+
+  /* the last mutation recorded, so that an observer registered on
+   * several ancestors of a node gets a single record for it
+   */
+  guint                 last_mutation;
+};
+
+/* the number of observed nodes, so that mutations only look for
+ * observers while there are some
+ */
+static volatile gint n_registrations = 0;
+
+/* stamps each mutation recorded */
+static volatile gint mutation_serial = 0;
+
+static void
+sopa_mutation_record_clear (gpointer data)
+{
+  SopaMutationRecord *record = data;
+
+  g_clear_object (&record->target);
+  g_clear_object (&record->added_node);
+  g_clear_object (&record->removed_node);
+  g_clear_object (&record->previous_sibling);
+  g_clear_object (&record->next_sibling);
+
+  g_free (record->name);
+  g_free (record->old_value);
+}
+
+static inline SopaNode *
+ref_node (SopaNode *node)
+{
+  return node != NULL ? g_object_ref (node) : NULL;
+}
+
+static void
+sopa_mutation_registration_unlink (SopaMutationRegistration *registration)
+{
+  GSList **node_registrations;
+
+  node_registrations = _sopa_node_get_registrations (registration->node);
+  *node_registrations = g_slist_remove (*node_registrations, registration);
+
+  g_atomic_int_add (&n_registrations, -1);
+
+  g_slice_free (SopaMutationRegistration, registration);
+}
+
+static void
+sopa_mutation_observer_dispose (GObject *object)
+{
+  sopa_mutation_observer_disconnect (SOPA_MUTATION_OBSERVER (object));
+
+  G_OBJECT_CLASS (sopa_mutation_observer_parent_class)->dispose (object);
+}
+
+static void
+sopa_mutation_observer_finalize (GObject *object)
+{
+  SopaMutationObserverPrivate *priv = SOPA_MUTATION_OBSERVER (object)->priv;
+
+  if (priv->records != NULL)
+    g_array_unref (priv->records);
+
+  if (priv->spare != NULL)
+    g_array_unref (priv->spare);
+
+  if (priv->notify != NULL)
+    priv->notify (priv->data);
+
+  G_OBJECT_CLASS (sopa_mutation_observer_parent_class)->finalize (object);
+}
+
+static void
+sopa_mutation_observer_class_init (SopaMutationObserverClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (SopaMutationObserverPrivate));
+
+  object_class->dispose = sopa_mutation_observer_dispose;
+  object_class->finalize = sopa_mutation_observer_finalize;
+}
+
+static void
+sopa_mutation_observer_init (SopaMutationObserver *self)
+{
+  self->priv = MUTATION_OBSERVER_PRIVATE (self);
+}
+
+/**
+ * sopa_mutation_observer_new:
+ * @func: the function to deliver the mutations to
+ * @user_data: data to pass to @func
+ * @notify: (allow-none): function to free @user_data with when the
+ *   observer is finalized, or %NULL
+ *
+ * Creates a new #SopaMutationObserver, which observes no nodes until
+ * sopa_mutation_observer_observe() is called.
+ *
+ * Return value: (transfer full): a new #SopaMutationObserver
+ *
+ * Since: 0.2
+ */
+SopaMutationObserver *
+sopa_mutation_observer_new (SopaMutationFunc func,
+                            gpointer         user_data,
+                            GDestroyNotify   notify)
+{
+  SopaMutationObserver *self;
+
+  g_return_val_if_fail (func != NULL, NULL);
+
+  self = g_object_new (SOPA_TYPE_MUTATION_OBSERVER, NULL);
+  self->priv->func = func;
+  self->priv->data = user_data;
+  self->priv->notify = notify;
+
+  return self;
+}
+
+/**
+ * sopa_mutation_observer_observe:
+ * @self: a #SopaMutationObserver
+ * @node: the #SopaNode to observe
+ * @flags: the mutations to report
+ *
+ * Starts recording the mutations of @node selected by @flags, which
+ * must include at least one of %SOPA_MUTATION_OBSERVE_CHILD_LIST,
+ * %SOPA_MUTATION_OBSERVE_ATTRIBUTES and
+ * %SOPA_MUTATION_OBSERVE_CHARACTER_DATA. If @self observes @node
+ * already, @flags replace the ones it was observed with.
+ *
+ * The observer does not keep @node alive; it stops observing it when
+ * it is finalized.
+ *
+ * Since: 0.2
+ */
+void
+sopa_mutation_observer_observe (SopaMutationObserver      *self,
+                                SopaNode                  *node,
+                                SopaMutationObserverFlags  flags)
+{
+  SopaMutationRegistration *registration;
+  GSList **node_registrations;
+  GSList *l;
+
+  g_return_if_fail (SOPA_IS_MUTATION_OBSERVER (self));
+  g_return_if_fail (SOPA_IS_NODE (node));
+  g_return_if_fail ((flags & OBSERVE_TYPES) != 0);
+
+  node_registrations = _sopa_node_get_registrations (node);
+
+  for (l = *node_registrations; l != NULL; l = l->next)
+    {
+      registration = l->data;
+
+      if (registration->observer == self)
+        {
+          registration->flags = flags;
+          return;
+        }
+    }
+
+  registration = g_slice_new (SopaMutationRegistration);
+  registration->observer = self;
+  registration->node = node;
+  registration->flags = flags;
+
+  *node_registrations = g_slist_prepend (*node_registrations, registration);
+  self->priv->registrations = g_slist_prepend (self->priv->registrations,
+                                               registration);
+
+  g_atomic_int_inc (&n_registrations);
+}
+
+/**
+ * sopa_mutation_observer_disconnect:
+ * @self: a #SopaMutationObserver
+ *
+ * Stops observing all the nodes, dropping the records that were not
+ * delivered yet.
+ *
+ * Since: 0.2
+ */
+void
+sopa_mutation_observer_disconnect (SopaMutationObserver *self)
+{
+  SopaMutationObserverPrivate *priv;
+
+  g_return_if_fail (SOPA_IS_MUTATION_OBSERVER (self));
+
+  priv = self->priv;
+
+  g_slist_free_full (priv->registrations,
+                     (GDestroyNotify) sopa_mutation_registration_unlink);
+  priv->registrations = NULL;
+
+  if (priv->records != NULL)
+    g_array_set_size (priv->records, 0);
+}
+
+/**
+ * sopa_mutation_observer_get_n_pending:
+ * @self: a #SopaMutationObserver
+ *
+ * Retrieves the number of records waiting for the next
+ * sopa_mutation_observer_flush().
+ *
+ * Return value: the number of records
+ *
+ * Since: 0.2
+ */
+guint
+sopa_mutation_observer_get_n_pending (SopaMutationObserver *self)
+{
+  g_return_val_if_fail (SOPA_IS_MUTATION_OBSERVER (self), 0);
+
+  return self->priv->records != NULL ? self->priv->records->len : 0;
+}
+
+/**
+ * sopa_mutation_observer_flush:
+ * @self: a #SopaMutationObserver
+ *
+ * Delivers the records of the mutations since the last flush to the
+ * function of @self, in a single call. Nothing is called if there are
+ * none.
+ *
+ * The function may change the observed trees; the mutations it makes
+ * are delivered by the next flush.
+ *
+ * Since: 0.2
+ */
+void
+sopa_mutation_observer_flush (SopaMutationObserver *self)
+{
+  SopaMutationObserverPrivate *priv;
+  GArray *batch;
+
+  g_return_if_fail (SOPA_IS_MUTATION_OBSERVER (self));
+
+  priv = self->priv;
+
+  if (priv->records == NULL || priv->records->len == 0)
+    return;
+
+  /* the batch is taken out first, so that mutations made by the
+   * function go to the next one
+   */
+  batch = priv->records;
+  priv->records = priv->spare;
+  priv->spare = NULL;
+
+  g_object_ref (self);
+
+  priv->func (self,
+              (const SopaMutationRecord *) batch->data,
+              batch->len,
+              priv->data);
+
+  g_array_set_size (batch, 0);
+
+  if (priv->spare == NULL)
+    priv->spare = batch;
+  else
+    g_array_unref (batch);
+
+  g_object_unref (self);
+}
+
+static void
+sopa_mutation_observer_append (SopaMutationObserver     *self,
+                               const SopaMutationRecord *record,
+                               gboolean                  old_values)
+{
+  SopaMutationObserverPrivate *priv = self->priv;
+  SopaMutationRecord *copy;
+
+  if (priv->records == NULL)
+    {
+      priv->records = g_array_new (FALSE, FALSE, sizeof (SopaMutationRecord));
+      g_array_set_clear_func (priv->records, sopa_mutation_record_clear);
+    }
+
+  g_array_set_size (priv->records, priv->records->len + 1);
+  copy = &g_array_index (priv->records, SopaMutationRecord,
+                         priv->records->len - 1);
+
+  copy->type = record->type;
+  copy->target = g_object_ref (record->target);
+  copy->added_node = ref_node (record->added_node);
+  copy->removed_node = ref_node (record->removed_node);
+  copy->previous_sibling = ref_node (record->previous_sibling);
+  copy->next_sibling = ref_node (record->next_sibling);
+  copy->name = g_strdup (record->name);
+  copy->old_value = old_values ? g_strdup (record->old_value) : NULL;
+}
+
+/* hands @record to the observers of its target, and to those of its
+ * ancestors observing their sub-trees
+ */
+static void
+sopa_mutation_observer_queue (const SopaMutationRecord  *record,
+                              SopaMutationObserverFlags  type_flag)
+{
+  SopaNode *node;
+  guint mutation;
+
+  mutation = (guint) g_atomic_int_add (&mutation_serial, 1) + 1;
+
+  for (node = record->target; node != NULL; node = sopa_node_get_parent (node))
+    {
+      GSList *l;
+
+      for (l = *_sopa_node_get_registrations (node); l != NULL; l = l->next)
+        {
+          SopaMutationRegistration *registration = l->data;
+          SopaMutationObserver *observer = registration->observer;
+
+          if ((registration->flags & type_flag) == 0)
+            continue;
+
+          if (node != record->target &&
+              (registration->flags & SOPA_MUTATION_OBSERVE_SUBTREE) == 0)
+            continue;
+
+          if (observer->priv->last_mutation == mutation)
+            continue;
+
+          observer->priv->last_mutation = mutation;
+
+          sopa_mutation_observer_append (observer, record,
+                                         (registration->flags &
+                                          SOPA_MUTATION_OBSERVE_OLD_VALUES) != 0);
+        }
+    }
+}
+
+/*< private >
+ * _sopa_mutation_observer_child_added:
+ * @parent: a #SopaNode
+ * @child: the child just added to @parent
+ *
+ * Records the addition of @child for the observers of @parent.
+ */
+void
+_sopa_mutation_observer_child_added (SopaNode *parent,
+                                     SopaNode *child)
+{
+  SopaMutationRecord record = { SOPA_MUTATION_CHILD_LIST, };
+
+  if (G_LIKELY (g_atomic_int_get (&n_registrations) == 0))
+    return;
+
+  record.target = parent;
+  record.added_node = child;
+  record.previous_sibling = sopa_node_get_previous_sibling (child);
+  record.next_sibling = sopa_node_get_next_sibling (child);
+
+  sopa_mutation_observer_queue (&record, SOPA_MUTATION_OBSERVE_CHILD_LIST);
+}
+
+/*< private >
+ * _sopa_mutation_observer_child_removed:
+ * @parent: a #SopaNode
+ * @child: the child about to be removed from @parent
+ *
+ * Records the removal of @child for the observers of @parent. It must
+ * be called while @child is still linked to its siblings.
+ */
+void
+_sopa_mutation_observer_child_removed (SopaNode *parent,
+                                       SopaNode *child)
+{
+  SopaMutationRecord record = { SOPA_MUTATION_CHILD_LIST, };
+
+  if (G_LIKELY (g_atomic_int_get (&n_registrations) == 0))
+    return;
+
+  record.target = parent;
+  record.removed_node = child;
+  record.previous_sibling = sopa_node_get_previous_sibling (child);
+  record.next_sibling = sopa_node_get_next_sibling (child);
+
+  sopa_mutation_observer_queue (&record, SOPA_MUTATION_OBSERVE_CHILD_LIST);
+}
+
+/*< private >
+ * _sopa_mutation_observer_attribute_changed:
+ * @element: a #SopaNode
+ * @name: the name of the attribute about to change
+ * @old_value: (allow-none): the current value of the attribute
+ *
+ * Records a change of an attribute of @element. It must be called
+ * before the change, while @old_value is still valid.
+ */
+void
+_sopa_mutation_observer_attribute_changed (SopaNode    *element,
+                                           const gchar *name,
+                                           const gchar *old_value)
+{
+  SopaMutationRecord record = { SOPA_MUTATION_ATTRIBUTE, };
+
+  if (G_LIKELY (g_atomic_int_get (&n_registrations) == 0))
+    return;
+
+  record.target = element;
+  record.name = (gchar *) name;
+  record.old_value = (gchar *) old_value;
+
+  sopa_mutation_observer_queue (&record, SOPA_MUTATION_OBSERVE_ATTRIBUTES);
+}
+
+/*< private >
+ * _sopa_mutation_observer_content_changed:
+ * @node: a #SopaNode
+ * @old_value: (allow-none): the current content of @node
+ *
+ * Records a change of the content of @node. It must be called before
+ * the change, while @old_value is still valid.
+ */
+void
+_sopa_mutation_observer_content_changed (SopaNode    *node,
+                                         const gchar *old_value)
+{
+  SopaMutationRecord record = { SOPA_MUTATION_CHARACTER_DATA, };
+
+  if (G_LIKELY (g_atomic_int_get (&n_registrations) == 0))
+    return;
+
+  record.target = node;
+  record.old_value = (gchar *) old_value;
+
+  sopa_mutation_observer_queue (&record,
+                                SOPA_MUTATION_OBSERVE_CHARACTER_DATA);
+}
+
+/*< private >
+ * _sopa_mutation_observer_forget_node:
+ * @node: a #SopaNode being finalized
+ *
+ * Removes @node from the observers observing it.
+ */
+void
+_sopa_mutation_observer_forget_node (SopaNode *node)
+{
+  GSList **node_registrations = _sopa_node_get_registrations (node);
+
+  while (*node_registrations != NULL)
+    {
+      SopaMutationRegistration *registration = (*node_registrations)->data;
+      SopaMutationObserverPrivate *priv = registration->observer->priv;
+
+      priv->registrations = g_slist_remove (priv->registrations,
+                                            registration);
+
+      sopa_mutation_registration_unlink (registration);
+    }
+}
@@ -0,0 +1,181 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-mutation-observer.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#if !defined(SOPA_H_INSIDE) && !defined(SOPA_COMPILATION)
+#error "Only <sopa/sopa.h> can be included directly.h"
+#endif
+
+#ifndef __SOPA_MUTATION_OBSERVER_H__
+#define __SOPA_MUTATION_OBSERVER_H__
+
+#include <glib-object.h>
+#include <sopa/sopa-node.h>
+
+G_BEGIN_DECLS
+
+#define SOPA_TYPE_MUTATION_OBSERVER sopa_mutation_observer_get_type()
+
+#define SOPA_MUTATION_OBSERVER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+  SOPA_TYPE_MUTATION_OBSERVER, SopaMutationObserver))
+
+#define SOPA_MUTATION_OBSERVER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), \
+  SOPA_TYPE_MUTATION_OBSERVER, SopaMutationObserverClass))
+
+#define SOPA_IS_MUTATION_OBSERVER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), \
+  SOPA_TYPE_MUTATION_OBSERVER))
+
+#define SOPA_IS_MUTATION_OBSERVER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), \
+  SOPA_TYPE_MUTATION_OBSERVER))
+
+#define SOPA_MUTATION_OBSERVER_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), \
+  SOPA_TYPE_MUTATION_OBSERVER, SopaMutationObserverClass))
+
+typedef struct _SopaMutationObserver SopaMutationObserver;
+typedef struct _SopaMutationObserverClass SopaMutationObserverClass;
+typedef struct _SopaMutationObserverPrivate SopaMutationObserverPrivate;
+
+typedef struct _SopaMutationRecord SopaMutationRecord;
+
+/**
+ * SopaMutationType:
+ * @SOPA_MUTATION_CHILD_LIST: a child was added or removed
+ * @SOPA_MUTATION_ATTRIBUTE: an attribute was set or removed
+ * @SOPA_MUTATION_CHARACTER_DATA: the content of a text node was set
+ *
+ * The kinds of mutations reported by a #SopaMutationObserver.
+ *
+ * Since: 0.2
+ */
+typedef enum {
+  SOPA_MUTATION_CHILD_LIST,
+  SOPA_MUTATION_ATTRIBUTE,
+  SOPA_MUTATION_CHARACTER_DATA
+} SopaMutationType;
+
+/**
+ * SopaMutationObserverFlags:
+ * @SOPA_MUTATION_OBSERVE_CHILD_LIST: report added and removed children
+ * @SOPA_MUTATION_OBSERVE_ATTRIBUTES: report attribute changes
+ * @SOPA_MUTATION_OBSERVE_CHARACTER_DATA: report text content changes
+ * @SOPA_MUTATION_OBSERVE_SUBTREE: report the mutations of all the
+ *   descendants of the node as well, not only of the node itself
+ * @SOPA_MUTATION_OBSERVE_OLD_VALUES: fill in the previous values of
+ *   changed attributes and text contents
+ *
+ * Flags selecting which mutations sopa_mutation_observer_observe()
+ * reports.
+ *
+ * Since: 0.2
+ */
+typedef enum { /*< flags >*/
+  SOPA_MUTATION_OBSERVE_CHILD_LIST     = 1 << 0,
+  SOPA_MUTATION_OBSERVE_ATTRIBUTES     = 1 << 1,
+  SOPA_MUTATION_OBSERVE_CHARACTER_DATA = 1 << 2,
+  SOPA_MUTATION_OBSERVE_SUBTREE        = 1 << 3,
+  SOPA_MUTATION_OBSERVE_OLD_VALUES     = 1 << 4
+} SopaMutationObserverFlags;
+
+/**
+ * SopaMutationRecord:
+ * @type: the kind of mutation
+ * @target: the node that changed; for %SOPA_MUTATION_CHILD_LIST, the
+ *   parent the child was added to or removed from
+ * @added_node: the child that was added, or %NULL
+ * @removed_node: the child that was removed, or %NULL
+ * @previous_sibling: the sibling before the added or removed child,
+ *   or %NULL
+ * @next_sibling: the sibling after the added or removed child, or %NULL
+ * @name: the name of the changed attribute, or %NULL
+ * @old_value: the previous value of the attribute or of the text
+ *   content, if %SOPA_MUTATION_OBSERVE_OLD_VALUES was requested and
+ *   there was one, or %NULL
+ *
+ * A mutation, as delivered by a #SopaMutationObserver. The record
+ * holds references on its nodes, so they stay alive until it is
+ * delivered even if they are removed from the tree.
+ *
+ * Since: 0.2
+ */
+struct _SopaMutationRecord
+{
+  SopaMutationType  type;
+  SopaNode         *target;
+
+  SopaNode         *added_node;
+  SopaNode         *removed_node;
+  SopaNode         *previous_sibling;
+  SopaNode         *next_sibling;
+
+  gchar            *name;
+  gchar            *old_value;
+};
+
+struct _SopaMutationObserver
+{
+  GObject parent;
+
+  SopaMutationObserverPrivate *priv;
+};
+
+struct _SopaMutationObserverClass
+{
+  GObjectClass parent_class;
+};
+
+/**
+ * SopaMutationFunc:
+ * @observer: the #SopaMutationObserver
+ * @records: (array length=n_records): the mutations, oldest first;
+ *   they are only valid during the call
+ * @n_records: the number of records
+ * @user_data: the data passed to sopa_mutation_observer_new()
+ *
+ * The function a #SopaMutationObserver delivers its batches of
+ * mutations to.
+ *
+ * Since: 0.2
+ */
+typedef void (* SopaMutationFunc) (SopaMutationObserver     *observer,
+                                   const SopaMutationRecord *records,
+                                   guint                     n_records,
+                                   gpointer                  user_data);
+
+GType sopa_mutation_observer_get_type (void) G_GNUC_CONST;
+
+SopaMutationObserver *              sopa_mutation_observer_new                  (SopaMutationFunc          func,
+                                                                                 gpointer                  user_data,
+                                                                                 GDestroyNotify            notify);
+void                                sopa_mutation_observer_observe              (SopaMutationObserver     *self,
+                                                                                 SopaNode                 *node,
+                                                                                 SopaMutationObserverFlags flags);
+void                                sopa_mutation_observer_disconnect           (SopaMutationObserver     *self);
+guint                               sopa_mutation_observer_get_n_pending        (SopaMutationObserver     *self);
+void                                sopa_mutation_observer_flush                (SopaMutationObserver     *self);
+
+G_END_DECLS
+
+#endif /* __SOPA_MUTATION_OBSERVER_H__ */
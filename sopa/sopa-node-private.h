@@ -45,6 +45,76 @@ void                                sopa_node_remove_all_children
 void                                sopa_node_destroy_all_children              (SopaNode                 *self);
 gint                                sopa_node_get_n_children                    (SopaNode                 *self);
 
+/* internal helpers */
+typedef struct _SopaNodeOrder SopaNodeOrder;
+typedef struct _SopaNodeSerial SopaNodeSerial;
+
+/*< private >
+ * SopaNodeSerial:
+ * @offset: where the markup of the node starts, counted from the start
+ *   of the markup of its parent
+ * @length: the length of the markup of the node
+ * @bytes: on tree roots, the markup of the whole tree
+ * @mode: the #SopaSerializeMode @bytes was written in
+ * @indent_width: the indent width @bytes was written with
+ * @cached: whether @offset and @length are valid within the markup
+ *   of the parent
+ * @dirty: whether the node or any of its descendants changed since
+ *   the markup was written
+ * @parsed: whether neither the node nor any of its descendants changed
+ *   since it was parsed, so that its range in the source of the
+ *   document is valid
+ * @sourced: whether the markup of the node was copied from the source
+ *   of its document, so that the offsets of its descendants do not
+ *   describe it
+ *
+ * The state that lets the writer copy the markup of unchanged
+ * subtrees from the last serialization of the tree.
+ */
+struct _SopaNodeSerial
+{
+  gsize   offset;
+  gsize   length;
+
+  GBytes *bytes;
+  gint    mode;
+  guint   indent_width;
+
+  guint   cached  : 1;
+  guint   dirty   : 1;
+  guint   parsed  : 1;
+  guint   sourced : 1;
+};
+
+const gchar *                       _sopa_node_get_debug_name                   (SopaNode                 *node);
+SopaNode *                          _sopa_node_next_in_tree                     (SopaNode                 *node,
+                                                                                 SopaNode                 *root);
+SopaNode *                          _sopa_node_skip_subtree                     (SopaNode                 *node,
+                                                                                 SopaNode                 *root);
+gint                                _sopa_node_compare_order                    (SopaNode                 *a,
+                                                                                 SopaNode                 *b);
+void                                _sopa_node_invalidate_order                 (SopaNode                 *self);
+SopaNode *                          _sopa_node_clone_shallow                    (SopaNode                 *node,
+                                                                                 gboolean                  share);
+void                                _sopa_node_link_child                       (SopaNode                 *parent,
+                                                                                 SopaNode                 *child);
+guint                               _sopa_node_get_index                        (SopaNode                 *node);
+guint                               _sopa_node_get_subtree_size                 (SopaNode                 *node);
+SopaNodeOrder *                     _sopa_node_ref_order                        (SopaNode                 *node);
+gboolean                            _sopa_node_order_is_current                 (SopaNode                 *node,
+                                                                                 SopaNodeOrder            *order);
+void                                _sopa_node_order_unref                      (SopaNodeOrder            *order);
+void                                _sopa_node_lock_serial                      (SopaNode                 *root);
+void                                _sopa_node_unlock_serial                    (SopaNode                 *root);
+SopaNodeSerial *                    _sopa_node_get_serial                       (SopaNode                 *node);
+GSList **                           _sopa_node_get_registrations                (SopaNode                 *node);
+void                                _sopa_node_mark_dirty                       (SopaNode                 *self);
+SopaNode *                          _sopa_node_freeze_tree                      (SopaNode                 *node);
+gboolean                            _sopa_node_is_frozen                        (SopaNode                 *self);
+void                                _sopa_node_begin_update                     (SopaNode                 *root);
+gboolean                            _sopa_node_end_update                       (SopaNode                 *root);
+void                                _sopa_node_thaw_tree                        (SopaNode                 *root);
+
 G_END_DECLS
 
 #endif /* __SOPA_NODE_PRIVATE_H__ */
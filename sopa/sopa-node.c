@@ -30,15 +30,87 @@
  *
  */
 
+#include <string.h>
+
 #include "sopa-node.h"
 #include "sopa-node-private.h"
+#include "sopa-document.h"
+#include "sopa-document-private.h"
+#include "sopa-element.h"
+#include "sopa-element-private.h"
+#include "sopa-text.h"
+#include "sopa-text-private.h"
 #include "sopa-marshal.h"
+#include "sopa-mutation-observer-private.h"
+#include "sopa-private.h"
+#include "sopa-task-pool-private.h"
+#include "sopa-writer-private.h"
 
 G_DEFINE_ABSTRACT_TYPE (SopaNode, sopa_node, G_TYPE_INITIALLY_UNOWNED)
 
 #define NODE_PRIVATE(o) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((o), SOPA_TYPE_NODE, SopaNodePrivate))
 
+/* the document-order numbering of a tree; it is shared by all the
+ * nodes numbered in the same pass, so that a single change in the
+ * tree invalidates the numbering of all of them. as long as it is
+ * valid, the tree has not changed, so it doubles as a tree version
+ */
+struct _SopaNodeOrder
+{
+  volatile gint ref_count;
+  volatile gint valid;
+};
+
+/* protects the numbering of trees, which happens on demand */
+G_LOCK_DEFINE_STATIC (node_order);
+
+/* protects the building of the arrays of children */
+G_LOCK_DEFINE_STATIC (children_index);
+
+/* the number of trees being traversed by sopa_node_foreach_parallel(),
+ * so that mutations only look for a frozen root while there are some
+ */
+static volatile gint n_frozen_trees = 0;
+
+typedef struct _SopaNodeUpdate SopaNodeUpdate;
+typedef struct _SopaNodeUpdateEntry SopaNodeUpdateEntry;
+typedef struct _SopaNodeUpdateCount SopaNodeUpdateCount;
+
+/* the number of updates begun by a thread and still in progress, so
+ * that mutations only look for an updating root in the threads having
+ * some; updates keep a reference, as they can end in another thread
+ * when their root is disposed
+ */
+struct _SopaNodeUpdateCount
+{
+  volatile gint ref_count;
+  volatile gint n_updates;
+};
+
+static void sopa_node_update_count_unref (gpointer        data);
+static void sopa_node_update_free        (SopaNodeUpdate *update);
+
+static GPrivate update_count = G_PRIVATE_INIT (sopa_node_update_count_unref);
+
+/* an update in progress on a tree: the nodes whose children changed,
+ * with the first and last children they had before, so that their
+ * notifications can be emitted once when the update ends
+ */
+struct _SopaNodeUpdate
+{
+  SopaNode            *root;
+  guint                depth;
+  SopaNodeUpdateCount *count;
+  GHashTable          *touched;
+};
+
+struct _SopaNodeUpdateEntry
+{
+  SopaNode   *old_first_child;
+  SopaNode   *old_last_child;
+};
+
 struct _SopaNodePrivate
 {
   /* a non-unique name, used for debugging */
@@ -60,6 +132,50 @@ struct _SopaNodePrivate
    */
   gint       age;
 
+  /* array of the children, built on demand for indexed access; it
+   * is valid as long as children_index_age matches the age, which is
+   * set last so that readers in other threads see a complete array
+   */
+  SopaNode **children_index;
+  volatile gint children_index_age;
+
+  /* pre-order and post-order positions of the node, valid as long
+   * as the order is valid; a node contains another if its interval
+   * contains the other's
+   */
+  SopaNodeOrder *order;
+  guint      pre_index;
+  guint      post_index;
+
+  /* number of nodes in the sub-tree, valid along with the order */
+  guint      subtree_size;
+
+  /* on tree roots, the number of parallel traversals in progress */
+  volatile gint frozen;
+
+  /* on tree roots, the update in progress, if any */
+  SopaNodeUpdate *update;
+
+  /* where the markup of the node is in the last serialization */
+  SopaNodeSerial serial;
+
+  /* on tree roots, held while the serialization state of the tree is
+   * read or written; see _sopa_node_lock_serial()
+   */
+  volatile gint serial_lock;
+
+  /* structural hash of the sub-tree, computed on demand; it is
+   * cleared along with the ones of the ancestors on any change.
+   * Threads reading the same tree may hash it at once: the flag is
+   * set atomically once the hash is written, and the hash is only
+   * read after the flag, so they all see either no hash or a whole one
+   */
+  guint64    hash;
+  volatile gint hash_valid;
+
+  /* the mutation observers observing the node */
+  GSList    *registrations;
+
 #ifdef SOPA_ENABLE_DEBUG
   /* a string used for debugging messages */
   gchar *debug_name;
@@ -193,6 +309,15 @@ sopa_node_dispose (GObject *object)
   SopaNode *self = SOPA_NODE (object);
   SopaNodePrivate *priv = self->priv;
 
+  /* an update left open ends without notifications, before the
+   * children go away
+   */
+  if (priv->update != NULL)
+    {
+      sopa_node_update_free (priv->update);
+      priv->update = NULL;
+    }
+
   g_signal_emit (self, obj_signals[DESTROY], 0);
 
   /* avoid recursing when called from sopa_node_destroy() */
@@ -213,6 +338,16 @@ sopa_node_finalize (GObject *object)
   SopaNodePrivate *priv = self->priv;
 
   g_free (priv->name);
+  g_free (priv->children_index);
+
+  if (priv->order != NULL)
+    _sopa_node_order_unref (priv->order);
+
+  if (priv->serial.bytes != NULL)
+    g_bytes_unref (priv->serial.bytes);
+
+  if (priv->registrations != NULL)
+    _sopa_mutation_observer_forget_node (self);
 
 #ifdef SOPA_ENABLE_DEBUG
   g_free (priv->debug_name);
@@ -297,6 +432,9 @@ sopa_node_init (SopaNode *self)
   priv->n_children = 0;
   priv->in_destruction = FALSE;
   priv->age = 0;
+  priv->children_index_age = -1;
+
+  priv->serial.dirty = TRUE;
 }
 
 /**
@@ -367,552 +505,2488 @@ sopa_node_get_name (SopaNode *self)
   return self->priv->name;
 }
 
-static inline void
-remove_child (SopaNode *self,
-              SopaNode *child)
+static SopaNodeOrder *
+sopa_node_order_new (void)
 {
-  SopaNode *prev_sibling, *next_sibling;
+  SopaNodeOrder *order = g_slice_new (SopaNodeOrder);
 
-  prev_sibling = child->priv->prev_sibling;
-  next_sibling = child->priv->next_sibling;
+  order->ref_count = 1;
+  order->valid = TRUE;
 
-  if (prev_sibling != NULL)
-    prev_sibling->priv->next_sibling = next_sibling;
+  return order;
+}
 
-  if (next_sibling != NULL)
-    next_sibling->priv->prev_sibling = prev_sibling;
+static SopaNodeOrder *
+sopa_node_order_ref (SopaNodeOrder *order)
+{
+  g_atomic_int_inc (&order->ref_count);
 
-  if (self->priv->first_child == child)
-    self->priv->first_child = next_sibling;
+  return order;
+}
 
-  if (self->priv->last_child == child)
-    self->priv->last_child = prev_sibling;
+/*< private >
+ * _sopa_node_order_unref:
+ * @order: a #SopaNodeOrder
+ *
+ * Releases a reference acquired with _sopa_node_ref_order().
+ */
+void
+_sopa_node_order_unref (SopaNodeOrder *order)
+{
+  if (g_atomic_int_dec_and_test (&order->ref_count))
+    g_slice_free (SopaNodeOrder, order);
+}
 
-  child->priv->parent = NULL;
-  child->priv->prev_sibling = NULL;
-  child->priv->next_sibling = NULL;
+/*< private >
+ * _sopa_node_invalidate_order:
+ * @self: a #SopaNode
+ *
+ * Marks the tree containing @self as changed. This is called whenever
+ * the children of @self change, and by subclasses whenever a change
+ * in @self can change the result of a query.
+ */
+void
+_sopa_node_invalidate_order (SopaNode *self)
+{
+  if (self->priv->order != NULL)
+    g_atomic_int_set (&self->priv->order->valid, FALSE);
 }
 
+static inline gboolean
+sopa_node_order_is_valid (SopaNode *node)
+{
+  return node->priv->order != NULL &&
+         g_atomic_int_get (&node->priv->order->valid);
+}
+
+/* numbers the tree rooted in @root, without recursing */
 static void
-sopa_node_remove_child_internal (SopaNode *self,
-                                 SopaNode *child)
+sopa_node_number_tree (SopaNode *root)
 {
-  SopaNode *old_first, *old_last;
-  GObject *obj;
+  SopaNodeOrder *order;
+  SopaNode *node;
+  guint pre = 0, post = 0;
 
-  obj = G_OBJECT (self);
-  g_object_freeze_notify (obj);
+  order = sopa_node_order_new ();
+  node = root;
 
-  old_first = self->priv->first_child;
-  old_last = self->priv->last_child;
+  for (;;)
+    {
+      if (node->priv->order != NULL)
+        _sopa_node_order_unref (node->priv->order);
 
-  remove_child (self, child);
+      node->priv->order = sopa_node_order_ref (order);
+      node->priv->pre_index = pre++;
 
-  self->priv->n_children -= 1;
+      if (node->priv->first_child != NULL)
+        {
+          node = node->priv->first_child;
+          continue;
+        }
 
-  self->priv->age += 1;
+      /* leave the node, and every ancestor whose last child it is */
+      for (;;)
+        {
+          node->priv->post_index = post++;
+          node->priv->subtree_size = pre - node->priv->pre_index;
 
-  /* we need to emit the signal before dropping the reference */
-  //g_signal_emit_by_name (self, "node-removed", child);
+          if (node == root)
+            {
+              _sopa_node_order_unref (order);
+              return;
+            }
 
-  if (old_first != self->priv->first_child)
-    g_object_notify_by_pspec (obj, obj_props[PROP_FIRST_CHILD]);
+          if (node->priv->next_sibling != NULL)
+            {
+              node = node->priv->next_sibling;
+              break;
+            }
 
-  if (old_last != self->priv->last_child)
-    g_object_notify_by_pspec (obj, obj_props[PROP_LAST_CHILD]);
+          node = node->priv->parent;
+        }
+    }
+}
 
-  g_object_thaw_notify (obj);
+static SopaNode *
+sopa_node_get_root (SopaNode *node)
+{
+  while (node->priv->parent != NULL)
+    node = node->priv->parent;
 
-  /* remove the reference we acquired in sopa_node_add_child() */
-  g_object_unref (child);
+  return node;
 }
 
-static void
-insert_child_at_index (SopaNode *self,
-                       SopaNode *child,
-                       gpointer  data_)
+/* ensures @a and @b share a valid numbering; returns %FALSE if they
+ * are in different trees
+ */
+static gboolean
+sopa_node_ensure_order (SopaNode *a,
+                        SopaNode *b)
 {
-  gint index_ = GPOINTER_TO_INT (data_);
+  SopaNode *root;
 
-  child->priv->parent = self;
+  if (a->priv->order == b->priv->order && sopa_node_order_is_valid (a))
+    return TRUE;
 
-  if (index_ == 0)
-    {
-      SopaNode *tmp = self->priv->first_child;
+  root = sopa_node_get_root (a);
+  if (root != sopa_node_get_root (b))
+    return FALSE;
 
-      if (tmp != NULL)
-        tmp->priv->prev_sibling = child;
+  G_LOCK (node_order);
 
-      child->priv->prev_sibling = NULL;
-      child->priv->next_sibling = tmp;
-    }
-  else if (index_ < 0 || index_ >= self->priv->n_children)
-    {
-      SopaNode *tmp = self->priv->last_child;
+  /* another thread could have numbered the tree meanwhile */
+  if (a->priv->order != b->priv->order || !sopa_node_order_is_valid (a))
+    sopa_node_number_tree (root);
 
-      if (tmp != NULL)
-        tmp->priv->next_sibling = child;
+  G_UNLOCK (node_order);
 
-      child->priv->prev_sibling = tmp;
-      child->priv->next_sibling = NULL;
-    }
-  else
-    {
-      SopaNode *iter;
-      int i;
+  return TRUE;
+}
 
-      for (iter = self->priv->first_child, i = 0;
-           iter != NULL;
-           iter = iter->priv->next_sibling, i += 1)
-        {
-          if (index_ == i)
-            {
-              SopaNode *tmp = iter->priv->prev_sibling;
+/* ensures the tree containing @node is numbered */
+static void
+sopa_node_ensure_numbered (SopaNode *node)
+{
+  if (sopa_node_order_is_valid (node))
+    return;
 
-              child->priv->prev_sibling = tmp;
-              child->priv->next_sibling = iter;
+  G_LOCK (node_order);
 
-              iter->priv->prev_sibling = child;
+  if (!sopa_node_order_is_valid (node))
+    sopa_node_number_tree (sopa_node_get_root (node));
 
-              if (tmp != NULL)
-                tmp->priv->next_sibling = child;
+  G_UNLOCK (node_order);
+}
 
-              break;
-            }
-        }
-    }
+/*< private >
+ * _sopa_node_get_subtree_size:
+ * @node: a #SopaNode
+ *
+ * Retrieves the number of nodes in the sub-tree rooted in @node,
+ * including @node; numbers the tree if needed.
+ *
+ * Return value: the number of nodes
+ */
+guint
+_sopa_node_get_subtree_size (SopaNode *node)
+{
+  sopa_node_ensure_numbered (node);
 
-  if (child->priv->prev_sibling == NULL)
-    self->priv->first_child = child;
+  return node->priv->subtree_size;
+}
 
-  if (child->priv->next_sibling == NULL)
-    self->priv->last_child = child;
+/*< private >
+ * _sopa_node_get_index:
+ * @node: a #SopaNode
+ *
+ * Retrieves the position of @node in the document order of its tree,
+ * where the root is 0; numbers the tree if needed.
+ *
+ * Return value: the position of @node
+ */
+guint
+_sopa_node_get_index (SopaNode *node)
+{
+  sopa_node_ensure_numbered (node);
+
+  return node->priv->pre_index;
 }
 
-static void
-insert_child_above (SopaNode *self,
-                    SopaNode *child,
-                    gpointer  data)
+/*< private >
+ * _sopa_node_ref_order:
+ * @node: a #SopaNode
+ *
+ * Retrieves the current version of the tree containing @node, which
+ * stays current until the tree is changed; numbers the tree if needed.
+ *
+ * Return value: (transfer full): the version, to be released with
+ *      _sopa_node_order_unref()
+ */
+SopaNodeOrder *
+_sopa_node_ref_order (SopaNode *node)
 {
-  SopaNode *sibling = data;
+  sopa_node_ensure_numbered (node);
 
-  child->priv->parent = self;
+  return sopa_node_order_ref (node->priv->order);
+}
 
-  if (sibling == NULL)
-    sibling = self->priv->last_child;
+/*< private >
+ * _sopa_node_order_is_current:
+ * @node: a #SopaNode
+ * @order: a version returned by _sopa_node_ref_order()
+ *
+ * Checks whether the tree containing @node is unchanged since @order
+ * was retrieved.
+ *
+ * Return value: %TRUE if @order is still current
+ */
+gboolean
+_sopa_node_order_is_current (SopaNode      *node,
+                             SopaNodeOrder *order)
+{
+  return node->priv->order == order && g_atomic_int_get (&order->valid);
+}
 
-  child->priv->prev_sibling = sibling;
+/*< private >
+ * _sopa_node_freeze_tree:
+ * @node: a #SopaNode
+ *
+ * Prevents changes to the tree containing @node, which is being read
+ * from other threads, until _sopa_node_thaw_tree() is called: the
+ * children of its nodes, the attributes of its elements and the
+ * contents of its text nodes; see _sopa_node_is_frozen().
+ *
+ * Return value: (transfer none): the root of the tree, to be passed
+ *      to _sopa_node_thaw_tree()
+ */
+SopaNode *
+_sopa_node_freeze_tree (SopaNode *node)
+{
+  SopaNode *root = sopa_node_get_root (node);
 
-  if (sibling != NULL)
-    {
-      SopaNode *tmp = sibling->priv->next_sibling;
+  g_atomic_int_inc (&root->priv->frozen);
+  g_atomic_int_inc (&n_frozen_trees);
 
-      child->priv->next_sibling = tmp;
+  return root;
+}
 
-      if (tmp != NULL)
-        tmp->priv->prev_sibling = child;
+/*< private >
+ * _sopa_node_thaw_tree:
+ * @root: the root returned by _sopa_node_freeze_tree()
+ *
+ * Allows changes to the tree again.
+ */
+void
+_sopa_node_thaw_tree (SopaNode *root)
+{
+  g_atomic_int_add (&n_frozen_trees, -1);
+  g_atomic_int_add (&root->priv->frozen, -1);
+}
 
-      sibling->priv->next_sibling = child;
+static void
+sopa_node_update_count_unref (gpointer data)
+{
+  SopaNodeUpdateCount *count = data;
+
+  if (g_atomic_int_dec_and_test (&count->ref_count))
+    g_slice_free (SopaNodeUpdateCount, count);
+}
+
+/* the count of the calling thread, with a new reference */
+static SopaNodeUpdateCount *
+sopa_node_update_count_ref (void)
+{
+  SopaNodeUpdateCount *count = g_private_get (&update_count);
+
+  if (count == NULL)
+    {
+      count = g_slice_new (SopaNodeUpdateCount);
+      count->ref_count = 1;
+      count->n_updates = 0;
+
+      g_private_set (&update_count, count);
     }
-  else
-    child->priv->next_sibling = NULL;
 
-  if (child->priv->prev_sibling == NULL)
-    self->priv->first_child = child;
+  g_atomic_int_inc (&count->ref_count);
 
-  if (child->priv->next_sibling == NULL)
-    self->priv->last_child = child;
+  return count;
 }
 
 static void
-insert_child_below (SopaNode *self,
-                    SopaNode *child,
-                    gpointer  data)
+sopa_node_update_entry_free (gpointer data)
 {
-  SopaNode *sibling = data;
+  SopaNodeUpdateEntry *entry = data;
 
-  child->priv->parent = self;
+  g_clear_object (&entry->old_first_child);
+  g_clear_object (&entry->old_last_child);
 
-  if (sibling == NULL)
-    sibling = self->priv->first_child;
+  g_slice_free (SopaNodeUpdateEntry, entry);
+}
 
-  child->priv->next_sibling = sibling;
+static void
+sopa_node_update_free (SopaNodeUpdate *update)
+{
+  GHashTableIter iter;
+  gpointer key;
 
-  if (sibling != NULL)
+  g_hash_table_iter_init (&iter, update->touched);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
     {
-      SopaNode *tmp = sibling->priv->prev_sibling;
+      if (key != update->root)
+        g_object_unref (key);
+    }
 
-      child->priv->prev_sibling = tmp;
+  g_hash_table_unref (update->touched);
 
-      if (tmp != NULL)
-        tmp->priv->next_sibling = child;
+  g_atomic_int_add (&update->count->n_updates, -1);
+  sopa_node_update_count_unref (update->count);
 
-      sibling->priv->prev_sibling = child;
-    }
-  else
-    child->priv->prev_sibling = NULL;
+  g_slice_free (SopaNodeUpdate, update);
+}
 
-  if (child->priv->prev_sibling == NULL)
-    self->priv->first_child = child;
+/* the update in progress on the tree containing @self, if any; only
+ * the changes made from the thread that began it are batched
+ */
+static inline SopaNodeUpdate *
+sopa_node_get_update (SopaNode *self)
+{
+  SopaNodeUpdateCount *count = g_private_get (&update_count);
+
+  if (G_LIKELY (count == NULL || g_atomic_int_get (&count->n_updates) == 0))
+    return NULL;
+
+  return sopa_node_get_root (self)->priv->update;
+}
+
+/* records that the children of @self are about to change */
+static void
+sopa_node_update_touch (SopaNodeUpdate *update,
+                        SopaNode       *self)
+{
+  SopaNodeUpdateEntry *entry;
+
+  if (g_hash_table_contains (update->touched, self))
+    return;
+
+  entry = g_slice_new (SopaNodeUpdateEntry);
+  entry->old_first_child = self->priv->first_child != NULL
+                         ? g_object_ref (self->priv->first_child)
+                         : NULL;
+  entry->old_last_child = self->priv->last_child != NULL
+                        ? g_object_ref (self->priv->last_child)
+                        : NULL;
+
+  /* the root is not referenced, so that an update left open does not
+   * keep its tree alive
+   */
+  g_hash_table_insert (update->touched,
+                       self != update->root ? g_object_ref (self) : self,
+                       entry);
+}
+
+/*< private >
+ * _sopa_node_begin_update:
+ * @root: the root of a tree
+ *
+ * Starts an update of the tree rooted in @root, during which changes
+ * to the children of its nodes do not emit notifications; see
+ * sopa_document_begin_update(). Updates can be nested.
+ */
+void
+_sopa_node_begin_update (SopaNode *root)
+{
+  SopaNodeUpdate *update = root->priv->update;
+
+  if (update == NULL)
+    {
+      update = g_slice_new (SopaNodeUpdate);
+      update->root = root;
+      update->depth = 0;
+      update->count = sopa_node_update_count_ref ();
+      update->touched = g_hash_table_new_full (NULL, NULL, NULL,
+                                               sopa_node_update_entry_free);
+
+      root->priv->update = update;
+      g_atomic_int_inc (&update->count->n_updates);
+    }
+
+  update->depth += 1;
+}
+
+/*< private >
+ * _sopa_node_end_update:
+ * @root: the root passed to _sopa_node_begin_update()
+ *
+ * Ends an update of the tree rooted in @root. When the outermost
+ * update ends, each node whose children changed during it emits its
+ * notifications once.
+ *
+ * Return value: %FALSE if there was no update in progress
+ */
+gboolean
+_sopa_node_end_update (SopaNode *root)
+{
+  SopaNodeUpdate *update = root->priv->update;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  if (update == NULL)
+    return FALSE;
+
+  update->depth -= 1;
+  if (update->depth > 0)
+    return TRUE;
+
+  /* the notification handlers see the tree out of the update */
+  root->priv->update = NULL;
+
+  g_hash_table_iter_init (&iter, update->touched);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      SopaNode *node = key;
+      SopaNodeUpdateEntry *entry = value;
+
+      if (entry->old_first_child != node->priv->first_child)
+        g_object_notify_by_pspec (G_OBJECT (node),
+                                  obj_props[PROP_FIRST_CHILD]);
+
+      if (entry->old_last_child != node->priv->last_child)
+        g_object_notify_by_pspec (G_OBJECT (node),
+                                  obj_props[PROP_LAST_CHILD]);
+    }
+
+  sopa_node_update_free (update);
+
+  return TRUE;
+}
+
+/*< private >
+ * _sopa_node_lock_serial:
+ * @root: the root of a tree
+ *
+ * Acquires the lock of the serialization state of the tree rooted in
+ * @root, which serializing and cloning the tree read and update; the
+ * other functions reading a tree leave it alone, so they need no lock.
+ */
+void
+_sopa_node_lock_serial (SopaNode *root)
+{
+  g_bit_lock (&root->priv->serial_lock, 0);
+}
+
+/*< private >
+ * _sopa_node_unlock_serial:
+ * @root: the root passed to _sopa_node_lock_serial()
+ *
+ * Releases the lock acquired with _sopa_node_lock_serial().
+ */
+void
+_sopa_node_unlock_serial (SopaNode *root)
+{
+  g_bit_unlock (&root->priv->serial_lock, 0);
+}
+
+/*< private >
+ * _sopa_node_get_serial:
+ * @node: a #SopaNode
+ *
+ * Retrieves the serialization state of @node, for the writer.
+ *
+ * Return value: (transfer none): the state
+ */
+SopaNodeSerial *
+_sopa_node_get_serial (SopaNode *node)
+{
+  return &node->priv->serial;
+}
+
+/*< private >
+ * _sopa_node_get_registrations:
+ * @node: a #SopaNode
+ *
+ * Retrieves the list of the mutation observers observing @node, for
+ * the observers to update.
+ *
+ * Return value: (transfer none): the list
+ */
+GSList **
+_sopa_node_get_registrations (SopaNode *node)
+{
+  return &node->priv->registrations;
+}
+
+/*< private >
+ * _sopa_node_mark_dirty:
+ * @self: a #SopaNode
+ *
+ * Marks the markup of @self and of its ancestors as changed. This is
+ * called whenever the children of @self change, and by subclasses
+ * whenever a change in @self changes its markup.
+ */
+void
+_sopa_node_mark_dirty (SopaNode *self)
+{
+  SopaNode *node;
+
+  /* the ancestors of a dirty node are dirty already, those of a node
+   * that changed since it was parsed changed as well, and those of a
+   * node without a hash have none either
+   */
+  for (node = self;
+       node != NULL &&
+       (!node->priv->serial.dirty ||
+        node->priv->serial.parsed ||
+        g_atomic_int_get (&node->priv->hash_valid));
+       node = node->priv->parent)
+    {
+      node->priv->serial.dirty = TRUE;
+      node->priv->serial.parsed = FALSE;
+      g_atomic_int_set (&node->priv->hash_valid, FALSE);
+    }
+}
+
+/*< private >
+ * _sopa_node_is_frozen:
+ * @self: a #SopaNode
+ *
+ * Checks whether the tree containing @self is frozen with
+ * _sopa_node_freeze_tree(), in which case neither its structure nor
+ * the data of its nodes may change.
+ *
+ * Return value: %TRUE if the tree of @self is frozen
+ */
+gboolean
+_sopa_node_is_frozen (SopaNode *self)
+{
+  if (G_LIKELY (g_atomic_int_get (&n_frozen_trees) == 0))
+    return FALSE;
+
+  return g_atomic_int_get (&sopa_node_get_root (self)->priv->frozen) > 0;
+}
+
+static inline void
+remove_child (SopaNode *self,
+              SopaNode *child)
+{
+  SopaNode *prev_sibling, *next_sibling;
+
+  prev_sibling = child->priv->prev_sibling;
+  next_sibling = child->priv->next_sibling;
+
+  if (prev_sibling != NULL)
+    prev_sibling->priv->next_sibling = next_sibling;
+
+  if (next_sibling != NULL)
+    next_sibling->priv->prev_sibling = prev_sibling;
+
+  if (self->priv->first_child == child)
+    self->priv->first_child = next_sibling;
+
+  if (self->priv->last_child == child)
+    self->priv->last_child = prev_sibling;
+
+  child->priv->parent = NULL;
+  child->priv->prev_sibling = NULL;
+  child->priv->next_sibling = NULL;
+}
+
+static void
+sopa_node_remove_child_internal (SopaNode *self,
+                                 SopaNode *child)
+{
+  SopaNode *old_first, *old_last;
+  SopaNodeUpdate *update;
+  GObject *obj;
+
+  if (G_UNLIKELY (_sopa_node_is_frozen (self)))
+    {
+      g_critical ("The node '%s' cannot be removed from '%s' while its "
+                  "tree is being read from other threads.",
+                  _sopa_node_get_debug_name (child),
+                  _sopa_node_get_debug_name (self));
+      return;
+    }
+
+  obj = G_OBJECT (self);
+
+  /* within an update, the notifications are emitted when it ends */
+  update = sopa_node_get_update (self);
+  if (update != NULL)
+    sopa_node_update_touch (update, self);
+  else
+    g_object_freeze_notify (obj);
+
+  old_first = self->priv->first_child;
+  old_last = self->priv->last_child;
+
+  _sopa_mutation_observer_child_removed (self, child);
+
+  remove_child (self, child);
+
+  self->priv->n_children -= 1;
+
+  self->priv->age += 1;
+  _sopa_node_invalidate_order (self);
+  _sopa_node_mark_dirty (self);
+
+  /* we need to emit the signal before dropping the reference */
+  //g_signal_emit_by_name (self, "node-removed", child);
+
+  if (update == NULL)
+    {
+      if (old_first != self->priv->first_child)
+        g_object_notify_by_pspec (obj, obj_props[PROP_FIRST_CHILD]);
+
+      if (old_last != self->priv->last_child)
+        g_object_notify_by_pspec (obj, obj_props[PROP_LAST_CHILD]);
+
+      g_object_thaw_notify (obj);
+    }
+
+  /* remove the reference we acquired in sopa_node_add_child() */
+  g_object_unref (child);
+}
+
+static void
+insert_child_at_index (SopaNode *self,
+                       SopaNode *child,
+                       gpointer  data_)
+{
+  gint index_ = GPOINTER_TO_INT (data_);
+
+  child->priv->parent = self;
+
+  if (index_ == 0)
+    {
+      SopaNode *tmp = self->priv->first_child;
+
+      if (tmp != NULL)
+        tmp->priv->prev_sibling = child;
+
+      child->priv->prev_sibling = NULL;
+      child->priv->next_sibling = tmp;
+    }
+  else if (index_ < 0 || index_ >= self->priv->n_children)
+    {
+      SopaNode *tmp = self->priv->last_child;
+
+      if (tmp != NULL)
+        tmp->priv->next_sibling = child;
+
+      child->priv->prev_sibling = tmp;
+      child->priv->next_sibling = NULL;
+    }
+  else
+    {
+      SopaNode *iter;
+      int i;
+
+      for (iter = self->priv->first_child, i = 0;
+           iter != NULL;
+           iter = iter->priv->next_sibling, i += 1)
+        {
+          if (index_ == i)
+            {
+              SopaNode *tmp = iter->priv->prev_sibling;
+
+              child->priv->prev_sibling = tmp;
+              child->priv->next_sibling = iter;
+
+              iter->priv->prev_sibling = child;
+
+              if (tmp != NULL)
+                tmp->priv->next_sibling = child;
+
+              break;
+            }
+        }
+    }
+
+  if (child->priv->prev_sibling == NULL)
+    self->priv->first_child = child;
+
+  if (child->priv->next_sibling == NULL)
+    self->priv->last_child = child;
+}
+
+static void
+insert_child_above (SopaNode *self,
+                    SopaNode *child,
+                    gpointer  data)
+{
+  SopaNode *sibling = data;
+
+  child->priv->parent = self;
+
+  if (sibling == NULL)
+    sibling = self->priv->last_child;
+
+  child->priv->prev_sibling = sibling;
+
+  if (sibling != NULL)
+    {
+      SopaNode *tmp = sibling->priv->next_sibling;
+
+      child->priv->next_sibling = tmp;
+
+      if (tmp != NULL)
+        tmp->priv->prev_sibling = child;
+
+      sibling->priv->next_sibling = child;
+    }
+  else
+    child->priv->next_sibling = NULL;
+
+  if (child->priv->prev_sibling == NULL)
+    self->priv->first_child = child;
+
+  if (child->priv->next_sibling == NULL)
+    self->priv->last_child = child;
+}
+
+static void
+insert_child_below (SopaNode *self,
+                    SopaNode *child,
+                    gpointer  data)
+{
+  SopaNode *sibling = data;
+
+  child->priv->parent = self;
+
+  if (sibling == NULL)
+    sibling = self->priv->first_child;
+
+  child->priv->next_sibling = sibling;
+
+  if (sibling != NULL)
+    {
+      SopaNode *tmp = sibling->priv->prev_sibling;
+
+      child->priv->prev_sibling = tmp;
+
+      if (tmp != NULL)
+        tmp->priv->next_sibling = child;
+
+      sibling->priv->prev_sibling = child;
+    }
+  else
+    child->priv->prev_sibling = NULL;
+
+  if (child->priv->prev_sibling == NULL)
+    self->priv->first_child = child;
+
+  if (child->priv->next_sibling == NULL)
+    self->priv->last_child = child;
+}
+
+typedef void (* SopaNodeAddChildFunc) (SopaNode     *parent,
+                                       SopaNode     *child,
+                                       gpointer      data);
+
+/*< private >
+ * sopa_node_add_child_internal:
+ * @self: a #SopaNode
+ * @child: a #SopaNode
+ * @add_func: delegate function
+ * @data: (closure): data to pass to @add_func
+ *
+ * Adds @child to the list of children of @self.
+ *
+ * The actual insertion inside the list is delegated to @add_func: this
+ * function will just set up the state, perform basic checks, and emit
+ * signals.
+ */
+static inline void
+sopa_node_add_child_internal (SopaNode              *self,
+                              SopaNode              *child,
+                              SopaNodeAddChildFunc   add_func,
+                              gpointer               data)
+{
+  SopaNode *old_first_child, *old_last_child;
+  SopaNodeUpdate *update;
+  GObject *obj;
+
+  if (G_UNLIKELY (_sopa_node_is_frozen (self)))
+    {
+      g_critical ("The node '%s' cannot be added to '%s' while its "
+                  "tree is being read from other threads.",
+                  _sopa_node_get_debug_name (child),
+                  _sopa_node_get_debug_name (self));
+      return;
+    }
+
+  if (child->priv->parent != NULL)
+    {
+      g_warning ("The node '%s' already has a parent, '%s'. You must "
+                 "use sopa_node_remove_child() first.",
+                 _sopa_node_get_debug_name (child),
+                 _sopa_node_get_debug_name (child->priv->parent));
+      return;
+    }
+
+  if (child->priv->in_destruction)
+    {
+      g_warning ("The node '%s' is currently being destroyed, and "
+                 "cannot be added as a child of another node.",
+                 _sopa_node_get_debug_name (child));
+
+      return;
+    }
+
+  old_first_child = self->priv->first_child;
+  old_last_child = self->priv->last_child;
+
+  obj = G_OBJECT (self);
+
+  /* within an update, the notifications are emitted when it ends */
+  update = sopa_node_get_update (self);
+  if (update != NULL)
+    sopa_node_update_touch (update, self);
+  else
+    g_object_freeze_notify (obj);
+
+  g_object_ref_sink (child);
+  child->priv->parent = NULL;
+  child->priv->next_sibling = NULL;
+  child->priv->prev_sibling = NULL;
+
+  /* delegate the actual insertion */
+  add_func (self, child, data);
+
+  g_assert (child->priv->parent == self);
+
+  self->priv->n_children += 1;
+
+  self->priv->age += 1;
+  _sopa_node_invalidate_order (self);
+  _sopa_node_mark_dirty (self);
+
+  /* a sub-tree numbered on its own is numbered again in its new tree */
+  _sopa_node_invalidate_order (child);
+
+  /* the markup @child had elsewhere says nothing about its new place */
+  child->priv->serial.cached = FALSE;
+  if (child->priv->serial.bytes != NULL)
+    {
+      g_bytes_unref (child->priv->serial.bytes);
+      child->priv->serial.bytes = NULL;
+    }
+
+  //g_signal_emit_by_name (self, "node-added", child);
+  _sopa_mutation_observer_child_added (self, child);
+
+  if (update == NULL)
+    {
+      if (old_first_child != self->priv->first_child)
+        g_object_notify_by_pspec (obj, obj_props[PROP_FIRST_CHILD]);
+
+      if (old_last_child != self->priv->last_child)
+        g_object_notify_by_pspec (obj, obj_props[PROP_LAST_CHILD]);
+
+      g_object_thaw_notify (obj);
+    }
+}
+
+/**
+ * sopa_node_add_child:
+ * @self: a #SopaNode
+ * @child: a #SopaNode
+ *
+ * Adds @child to the children of @self.
+ *
+ * This function will acquire a reference on @child that will only
+ * be released when calling sopa_node_remove_child().
+ *
+ */
+void
+sopa_node_add_child (SopaNode *self,
+                     SopaNode *child)
+{
+  g_return_if_fail (SOPA_IS_NODE (self));
+  g_return_if_fail (SOPA_IS_NODE (child));
+  g_return_if_fail (self != child);
+  g_return_if_fail (child->priv->parent == NULL);
+
+  sopa_node_add_child_internal (self,
+                                child,
+                                insert_child_at_index,
+                                GINT_TO_POINTER (-1));
+}
+
+/**
+ * sopa_node_insert_child_at_index:
+ * @self: a #SopaNode
+ * @child: a #SopaNode
+ * @index_: the index
+ *
+ * Inserts @child into the list of children of @self, using the
+ * given @index_. If @index_ is greater than the number of children
+ * in @self, or is less than 0, then the new child is added at the end.
+ *
+ * This function will acquire a reference on @child that will only
+ * be released when calling sopa_node_remove_child().
+ *
+ */
+void
+sopa_node_insert_child_at_index (SopaNode *self,
+                                 SopaNode *child,
+                                 gint index_)
+{
+  g_return_if_fail (SOPA_IS_NODE (self));
+  g_return_if_fail (SOPA_IS_NODE (child));
+  g_return_if_fail (self != child);
+  g_return_if_fail (child->priv->parent == NULL);
+
+  sopa_node_add_child_internal (self, child,
+                                insert_child_at_index,
+                                GINT_TO_POINTER (index_));
+}
+
+/**
+ * sopa_node_insert_child_above:
+ * @self: a #SopaNode
+ * @child: a #SopaNode
+ * @sibling: (allow-none): a child of @self, or %NULL
+ *
+ * Inserts @child into the list of children of @self, above another
+ * child of @self or, if @sibling is %NULL, above all the children
+ * of @self.
+ *
+ * This function will acquire a reference on @child that will only
+ * be released when calling sopa_node_remove_child().
+ *
+ */
+void
+sopa_node_insert_child_above (SopaNode *self,
+                              SopaNode *child,
+                              SopaNode *sibling)
+{
+  g_return_if_fail (SOPA_IS_NODE (self));
+  g_return_if_fail (SOPA_IS_NODE (child));
+  g_return_if_fail (self != child);
+  g_return_if_fail (child != sibling);
+  g_return_if_fail (child->priv->parent == NULL);
+  g_return_if_fail (sibling == NULL ||
+                    (SOPA_IS_NODE (sibling) &&
+                     sibling->priv->parent == self));
+
+  sopa_node_add_child_internal (self, child,
+                                insert_child_above,
+                                sibling);
+}
+
+/**
+ * sopa_node_insert_child_below:
+ * @self: a #SopaNode
+ * @child: a #SopaNode
+ * @sibling: (allow-none): a child of @self, or %NULL
+ *
+ * Inserts @child into the list of children of @self, below another
+ * child of @self or, if @sibling is %NULL, below all the children
+ * of @self.
+ *
+ * This function will acquire a reference on @child that will only
+ * be released when calling sopa_node_remove_child().
+ *
+ */
+void
+sopa_node_insert_child_below (SopaNode *self,
+                              SopaNode *child,
+                              SopaNode *sibling)
+{
+  g_return_if_fail (SOPA_IS_NODE (self));
+  g_return_if_fail (SOPA_IS_NODE (child));
+  g_return_if_fail (self != child);
+  g_return_if_fail (child != sibling);
+  g_return_if_fail (child->priv->parent == NULL);
+  g_return_if_fail (sibling == NULL ||
+                    (SOPA_IS_NODE (sibling) &&
+                     sibling->priv->parent == self));
+
+  sopa_node_add_child_internal (self, child,
+                                insert_child_below,
+                                sibling);
+}
+
+/**
+ * sopa_node_remove_child:
+ * @self: a #SopaNode
+ * @child: a #SopaNode
+ *
+ * Removes @child from the children of @self.
+ *
+ * This function will release the reference added by
+ * sopa_node_add_child(), so if you want to keep using @child
+ * you will have to acquire a referenced on it before calling this
+ * function.
+ *
+ */
+void
+sopa_node_remove_child (SopaNode *self,
+                        SopaNode *child)
+{
+  g_return_if_fail (SOPA_IS_NODE (self));
+  g_return_if_fail (SOPA_IS_NODE (child));
+  g_return_if_fail (self != child);
+  g_return_if_fail (child->priv->parent == self);
+
+  sopa_node_remove_child_internal (self, child);
+}
+
+/**
+ * sopa_node_remove_all_children:
+ * @self: a #SopaNode
+ *
+ * Removes all children of @self.
+ *
+ * This function releases the reference added by inserting a child actor
+ * in the list of children of @self.
+ *
+ * If the reference count of a child drops to zero, the child will be
+ * destroyed. If you want to ensure the destruction of all the children
+ * of @self, use sopa_node_destroy_all_children().
+ *
+ */
+void
+sopa_node_remove_all_children (SopaNode *self)
+{
+  SopaNodeIter iter;
+
+  g_return_if_fail (SOPA_IS_NODE (self));
+
+  if (self->priv->n_children == 0)
+    return;
+
+  g_object_freeze_notify (G_OBJECT (self));
+
+  sopa_node_iter_init (&iter, self);
+  while (sopa_node_iter_next (&iter, NULL))
+    sopa_node_iter_remove (&iter);
+
+  g_object_thaw_notify (G_OBJECT (self));
+
+  /* sanity check */
+  g_assert (self->priv->first_child == NULL);
+  g_assert (self->priv->last_child == NULL);
+  g_assert (self->priv->n_children == 0);
+}
+
+/**
+ * sopa_node_destroy_all_children:
+ * @self: a #SopaNode
+ *
+ * Destroys all children of @self.
+ *
+ * This function releases the reference added by inserting a child
+ * node in the list of children of @self, and ensures that the
+ * #SopaNode::destroy signal is emitted on each child of the
+ * node.
+ *
+ * By default, #SopaNode will emit the #SopaNode::destroy signal
+ * when its reference count drops to 0; the default handler of the
+ * #SopaNode::destroy signal will destroy all the children of an
+ * node. This function ensures that all children are destroyed, instead
+ * of just removed from @self, unlike sopa_node_remove_all_children()
+ * which will merely release the reference and remove each child.
+ *
+ * Unless you acquired an additional reference on each child of @self
+ * prior to calling sopa_node_remove_all_children() and want to reuse
+ * the actors, you should use sopa_node_destroy_all_children() in
+ * order to make sure that children are destroyed and signal handlers
+ * are disconnected even in cases where circular references prevent this
+ * from automatically happening through reference counting alone.
+ *
+ */
+void
+sopa_node_destroy_all_children (SopaNode *self)
+{
+  SopaNodeIter iter;
+
+  g_return_if_fail (SOPA_IS_NODE (self));
+
+  if (self->priv->n_children == 0)
+    return;
+
+  g_object_freeze_notify (G_OBJECT (self));
+
+  sopa_node_iter_init (&iter, self);
+  while (sopa_node_iter_next (&iter, NULL))
+    sopa_node_iter_destroy (&iter);
+
+  g_object_thaw_notify (G_OBJECT (self));
+
+  /* sanity check */
+  g_assert (self->priv->first_child == NULL);
+  g_assert (self->priv->last_child == NULL);
+  g_assert (self->priv->n_children == 0);
+}
+
+/**
+ * sopa_node_get_n_children:
+ * @self: a #SopaNode
+ *
+ * Retrieves the number of children of @self
+ *
+ * Return value: number of children of a node
+ */
+gint
+sopa_node_get_n_children (SopaNode *self)
+{
+  g_return_val_if_fail (SOPA_IS_NODE (self), 0);
+
+  return self->priv->n_children;
+}
+
+/* the array is only rebuilt once the children changed, so no reader
+ * can be using it then; building it under a lock keeps readers of the
+ * unchanged tree in several threads from building it at once
+ */
+static void
+sopa_node_ensure_children_index (SopaNode *self)
+{
+  SopaNodePrivate *priv = self->priv;
+  SopaNode *iter;
+  gint i;
+
+  if (g_atomic_int_get (&priv->children_index_age) == priv->age)
+    return;
+
+  G_LOCK (children_index);
+
+  if (priv->children_index_age != priv->age)
+    {
+      priv->children_index = g_renew (SopaNode *,
+                                      priv->children_index,
+                                      MAX (priv->n_children, 1));
+
+      for (iter = priv->first_child, i = 0;
+           iter != NULL;
+           iter = iter->priv->next_sibling, i += 1)
+        priv->children_index[i] = iter;
+
+      g_atomic_int_set (&priv->children_index_age, priv->age);
+    }
+
+  G_UNLOCK (children_index);
+}
+
+/**
+ * sopa_node_get_child_at_index:
+ * @self: a #SopaNode
+ * @index_: the position in the list of children
+ *
+ * Retrieves the child of @self at the given position.
+ *
+ * The first call after the children of @self are changed is linear in
+ * the number of children; subsequent calls take constant time.
+ *
+ * Return value: (transfer none): the #SopaNode at @index_, or %NULL if
+ *      @index_ is out of range
+ */
+SopaNode *
+sopa_node_get_child_at_index (SopaNode *self,
+                              gint      index_)
+{
+  g_return_val_if_fail (SOPA_IS_NODE (self), NULL);
+
+  if (index_ < 0 || index_ >= self->priv->n_children)
+    return NULL;
+
+  if (index_ == 0)
+    return self->priv->first_child;
+
+  if (index_ == self->priv->n_children - 1)
+    return self->priv->last_child;
+
+  sopa_node_ensure_children_index (self);
+
+  return self->priv->children_index[index_];
+}
+
+/**
+ * sopa_node_contains:
+ * @self: a #SopaNode
+ * @node: a #SopaNode
+ *
+ * Checks whether @node is @self or one of its descendants.
+ *
+ * The nodes of a tree are numbered in document order the first time
+ * they are compared after the tree was changed; until the next change,
+ * this check takes constant time.
+ *
+ * Return value: %TRUE if @self contains @node
+ *
+ * Since: 0.2
+ */
+gboolean
+sopa_node_contains (SopaNode *self,
+                    SopaNode *node)
+{
+  g_return_val_if_fail (SOPA_IS_NODE (self), FALSE);
+  g_return_val_if_fail (SOPA_IS_NODE (node), FALSE);
+
+  if (self == node)
+    return TRUE;
+
+  if (node->priv->parent == self)
+    return TRUE;
+
+  if (self->priv->first_child == NULL || !sopa_node_ensure_order (self, node))
+    return FALSE;
+
+  return self->priv->pre_index < node->priv->pre_index &&
+         node->priv->post_index < self->priv->post_index;
+}
+
+/**
+ * sopa_node_compare_document_position:
+ * @self: a #SopaNode
+ * @other: a #SopaNode
+ *
+ * Compares the position of @other in the document to that of @self,
+ * as the DOM compareDocumentPosition() method does.
+ *
+ * Like sopa_node_contains(), this takes constant time as long as the
+ * tree is not changed between calls.
+ *
+ * Return value: a combination of #SopaNodePosition flags describing
+ *      where @other is relative to @self, or 0 if they are the same node
+ *
+ * Since: 0.2
+ */
+SopaNodePosition
+sopa_node_compare_document_position (SopaNode *self,
+                                     SopaNode *other)
+{
+  g_return_val_if_fail (SOPA_IS_NODE (self), SOPA_NODE_POSITION_DISCONNECTED);
+  g_return_val_if_fail (SOPA_IS_NODE (other), SOPA_NODE_POSITION_DISCONNECTED);
+
+  if (self == other)
+    return 0;
+
+  if (!sopa_node_ensure_order (self, other))
+    return SOPA_NODE_POSITION_DISCONNECTED |
+           (other < self ? SOPA_NODE_POSITION_PRECEDING
+                         : SOPA_NODE_POSITION_FOLLOWING);
+
+  if (other->priv->pre_index < self->priv->pre_index)
+    {
+      /* an ancestor, or a node before @self */
+      if (other->priv->post_index > self->priv->post_index)
+        return SOPA_NODE_POSITION_CONTAINS | SOPA_NODE_POSITION_PRECEDING;
+
+      return SOPA_NODE_POSITION_PRECEDING;
+    }
+
+  /* a descendant, or a node after @self */
+  if (other->priv->post_index < self->priv->post_index)
+    return SOPA_NODE_POSITION_CONTAINED_BY | SOPA_NODE_POSITION_FOLLOWING;
+
+  return SOPA_NODE_POSITION_FOLLOWING;
+}
+
+typedef struct
+{
+  /* a run of siblings, with or without their descendants */
+  SopaNode *first;
+  guint     n_siblings;
+  gboolean  descendants;
+} ForeachTask;
+
+typedef struct
+{
+  SopaNodeForeachFunc func;
+  gpointer            user_data;
+} ForeachClosure;
+
+static void
+foreach_task_run (gpointer data,
+                  gpointer user_data)
+{
+  ForeachTask *task = data;
+  ForeachClosure *closure = user_data;
+  SopaNode *sibling, *node;
+  guint i;
+
+  for (sibling = task->first, i = 0;
+       i < task->n_siblings;
+       sibling = sibling->priv->next_sibling, i++)
+    {
+      if (!task->descendants)
+        {
+          closure->func (sibling, closure->user_data);
+          continue;
+        }
+
+      for (node = sibling; node != NULL; node = _sopa_node_next_in_tree (node, sibling))
+        closure->func (node, closure->user_data);
+    }
+}
+
+static void
+foreach_add_task (GArray   *tasks,
+                  SopaNode *first,
+                  guint     n_siblings,
+                  gboolean  descendants)
+{
+  ForeachTask task;
+
+  task.first = first;
+  task.n_siblings = n_siblings;
+  task.descendants = descendants;
+
+  g_array_append_val (tasks, task);
+}
+
+/* splits the sub-tree of @self into tasks of about @grain nodes: nodes
+ * with larger sub-trees become a task of their own, and their children
+ * are grouped in runs of small siblings
+ */
+static void
+foreach_split (SopaNode *self,
+               guint     grain,
+               GArray   *tasks)
+{
+  GPtrArray *stack;
+  SopaNode *node, *child, *run;
+  guint run_length, run_size;
+
+  stack = g_ptr_array_new ();
+  g_ptr_array_add (stack, self);
+
+  while (stack->len > 0)
+    {
+      node = g_ptr_array_remove_index_fast (stack, stack->len - 1);
+
+      foreach_add_task (tasks, node, 1, FALSE);
+
+      run = NULL;
+      run_length = run_size = 0;
+
+      for (child = node->priv->first_child;
+           child != NULL;
+           child = child->priv->next_sibling)
+        {
+          if (child->priv->subtree_size > grain)
+            {
+              if (run != NULL)
+                foreach_add_task (tasks, run, run_length, TRUE);
+
+              run = NULL;
+              run_length = run_size = 0;
+
+              g_ptr_array_add (stack, child);
+              continue;
+            }
+
+          if (run == NULL)
+            run = child;
+
+          run_length += 1;
+          run_size += child->priv->subtree_size;
+
+          if (run_size >= grain)
+            {
+              foreach_add_task (tasks, run, run_length, TRUE);
+
+              run = NULL;
+              run_length = run_size = 0;
+            }
+        }
+
+      if (run != NULL)
+        foreach_add_task (tasks, run, run_length, TRUE);
+    }
+
+  g_ptr_array_unref (stack);
+}
+
+/**
+ * sopa_node_foreach_parallel:
+ * @self: a #SopaNode
+ * @func: (scope call): the function to call for each node
+ * @user_data: data to pass to @func
+ * @n_threads: the maximum number of threads to use, or 0 to use one
+ *      per processor
+ *
+ * Calls @func once for @self and each of its descendants, from up to
+ * @n_threads threads at once, and in no particular order.
+ *
+ * The sub-tree is split into tasks of similar node counts, which are
+ * run by a work-stealing pool; the calling thread takes part in the
+ * work, and the function returns once all the nodes were visited.
+ *
+ * The tree containing @self must not be changed until the function
+ * returns; adding or removing nodes anywhere in it, setting or
+ * removing attributes or setting the content of text nodes, from
+ * @func or from another thread, fails with a critical warning.
+ *
+ * Since: 0.2
+ */
+void
+sopa_node_foreach_parallel (SopaNode            *self,
+                            SopaNodeForeachFunc  func,
+                            gpointer             user_data,
+                            guint                n_threads)
+{
+  ForeachClosure closure;
+  ForeachTask task;
+  SopaNode *root;
+  GArray *tasks;
+  GPtrArray *task_ptrs;
+  guint grain, i;
+
+  g_return_if_fail (SOPA_IS_NODE (self));
+  g_return_if_fail (func != NULL);
+
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+
+  closure.func = func;
+  closure.user_data = user_data;
+
+  root = _sopa_node_freeze_tree (self);
+
+  sopa_node_ensure_numbered (self);
+
+  /* a few tasks per thread, so that idle threads can steal some */
+  grain = MAX (self->priv->subtree_size / (n_threads * 8), 256);
+
+  if (n_threads == 1 || self->priv->subtree_size <= grain)
+    {
+      task.first = self;
+      task.n_siblings = 1;
+      task.descendants = TRUE;
+
+      foreach_task_run (&task, &closure);
+    }
+  else
+    {
+      tasks = g_array_new (FALSE, FALSE, sizeof (ForeachTask));
+      foreach_split (self, grain, tasks);
+
+      task_ptrs = g_ptr_array_sized_new (tasks->len);
+      for (i = 0; i < tasks->len; i++)
+        g_ptr_array_add (task_ptrs, &g_array_index (tasks, ForeachTask, i));
+
+      _sopa_task_pool_run (task_ptrs->pdata, task_ptrs->len,
+                           n_threads,
+                           foreach_task_run,
+                           &closure);
+
+      g_ptr_array_unref (task_ptrs);
+      g_array_unref (tasks);
+    }
+
+  _sopa_node_thaw_tree (root);
+}
+
+/**
+ * sopa_node_get_parent:
+ * @self: A #SopaNode
+ *
+ * Retrieves the parent of @self.
+ *
+ * Return Value: (transfer none): The #SopaNode parent, or %NULL
+ *  if no parent is set
+ */
+SopaNode *
+sopa_node_get_parent (SopaNode *self)
+{
+  g_return_val_if_fail (SOPA_IS_NODE (self), NULL);
+
+  return self->priv->parent;
+}
+
+/**
+ * sopa_node_get_first_child:
+ * @self: A #SopaNode
+ *
+ * Retrieves the first child of @self.
+ *
+ * Return Value: (transfer none): The first child #SopaNode, or %NULL
+ *  if @self has no children
+ */
+SopaNode *
+sopa_node_get_first_child (SopaNode *self)
+{
+  g_return_val_if_fail (SOPA_IS_NODE (self), NULL);
+
+  return self->priv->first_child;
+}
+
+/**
+ * sopa_node_get_last_child:
+ * @self: A #SopaNode
+ *
+ * Retrieves the last child of @self.
+ *
+ * Return Value: (transfer none): The last child #SopaNode, or %NULL
+ *  if @self has no children
+ */
+SopaNode *
+sopa_node_get_last_child (SopaNode *self)
+{
+  g_return_val_if_fail (SOPA_IS_NODE (self), NULL);
+
+  return self->priv->last_child;
+}
+
+/**
+ * sopa_node_get_next_sibling:
+ * @self: A #SopaNode
+ *
+ * Retrieves the sibling of @self that comes after it in the list
+ * of children of @self's parent.
+ *
+ * Return Value: (transfer none): The next sibling #SopaNode, or %NULL
+ */
+SopaNode *
+sopa_node_get_next_sibling (SopaNode *self)
+{
+  g_return_val_if_fail (SOPA_IS_NODE (self), NULL);
+
+  return self->priv->next_sibling;
+}
+
+/**
+ * sopa_node_get_previous_sibling:
+ * @self: A #SopaNode
+ *
+ * Retrieves the sibling of @self that comes before it in the list
+ * of children of @self's parent.
+ *
+ * Return Value: (transfer none): The previous sibling #SopaNode, or %NULL
+ */
+SopaNode *
+sopa_node_get_previous_sibling (SopaNode *self)
+{
+  g_return_val_if_fail (SOPA_IS_NODE (self), NULL);
+
+  return self->priv->prev_sibling;
+}
+
+/*< private >
+ * _sopa_node_next_in_tree:
+ * @node: a #SopaNode
+ * @root: the #SopaNode where the walk started
+ *
+ * Retrieves the node following @node in a pre-order walk of the
+ * sub-tree rooted in @root, without recursing.
+ *
+ * Return value: the next #SopaNode, or %NULL at the end of the walk
+ */
+SopaNode *
+_sopa_node_next_in_tree (SopaNode *node,
+                         SopaNode *root)
+{
+  if (node->priv->first_child != NULL)
+    return node->priv->first_child;
+
+  return _sopa_node_skip_subtree (node, root);
+}
+
+/*< private >
+ * _sopa_node_skip_subtree:
+ * @node: a #SopaNode
+ * @root: the #SopaNode where the walk started
+ *
+ * Like _sopa_node_next_in_tree(), but does not descend into the
+ * children of @node.
+ *
+ * Return value: the next #SopaNode, or %NULL at the end of the walk
+ */
+SopaNode *
+_sopa_node_skip_subtree (SopaNode *node,
+                         SopaNode *root)
+{
+  while (node != NULL && node != root)
+    {
+      if (node->priv->next_sibling != NULL)
+        return node->priv->next_sibling;
 
-  if (child->priv->next_sibling == NULL)
-    self->priv->last_child = child;
-}
+      node = node->priv->parent;
+    }
 
-typedef void (* SopaNodeAddChildFunc) (SopaNode     *parent,
-                                       SopaNode     *child,
-                                       gpointer      data);
+  return NULL;
+}
 
 /*< private >
- * sopa_node_add_child_internal:
- * @self: a #SopaNode
- * @child: a #SopaNode
- * @add_func: delegate function
- * @data: (closure): data to pass to @add_func
+ * _sopa_node_compare_order:
+ * @a: a #SopaNode
+ * @b: a #SopaNode
  *
- * Adds @child to the list of children of @self.
+ * Compares the position of two nodes in document order. Nodes in
+ * different trees are ordered by address, so that sorting is stable.
  *
- * The actual insertion inside the list is delegated to @add_func: this
- * function will just set up the state, perform basic checks, and emit
- * signals.
+ * Return value: a negative value if @a comes before @b, a positive
+ *      value if it comes after, and 0 if they are the same node
+ */
+gint
+_sopa_node_compare_order (SopaNode *a,
+                          SopaNode *b)
+{
+  if (a == b)
+    return 0;
+
+  if (!sopa_node_ensure_order (a, b))
+    return a < b ? -1 : 1;
+
+  return a->priv->pre_index < b->priv->pre_index ? -1 : 1;
+}
+
+/* easy way to have properly named fields instead of the dummy ones
+ * we use in the public structure
  */
+typedef struct _RealNodeIter
+{
+  SopaNode *root;               /* dummy1 */
+  SopaNode *current;            /* dummy2 */
+  gpointer padding_1;           /* dummy3 */
+  gint age;                     /* dummy4 */
+  gpointer padding_2;           /* dummy5 */
+} RealNodeIter;
+
+typedef struct
+{
+  /* %NULL while measuring */
+  gchar    *out;
+
+  /* the number of bytes that fit in @out, without the nul */
+  gsize     size;
+
+  /* the length of the text, even past @size */
+  gsize     len;
+
+  gboolean  inner;
+  gboolean  pending_space;
+} TextBuilder;
+
 static inline void
-sopa_node_add_child_internal (SopaNode              *self,
-                              SopaNode              *child,
-                              SopaNodeAddChildFunc   add_func,
-                              gpointer               data)
+text_builder_append (TextBuilder *builder,
+                     const gchar *str,
+                     gsize        len)
 {
-  SopaNode *old_first_child, *old_last_child;
-  GObject *obj;
+  if (builder->len < builder->size)
+    memcpy (builder->out + builder->len,
+            str,
+            MIN (len, builder->size - builder->len));
 
-  if (child->priv->parent != NULL)
+  builder->len += len;
+}
+
+static inline gboolean
+is_html_space (gchar c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+/* appends @str with its runs of white space collapsed, dropping the
+ * white space at the start and at the end of the whole text
+ */
+static void
+text_builder_append_collapsed (TextBuilder *builder,
+                               const gchar *str)
+{
+  const gchar *run;
+
+  while (*str != '\0')
     {
-      g_warning ("The node '%s' already has a parent, '%s'. You must "
-                 "use sopa_node_remove_child() first.",
-                 _sopa_node_get_debug_name (child),
-                 _sopa_node_get_debug_name (child->priv->parent));
-      return;
+      if (is_html_space (*str))
+        {
+          builder->pending_space = builder->len > 0;
+
+          do
+            str++;
+          while (is_html_space (*str));
+
+          continue;
+        }
+
+      if (builder->pending_space)
+        {
+          text_builder_append (builder, " ", 1);
+          builder->pending_space = FALSE;
+        }
+
+      run = str;
+      do
+        str++;
+      while (*str != '\0' && !is_html_space (*str));
+
+      text_builder_append (builder, run, str - run);
     }
+}
 
-  if (child->priv->in_destruction)
+static gboolean
+is_hidden_element (SopaNode *node)
+{
+  const gchar *tag;
+
+  if (!SOPA_IS_ELEMENT (node))
+    return FALSE;
+
+  tag = sopa_element_get_tag (SOPA_ELEMENT (node));
+
+  return tag != NULL &&
+         (g_ascii_strcasecmp (tag, "script") == 0 ||
+          g_ascii_strcasecmp (tag, "style") == 0);
+}
+
+static void
+text_builder_collect (TextBuilder *builder,
+                      SopaNode    *root)
+{
+  SopaNode *node = root;
+
+  while (node != NULL)
     {
-      g_warning ("The node '%s' is currently being destroyed, and "
-                 "cannot be added as a child of another node.",
-                 _sopa_node_get_debug_name (child));
+      if (SOPA_IS_TEXT (node))
+        {
+          const gchar *content = sopa_text_get_content (SOPA_TEXT (node));
 
-      return;
+          if (content == NULL)
+            ;
+          else if (builder->inner)
+            text_builder_append_collapsed (builder, content);
+          else
+            text_builder_append (builder, content, strlen (content));
+
+          node = _sopa_node_skip_subtree (node, root);
+        }
+      else if (builder->inner && is_hidden_element (node))
+        node = _sopa_node_skip_subtree (node, root);
+      else
+        node = _sopa_node_next_in_tree (node, root);
     }
+}
 
-  old_first_child = self->priv->first_child;
-  old_last_child = self->priv->last_child;
+/* writes the text of @root into @buffer, if not %NULL, and returns its
+ * full length; the result is truncated to fit in @buffer_size bytes
+ */
+static gsize
+sopa_node_extract_text (SopaNode *root,
+                        gboolean  inner,
+                        gchar    *buffer,
+                        gsize     buffer_size)
+{
+  TextBuilder builder = { NULL, 0, 0, inner, FALSE };
 
-  obj = G_OBJECT (self);
-  g_object_freeze_notify (obj);
+  if (buffer != NULL && buffer_size > 0)
+    {
+      builder.out = buffer;
+      builder.size = buffer_size - 1;
+    }
 
-  g_object_ref_sink (child);
-  child->priv->parent = NULL;
-  child->priv->next_sibling = NULL;
-  child->priv->prev_sibling = NULL;
+  text_builder_collect (&builder, root);
 
-  /* delegate the actual insertion */
-  add_func (self, child, data);
+  if (builder.out != NULL)
+    builder.out[MIN (builder.len, builder.size)] = '\0';
 
-  g_assert (child->priv->parent == self);
+  return builder.len;
+}
 
-  self->priv->n_children += 1;
+static gchar *
+sopa_node_dup_text (SopaNode *root,
+                    gboolean  inner,
+                    gsize    *length)
+{
+  gchar *retval;
+  gsize len;
 
-  self->priv->age += 1;
+  len = sopa_node_extract_text (root, inner, NULL, 0);
 
-  //g_signal_emit_by_name (self, "node-added", child);
+  retval = g_malloc (len + 1);
+  sopa_node_extract_text (root, inner, retval, len + 1);
 
-  if (old_first_child != self->priv->first_child)
-    g_object_notify_by_pspec (obj, obj_props[PROP_FIRST_CHILD]);
+  if (length != NULL)
+    *length = len;
+
+  return retval;
+}
 
-  if (old_last_child != self->priv->last_child)
-    g_object_notify_by_pspec (obj, obj_props[PROP_LAST_CHILD]);
+/**
+ * sopa_node_get_text_content:
+ * @self: a #SopaNode
+ * @length: (out) (allow-none): return location for the length of the
+ *      text, or %NULL
+ *
+ * Retrieves the content of the #SopaText nodes of the sub-tree rooted
+ * in @self, concatenated in document order.
+ *
+ * The length of the text is computed first, so that it is copied into
+ * a single allocation.
+ *
+ * Return value: (transfer full): a newly allocated string, free it
+ *      with g_free()
+ *
+ * Since: 0.2
+ */
+gchar *
+sopa_node_get_text_content (SopaNode *self,
+                            gsize    *length)
+{
+  g_return_val_if_fail (SOPA_IS_NODE (self), NULL);
 
-  g_object_thaw_notify (obj);
+  return sopa_node_dup_text (self, FALSE, length);
 }
 
 /**
- * sopa_node_add_child:
+ * sopa_node_get_inner_text:
  * @self: a #SopaNode
- * @child: a #SopaNode
+ * @length: (out) (allow-none): return location for the length of the
+ *      text, or %NULL
  *
- * Adds @child to the children of @self.
+ * Like sopa_node_get_text_content(), but leaves out the content of
+ * &lt;script&gt; and &lt;style&gt; elements, collapses each run of
+ * white space into a single space and drops the white space at both
+ * ends, which is the text as a reader would see it.
  *
- * This function will acquire a reference on @child that will only
- * be released when calling sopa_node_remove_child().
+ * Return value: (transfer full): a newly allocated string, free it
+ *      with g_free()
+ *
+ * Since: 0.2
+ */
+gchar *
+sopa_node_get_inner_text (SopaNode *self,
+                          gsize    *length)
+{
+  g_return_val_if_fail (SOPA_IS_NODE (self), NULL);
+
+  return sopa_node_dup_text (self, TRUE, length);
+}
+
+/**
+ * sopa_node_copy_text_content:
+ * @self: a #SopaNode
+ * @buffer: (array length=buffer_size) (allow-none): the buffer to
+ *      write the text to, or %NULL
+ * @buffer_size: the size of @buffer, in bytes
+ *
+ * Writes the text sopa_node_get_text_content() returns to @buffer,
+ * in a single walk of the sub-tree. At most @buffer_size - 1 bytes
+ * are written, followed by a nul byte, in the same way as
+ * g_strlcpy(); a truncated text may end in the middle of a character.
+ *
+ * Return value: the length of the whole text; if it is not less than
+ *      @buffer_size, the text was truncated
+ *
+ * Since: 0.2
+ */
+gsize
+sopa_node_copy_text_content (SopaNode *self,
+                             gchar    *buffer,
+                             gsize     buffer_size)
+{
+  g_return_val_if_fail (SOPA_IS_NODE (self), 0);
+
+  return sopa_node_extract_text (self, FALSE, buffer, buffer_size);
+}
+
+/**
+ * sopa_node_copy_inner_text:
+ * @self: a #SopaNode
+ * @buffer: (array length=buffer_size) (allow-none): the buffer to
+ *      write the text to, or %NULL
+ * @buffer_size: the size of @buffer, in bytes
+ *
+ * Writes the text sopa_node_get_inner_text() returns to @buffer; see
+ * sopa_node_copy_text_content().
+ *
+ * Return value: the length of the whole text; if it is not less than
+ *      @buffer_size, the text was truncated
+ *
+ * Since: 0.2
+ */
+gsize
+sopa_node_copy_inner_text (SopaNode *self,
+                           gchar    *buffer,
+                           gsize     buffer_size)
+{
+  g_return_val_if_fail (SOPA_IS_NODE (self), 0);
+
+  return sopa_node_extract_text (self, TRUE, buffer, buffer_size);
+}
+
+#define HASH_PRIME G_GUINT64_CONSTANT (0x100000001b3)
+
+/* order dependent, so that swapped children hash differently */
+static inline guint64
+hash_combine (guint64 hash,
+              guint64 value)
+{
+  hash = ((hash << 5) | (hash >> 59)) ^ _sopa_hash_mix (value);
+
+  return hash * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15);
+}
+
+/* FNV-1a, with the length so that adjacent strings do not run into
+ * each other
+ */
+static guint64
+hash_string (guint64      hash,
+             const gchar *str)
+{
+  guint64 value = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+  gsize len = 0;
+
+  if (str != NULL)
+    {
+      for (; str[len] != '\0'; len++)
+        {
+          value ^= (guchar) str[len];
+          value *= HASH_PRIME;
+        }
+    }
+
+  return hash_combine (hash_combine (hash, value), len);
+}
+
+/* the hash of @node, from its own data and the hashes of its
+ * children, which must be valid
+ */
+static guint64
+sopa_node_compute_hash (SopaNode *node)
+{
+  SopaNode *child;
+  guint64 hash;
+
+  /* type names, unlike types, are the same in every process */
+  hash = hash_string (0, G_OBJECT_TYPE_NAME (node));
+
+  if (SOPA_IS_ELEMENT (node))
+    {
+      const SopaElementAttribute *attributes;
+      guint n_attributes, i;
+
+      hash = hash_string (hash, sopa_element_get_tag (SOPA_ELEMENT (node)));
+
+      attributes = _sopa_element_get_attributes (SOPA_ELEMENT (node),
+                                                 &n_attributes);
+      hash = hash_combine (hash, n_attributes);
+      for (i = 0; i < n_attributes; i++)
+        {
+          hash = hash_string (hash, attributes[i].name);
+          hash = hash_string (hash, attributes[i].value);
+        }
+    }
+  else if (SOPA_IS_TEXT (node))
+    hash = hash_string (hash, sopa_text_get_content (SOPA_TEXT (node)));
+
+  hash = hash_combine (hash, node->priv->n_children);
+  for (child = node->priv->first_child;
+       child != NULL;
+       child = child->priv->next_sibling)
+    hash = hash_combine (hash, child->priv->hash);
+
+  return hash;
+}
+
+static inline SopaNode *
+first_unhashed_sibling (SopaNode *node)
+{
+  while (node != NULL && g_atomic_int_get (&node->priv->hash_valid))
+    node = node->priv->next_sibling;
+
+  return node;
+}
+
+/**
+ * sopa_node_get_hash:
+ * @self: a #SopaNode
+ *
+ * Retrieves a 64 bit structural hash of @self and its descendants,
+ * computed over the type of each node, the tags and the attributes,
+ * in order, of elements, the content of text nodes, and the hashes of
+ * the children, in order.
+ *
+ * Identical sub-trees have the same hash, wherever they are and in
+ * every process, so hashes can be stored to find repeated blocks
+ * across documents. Hashes are computed on demand and kept until the
+ * sub-tree changes, so asking again for the hash of an unchanged
+ * sub-tree, or for the one of its parent, does not hash it again.
+ *
+ * Return value: the hash of @self
+ *
+ * Since: 0.2
+ */
+guint64
+sopa_node_get_hash (SopaNode *self)
+{
+  SopaNode *node, *child;
+
+  g_return_val_if_fail (SOPA_IS_NODE (self), 0);
+
+  /* post-order, without recursion; children only get a hash after
+   * all theirs, so a parent is hashed when none is left to do
+   */
+  node = self;
+  while (!g_atomic_int_get (&self->priv->hash_valid))
+    {
+      child = first_unhashed_sibling (node->priv->first_child);
+      if (child != NULL)
+        {
+          node = child;
+          continue;
+        }
+
+      node->priv->hash = sopa_node_compute_hash (node);
+      g_atomic_int_set (&node->priv->hash_valid, TRUE);
+
+      if (node != self)
+        {
+          child = first_unhashed_sibling (node->priv->next_sibling);
+          node = child != NULL ? child : node->priv->parent;
+        }
+    }
+
+  return self->priv->hash;
+}
+
+/* whether @a and @b have the same data, leaving out their children */
+static gboolean
+sopa_node_equal_data (SopaNode *a,
+                      SopaNode *b)
+{
+  if (G_OBJECT_TYPE (a) != G_OBJECT_TYPE (b) ||
+      a->priv->n_children != b->priv->n_children)
+    return FALSE;
+
+  if (SOPA_IS_ELEMENT (a))
+    {
+      const SopaElementAttribute *attributes_a, *attributes_b;
+      guint n_attributes_a, n_attributes_b, i;
+
+      if (g_strcmp0 (sopa_element_get_tag (SOPA_ELEMENT (a)),
+                     sopa_element_get_tag (SOPA_ELEMENT (b))) != 0)
+        return FALSE;
+
+      attributes_a = _sopa_element_get_attributes (SOPA_ELEMENT (a),
+                                                   &n_attributes_a);
+      attributes_b = _sopa_element_get_attributes (SOPA_ELEMENT (b),
+                                                   &n_attributes_b);
+      if (n_attributes_a != n_attributes_b)
+        return FALSE;
+
+      for (i = 0; i < n_attributes_a; i++)
+        {
+          if (g_strcmp0 (attributes_a[i].name, attributes_b[i].name) != 0 ||
+              g_strcmp0 (attributes_a[i].value, attributes_b[i].value) != 0)
+            return FALSE;
+        }
+    }
+  else if (SOPA_IS_TEXT (a))
+    {
+      if (g_strcmp0 (sopa_text_get_content (SOPA_TEXT (a)),
+                     sopa_text_get_content (SOPA_TEXT (b))) != 0)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * sopa_node_equal:
+ * @a: a #SopaNode
+ * @b: a #SopaNode
  *
+ * Checks whether @a and @b are structurally equal: they have the same
+ * type and data, as hashed by sopa_node_get_hash(), and their children
+ * are equal, in the same order.
+ *
+ * The hashes of @a and @b are compared first, so that different
+ * sub-trees are told apart without walking them. When the hashes are
+ * equal the sub-trees are walked anyway, so that a collision never
+ * makes them equal.
+ *
+ * Return value: %TRUE if @a and @b are equal
+ *
+ * Since: 0.2
+ */
+gboolean
+sopa_node_equal (SopaNode *a,
+                 SopaNode *b)
+{
+  SopaNode *node_a, *node_b;
+
+  g_return_val_if_fail (SOPA_IS_NODE (a), FALSE);
+  g_return_val_if_fail (SOPA_IS_NODE (b), FALSE);
+
+  if (a == b)
+    return TRUE;
+
+  if (sopa_node_get_hash (a) != sopa_node_get_hash (b))
+    return FALSE;
+
+  /* with the same number of children everywhere, equal pre-orders
+   * are equal trees
+   */
+  for (node_a = a, node_b = b;
+       node_a != NULL && node_b != NULL;
+       node_a = _sopa_node_next_in_tree (node_a, a),
+       node_b = _sopa_node_next_in_tree (node_b, b))
+    {
+      if (!sopa_node_equal_data (node_a, node_b))
+        return FALSE;
+    }
+
+  return node_a == node_b;
+}
+
+/* the source map of the document of @self, if neither @self nor any
+ * of its ancestors changed since the document was parsed
+ */
+static SopaSourceMap *
+sopa_node_get_source_map (SopaNode *self)
+{
+  SopaNode *node;
+
+  for (node = self; node->priv->parent != NULL; node = node->priv->parent)
+    {
+      if (!node->priv->serial.parsed)
+        return NULL;
+    }
+
+  if (!node->priv->serial.parsed || !SOPA_IS_DOCUMENT (node))
+    return NULL;
+
+  return _sopa_document_get_source_map (SOPA_DOCUMENT (node));
+}
+
+/* copies the markup of the siblings from @first to @last from the
+ * source of their document, if they did not change since parsed
  */
-void
-sopa_node_add_child (SopaNode *self,
-                     SopaNode *child)
+static gchar *
+sopa_node_copy_source (SopaNode *first,
+                       SopaNode *last,
+                       gsize    *length)
 {
-  g_return_if_fail (SOPA_IS_NODE (self));
-  g_return_if_fail (SOPA_IS_NODE (child));
-  g_return_if_fail (self != child);
-  g_return_if_fail (child->priv->parent == NULL);
+  SopaSourceMap *map;
+  const gchar *data;
+  gsize start, end;
 
-  sopa_node_add_child_internal (self,
-                                child,
-                                insert_child_at_index,
-                                GINT_TO_POINTER (-1));
+  /* a change to any of the siblings clears their parent */
+  map = sopa_node_get_source_map (first);
+  if (map == NULL ||
+      !last->priv->serial.parsed ||
+      !_sopa_source_map_lookup (map, first, &start, NULL) ||
+      !_sopa_source_map_lookup (map, last, NULL, &end))
+    return NULL;
+
+  data = g_bytes_get_data (_sopa_source_map_get_source (map), NULL);
+
+  if (length != NULL)
+    *length = end - start;
+
+  return g_strndup (data + start, end - start);
 }
 
-/**
- * sopa_node_insert_child_at_index:
- * @self: a #SopaNode
- * @child: a #SopaNode
- * @index_: the index
- *
- * Inserts @child into the list of children of @self, using the
- * given @index_. If @index_ is greater than the number of children
- * in @self, or is less than 0, then the new child is added at the end.
+/*< private >
+ * _sopa_node_clone_shallow:
+ * @node: a #SopaNode
+ * @share: whether the copy shares the data of @node
  *
- * This function will acquire a reference on @child that will only
- * be released when calling sopa_node_remove_child().
+ * Copies @node without its children, for building a copy of its
+ * sub-tree with _sopa_node_link_child(); the copy keeps the hash and
+ * the serialization state of @node, which hold for such a copy.
  *
+ * Return value: (transfer floating): the copy
  */
-void
-sopa_node_insert_child_at_index (SopaNode *self,
-                                 SopaNode *child,
-                                 gint index_)
+SopaNode *
+_sopa_node_clone_shallow (SopaNode *node,
+                          gboolean  share)
 {
-  g_return_if_fail (SOPA_IS_NODE (self));
-  g_return_if_fail (SOPA_IS_NODE (child));
-  g_return_if_fail (self != child);
-  g_return_if_fail (child->priv->parent == NULL);
+  SopaNode *copy;
 
-  sopa_node_add_child_internal (self, child,
-                                insert_child_at_index,
-                                GINT_TO_POINTER (index_));
+  copy = g_object_new (G_OBJECT_TYPE (node), NULL);
+
+  if (SOPA_IS_ELEMENT (node))
+    {
+      _sopa_element_copy_data (SOPA_ELEMENT (copy), SOPA_ELEMENT (node),
+                               share);
+
+      if (SOPA_IS_DOCUMENT (node))
+        _sopa_document_copy_settings (SOPA_DOCUMENT (copy),
+                                      SOPA_DOCUMENT (node));
+    }
+  else if (SOPA_IS_TEXT (node))
+    _sopa_text_copy_data (SOPA_TEXT (copy), SOPA_TEXT (node), share);
+
+  if (g_atomic_int_get (&node->priv->hash_valid))
+    {
+      copy->priv->hash = node->priv->hash;
+      copy->priv->hash_valid = TRUE;
+    }
+
+  copy->priv->serial = node->priv->serial;
+  copy->priv->serial.parsed = FALSE;
+  if (copy->priv->serial.bytes != NULL)
+    g_bytes_ref (copy->priv->serial.bytes);
+
+  return copy;
 }
 
-/**
- * sopa_node_insert_child_above:
- * @self: a #SopaNode
- * @child: a #SopaNode
- * @sibling: (allow-none): a child of @self, or %NULL
- *
- * Inserts @child into the list of children of @self, above another
- * child of @self or, if @sibling is %NULL, above all the children
- * of @self.
- *
- * This function will acquire a reference on @child that will only
- * be released when calling sopa_node_remove_child().
+/*< private >
+ * _sopa_node_link_child:
+ * @parent: a #SopaNode
+ * @child: a #SopaNode without a parent
  *
+ * Appends @child to @parent, which is still being built and so has
+ * neither observers nor notification handlers to tell, and whose
+ * hash and markup must stay as they were copied.
  */
 void
-sopa_node_insert_child_above (SopaNode *self,
-                              SopaNode *child,
-                              SopaNode *sibling)
+_sopa_node_link_child (SopaNode *parent,
+                       SopaNode *child)
 {
-  g_return_if_fail (SOPA_IS_NODE (self));
-  g_return_if_fail (SOPA_IS_NODE (child));
-  g_return_if_fail (self != child);
-  g_return_if_fail (child != sibling);
-  g_return_if_fail (child->priv->parent == NULL);
-  g_return_if_fail (sibling == NULL ||
-                    (SOPA_IS_NODE (sibling) &&
-                     sibling->priv->parent == self));
+  g_object_ref_sink (child);
 
-  sopa_node_add_child_internal (self, child,
-                                insert_child_above,
-                                sibling);
+  child->priv->parent = parent;
+  child->priv->prev_sibling = parent->priv->last_child;
+
+  if (parent->priv->last_child != NULL)
+    parent->priv->last_child->priv->next_sibling = child;
+  else
+    parent->priv->first_child = child;
+
+  parent->priv->last_child = child;
+  parent->priv->n_children += 1;
 }
 
 /**
- * sopa_node_insert_child_below:
+ * sopa_node_clone:
  * @self: a #SopaNode
- * @child: a #SopaNode
- * @sibling: (allow-none): a child of @self, or %NULL
+ * @mode: how the data of the nodes is copied
  *
- * Inserts @child into the list of children of @self, below another
- * child of @self or, if @sibling is %NULL, below all the children
- * of @self.
+ * Copies @self and its descendants into a new tree. Cloning a
+ * #SopaDocument gives a #SopaDocument.
  *
- * This function will acquire a reference on @child that will only
- * be released when calling sopa_node_remove_child().
+ * With %SOPA_NODE_CLONE_COPY_ON_WRITE, the clone shares the tags,
+ * attributes and text contents of @self, and either tree copies them
+ * only when it changes them, so the clone costs little more than its
+ * nodes. The clone also starts with the structural hashes and the
+ * last serialization of @self, so comparing the trees or serializing
+ * the clone before it changes does not walk it again.
+ *
+ * Return value: (transfer floating): the root of the new tree
  *
+ * Since: 0.2
  */
-void
-sopa_node_insert_child_below (SopaNode *self,
-                              SopaNode *child,
-                              SopaNode *sibling)
+SopaNode *
+sopa_node_clone (SopaNode          *self,
+                 SopaNodeCloneMode  mode)
 {
-  g_return_if_fail (SOPA_IS_NODE (self));
-  g_return_if_fail (SOPA_IS_NODE (child));
-  g_return_if_fail (self != child);
-  g_return_if_fail (child != sibling);
-  g_return_if_fail (child->priv->parent == NULL);
-  g_return_if_fail (sibling == NULL ||
-                    (SOPA_IS_NODE (sibling) &&
-                     sibling->priv->parent == self));
+  SopaNode *node, *copy, *copy_root, *child, *root;
+  gboolean share;
 
-  sopa_node_add_child_internal (self, child,
-                                insert_child_below,
-                                sibling);
+  g_return_val_if_fail (SOPA_IS_NODE (self), NULL);
+
+  share = mode == SOPA_NODE_CLONE_COPY_ON_WRITE;
+
+  /* the markup kept on the tree is copied along */
+  root = sopa_node_get_root (self);
+  _sopa_node_lock_serial (root);
+
+  copy_root = _sopa_node_clone_shallow (self, share);
+
+  /* a copy out of its tree is not cached within another markup */
+  copy_root->priv->serial.cached = FALSE;
+
+  node = self;
+  copy = copy_root;
+
+  for (;;)
+    {
+      if (node->priv->first_child != NULL)
+        {
+          node = node->priv->first_child;
+        }
+      else
+        {
+          /* leave the node, and every ancestor whose last child it is */
+          while (node != self && node->priv->next_sibling == NULL)
+            {
+              node = node->priv->parent;
+              copy = copy->priv->parent;
+            }
+
+          if (node == self)
+            break;
+
+          node = node->priv->next_sibling;
+          copy = copy->priv->parent;
+        }
+
+      child = _sopa_node_clone_shallow (node, share);
+      _sopa_node_link_child (copy, child);
+      copy = child;
+    }
+
+  _sopa_node_unlock_serial (root);
+
+  return copy_root;
 }
 
 /**
- * sopa_node_remove_child:
+ * sopa_node_get_source_range:
  * @self: a #SopaNode
- * @child: a #SopaNode
+ * @start: (out) (allow-none): return location for the offset of the
+ *      first byte of the markup of @self, or %NULL
+ * @end: (out) (allow-none): return location for the offset right
+ *      after the last byte of the markup of @self, or %NULL
  *
- * Removes @child from the children of @self.
+ * Retrieves where the markup of @self is in the text its document was
+ * parsed from, as returned by sopa_document_get_source().
  *
- * This function will release the reference added by
- * sopa_node_add_child(), so if you want to keep using @child
- * you will have to acquire a referenced on it before calling this
- * function.
+ * Offsets are only known for documents parsed with the
+ * #SopaParser:track-offsets property set, and only as long as neither
+ * @self nor any of its descendants is changed. Nodes only have the
+ * range of their own markup: for elements it goes from the start tag
+ * to the end tag, for text nodes it covers the text as written, with
+ * its entities.
+ *
+ * Return value: %TRUE if the range of @self is known
  *
+ * Since: 0.2
  */
-void
-sopa_node_remove_child (SopaNode *self,
-                        SopaNode *child)
+gboolean
+sopa_node_get_source_range (SopaNode *self,
+                            gsize    *start,
+                            gsize    *end)
 {
-  g_return_if_fail (SOPA_IS_NODE (self));
-  g_return_if_fail (SOPA_IS_NODE (child));
-  g_return_if_fail (self != child);
-  g_return_if_fail (child->priv->parent == NULL);
-  g_return_if_fail (child->priv->parent == self);
+  SopaSourceMap *map;
 
-  sopa_node_remove_child_internal (self, child);
+  g_return_val_if_fail (SOPA_IS_NODE (self), FALSE);
+
+  map = sopa_node_get_source_map (self);
+
+  return map != NULL && _sopa_source_map_lookup (map, self, start, end);
 }
 
 /**
- * sopa_node_remove_all_children:
+ * sopa_node_get_source_position:
  * @self: a #SopaNode
+ * @line: (out) (allow-none): return location for the line, or %NULL
+ * @column: (out) (allow-none): return location for the column, or %NULL
  *
- * Removes all children of @self.
+ * Retrieves the line and the column where the markup of @self starts
+ * in the text its document was parsed from, both counted from 1; the
+ * column counts characters, not bytes. See
+ * sopa_node_get_source_range().
  *
- * This function releases the reference added by inserting a child actor
- * in the list of children of @self.
+ * Lines are indexed the first time a position is asked for, so that
+ * documents which never need them do not pay for them.
  *
- * If the reference count of a child drops to zero, the child will be
- * destroyed. If you want to ensure the destruction of all the children
- * of @self, use sopa_node_destroy_all_children().
+ * Return value: %TRUE if the position of @self is known
  *
+ * Since: 0.2
  */
-void
-sopa_node_remove_all_children (SopaNode *self)
+gboolean
+sopa_node_get_source_position (SopaNode *self,
+                               guint    *line,
+                               guint    *column)
 {
-  SopaNodeIter iter;
-
-  g_return_if_fail (SOPA_IS_NODE (self));
-
-  if (self->priv->n_children == 0)
-    return;
+  SopaSourceMap *map;
+  gsize start;
 
-  g_object_freeze_notify (G_OBJECT (self));
+  g_return_val_if_fail (SOPA_IS_NODE (self), FALSE);
 
-  sopa_node_iter_init (&iter, self);
-  while (sopa_node_iter_next (&iter, NULL))
-    sopa_node_iter_remove (&iter);
+  map = sopa_node_get_source_map (self);
+  if (map == NULL || !_sopa_source_map_lookup (map, self, &start, NULL))
+    return FALSE;
 
-  g_object_thaw_notify (G_OBJECT (self));
+  _sopa_source_map_get_position (map, start, line, column);
 
-  /* sanity check */
-  g_assert (self->priv->first_child == NULL);
-  g_assert (self->priv->last_child == NULL);
-  g_assert (self->priv->n_children == 0);
+  return TRUE;
 }
 
 /**
- * sopa_node_destroy_all_children:
- * @self: a #SopaNode
- *
- * Destroys all children of @self.
- *
- * This function releases the reference added by inserting a child
- * node in the list of children of @self, and ensures that the
- * #SopaNode::destroy signal is emitted on each child of the
- * node.
- *
- * By default, #SopaNode will emit the #SopaNode::destroy signal
- * when its reference count drops to 0; the default handler of the
- * #SopaNode::destroy signal will destroy all the children of an
- * node. This function ensures that all children are destroyed, instead
- * of just removed from @self, unlike sopa_node_remove_all_children()
- * which will merely release the reference and remove each child.
- *
- * Unless you acquired an additional reference on each child of @self
- * prior to calling sopa_node_remove_all_children() and want to reuse
- * the actors, you should use sopa_node_destroy_all_children() in
- * order to make sure that children are destroyed and signal handlers
- * are disconnected even in cases where circular references prevent this
- * from automatically happening through reference counting alone.
- *
+ * sopa_node_serialize_range:
+ * @first: a #SopaNode
+ * @last: a sibling of @first that follows it, or @first itself
+ * @options: (allow-none): a #SopaSerializeOptions, or %NULL for the
+ *      pretty layout with the default indent width
+ * @length: (out) (allow-none): return location for the length of the
+ *      string, or %NULL
+ *
+ * Serializes the siblings from @first to @last, and their descendants,
+ * as if they were the only children of an element passed to
+ * sopa_element_serialize(); the tree is not changed.
+ *
+ * In the minified and faithful layouts, when none of the nodes changed
+ * since the root of their tree was last serialized in the same layout,
+ * their markup is copied from that serialization instead of being
+ * written again. In the faithful layout, when none of them changed
+ * since their document was parsed with the #SopaParser:track-offsets
+ * property set, their markup is copied from the source instead, with
+ * whatever was written between them, like comments.
+ *
+ * Return value: (transfer full): a newly allocated string, free it
+ *      with g_free(), or %NULL if @last does not follow @first
+ *
+ * Since: 0.2
  */
-void
-sopa_node_destroy_all_children (SopaNode *self)
+gchar *
+sopa_node_serialize_range (SopaNode                   *first,
+                           SopaNode                   *last,
+                           const SopaSerializeOptions *options,
+                           gsize                      *length)
 {
-  SopaNodeIter iter;
+  SopaSerializeMode mode = SOPA_SERIALIZE_MODE_PRETTY;
+  guint indent_width = 2;
+  guint n_siblings;
+  SopaNode *node;
 
-  g_return_if_fail (SOPA_IS_NODE (self));
+  g_return_val_if_fail (SOPA_IS_NODE (first), NULL);
+  g_return_val_if_fail (SOPA_IS_NODE (last), NULL);
 
-  if (self->priv->n_children == 0)
-    return;
+  n_siblings = 1;
+  for (node = first; node != last; node = node->priv->next_sibling)
+    {
+      if (node->priv->next_sibling == NULL)
+        {
+          g_critical ("The node '%s' is not a following sibling of '%s'.",
+                      _sopa_node_get_debug_name (last),
+                      _sopa_node_get_debug_name (first));
+          return NULL;
+        }
 
-  g_object_freeze_notify (G_OBJECT (self));
+      n_siblings += 1;
+    }
 
-  sopa_node_iter_init (&iter, self);
-  while (sopa_node_iter_next (&iter, NULL))
-    sopa_node_iter_destroy (&iter);
+  if (options != NULL)
+    {
+      mode = sopa_serialize_options_get_mode (options);
+      indent_width = sopa_serialize_options_get_indent_width (options);
+    }
 
-  g_object_thaw_notify (G_OBJECT (self));
+  if (mode == SOPA_SERIALIZE_MODE_FAITHFUL)
+    {
+      gchar *source;
 
-  /* sanity check */
-  g_assert (self->priv->first_child == NULL);
-  g_assert (self->priv->last_child == NULL);
-  g_assert (self->priv->n_children == 0);
+      source = sopa_node_copy_source (first, last, length);
+      if (source != NULL)
+        return source;
+    }
+
+  return _sopa_writer_range_to_string (first, last, n_siblings,
+                                       mode, indent_width,
+                                       length);
 }
 
 /**
- * sopa_node_get_n_children:
+ * sopa_node_get_outer_html:
  * @self: a #SopaNode
+ * @length: (out) (allow-none): return location for the length of the
+ *      string, or %NULL
  *
- * Retrieves the number of children of @self
- *
- * Return value: number of children of a node
- */
-gint
-sopa_node_get_n_children (SopaNode *self)
-{
-  g_return_val_if_fail (SOPA_IS_NODE (self), 0);
-
-  return self->priv->n_children;
-}
-
-/**
- * sopa_node_get_parent:
- * @self: A #SopaNode
+ * Serializes @self and its descendants in the faithful layout, which
+ * is the markup of the node as it appears in the document; see
+ * sopa_node_serialize_range(). When @self did not change since it was
+ * parsed with the #SopaParser:track-offsets property set, this is a
+ * copy of its markup in the source.
  *
- * Retrieves the parent of @self.
+ * Return value: (transfer full): a newly allocated string, free it
+ *      with g_free()
  *
- * Return Value: (transfer none): The #SopaNode parent, or %NULL
- *  if no parent is set
+ * Since: 0.2
  */
-SopaNode *
-sopa_node_get_parent (SopaNode *self)
+gchar *
+sopa_node_get_outer_html (SopaNode *self,
+                          gsize    *length)
 {
+  gchar *source;
+
   g_return_val_if_fail (SOPA_IS_NODE (self), NULL);
 
-  return self->priv->parent;
-}
+  source = sopa_node_copy_source (self, self, length);
+  if (source != NULL)
+    return source;
 
-/* easy way to have properly named fields instead of the dummy ones
- * we use in the public structure
- */
-typedef struct _RealNodeIter
-{
-  SopaNode *root;               /* dummy1 */
-  SopaNode *current;            /* dummy2 */
-  gpointer padding_1;           /* dummy3 */
-  gint age;                     /* dummy4 */
-  gpointer padding_2;           /* dummy5 */
-} RealNodeIter;
+  return _sopa_writer_range_to_string (self, self, 1,
+                                       SOPA_SERIALIZE_MODE_FAITHFUL, 0,
+                                       length);
+}
 
 /**
  * sopa_node_iter_init:
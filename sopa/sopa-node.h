@@ -28,7 +28,9 @@
 #define __SOPA_NODE_H__
 
 #include <glib-object.h>
+#include <sopa/sopa-enum-types.h>
 #include <sopa/sopa-macros.h>
+#include <sopa/sopa-serialize-options.h>
 
 G_BEGIN_DECLS
 
@@ -60,6 +62,41 @@ typedef struct _SopaNodePrivate SopaNodePrivate;
 
 typedef struct _SopaNodeIter SopaNodeIter;
 
+/**
+ * SopaNodePosition:
+ * @SOPA_NODE_POSITION_DISCONNECTED: the nodes are in different trees
+ * @SOPA_NODE_POSITION_PRECEDING: the other node comes before
+ * @SOPA_NODE_POSITION_FOLLOWING: the other node comes after
+ * @SOPA_NODE_POSITION_CONTAINS: the other node is an ancestor
+ * @SOPA_NODE_POSITION_CONTAINED_BY: the other node is a descendant
+ *
+ * Flags returned by sopa_node_compare_document_position().
+ *
+ * Since: 0.2
+ */
+typedef enum { /*< flags >*/
+  SOPA_NODE_POSITION_DISCONNECTED = 1 << 0,
+  SOPA_NODE_POSITION_PRECEDING    = 1 << 1,
+  SOPA_NODE_POSITION_FOLLOWING    = 1 << 2,
+  SOPA_NODE_POSITION_CONTAINS     = 1 << 3,
+  SOPA_NODE_POSITION_CONTAINED_BY = 1 << 4
+} SopaNodePosition;
+
+/**
+ * SopaNodeCloneMode:
+ * @SOPA_NODE_CLONE_DEEP: the clone gets its own copy of all the data
+ * @SOPA_NODE_CLONE_COPY_ON_WRITE: the clone shares the strings and
+ *   attributes of the original until either of them changes them
+ *
+ * How sopa_node_clone() copies the data of the nodes.
+ *
+ * Since: 0.2
+ */
+typedef enum {
+  SOPA_NODE_CLONE_DEEP,
+  SOPA_NODE_CLONE_COPY_ON_WRITE
+} SopaNodeCloneMode;
+
 struct _SopaNode
 {
   GInitiallyUnowned parent;
@@ -96,6 +133,18 @@ struct _SopaNodeIter {
   gpointer SOPA_PRIVATE_FIELD (dummy5);
 };
 
+/**
+ * SopaNodeForeachFunc:
+ * @node: a #SopaNode
+ * @user_data: the data passed to sopa_node_foreach_parallel()
+ *
+ * The function called for each node by sopa_node_foreach_parallel().
+ *
+ * Since: 0.2
+ */
+typedef void (* SopaNodeForeachFunc) (SopaNode *node,
+                                      gpointer  user_data);
+
 GType sopa_node_get_type (void) G_GNUC_CONST;
 
 void                                sopa_node_destroy                           (SopaNode                 *self);
@@ -103,6 +152,47 @@ void                                sopa_node_set_name
                                                                                  const gchar              *name);
 const gchar *                       sopa_node_get_name                          (SopaNode                 *self);
 SopaNode *                          sopa_node_get_parent                        (SopaNode                 *self);
+SopaNode *                          sopa_node_get_first_child                   (SopaNode                 *self);
+SopaNode *                          sopa_node_get_last_child                    (SopaNode                 *self);
+SopaNode *                          sopa_node_get_next_sibling                  (SopaNode                 *self);
+SopaNode *                          sopa_node_get_previous_sibling              (SopaNode                 *self);
+SopaNode *                          sopa_node_get_child_at_index                (SopaNode                 *self,
+                                                                                 gint                      index_);
+gboolean                            sopa_node_contains                          (SopaNode                 *self,
+                                                                                 SopaNode                 *node);
+SopaNodePosition                    sopa_node_compare_document_position         (SopaNode                 *self,
+                                                                                 SopaNode                 *other);
+void                                sopa_node_foreach_parallel                  (SopaNode                 *self,
+                                                                                 SopaNodeForeachFunc       func,
+                                                                                 gpointer                  user_data,
+                                                                                 guint                     n_threads);
+gchar *                             sopa_node_get_text_content                  (SopaNode                 *self,
+                                                                                 gsize                    *length);
+gchar *                             sopa_node_get_inner_text                    (SopaNode                 *self,
+                                                                                 gsize                    *length);
+gsize                               sopa_node_copy_text_content                 (SopaNode                 *self,
+                                                                                 gchar                    *buffer,
+                                                                                 gsize                     buffer_size);
+gsize                               sopa_node_copy_inner_text                   (SopaNode                 *self,
+                                                                                 gchar                    *buffer,
+                                                                                 gsize                     buffer_size);
+SopaNode *                          sopa_node_clone                             (SopaNode                 *self,
+                                                                                 SopaNodeCloneMode         mode);
+guint64                             sopa_node_get_hash                          (SopaNode                 *self);
+gboolean                            sopa_node_equal                             (SopaNode                 *a,
+                                                                                 SopaNode                 *b);
+gboolean                            sopa_node_get_source_range                  (SopaNode                 *self,
+                                                                                 gsize                    *start,
+                                                                                 gsize                    *end);
+gboolean                            sopa_node_get_source_position               (SopaNode                 *self,
+                                                                                 guint                    *line,
+                                                                                 guint                    *column);
+gchar *                             sopa_node_serialize_range                   (SopaNode                 *first,
+                                                                                 SopaNode                 *last,
+                                                                                 const SopaSerializeOptions *options,
+                                                                                 gsize                    *length);
+gchar *                             sopa_node_get_outer_html                    (SopaNode                 *self,
+                                                                                 gsize                    *length);
 void                                sopa_node_iter_init                         (SopaNodeIter             *iter,
                                                                                  SopaNode                 *root);
 gboolean                            sopa_node_iter_is_valid                     (const SopaNodeIter       *iter);
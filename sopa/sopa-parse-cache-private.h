@@ -0,0 +1,58 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-parse-cache-private.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#ifndef __SOPA_PARSE_CACHE_PRIVATE_H__
+#define __SOPA_PARSE_CACHE_PRIVATE_H__
+
+#include <glib.h>
+
+#include "sopa-document.h"
+#include "sopa-parse-cache.h"
+
+G_BEGIN_DECLS
+
+/* the parser options a cached document depends on */
+#define SOPA_PARSE_CACHE_TRACK_OFFSETS (1 << 0)
+
+typedef struct _SopaParseCacheKey SopaParseCacheKey;
+
+struct _SopaParseCacheKey
+{
+  guint64            hash[2];
+  gsize              length;
+  guint              options;
+};
+
+gboolean                            _sopa_parse_cache_key_init                  (SopaParseCache           *self,
+                                                                                 SopaParseCacheKey        *key,
+                                                                                 const gchar              *text,
+                                                                                 gsize                     length,
+                                                                                 guint                     options);
+SopaDocument *                      _sopa_parse_cache_lookup                    (SopaParseCache           *self,
+                                                                                 const SopaParseCacheKey  *key);
+SopaDocument *                      _sopa_parse_cache_insert                    (SopaParseCache           *self,
+                                                                                 const SopaParseCacheKey  *key,
+                                                                                 SopaDocument             *document);
+
+G_END_DECLS
+
+#endif /* __SOPA_PARSE_CACHE_PRIVATE_H__ */
@@ -0,0 +1,582 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-parse-cache.c
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+/**
+ * SECTION:sopa-parse-cache
+ * @short_description: Documents kept by the content of their source
+ *
+ * A #SopaParseCache keeps the documents parsed by the #SopaParser
+ * objects it is attached to with sopa_parser_set_cache(), so that
+ * parsing the same text again hands out the document already built
+ * instead of parsing it.
+ *
+ * Documents are keyed by a 128 bit hash of their text, computed eight
+ * bytes at a time, together with its length and the parser options
+ * that change the result; the text itself is not kept. The cache
+ * holds documents up to a size budget, estimated from the length of
+ * their text and their number of nodes, and drops the least recently
+ * used ones to stay under it.
+ *
+ * With %SOPA_PARSE_CACHE_CLONE, the default to use, each parse gets a
+ * copy-on-write clone of the cached document, which costs its nodes
+ * but neither the strings nor the attributes, and can be changed
+ * without affecting the cache. With %SOPA_PARSE_CACHE_SHARE each parse
+ * gets the cached document itself, which must then be treated as
+ * read-only by everyone. Several threads can read a shared document
+ * at once, but functions which fill caches of the document on first
+ * use, such as serialization, cached queries or source positions,
+ * must not run on it from several threads at the same time.
+ *
+ * A cache can be shared by parsers running in different threads.
+ */
+
+#include <string.h>
+
+#include "sopa-parse-cache-private.h"
+
+#include "sopa-node-private.h"
+#include "sopa-private.h"
+
+G_DEFINE_BOXED_TYPE (SopaParseCache, sopa_parse_cache,
+                     sopa_parse_cache_ref,
+                     sopa_parse_cache_unref)
+
+/* roughly what a node takes, with its instance and private data */
+#define NODE_SIZE 160
+
+#define HASH_PRIME_1 G_GUINT64_CONSTANT (0x9e3779b185ebca87)
+#define HASH_PRIME_2 G_GUINT64_CONSTANT (0xc2b2ae3d27d4eb4f)
+#define HASH_PRIME_3 G_GUINT64_CONSTANT (0x165667b19e3779f9)
+#define HASH_PRIME_4 G_GUINT64_CONSTANT (0x85ebca77c2b2ae63)
+
+typedef struct _CacheEntry CacheEntry;
+
+struct _CacheEntry
+{
+  SopaParseCacheKey  key;
+  SopaDocument      *document;
+  gsize              size;
+
+  /* in the queue of the cache, most recently used first */
+  GList              link;
+};
+
+struct _SopaParseCache
+{
+  volatile gint      ref_count;
+
+  SopaParseCacheMode mode;
+  gsize              max_size;
+
+  GMutex             mutex;
+
+  /* everything below is protected by the mutex */
+  GHashTable        *entries;
+  GQueue             queue;
+  gsize              size;
+
+  guint64            n_hits;
+  guint64            n_misses;
+};
+
+static inline guint64
+hash_rotate (guint64 value,
+             guint   bits)
+{
+  return (value << bits) | (value >> (64 - bits));
+}
+
+/* two independent lanes over the text, eight bytes at a time, which
+ * the processor runs side by side
+ */
+static void
+hash_text (const gchar *text,
+           gsize        length,
+           guint64      hash[2])
+{
+  guint64 a, b, word;
+  gsize i;
+
+  a = (length + 1) * HASH_PRIME_1;
+  b = (length + 1) * HASH_PRIME_3;
+
+  for (i = 0; i + sizeof (word) <= length; i += sizeof (word))
+    {
+      memcpy (&word, text + i, sizeof (word));
+
+      a = hash_rotate (a + word * HASH_PRIME_2, 31) * HASH_PRIME_1;
+      b = hash_rotate (b ^ word * HASH_PRIME_4, 27) * HASH_PRIME_3;
+    }
+
+  /* the length is in the seeds, so padding the tail is safe */
+  if (i < length)
+    {
+      word = 0;
+      memcpy (&word, text + i, length - i);
+
+      a = hash_rotate (a + word * HASH_PRIME_2, 31) * HASH_PRIME_1;
+      b = hash_rotate (b ^ word * HASH_PRIME_4, 27) * HASH_PRIME_3;
+    }
+
+  hash[0] = _sopa_hash_mix (a ^ hash_rotate (b, 32));
+  hash[1] = _sopa_hash_mix (b + a * HASH_PRIME_2);
+}
+
+static guint
+cache_key_hash (gconstpointer data)
+{
+  const SopaParseCacheKey *key = data;
+
+  return (guint) (key->hash[0] ^ key->options);
+}
+
+static gboolean
+cache_key_equal (gconstpointer a,
+                 gconstpointer b)
+{
+  const SopaParseCacheKey *key_a = a;
+  const SopaParseCacheKey *key_b = b;
+
+  return key_a->hash[0] == key_b->hash[0] &&
+         key_a->hash[1] == key_b->hash[1] &&
+         key_a->length == key_b->length &&
+         key_a->options == key_b->options;
+}
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+  g_object_unref (entry->document);
+
+  g_slice_free (CacheEntry, entry);
+}
+
+/* takes @entry out of the cache, which must be locked */
+static void
+cache_remove_entry (SopaParseCache *self,
+                    CacheEntry     *entry)
+{
+  g_hash_table_remove (self->entries, &entry->key);
+  g_queue_unlink (&self->queue, &entry->link);
+
+  self->size -= entry->size;
+}
+
+/* the document to give to a parse, from one held by the cache */
+static SopaDocument *
+cache_hand_out (SopaParseCache *self,
+                SopaDocument   *document)
+{
+  SopaNode *clone;
+
+  if (self->mode == SOPA_PARSE_CACHE_SHARE)
+    return g_object_ref (document);
+
+  /* parses return a strong reference, never a floating one */
+  clone = sopa_node_clone (SOPA_NODE (document),
+                           SOPA_NODE_CLONE_COPY_ON_WRITE);
+
+  return SOPA_DOCUMENT (g_object_ref_sink (clone));
+}
+
+/**
+ * sopa_parse_cache_new:
+ * @max_size: the most bytes the cached documents may take
+ * @mode: how the cached documents are handed out
+ *
+ * Creates a new, empty #SopaParseCache.
+ *
+ * The size of a document is estimated from the length of its text and
+ * its number of nodes. Documents larger than @max_size on their own
+ * are not cached.
+ *
+ * Return value: (transfer full): a new #SopaParseCache
+ *
+ * Since: 0.2
+ */
+SopaParseCache *
+sopa_parse_cache_new (gsize              max_size,
+                      SopaParseCacheMode mode)
+{
+  SopaParseCache *self;
+
+  self = g_slice_new0 (SopaParseCache);
+  self->ref_count = 1;
+  self->mode = mode;
+  self->max_size = max_size;
+
+  g_mutex_init (&self->mutex);
+  self->entries = g_hash_table_new (cache_key_hash, cache_key_equal);
+  g_queue_init (&self->queue);
+
+  return self;
+}
+
+/**
+ * sopa_parse_cache_ref:
+ * @self: a #SopaParseCache
+ *
+ * Acquires a reference on @self.
+ *
+ * Return value: (transfer full): the #SopaParseCache
+ *
+ * Since: 0.2
+ */
+SopaParseCache *
+sopa_parse_cache_ref (SopaParseCache *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+/**
+ * sopa_parse_cache_unref:
+ * @self: a #SopaParseCache
+ *
+ * Releases a reference on @self. When the last reference is released
+ * the cache is freed, along with its references on the documents.
+ *
+ * Since: 0.2
+ */
+void
+sopa_parse_cache_unref (SopaParseCache *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (!g_atomic_int_dec_and_test (&self->ref_count))
+    return;
+
+  sopa_parse_cache_clear (self);
+
+  g_hash_table_unref (self->entries);
+  g_mutex_clear (&self->mutex);
+
+  g_slice_free (SopaParseCache, self);
+}
+
+/**
+ * sopa_parse_cache_get_mode:
+ * @self: a #SopaParseCache
+ *
+ * Retrieves how @self hands out its documents.
+ *
+ * Return value: the #SopaParseCacheMode of @self
+ *
+ * Since: 0.2
+ */
+SopaParseCacheMode
+sopa_parse_cache_get_mode (SopaParseCache *self)
+{
+  g_return_val_if_fail (self != NULL, SOPA_PARSE_CACHE_CLONE);
+
+  return self->mode;
+}
+
+/**
+ * sopa_parse_cache_get_max_size:
+ * @self: a #SopaParseCache
+ *
+ * Retrieves the size budget of @self.
+ *
+ * Return value: the most bytes the documents of @self may take
+ *
+ * Since: 0.2
+ */
+gsize
+sopa_parse_cache_get_max_size (SopaParseCache *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->max_size;
+}
+
+/**
+ * sopa_parse_cache_get_size:
+ * @self: a #SopaParseCache
+ *
+ * Retrieves the estimated size of the documents held by @self.
+ *
+ * Return value: the size of the cached documents, in bytes
+ *
+ * Since: 0.2
+ */
+gsize
+sopa_parse_cache_get_size (SopaParseCache *self)
+{
+  gsize size;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->mutex);
+  size = self->size;
+  g_mutex_unlock (&self->mutex);
+
+  return size;
+}
+
+/**
+ * sopa_parse_cache_get_n_documents:
+ * @self: a #SopaParseCache
+ *
+ * Retrieves the number of documents held by @self.
+ *
+ * Return value: the number of cached documents
+ *
+ * Since: 0.2
+ */
+guint
+sopa_parse_cache_get_n_documents (SopaParseCache *self)
+{
+  guint n_documents;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->mutex);
+  n_documents = self->queue.length;
+  g_mutex_unlock (&self->mutex);
+
+  return n_documents;
+}
+
+/**
+ * sopa_parse_cache_get_stats:
+ * @self: a #SopaParseCache
+ * @n_hits: (out) (allow-none): return location for the number of
+ *      parses that got a cached document, or %NULL
+ * @n_misses: (out) (allow-none): return location for the number of
+ *      parses that had to parse their text, or %NULL
+ *
+ * Retrieves how well @self has done since it was created.
+ *
+ * Since: 0.2
+ */
+void
+sopa_parse_cache_get_stats (SopaParseCache *self,
+                            guint64        *n_hits,
+                            guint64        *n_misses)
+{
+  g_return_if_fail (self != NULL);
+
+  g_mutex_lock (&self->mutex);
+
+  if (n_hits != NULL)
+    *n_hits = self->n_hits;
+
+  if (n_misses != NULL)
+    *n_misses = self->n_misses;
+
+  g_mutex_unlock (&self->mutex);
+}
+
+/**
+ * sopa_parse_cache_clear:
+ * @self: a #SopaParseCache
+ *
+ * Drops all the documents held by @self. The documents already handed
+ * out are not affected.
+ *
+ * Since: 0.2
+ */
+void
+sopa_parse_cache_clear (SopaParseCache *self)
+{
+  GList *links;
+
+  g_return_if_fail (self != NULL);
+
+  g_mutex_lock (&self->mutex);
+
+  links = self->queue.head;
+
+  g_hash_table_remove_all (self->entries);
+  g_queue_init (&self->queue);
+  self->size = 0;
+
+  g_mutex_unlock (&self->mutex);
+
+  /* the documents are released unlocked, as it may take a while */
+  while (links != NULL)
+    {
+      CacheEntry *entry = links->data;
+
+      links = links->next;
+      cache_entry_free (entry);
+    }
+}
+
+/*
+ * _sopa_parse_cache_key_init:
+ * @self: a #SopaParseCache
+ * @key: the key to fill in
+ * @text: the text about to be parsed
+ * @length: the length of @text
+ * @options: the options of the parser that change the document
+ *
+ * Computes the key of the document parsed from @text.
+ *
+ * Return value: %FALSE if documents parsed with @options cannot be
+ *      handed out by @self, so that @key is not to be used
+ */
+gboolean
+_sopa_parse_cache_key_init (SopaParseCache    *self,
+                            SopaParseCacheKey *key,
+                            const gchar       *text,
+                            gsize              length,
+                            guint              options)
+{
+  /* the source offsets are not carried over to clones */
+  if (self->mode == SOPA_PARSE_CACHE_CLONE &&
+      (options & SOPA_PARSE_CACHE_TRACK_OFFSETS) != 0)
+    return FALSE;
+
+  hash_text (text, length, key->hash);
+  key->length = length;
+  key->options = options;
+
+  return TRUE;
+}
+
+/*
+ * _sopa_parse_cache_lookup:
+ * @self: a #SopaParseCache
+ * @key: the key of the text to parse
+ *
+ * Looks for the document parsed from the text of @key, which becomes
+ * the most recently used.
+ *
+ * Return value: (transfer full): the document to give to the parse,
+ *      or %NULL if the text has to be parsed
+ */
+SopaDocument *
+_sopa_parse_cache_lookup (SopaParseCache          *self,
+                          const SopaParseCacheKey *key)
+{
+  CacheEntry *entry;
+  SopaDocument *document = NULL;
+  SopaDocument *result;
+
+  g_mutex_lock (&self->mutex);
+
+  entry = g_hash_table_lookup (self->entries, key);
+
+  if (entry != NULL)
+    {
+      g_queue_unlink (&self->queue, &entry->link);
+      g_queue_push_head_link (&self->queue, &entry->link);
+
+      document = g_object_ref (entry->document);
+      self->n_hits += 1;
+    }
+  else
+    self->n_misses += 1;
+
+  g_mutex_unlock (&self->mutex);
+
+  if (document == NULL)
+    return NULL;
+
+  /* cloning only reads the cached tree, so it needs no lock */
+  result = cache_hand_out (self, document);
+  g_object_unref (document);
+
+  return result;
+}
+
+/*
+ * _sopa_parse_cache_insert:
+ * @self: a #SopaParseCache
+ * @key: the key of the text @document was parsed from
+ * @document: (transfer full): the newly parsed document, not floating
+ *
+ * Adds @document to @self, dropping the least recently used documents
+ * as needed to stay within the size budget.
+ *
+ * Return value: (transfer full): the document to give to the parse
+ */
+SopaDocument *
+_sopa_parse_cache_insert (SopaParseCache          *self,
+                          const SopaParseCacheKey *key,
+                          SopaDocument            *document)
+{
+  CacheEntry *entry;
+  SopaDocument *result;
+  GList *evicted = NULL;
+  gsize size;
+
+  /* computed now, so that the cached tree is only ever read; the
+   * size needs the nodes numbered, which queries need as well
+   */
+  sopa_node_get_hash (SOPA_NODE (document));
+  size = key->length +
+    _sopa_node_get_subtree_size (SOPA_NODE (document)) * NODE_SIZE;
+
+  g_mutex_lock (&self->mutex);
+
+  /* too large, or parsed by another thread in the meantime; the
+   * document is then left to the parse alone
+   */
+  if (size > self->max_size ||
+      g_hash_table_contains (self->entries, key))
+    {
+      g_mutex_unlock (&self->mutex);
+      return document;
+    }
+
+  entry = g_slice_new (CacheEntry);
+  entry->key = *key;
+  entry->document = g_object_ref (document);
+  entry->size = size;
+  entry->link.data = entry;
+  entry->link.prev = NULL;
+  entry->link.next = NULL;
+
+  g_hash_table_insert (self->entries, &entry->key, entry);
+  g_queue_push_head_link (&self->queue, &entry->link);
+  self->size += size;
+
+  while (self->size > self->max_size)
+    {
+      CacheEntry *last = self->queue.tail->data;
+
+      cache_remove_entry (self, last);
+      evicted = g_list_prepend (evicted, last);
+    }
+
+  g_mutex_unlock (&self->mutex);
+
+  g_list_free_full (evicted, (GDestroyNotify) cache_entry_free);
+
+  /* the reference of the parse keeps the document alive, even if
+   * another thread evicts it in the meantime
+   */
+  if (self->mode == SOPA_PARSE_CACHE_SHARE)
+    return document;
+
+  /* the cached document stays as parsed, the parse gets a clone */
+  result = cache_hand_out (self, document);
+  g_object_unref (document);
+
+  return result;
+}
@@ -0,0 +1,72 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-parse-cache.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#if !defined(SOPA_H_INSIDE) && !defined(SOPA_COMPILATION)
+#error "Only <sopa/sopa.h> can be included directly.h"
+#endif
+
+#ifndef __SOPA_PARSE_CACHE_H__
+#define __SOPA_PARSE_CACHE_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define SOPA_TYPE_PARSE_CACHE (sopa_parse_cache_get_type ())
+
+typedef struct _SopaParseCache SopaParseCache;
+
+/**
+ * SopaParseCacheMode:
+ * @SOPA_PARSE_CACHE_CLONE: each parse gets its own copy-on-write clone
+ *   of the cached document, which it can change freely
+ * @SOPA_PARSE_CACHE_SHARE: each parse gets a reference to the cached
+ *   document itself, which must not be changed; it can be read and
+ *   serialized from several threads at once
+ *
+ * How a #SopaParseCache hands out the documents it holds.
+ *
+ * Since: 0.2
+ */
+typedef enum {
+  SOPA_PARSE_CACHE_CLONE,
+  SOPA_PARSE_CACHE_SHARE
+} SopaParseCacheMode;
+
+GType sopa_parse_cache_get_type (void) G_GNUC_CONST;
+
+SopaParseCache *                    sopa_parse_cache_new                        (gsize                   max_size,
+                                                                                 SopaParseCacheMode      mode);
+SopaParseCache *                    sopa_parse_cache_ref                        (SopaParseCache         *self);
+void                                sopa_parse_cache_unref                      (SopaParseCache         *self);
+SopaParseCacheMode                  sopa_parse_cache_get_mode                   (SopaParseCache         *self);
+gsize                               sopa_parse_cache_get_max_size               (SopaParseCache         *self);
+gsize                               sopa_parse_cache_get_size                   (SopaParseCache         *self);
+guint                               sopa_parse_cache_get_n_documents            (SopaParseCache         *self);
+void                                sopa_parse_cache_get_stats                  (SopaParseCache         *self,
+                                                                                 guint64                *n_hits,
+                                                                                 guint64                *n_misses);
+void                                sopa_parse_cache_clear                      (SopaParseCache         *self);
+
+G_END_DECLS
+
+#endif /* __SOPA_PARSE_CACHE_H__ */
@@ -26,27 +26,249 @@
 #include "sopa-comment.h"
 #include "sopa-data.h"
 #include "sopa-text.h"
+#include "sopa-document-private.h"
+#include "sopa-node-private.h"
+#include "sopa-parse-cache-private.h"
+#include "sopa-selector-private.h"
+#include "sopa-source-map-private.h"
+#include "sopa-subtree-pool-private.h"
 
 G_DEFINE_TYPE (SopaParser, sopa_parser, G_TYPE_OBJECT)
 
 #define PARSER_PRIVATE(o) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((o), SOPA_TYPE_PARSER, SopaParserPrivate))
 
+#define STREAM_CHUNK_SIZE 65536
+
+typedef struct _SopaParserFrame SopaParserFrame;
+typedef struct _SopaParserMatcher SopaParserMatcher;
+
+/* an open element outside of any match, kept while streaming so that
+ * selectors can be evaluated without building the element
+ */
+struct _SopaParserFrame
+{
+  SopaParserFrame      *parent;
+
+  gchar                *tag;
+  gchar               **attribute_names;
+  gchar               **attribute_values;
+};
+
+struct _SopaParserMatcher
+{
+  guint                 id;
+
+  SopaSelector         *selector;
+
+  SopaParserMatchFunc   func;
+  gpointer              data;
+  GDestroyNotify        notify;
+};
+
 struct _SopaParserPrivate
 {
   /* used during parsing */
-  SopaDocument  *doc;
-  GQueue        *stack;
+  SopaDocument         *doc;
+  GQueue               *stack;
+
+  /* streaming */
+  GList                *matchers;
+  guint                 last_matcher_id;
+
+  SopaParserFrame      *frame;
+  SopaElement          *match_root;
+  SopaParserMatcher    *match;
+
+  /* offset tracking: the text parsed so far, the offset up to which
+   * its markup was reported by the callbacks, and the span of each
+   * node, with those of the open elements still missing their end
+   */
+  gboolean              track_offsets;
+  GByteArray           *source;
+  gsize                 source_cursor;
+  gboolean              source_empty_tag;
+  GArray               *spans;
+  GArray               *open_spans;
+
+  SopaParseCache       *cache;
+  SopaSubtreePool      *subtree_pool;
 };
 
+enum {
+  PROP_0,
+
+  PROP_TRACK_OFFSETS,
+  PROP_CACHE,
+  PROP_SUBTREE_POOL,
+
+  PROP_LAST
+};
+
+static GParamSpec *obj_props[PROP_LAST];
+
+static void
+sopa_parser_frame_free (SopaParserFrame *frame)
+{
+  g_free (frame->tag);
+  g_strfreev (frame->attribute_names);
+  g_strfreev (frame->attribute_values);
+
+  g_slice_free (SopaParserFrame, frame);
+}
+
+static void
+sopa_parser_matcher_free (SopaParserMatcher *matcher)
+{
+  if (matcher->notify != NULL)
+    matcher->notify (matcher->data);
+
+  sopa_selector_unref (matcher->selector);
+
+  g_slice_free (SopaParserMatcher, matcher);
+}
+
+static const gchar *
+frame_get_tag (gconstpointer subject)
+{
+  return ((const SopaParserFrame *) subject)->tag;
+}
+
+static const gchar *
+frame_get_attribute (gconstpointer  subject,
+                     const gchar   *name)
+{
+  const SopaParserFrame *frame = subject;
+  gint i;
+
+  for (i = 0; frame->attribute_names[i] != NULL; i++)
+    {
+      if (strcmp (frame->attribute_names[i], name) == 0)
+        return frame->attribute_values[i];
+    }
+
+  return NULL;
+}
+
+static gconstpointer
+frame_get_parent (gconstpointer subject)
+{
+  return ((const SopaParserFrame *) subject)->parent;
+}
+
+static const SopaSelectorAdapter frame_adapter = {
+  frame_get_tag,
+  frame_get_attribute,
+  frame_get_parent
+};
+
+/* drops any state left behind by a parse, successful or not */
+static void
+sopa_parser_reset (SopaParser *self)
+{
+  SopaParserPrivate *priv = self->priv;
+
+  while (priv->frame != NULL)
+    {
+      SopaParserFrame *parent = priv->frame->parent;
+
+      sopa_parser_frame_free (priv->frame);
+      priv->frame = parent;
+    }
+
+  if (priv->match_root != NULL)
+    {
+      sopa_node_destroy (SOPA_NODE (priv->match_root));
+      g_object_unref (priv->match_root);
+      priv->match_root = NULL;
+    }
+
+  priv->match = NULL;
+
+  /* the stack does not own its nodes, the document or the match does */
+  g_queue_clear (priv->stack);
+
+  if (priv->source != NULL)
+    {
+      g_byte_array_unref (priv->source);
+      g_array_unref (priv->spans);
+      g_array_unref (priv->open_spans);
+      priv->source = NULL;
+      priv->spans = NULL;
+      priv->open_spans = NULL;
+    }
+}
+
+static void
+sopa_parser_get_property (GObject    *object,
+                          guint       property_id,
+                          GValue     *value,
+                          GParamSpec *pspec)
+{
+  SopaParser *parser = SOPA_PARSER (object);
+
+  switch (property_id)
+    {
+    case PROP_TRACK_OFFSETS:
+      g_value_set_boolean (value, parser->priv->track_offsets);
+      break;
+
+    case PROP_CACHE:
+      g_value_set_boxed (value, parser->priv->cache);
+      break;
+
+    case PROP_SUBTREE_POOL:
+      g_value_set_boxed (value, parser->priv->subtree_pool);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+sopa_parser_set_property (GObject      *object,
+                          guint         property_id,
+                          const GValue *value,
+                          GParamSpec   *pspec)
+{
+  SopaParser *parser = SOPA_PARSER (object);
+
+  switch (property_id)
+    {
+    case PROP_TRACK_OFFSETS:
+      sopa_parser_set_track_offsets (parser, g_value_get_boolean (value));
+      break;
+
+    case PROP_CACHE:
+      sopa_parser_set_cache (parser, g_value_get_boxed (value));
+      break;
+
+    case PROP_SUBTREE_POOL:
+      sopa_parser_set_subtree_pool (parser, g_value_get_boxed (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
 static void
 sopa_parser_finalize (GObject *object)
 {
   SopaParser *parser = SOPA_PARSER (object);
 
-  /* Free stack */
-  g_queue_free_full (parser->priv->stack,
-                     (GDestroyNotify) g_object_unref);
+  sopa_parser_reset (parser);
+  g_queue_free (parser->priv->stack);
+
+  g_list_free_full (parser->priv->matchers,
+                    (GDestroyNotify) sopa_parser_matcher_free);
+
+  if (parser->priv->cache != NULL)
+    sopa_parse_cache_unref (parser->priv->cache);
+
+  if (parser->priv->subtree_pool != NULL)
+    sopa_subtree_pool_unref (parser->priv->subtree_pool);
 
   G_OBJECT_CLASS (sopa_parser_parent_class)->finalize (object);
 }
@@ -58,7 +280,56 @@ sopa_parser_class_init (SopaParserClass *klass)
 
   g_type_class_add_private (klass, sizeof (SopaParserPrivate));
 
+  object_class->get_property = sopa_parser_get_property;
+  object_class->set_property = sopa_parser_set_property;
   object_class->finalize = sopa_parser_finalize;
+
+  /**
+   * SopaParser:track-offsets:
+   *
+   * Whether the parsed documents keep their source, with the offsets
+   * of the markup of each node; see sopa_node_get_source_range()
+   *
+   * Since: 0.2
+   */
+  obj_props[PROP_TRACK_OFFSETS] =
+    g_param_spec_boolean ("track-offsets",
+                          "Track offsets",
+                          "Whether the source offsets of nodes are recorded",
+                          FALSE,
+                          G_PARAM_READWRITE);
+
+  /**
+   * SopaParser:cache:
+   *
+   * The #SopaParseCache the parsed documents are kept in and looked
+   * up from; see sopa_parser_set_cache()
+   *
+   * Since: 0.2
+   */
+  obj_props[PROP_CACHE] =
+    g_param_spec_boxed ("cache",
+                        "Cache",
+                        "The cache of parsed documents",
+                        SOPA_TYPE_PARSE_CACHE,
+                        G_PARAM_READWRITE);
+
+  /**
+   * SopaParser:subtree-pool:
+   *
+   * The #SopaSubtreePool the parsed documents share the data of their
+   * repeated subtrees through; see sopa_parser_set_subtree_pool()
+   *
+   * Since: 0.2
+   */
+  obj_props[PROP_SUBTREE_POOL] =
+    g_param_spec_boxed ("subtree-pool",
+                        "Subtree pool",
+                        "The pool of subtrees shared across documents",
+                        SOPA_TYPE_SUBTREE_POOL,
+                        G_PARAM_READWRITE);
+
+  g_object_class_install_properties (object_class, PROP_LAST, obj_props);
 }
 
 static void
@@ -69,23 +340,56 @@ sopa_parser_init (SopaParser *self)
   self->priv->stack = g_queue_new ();
 }
 
+/* the element new content is added to, or %NULL if it must be dropped */
+static inline SopaElement *
+sopa_parser_get_current_parent (SopaParser *self)
+{
+  SopaParserPrivate *priv = self->priv;
+
+  if (!g_queue_is_empty (priv->stack))
+    return g_queue_peek_head (priv->stack);
+
+  /* outside of a match nothing is built while streaming */
+  if (priv->matchers != NULL)
+    return NULL;
+
+  return SOPA_ELEMENT (priv->doc);
+}
+
+/* moves the cursor past the next markup reported by the markup parser,
+ * returning where it starts
+ */
+static gsize
+source_advance_markup (SopaParser *self)
+{
+  SopaParserPrivate *priv = self->priv;
+  gsize start;
+
+  start = _sopa_source_find ((const gchar *) priv->source->data,
+                             priv->source->len,
+                             priv->source_cursor,
+                             "<");
+  priv->source_cursor = _sopa_source_skip_markup ((const gchar *) priv->source->data,
+                                                  priv->source->len,
+                                                  start,
+                                                  &priv->source_empty_tag);
+
+  return start;
+}
+
 static void
-sopa_parser_stack_give_parent (SopaParser   *self,
-                               SopaElement  *parent,
-                               gint          pos)
+source_add_span (SopaParser *self,
+                 SopaNode   *node,
+                 gsize       start,
+                 gsize       end)
 {
-  gint i;
-  guint stack_len = g_queue_get_length (self->priv->stack);
+  SopaSourceSpan span;
 
-  if (pos < 0)
-    pos = (gint) stack_len;
+  span.node = node;
+  span.start = start;
+  span.end = end;
 
-  for (i = 0; i < pos; i++)
-    {
-      sopa_element_insert_child_at_index (parent,
-                                          SOPA_NODE (g_queue_pop_head (self->priv->stack)),
-                                          0);
-    }
+  g_array_append_val (self->priv->spans, span);
 }
 
 static void
@@ -97,12 +401,46 @@ handle_start_element (GMarkupParseContext *context,
                       GError             **error)
 {
   SopaParser *parser = SOPA_PARSER (user_data);
-  SopaElement *elem;
+  SopaParserPrivate *priv = parser->priv;
+  SopaParserMatcher *match = NULL;
+  SopaElement *elem, *parent;
+  gsize start = 0;
+  gint i;
+
+  if (priv->source != NULL)
+    start = source_advance_markup (parser);
+
+  if (priv->matchers != NULL && priv->match_root == NULL)
+    {
+      SopaParserFrame *frame;
+      GList *l;
+
+      frame = g_slice_new (SopaParserFrame);
+      frame->parent = priv->frame;
+      frame->tag = g_ascii_strdown (element_name, -1);
+      frame->attribute_names = g_strdupv ((gchar **) attribute_names);
+      frame->attribute_values = g_strdupv ((gchar **) attribute_values);
+      priv->frame = frame;
+
+      for (l = priv->matchers; l != NULL && match == NULL; l = l->next)
+        {
+          SopaParserMatcher *matcher = l->data;
+
+          if (_sopa_selector_match_subject (matcher->selector,
+                                            &frame_adapter,
+                                            frame))
+            match = matcher;
+        }
+
+      /* not interesting, keep only the frame */
+      if (match == NULL)
+        return;
+    }
 
   elem = sopa_element_new (element_name);
 
   /* Add attributes */
-  gint i = 0;
+  i = 0;
   while (attribute_names[i] && attribute_values[i])
     {
       sopa_element_add_attribute (elem,
@@ -111,7 +449,26 @@ handle_start_element (GMarkupParseContext *context,
       i++;
     }
 
-  g_queue_push_head (parser->priv->stack, elem);
+  if (match != NULL)
+    {
+      /* detached root of a new match */
+      priv->match_root = g_object_ref_sink (elem);
+      priv->match = match;
+    }
+  else
+    {
+      parent = sopa_parser_get_current_parent (parser);
+      sopa_element_add_child (parent, SOPA_NODE (elem));
+    }
+
+  g_queue_push_head (priv->stack, elem);
+
+  /* the end is known at the end tag */
+  if (priv->source != NULL)
+    {
+      g_array_append_val (priv->open_spans, priv->spans->len);
+      source_add_span (parser, SOPA_NODE (elem), start, 0);
+    }
 }
 
 static void
@@ -121,39 +478,70 @@ handle_end_element (GMarkupParseContext *context,
                     GError             **error)
 {
   SopaParser *parser = SOPA_PARSER (user_data);
-  SopaNode *node = NULL;
-  guint idx;
-  gboolean f_elem;
+  SopaParserPrivate *priv = parser->priv;
+  SopaParserFrame *frame;
+  SopaElement *elem;
 
-  for (idx = 0, f_elem = FALSE;
-       idx < g_queue_get_length (parser->priv->stack) && !f_elem;
-       idx++)
+  if (priv->source != NULL)
     {
-      node = g_queue_peek_nth (parser->priv->stack, idx);
+      SopaSourceSpan *span;
+      guint index_;
+
+      /* an empty element tag is its own end tag */
+      if (!priv->source_empty_tag)
+        source_advance_markup (parser);
+      priv->source_empty_tag = FALSE;
 
-      if (!SOPA_IS_ELEMENT (node))
-        continue;
+      if (priv->open_spans->len > 0)
+        {
+          index_ = g_array_index (priv->open_spans,
+                                  guint,
+                                  priv->open_spans->len - 1);
+          g_array_set_size (priv->open_spans, priv->open_spans->len - 1);
 
-      if (g_strcmp0 (sopa_element_get_tag (SOPA_ELEMENT (node)),
-                    element_name) == 0)
-        f_elem = TRUE;
-      else
-        continue;
+          span = &g_array_index (priv->spans, SopaSourceSpan, index_);
+          span->end = priv->source_cursor;
+        }
+    }
 
-      sopa_parser_stack_give_parent (parser,
-                                     SOPA_ELEMENT (node),
-                                     idx);
+  if (priv->matchers != NULL && priv->match_root == NULL)
+    {
+      frame = priv->frame;
+      priv->frame = frame->parent;
+      sopa_parser_frame_free (frame);
+      return;
     }
 
-  if (f_elem == FALSE)
+  elem = g_queue_pop_head (priv->stack);
+
+  if (elem == NULL ||
+      g_ascii_strcasecmp (sopa_element_get_tag (elem), element_name) != 0)
     {
-      //TODO improve this
-      g_set_error_literal (error,
-                           G_MARKUP_ERROR,
-                           G_MARKUP_ERROR_PARSE,
-                           "Something goes wrong...");
+      g_set_error (error,
+                   G_MARKUP_ERROR,
+                   G_MARKUP_ERROR_PARSE,
+                   "Unexpected closing tag '%s'",
+                   element_name);
       return;
     }
+
+  if (elem == priv->match_root)
+    {
+      SopaParserMatcher *match = priv->match;
+
+      priv->match_root = NULL;
+      priv->match = NULL;
+
+      /* the frame of the match root is still open */
+      frame = priv->frame;
+      priv->frame = frame->parent;
+      sopa_parser_frame_free (frame);
+
+      match->func (parser, elem, match->data);
+
+      /* the match is freed here unless @func kept a reference */
+      g_object_unref (elem);
+    }
 }
 
 static void
@@ -163,23 +551,47 @@ handle_text (GMarkupParseContext *context,
              gpointer             user_data,
              GError             **error)
 {
-  if (text_len <= 0)
-    return;
-
   SopaParser *parser = SOPA_PARSER (user_data);
+  SopaElement *parent;
   SopaText *elem;
   gchar *content;
+  gsize i, start = 0;
+
+  /* the text runs until the next markup */
+  if (parser->priv->source != NULL)
+    {
+      start = parser->priv->source_cursor;
+      parser->priv->source_cursor =
+        _sopa_source_find ((const gchar *) parser->priv->source->data,
+                           parser->priv->source->len,
+                           start,
+                           "<");
+    }
+
+  if (text_len <= 0)
+    return;
+
+  parent = sopa_parser_get_current_parent (parser);
+  if (parent == NULL)
+    return;
+
+  /* skip whitespace-only text */
+  for (i = 0; i < text_len && g_ascii_isspace (text[i]); i++)
+    ;
+
+  if (i == text_len)
+    return;
 
   /* Create a nul-terminated string */
-  content = g_strchomp (g_strndup (text, text_len));
+  content = g_strndup (text, text_len);
 
-  if (strlen (content))
-    {
-      elem = sopa_text_new ();
-      sopa_text_set_content (elem, text);
+  elem = sopa_text_new ();
+  sopa_text_set_content (elem, content);
+  sopa_element_add_child (parent, SOPA_NODE (elem));
 
-      g_queue_push_head (parser->priv->stack, elem);
-    }
+  if (parser->priv->source != NULL)
+    source_add_span (parser, SOPA_NODE (elem),
+                     start, parser->priv->source_cursor);
 
   g_free (content);
 }
@@ -191,8 +603,10 @@ handle_passthrough (GMarkupParseContext *context,
                     gpointer             user_data,
                     GError             **error)
 {
-  //SopaParser *parser = SOPA_PARSER (user_data);
-  g_print ("handle_passthrough\n");
+  SopaParser *parser = SOPA_PARSER (user_data);
+
+  if (parser->priv->source != NULL)
+    source_advance_markup (parser);
 }
 
 static void
@@ -200,55 +614,98 @@ handle_error (GMarkupParseContext *context,
               GError              *error,
               gpointer             user_data)
 {
-  //SopaParser *parser = SOPA_PARSER (user_data);
-  const gchar *cur_elem;
+  SopaParser *parser = SOPA_PARSER (user_data);
 
-  cur_elem = g_markup_parse_context_get_element (context);
-  g_print ("handle_error elem:%s\n", cur_elem);
+  /* the error itself is returned by sopa_parser_end() */
+  sopa_parser_reset (parser);
 }
 
-static gboolean
-sopa_parser_parse_data (SopaParser   *self,
-                        const gchar  *text,
-                        gssize        text_len,
-                        GError      **error)
+static const GMarkupParser markup_parser = {
+  handle_start_element,
+  handle_end_element,
+  handle_text,
+  handle_passthrough,
+  handle_error
+};
+
+static GMarkupParseContext *
+sopa_parser_begin (SopaParser *self)
 {
-  GMarkupParser parser = {
-    handle_start_element,
-    handle_end_element,
-    handle_text,
-    handle_passthrough,
-    handle_error
-  };
+  SopaParserPrivate *priv = self->priv;
 
-  GMarkupParseContext *context = NULL;
-  GError *internal_error = NULL;
+  sopa_parser_reset (self);
 
-  context = g_markup_parse_context_new (&parser, 0, self, NULL);
+  priv->doc = sopa_document_new ();
 
-  if (!g_markup_parse_context_parse (context, text, text_len, &internal_error));
+  /* streaming builds no document to keep offsets for */
+  if (priv->track_offsets && priv->matchers == NULL)
+    {
+      priv->source = g_byte_array_new ();
+      priv->source_cursor = 0;
+      priv->source_empty_tag = FALSE;
+      priv->spans = g_array_new (FALSE, FALSE, sizeof (SopaSourceSpan));
+      priv->open_spans = g_array_new (FALSE, FALSE, sizeof (guint));
+    }
+
+  return g_markup_parse_context_new (&markup_parser, 0, self, NULL);
+}
+
+/* hands the offsets recorded while parsing over to the document */
+static void
+sopa_parser_finish_source (SopaParser *self)
+{
+  SopaParserPrivate *priv = self->priv;
+  SopaSourceMap *map;
+  SopaSourceSpan *spans;
+  guint i;
 
+  source_add_span (self, SOPA_NODE (priv->doc), 0, priv->source->len);
 
-  if (!g_markup_parse_context_end_parse (context, &internal_error));
+  /* set once the tree is complete, adding children clears it */
+  spans = (SopaSourceSpan *) priv->spans->data;
+  for (i = 0; i < priv->spans->len; i++)
+    _sopa_node_get_serial (spans[i].node)->parsed = TRUE;
+
+  map = _sopa_source_map_new (g_byte_array_free_to_bytes (priv->source),
+                              priv->spans);
+  _sopa_document_set_source_map (priv->doc, map);
+
+  g_array_unref (priv->open_spans);
+  priv->source = NULL;
+  priv->spans = NULL;
+  priv->open_spans = NULL;
+}
+
+static SopaDocument *
+sopa_parser_end (SopaParser           *self,
+                 GMarkupParseContext  *context,
+                 gboolean              parsed,
+                 GError              **error)
+{
+  SopaDocument *doc = self->priv->doc;
 
+  if (parsed)
+    parsed = g_markup_parse_context_end_parse (context, error);
 
-  /* Adds remaining stack elements to the root (document) element */
-  self->priv->doc = sopa_document_new ();
-  sopa_parser_stack_give_parent (self,
-                                 SOPA_ELEMENT (self->priv->doc),
-                                 -1);
-  goto exit;
-exit:
   g_markup_parse_context_free (context);
 
-  if (internal_error != NULL)
+  if (parsed && self->priv->source != NULL)
+    sopa_parser_finish_source (self);
+
+  sopa_parser_reset (self);
+  self->priv->doc = NULL;
+
+  if (!parsed)
     {
-      g_propagate_error (error, internal_error);
-      //g_clear_error (&internal_error);
-      return FALSE;
+      g_object_unref (doc);
+      return NULL;
     }
 
-  return TRUE;
+  if (self->priv->subtree_pool != NULL && self->priv->matchers == NULL)
+    _sopa_subtree_pool_intern (self->priv->subtree_pool, doc);
+
+  /* the same kind of reference a parse cache hands out */
+  return g_object_ref_sink (doc);
 }
 
 /**
@@ -275,8 +732,16 @@ sopa_parser_new (void)
  *
  * The data need not be valid UTF-8; an error will be signaled if it's invalid.
  *
+ * If selectors were registered with sopa_parser_add_selector() only the
+ * matching sub-trees are built, and the returned document is empty.
+ *
+ * If a #SopaParseCache was set with sopa_parser_set_cache(), and it
+ * holds the document of the same text parsed with the same options,
+ * the document is handed out by the cache without parsing @text.
+ *
  * Return value: (transfer full): the newly created #SopaDocument if successful
- *      or %NULL otherwise
+ *      or %NULL otherwise; it is not floating, whether it was parsed or
+ *      handed out by a cache, and is released with g_object_unref()
  */
 SopaDocument *
 sopa_parser_parse (SopaParser   *self,
@@ -284,16 +749,117 @@ sopa_parser_parse (SopaParser   *self,
                    gssize        text_len,
                    GError      **error)
 {
+  SopaParserPrivate *priv;
+  GMarkupParseContext *context;
+  SopaParseCacheKey key;
+  SopaDocument *doc;
+  gboolean parsed, cached = FALSE;
+
   g_return_val_if_fail (SOPA_IS_PARSER (self), NULL);
   g_return_val_if_fail (text != NULL, NULL);
 
-  if (sopa_parser_parse_data (self,
-                              text,
-                              text_len,
-                              error))
-    return self->priv->doc;
+  priv = self->priv;
 
-  return NULL;
+  /* streaming hands its matches to callbacks, which a hit would skip */
+  if (priv->cache != NULL && priv->matchers == NULL)
+    {
+      if (text_len < 0)
+        text_len = strlen (text);
+
+      cached = _sopa_parse_cache_key_init (priv->cache,
+                                           &key,
+                                           text,
+                                           text_len,
+                                           priv->track_offsets ?
+                                             SOPA_PARSE_CACHE_TRACK_OFFSETS : 0);
+      if (cached)
+        {
+          doc = _sopa_parse_cache_lookup (priv->cache, &key);
+          if (doc != NULL)
+            return doc;
+        }
+    }
+
+  context = sopa_parser_begin (self);
+
+  if (priv->source != NULL)
+    {
+      if (text_len < 0)
+        text_len = strlen (text);
+
+      g_byte_array_append (priv->source,
+                           (const guint8 *) text,
+                           text_len);
+    }
+
+  parsed = g_markup_parse_context_parse (context, text, text_len, error);
+
+  doc = sopa_parser_end (self, context, parsed, error);
+
+  if (cached && doc != NULL)
+    doc = _sopa_parse_cache_insert (priv->cache, &key, doc);
+
+  return doc;
+}
+
+/**
+ * sopa_parser_parse_stream:
+ * @self: a #SopaParser
+ * @stream: a #GInputStream
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @error: return location for a #GError
+ *
+ * Parses the whole contents of @stream, reading it in fixed size chunks.
+ *
+ * Combined with sopa_parser_add_selector() the memory used while parsing
+ * is bound by the largest matching sub-tree, regardless of the size of
+ * the input.
+ *
+ * Return value: (transfer full): the newly created #SopaDocument if
+ *      successful or %NULL otherwise; it is not floating, and is
+ *      released with g_object_unref()
+ */
+SopaDocument *
+sopa_parser_parse_stream (SopaParser    *self,
+                          GInputStream  *stream,
+                          GCancellable  *cancellable,
+                          GError       **error)
+{
+  GMarkupParseContext *context;
+  gchar *buffer;
+  gssize n_read;
+  gboolean parsed = TRUE;
+
+  g_return_val_if_fail (SOPA_IS_PARSER (self), NULL);
+  g_return_val_if_fail (G_IS_INPUT_STREAM (stream), NULL);
+
+  context = sopa_parser_begin (self);
+  buffer = g_malloc (STREAM_CHUNK_SIZE);
+
+  while (parsed)
+    {
+      n_read = g_input_stream_read (stream,
+                                    buffer,
+                                    STREAM_CHUNK_SIZE,
+                                    cancellable,
+                                    error);
+      if (n_read <= 0)
+        {
+          parsed = n_read == 0;
+          break;
+        }
+
+      if (self->priv->source != NULL)
+        g_byte_array_append (self->priv->source,
+                             (const guint8 *) buffer,
+                             n_read);
+
+      parsed = g_markup_parse_context_parse (context, buffer, n_read, error);
+    }
+
+  g_free (buffer);
+
+  return sopa_parser_end (self, context, parsed, error);
 }
 
 /**
@@ -322,3 +888,239 @@ sopa_parser_parse_async (SopaParser           *self,
 
   //TODO
 }
+
+/**
+ * sopa_parser_set_track_offsets:
+ * @self: a #SopaParser
+ * @track_offsets: whether to record source offsets
+ *
+ * Sets whether the documents parsed by @self keep their source and the
+ * range of the markup of each node within it, for
+ * sopa_node_get_source_range(), sopa_node_get_source_position() and
+ * to copy the markup of unchanged nodes in sopa_node_get_outer_html().
+ *
+ * The ranges are kept in a single table of the document, which costs
+ * a pointer and two 32 bit offsets per node, and lines are only
+ * indexed when a position is asked for. Nothing is recorded while
+ * streaming with sopa_parser_add_selector().
+ *
+ * Since: 0.2
+ */
+void
+sopa_parser_set_track_offsets (SopaParser *self,
+                               gboolean    track_offsets)
+{
+  g_return_if_fail (SOPA_IS_PARSER (self));
+
+  track_offsets = !!track_offsets;
+
+  if (self->priv->track_offsets == track_offsets)
+    return;
+
+  self->priv->track_offsets = track_offsets;
+
+  g_object_notify_by_pspec (G_OBJECT (self), obj_props[PROP_TRACK_OFFSETS]);
+}
+
+/**
+ * sopa_parser_get_track_offsets:
+ * @self: a #SopaParser
+ *
+ * Retrieves whether @self records source offsets.
+ *
+ * Return value: %TRUE if source offsets are recorded
+ *
+ * Since: 0.2
+ */
+gboolean
+sopa_parser_get_track_offsets (SopaParser *self)
+{
+  g_return_val_if_fail (SOPA_IS_PARSER (self), FALSE);
+
+  return self->priv->track_offsets;
+}
+
+/**
+ * sopa_parser_add_selector:
+ * @self: a #SopaParser
+ * @selector: a #SopaSelector
+ * @func: the function called for each matching element
+ * @user_data: user data passed to @func
+ * @notify: (allow-none): function called to free @user_data
+ *
+ * Switches @self to streaming mode, in which only the elements matched by
+ * one of the registered selectors are built. Each matching element is
+ * built with all its children and handed to @func, detached from any
+ * parent, as soon as its closing tag is parsed; it is released after @func
+ * returns, so @func must acquire a reference to keep it.
+ *
+ * Elements nested inside a match are not matched again. Selectors are
+ * evaluated against the ancestors of an element, so combinators and
+ * attribute selectors work as they do on a full document.
+ *
+ * Selectors cannot be added or removed while parsing.
+ *
+ * Return value: an identifier to use with sopa_parser_remove_selector()
+ */
+guint
+sopa_parser_add_selector (SopaParser           *self,
+                          SopaSelector         *selector,
+                          SopaParserMatchFunc   func,
+                          gpointer              user_data,
+                          GDestroyNotify        notify)
+{
+  SopaParserMatcher *matcher;
+
+  g_return_val_if_fail (SOPA_IS_PARSER (self), 0);
+  g_return_val_if_fail (selector != NULL, 0);
+  g_return_val_if_fail (func != NULL, 0);
+  g_return_val_if_fail (self->priv->doc == NULL, 0);
+
+  matcher = g_slice_new (SopaParserMatcher);
+  matcher->id = ++self->priv->last_matcher_id;
+  matcher->selector = sopa_selector_ref (selector);
+  matcher->func = func;
+  matcher->data = user_data;
+  matcher->notify = notify;
+
+  self->priv->matchers = g_list_append (self->priv->matchers, matcher);
+
+  return matcher->id;
+}
+
+/**
+ * sopa_parser_remove_selector:
+ * @self: a #SopaParser
+ * @id: an identifier returned by sopa_parser_add_selector()
+ *
+ * Removes a selector. When no selectors are left, @self builds whole
+ * documents again.
+ */
+void
+sopa_parser_remove_selector (SopaParser *self,
+                             guint       id)
+{
+  GList *l;
+
+  g_return_if_fail (SOPA_IS_PARSER (self));
+  g_return_if_fail (self->priv->doc == NULL);
+
+  for (l = self->priv->matchers; l != NULL; l = l->next)
+    {
+      SopaParserMatcher *matcher = l->data;
+
+      if (matcher->id == id)
+        {
+          self->priv->matchers = g_list_delete_link (self->priv->matchers, l);
+          sopa_parser_matcher_free (matcher);
+          return;
+        }
+    }
+}
+
+/**
+ * sopa_parser_set_cache:
+ * @self: a #SopaParser
+ * @cache: (allow-none): a #SopaParseCache, or %NULL
+ *
+ * Attaches @self to @cache, so that sopa_parser_parse() looks the text
+ * up in @cache before parsing it and adds the documents it parses to
+ * it. A cache can be shared by any number of parsers, in any threads.
+ *
+ * The cache is not used while streaming with sopa_parser_add_selector(),
+ * nor by sopa_parser_parse_stream(), whose text is only known once it
+ * is parsed. Documents keeping their source offsets are only cached
+ * by caches in %SOPA_PARSE_CACHE_SHARE mode, as clones do not carry
+ * the offsets.
+ *
+ * Since: 0.2
+ */
+void
+sopa_parser_set_cache (SopaParser     *self,
+                       SopaParseCache *cache)
+{
+  g_return_if_fail (SOPA_IS_PARSER (self));
+
+  if (self->priv->cache == cache)
+    return;
+
+  if (cache != NULL)
+    sopa_parse_cache_ref (cache);
+
+  if (self->priv->cache != NULL)
+    sopa_parse_cache_unref (self->priv->cache);
+
+  self->priv->cache = cache;
+
+  g_object_notify_by_pspec (G_OBJECT (self), obj_props[PROP_CACHE]);
+}
+
+/**
+ * sopa_parser_get_cache:
+ * @self: a #SopaParser
+ *
+ * Retrieves the cache @self is attached to.
+ *
+ * Return value: (transfer none): the #SopaParseCache of @self, or %NULL
+ *
+ * Since: 0.2
+ */
+SopaParseCache *
+sopa_parser_get_cache (SopaParser *self)
+{
+  g_return_val_if_fail (SOPA_IS_PARSER (self), NULL);
+
+  return self->priv->cache;
+}
+
+/**
+ * sopa_parser_set_subtree_pool:
+ * @self: a #SopaParser
+ * @pool: (allow-none): a #SopaSubtreePool, or %NULL
+ *
+ * Sets the pool through which the documents parsed by @self share the
+ * tags, attributes and text contents of the subtrees they repeat with
+ * the documents parsed before them; see #SopaSubtreePool. A pool can
+ * be shared by any number of parsers, in any threads.
+ *
+ * The pool is not used while streaming with sopa_parser_add_selector().
+ *
+ * Since: 0.2
+ */
+void
+sopa_parser_set_subtree_pool (SopaParser      *self,
+                              SopaSubtreePool *pool)
+{
+  g_return_if_fail (SOPA_IS_PARSER (self));
+
+  if (self->priv->subtree_pool == pool)
+    return;
+
+  if (pool != NULL)
+    sopa_subtree_pool_ref (pool);
+
+  if (self->priv->subtree_pool != NULL)
+    sopa_subtree_pool_unref (self->priv->subtree_pool);
+
+  self->priv->subtree_pool = pool;
+
+  g_object_notify_by_pspec (G_OBJECT (self), obj_props[PROP_SUBTREE_POOL]);
+}
+
+/**
+ * sopa_parser_get_subtree_pool:
+ * @self: a #SopaParser
+ *
+ * Retrieves the pool of subtrees set on @self.
+ *
+ * Return value: (transfer none): the #SopaSubtreePool of @self, or %NULL
+ *
+ * Since: 0.2
+ */
+SopaSubtreePool *
+sopa_parser_get_subtree_pool (SopaParser *self)
+{
+  g_return_val_if_fail (SOPA_IS_PARSER (self), NULL);
+
+  return self->priv->subtree_pool;
+}
@@ -26,6 +26,9 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 #include <sopa/sopa-document.h>
+#include <sopa/sopa-parse-cache.h>
+#include <sopa/sopa-selector.h>
+#include <sopa/sopa-subtree-pool.h>
 
 G_BEGIN_DECLS
 
@@ -67,6 +70,20 @@ struct _SopaParserClass
   GObjectClass parent_class;
 };
 
+/**
+ * SopaParserMatchFunc:
+ * @parser: the #SopaParser
+ * @element: (transfer none): the matching element, detached from its
+ *     parent and holding all its children
+ * @user_data: the data passed to sopa_parser_add_selector()
+ *
+ * The function called by a streaming #SopaParser for each element
+ * matching a registered selector.
+ */
+typedef void (* SopaParserMatchFunc) (SopaParser   *parser,
+                                      SopaElement  *element,
+                                      gpointer      user_data);
+
 GType sopa_parser_get_type (void) G_GNUC_CONST;
 
 SopaParser *                      sopa_parser_new                               (void);
@@ -74,12 +91,32 @@ SopaDocument *                    sopa_parser_parse
                                                                                  const gchar            *text,
                                                                                  gssize                  text_len,
                                                                                  GError                **error);
+SopaDocument *                    sopa_parser_parse_stream                      (SopaParser             *self,
+                                                                                 GInputStream           *stream,
+                                                                                 GCancellable           *cancellable,
+                                                                                 GError                **error);
 void                              sopa_parser_parse_async                       (SopaParser             *self,
                                                                                  const gchar            *text,
                                                                                  gssize                  text_len,
                                                                                  GCancellable           *cancellable,
                                                                                  GAsyncReadyCallback     callback,
                                                                                  gpointer                user_data);
+void                              sopa_parser_set_track_offsets                 (SopaParser             *self,
+                                                                                 gboolean                track_offsets);
+gboolean                          sopa_parser_get_track_offsets                 (SopaParser             *self);
+void                              sopa_parser_set_cache                         (SopaParser             *self,
+                                                                                 SopaParseCache         *cache);
+SopaParseCache *                  sopa_parser_get_cache                         (SopaParser             *self);
+void                              sopa_parser_set_subtree_pool                  (SopaParser             *self,
+                                                                                 SopaSubtreePool        *pool);
+SopaSubtreePool *                 sopa_parser_get_subtree_pool                  (SopaParser             *self);
+guint                             sopa_parser_add_selector                      (SopaParser             *self,
+                                                                                 SopaSelector           *selector,
+                                                                                 SopaParserMatchFunc     func,
+                                                                                 gpointer                user_data,
+                                                                                 GDestroyNotify          notify);
+void                              sopa_parser_remove_selector                   (SopaParser             *self,
+                                                                                 guint                   id);
 
 G_END_DECLS
 
@@ -0,0 +1,1030 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-patch.c
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+/**
+ * SECTION:sopa-patch
+ * @short_description: The differences between two documents
+ *
+ * A #SopaPatch is the edit script turning a document into another,
+ * made by sopa_document_diff() and applied by
+ * sopa_document_apply_patch().
+ *
+ * Nodes are identified by their index in the document order of the
+ * document the patch applies to, where the document itself is the
+ * node 0; the sub-trees inserted by the patch are numbered after
+ * them, in the order they are inserted.
+ */
+
+#include <string.h>
+
+#include "sopa-patch.h"
+#include "sopa-patch-private.h"
+
+#include "sopa-element.h"
+#include "sopa-element-private.h"
+#include "sopa-node-private.h"
+#include "sopa-text.h"
+
+G_DEFINE_BOXED_TYPE (SopaPatch, sopa_patch,
+                     sopa_patch_ref,
+                     sopa_patch_unref)
+
+G_DEFINE_QUARK (sopa-patch-error-quark, sopa_patch_error)
+
+/* the reference of operations appending to the children */
+#define NO_NODE G_MAXUINT
+
+typedef struct _PatchOperation PatchOperation;
+typedef struct _DiffPair DiffPair;
+typedef struct _DiffState DiffState;
+
+struct _PatchOperation
+{
+  SopaPatchOperationType  type;
+
+  /* the node deleted, moved or changed */
+  guint                   node;
+
+  /* where inserted and moved nodes go, before @before */
+  guint                   parent;
+  guint                   before;
+
+  gchar                  *name;
+  gchar                  *value;
+
+  /* the inserted sub-tree, copied again on every application */
+  SopaNode               *subtree;
+};
+
+struct _SopaPatch
+{
+  volatile gint  ref_count;
+
+  /* the document the patch applies to */
+  guint          n_base_nodes;
+  guint64        base_hash;
+
+  GArray        *operations;
+};
+
+/* two nodes matched with each other, whose sub-trees differ */
+struct _DiffPair
+{
+  SopaNode      *old_node;
+  SopaNode      *new_node;
+
+  SopaNode     **old_children;
+
+  /* for each child of @new_node, the position of its match among
+   * @old_children, or -1
+   */
+  gint          *matches;
+  guint          n_matches;
+
+  /* the children of @old_node without a match */
+  GPtrArray     *deleted;
+};
+
+struct _DiffState
+{
+  SopaPatch     *patch;
+
+  /* DiffPair, in the order they were matched */
+  GArray        *pairs;
+
+  /* hash -> index in @heads, reused for the children of every pair */
+  GHashTable    *buckets;
+
+  /* the inserted sub-trees that are moved deleted ones instead:
+   * new root -> old root, and the old roots that were taken
+   */
+  GHashTable    *moved;
+  GHashTable    *moved_from;
+
+  guint          next_id;
+};
+
+static void
+patch_operation_clear (gpointer data)
+{
+  PatchOperation *operation = data;
+
+  g_free (operation->name);
+  g_free (operation->value);
+
+  if (operation->subtree != NULL)
+    {
+      sopa_node_destroy (operation->subtree);
+      g_object_unref (operation->subtree);
+    }
+}
+
+static SopaPatch *
+sopa_patch_new (void)
+{
+  SopaPatch *self;
+
+  self = g_slice_new0 (SopaPatch);
+  self->ref_count = 1;
+
+  self->operations = g_array_new (FALSE, TRUE, sizeof (PatchOperation));
+  g_array_set_clear_func (self->operations, patch_operation_clear);
+
+  return self;
+}
+
+/**
+ * sopa_patch_ref:
+ * @self: a #SopaPatch
+ *
+ * Acquires a reference on @self.
+ *
+ * Return value: (transfer full): @self
+ *
+ * Since: 0.2
+ */
+SopaPatch *
+sopa_patch_ref (SopaPatch *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+/**
+ * sopa_patch_unref:
+ * @self: a #SopaPatch
+ *
+ * Releases a reference on @self, freeing it when the last one is
+ * released.
+ *
+ * Since: 0.2
+ */
+void
+sopa_patch_unref (SopaPatch *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      g_array_unref (self->operations);
+      g_slice_free (SopaPatch, self);
+    }
+}
+
+/**
+ * sopa_patch_get_n_operations:
+ * @self: a #SopaPatch
+ *
+ * Retrieves the number of operations of @self; a patch between equal
+ * documents has none.
+ *
+ * Return value: the number of operations
+ *
+ * Since: 0.2
+ */
+guint
+sopa_patch_get_n_operations (SopaPatch *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->operations->len;
+}
+
+/**
+ * sopa_patch_get_operation_type:
+ * @self: a #SopaPatch
+ * @index_: the index of an operation
+ *
+ * Retrieves the type of an operation of @self.
+ *
+ * Return value: the #SopaPatchOperationType of the operation
+ *
+ * Since: 0.2
+ */
+SopaPatchOperationType
+sopa_patch_get_operation_type (SopaPatch *self,
+                               guint      index_)
+{
+  g_return_val_if_fail (self != NULL, SOPA_PATCH_OPERATION_DELETE);
+  g_return_val_if_fail (index_ < self->operations->len,
+                        SOPA_PATCH_OPERATION_DELETE);
+
+  return g_array_index (self->operations, PatchOperation, index_).type;
+}
+
+static void
+append_quoted (GString     *str,
+               const gchar *value)
+{
+  gchar *escaped;
+
+  escaped = g_strescape (value != NULL ? value : "", NULL);
+  g_string_append_printf (str, " \"%s\"", escaped);
+  g_free (escaped);
+}
+
+static void
+append_place (GString              *str,
+              const PatchOperation *operation)
+{
+  g_string_append_printf (str, " %u", operation->parent);
+
+  if (operation->before == NO_NODE)
+    g_string_append (str, " end");
+  else
+    g_string_append_printf (str, " before %u", operation->before);
+}
+
+/**
+ * sopa_patch_to_string:
+ * @self: a #SopaPatch
+ *
+ * Describes the operations of @self, one per line, to show or log
+ * the differences between two documents:
+ *
+ * |[
+ * delete 12
+ * insert 3 before 7 &lt;p&gt;New&lt;/p&gt;
+ * move 9 3 end
+ * set-attribute 5 class "item"
+ * remove-attribute 5 hidden
+ * set-text 8 "Updated"
+ * ]|
+ *
+ * Nodes are given by their index in the document order of the
+ * original document.
+ *
+ * Return value: (transfer full): a newly allocated string, free it
+ *      with g_free()
+ *
+ * Since: 0.2
+ */
+gchar *
+sopa_patch_to_string (SopaPatch *self)
+{
+  GString *str;
+  guint i;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  str = g_string_new (NULL);
+
+  for (i = 0; i < self->operations->len; i++)
+    {
+      const PatchOperation *operation;
+      gchar *markup;
+
+      operation = &g_array_index (self->operations, PatchOperation, i);
+
+      switch (operation->type)
+        {
+        case SOPA_PATCH_OPERATION_DELETE:
+          g_string_append_printf (str, "delete %u", operation->node);
+          break;
+
+        case SOPA_PATCH_OPERATION_INSERT:
+          g_string_append (str, "insert");
+          append_place (str, operation);
+
+          markup = sopa_node_get_outer_html (operation->subtree, NULL);
+          g_string_append_c (str, ' ');
+          g_string_append (str, markup);
+          g_free (markup);
+          break;
+
+        case SOPA_PATCH_OPERATION_MOVE:
+          g_string_append_printf (str, "move %u", operation->node);
+          append_place (str, operation);
+          break;
+
+        case SOPA_PATCH_OPERATION_SET_ATTRIBUTE:
+          g_string_append_printf (str, "set-attribute %u %s",
+                                  operation->node,
+                                  operation->name);
+          append_quoted (str, operation->value);
+          break;
+
+        case SOPA_PATCH_OPERATION_REMOVE_ATTRIBUTE:
+          g_string_append_printf (str, "remove-attribute %u %s",
+                                  operation->node,
+                                  operation->name);
+          break;
+
+        case SOPA_PATCH_OPERATION_SET_TEXT:
+          g_string_append_printf (str, "set-text %u", operation->node);
+          append_quoted (str, operation->value);
+          break;
+        }
+
+      g_string_append_c (str, '\n');
+    }
+
+  return g_string_free (str, FALSE);
+}
+
+static PatchOperation *
+diff_add_operation (DiffState              *state,
+                    SopaPatchOperationType  type,
+                    SopaNode               *node)
+{
+  GArray *operations = state->patch->operations;
+  PatchOperation *operation;
+
+  g_array_set_size (operations, operations->len + 1);
+
+  operation = &g_array_index (operations, PatchOperation, operations->len - 1);
+  operation->type = type;
+  operation->node = node != NULL ? _sopa_node_get_index (node) : NO_NODE;
+  operation->parent = NO_NODE;
+  operation->before = NO_NODE;
+
+  return operation;
+}
+
+/* the key used to match children which are not identical: elements
+ * only match elements with the same tag and id
+ */
+static guint64
+diff_get_key (SopaNode *node)
+{
+  guint64 key;
+
+  key = g_str_hash (G_OBJECT_TYPE_NAME (node));
+
+  if (SOPA_IS_ELEMENT (node))
+    {
+      SopaElement *element = SOPA_ELEMENT (node);
+      const gchar *id;
+
+      key = key * 31 + g_str_hash (sopa_element_get_tag (element));
+
+      id = sopa_element_get_attribute (element, "id");
+      if (id != NULL)
+        key = key * 31 + g_str_hash (id);
+    }
+
+  return key;
+}
+
+static gboolean
+diff_can_match (SopaNode *old_node,
+                SopaNode *new_node)
+{
+  if (G_OBJECT_TYPE (old_node) != G_OBJECT_TYPE (new_node))
+    return FALSE;
+
+  if (SOPA_IS_ELEMENT (old_node))
+    return g_strcmp0 (sopa_element_get_tag (SOPA_ELEMENT (old_node)),
+                      sopa_element_get_tag (SOPA_ELEMENT (new_node))) == 0 &&
+           g_strcmp0 (sopa_element_get_attribute (SOPA_ELEMENT (old_node), "id"),
+                      sopa_element_get_attribute (SOPA_ELEMENT (new_node), "id")) == 0;
+
+  return TRUE;
+}
+
+/* pairs the children of @new_nodes with the ones of @old_nodes with
+ * the same value in @keys, first come first served; @chain links the
+ * old children with the same key, in order. With @exact the keys are
+ * hashes, and the children are only paired when they are equal, so
+ * that a collision never pairs different sub-trees
+ */
+static void
+diff_match_by_key (DiffState  *state,
+                   SopaNode  **old_nodes,
+                   guint64    *old_keys,
+                   gboolean   *old_matched,
+                   guint       n_old,
+                   SopaNode  **new_nodes,
+                   guint64    *new_keys,
+                   gint       *matches,
+                   guint       n_new,
+                   gboolean    exact)
+{
+  GArray *heads;
+  gint *chain;
+  guint i, j;
+
+  g_hash_table_remove_all (state->buckets);
+  heads = g_array_new (FALSE, FALSE, sizeof (gint));
+  chain = g_new (gint, n_old);
+
+  /* built backwards, so that each chain starts with the first child */
+  for (i = n_old; i-- > 0; )
+    {
+      gpointer bucket;
+
+      chain[i] = -1;
+
+      if (old_matched[i])
+        continue;
+
+      if (g_hash_table_lookup_extended (state->buckets, &old_keys[i],
+                                        NULL, &bucket))
+        {
+          chain[i] = g_array_index (heads, gint, GPOINTER_TO_UINT (bucket));
+          g_array_index (heads, gint, GPOINTER_TO_UINT (bucket)) = i;
+        }
+      else
+        {
+          gint first = i;
+
+          g_hash_table_insert (state->buckets, &old_keys[i],
+                               GUINT_TO_POINTER (heads->len));
+          g_array_append_val (heads, first);
+        }
+    }
+
+  for (j = 0; j < n_new; j++)
+    {
+      gpointer bucket;
+      gint *head, candidate;
+
+      if (matches[j] >= 0 ||
+          !g_hash_table_lookup_extended (state->buckets, &new_keys[j],
+                                         NULL, &bucket))
+        continue;
+
+      head = &g_array_index (heads, gint, GPOINTER_TO_UINT (bucket));
+      while (*head >= 0 && old_matched[*head])
+        *head = chain[*head];
+
+      for (candidate = *head; candidate >= 0; candidate = chain[candidate])
+        {
+          if (old_matched[candidate])
+            continue;
+
+          if (exact
+              ? sopa_node_equal (old_nodes[candidate], new_nodes[j])
+              : diff_can_match (old_nodes[candidate], new_nodes[j]))
+            {
+              old_matched[candidate] = TRUE;
+              matches[j] = candidate;
+              break;
+            }
+        }
+    }
+
+  g_free (chain);
+  g_array_unref (heads);
+}
+
+/* matches the children of the nodes of @pair: identical sub-trees by
+ * their hash, then the rest by tag and id, in order; the matched
+ * children that differ become new pairs
+ */
+static void
+diff_match_children (DiffState *state,
+                     guint      pair_index)
+{
+  DiffPair *pair = &g_array_index (state->pairs, DiffPair, pair_index);
+  SopaNode **old_nodes, **new_nodes, *child;
+  guint64 *old_keys, *new_keys;
+  gboolean *old_matched, *identical;
+  gint *matches;
+  guint n_old, n_new, i, j;
+
+  n_old = sopa_element_get_n_children (SOPA_ELEMENT (pair->old_node));
+  n_new = sopa_element_get_n_children (SOPA_ELEMENT (pair->new_node));
+
+  old_nodes = g_new (SopaNode *, n_old);
+  old_keys = g_new (guint64, n_old);
+  old_matched = g_new0 (gboolean, n_old);
+  new_nodes = g_new (SopaNode *, n_new);
+  new_keys = g_new (guint64, n_new);
+  matches = g_new (gint, n_new);
+
+  for (child = sopa_node_get_first_child (pair->old_node), i = 0;
+       child != NULL;
+       child = sopa_node_get_next_sibling (child), i++)
+    {
+      old_nodes[i] = child;
+      old_keys[i] = sopa_node_get_hash (child);
+    }
+
+  for (child = sopa_node_get_first_child (pair->new_node), j = 0;
+       child != NULL;
+       child = sopa_node_get_next_sibling (child), j++)
+    {
+      new_nodes[j] = child;
+      new_keys[j] = sopa_node_get_hash (child);
+      matches[j] = -1;
+    }
+
+  diff_match_by_key (state,
+                     old_nodes, old_keys, old_matched, n_old,
+                     new_nodes, new_keys, matches, n_new,
+                     TRUE);
+
+  /* the children matched so far are known to be equal */
+  identical = g_new (gboolean, n_new);
+  for (j = 0; j < n_new; j++)
+    identical[j] = matches[j] >= 0;
+
+  for (i = 0; i < n_old; i++)
+    old_keys[i] = diff_get_key (old_nodes[i]);
+  for (j = 0; j < n_new; j++)
+    new_keys[j] = diff_get_key (new_nodes[j]);
+
+  diff_match_by_key (state,
+                     old_nodes, old_keys, old_matched, n_old,
+                     new_nodes, new_keys, matches, n_new,
+                     FALSE);
+
+  /* the pair may have moved in the array while matching */
+  pair = &g_array_index (state->pairs, DiffPair, pair_index);
+  pair->old_children = old_nodes;
+  pair->matches = matches;
+  pair->n_matches = n_new;
+  pair->deleted = g_ptr_array_new ();
+
+  for (i = 0; i < n_old; i++)
+    {
+      if (!old_matched[i])
+        g_ptr_array_add (pair->deleted, old_nodes[i]);
+    }
+
+  for (j = 0; j < n_new; j++)
+    {
+      SopaNode *old_node;
+      DiffPair new_pair = { NULL, };
+
+      if (matches[j] < 0)
+        continue;
+
+      old_node = old_nodes[matches[j]];
+      if (identical[j] || sopa_node_equal (old_node, new_nodes[j]))
+        continue;
+
+      new_pair.old_node = old_node;
+      new_pair.new_node = new_nodes[j];
+      g_array_append_val (state->pairs, new_pair);
+    }
+
+  g_free (identical);
+  g_free (old_keys);
+  g_free (old_matched);
+  g_free (new_nodes);
+  g_free (new_keys);
+}
+
+/* turns the insertions of sub-trees identical to deleted ones, under
+ * any parent, into moves; the deleted sub-trees are found by hash,
+ * and only moved when they are equal to the inserted one
+ */
+static void
+diff_find_moves (DiffState *state)
+{
+  GHashTable *deleted;
+  GHashTableIter iter;
+  gpointer nodes;
+  guint i, j;
+
+  /* hash -> the deleted sub-trees with it */
+  deleted = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+
+  for (i = 0; i < state->pairs->len; i++)
+    {
+      DiffPair *pair = &g_array_index (state->pairs, DiffPair, i);
+
+      for (j = 0; j < pair->deleted->len; j++)
+        {
+          SopaNode *node = g_ptr_array_index (pair->deleted, j);
+          guint64 *hash;
+
+          hash = g_new (guint64, 1);
+          *hash = sopa_node_get_hash (node);
+
+          nodes = g_hash_table_lookup (deleted, hash);
+          g_hash_table_replace (deleted, hash, g_slist_prepend (nodes, node));
+        }
+    }
+
+  for (i = 0; i < state->pairs->len && g_hash_table_size (deleted) > 0; i++)
+    {
+      DiffPair *pair = &g_array_index (state->pairs, DiffPair, i);
+      SopaNode *child;
+
+      for (child = sopa_node_get_first_child (pair->new_node), j = 0;
+           child != NULL;
+           child = sopa_node_get_next_sibling (child), j++)
+        {
+          GSList *list, *link;
+          guint64 hash;
+
+          if (pair->matches[j] >= 0)
+            continue;
+
+          hash = sopa_node_get_hash (child);
+          list = g_hash_table_lookup (deleted, &hash);
+
+          for (link = list; link != NULL; link = link->next)
+            {
+              if (sopa_node_equal (link->data, child))
+                break;
+            }
+
+          if (link == NULL)
+            continue;
+
+          g_hash_table_insert (state->moved, child, link->data);
+          g_hash_table_add (state->moved_from, link->data);
+
+          list = g_slist_delete_link (list, link);
+          if (list != NULL)
+            g_hash_table_replace (deleted,
+                                  g_memdup (&hash, sizeof (hash)),
+                                  list);
+          else
+            g_hash_table_remove (deleted, &hash);
+        }
+    }
+
+  g_hash_table_iter_init (&iter, deleted);
+  while (g_hash_table_iter_next (&iter, NULL, &nodes))
+    g_slist_free (nodes);
+
+  g_hash_table_unref (deleted);
+}
+
+/* marks the longest run of matched children already in order, which
+ * stays in place while the others are moved around it
+ */
+static gboolean *
+diff_find_stable (const gint *matches,
+                  guint       n_matches)
+{
+  gboolean *stable;
+  gint *tails, *previous;
+  guint length = 0, j;
+  gint k;
+
+  stable = g_new0 (gboolean, n_matches);
+  tails = g_new (gint, n_matches + 1);
+  previous = g_new (gint, n_matches + 1);
+
+  for (j = 0; j < n_matches; j++)
+    {
+      guint low = 0, high = length;
+
+      if (matches[j] < 0)
+        continue;
+
+      while (low < high)
+        {
+          guint middle = low + (high - low) / 2;
+
+          if (matches[tails[middle]] < matches[j])
+            low = middle + 1;
+          else
+            high = middle;
+        }
+
+      previous[j] = low > 0 ? tails[low - 1] : -1;
+      tails[low] = j;
+
+      if (low == length)
+        length++;
+    }
+
+  for (k = length > 0 ? tails[length - 1] : -1; k >= 0; k = previous[k])
+    stable[k] = TRUE;
+
+  g_free (tails);
+  g_free (previous);
+
+  return stable;
+}
+
+static void
+diff_emit_attributes (DiffState   *state,
+                      SopaElement *old_element,
+                      SopaElement *new_element)
+{
+  const SopaElementAttribute *old_attributes, *new_attributes;
+  PatchOperation *operation;
+  guint n_old, n_new, n_kept, i;
+
+  old_attributes = _sopa_element_get_attributes (old_element, &n_old);
+  new_attributes = _sopa_element_get_attributes (new_element, &n_new);
+
+  /* the attributes keep their order: the ones with the same names in
+   * the same positions are changed in place, the rest replaced
+   */
+  for (n_kept = 0;
+       n_kept < n_old && n_kept < n_new &&
+       strcmp (old_attributes[n_kept].name, new_attributes[n_kept].name) == 0;
+       n_kept++)
+    ;
+
+  for (i = n_kept; i < n_old; i++)
+    {
+      operation = diff_add_operation (state,
+                                      SOPA_PATCH_OPERATION_REMOVE_ATTRIBUTE,
+                                      SOPA_NODE (old_element));
+      operation->name = g_strdup (old_attributes[i].name);
+    }
+
+  for (i = 0; i < n_new; i++)
+    {
+      if (i < n_kept &&
+          g_strcmp0 (old_attributes[i].value, new_attributes[i].value) == 0)
+        continue;
+
+      operation = diff_add_operation (state,
+                                      SOPA_PATCH_OPERATION_SET_ATTRIBUTE,
+                                      SOPA_NODE (old_element));
+      operation->name = g_strdup (new_attributes[i].name);
+      operation->value = g_strdup (new_attributes[i].value);
+    }
+}
+
+/* the operations turning the old node of @pair into the new one,
+ * leaving out the pairs of their children
+ */
+static void
+diff_emit_pair (DiffState *state,
+                DiffPair  *pair)
+{
+  PatchOperation *operation;
+  SopaNode **new_nodes, *child;
+  gboolean *stable;
+  guint parent, before, j;
+
+  if (SOPA_IS_TEXT (pair->old_node))
+    {
+      const gchar *content = sopa_text_get_content (SOPA_TEXT (pair->new_node));
+
+      if (g_strcmp0 (sopa_text_get_content (SOPA_TEXT (pair->old_node)),
+                     content) != 0)
+        {
+          operation = diff_add_operation (state,
+                                          SOPA_PATCH_OPERATION_SET_TEXT,
+                                          pair->old_node);
+          operation->value = g_strdup (content);
+        }
+    }
+
+  if (!SOPA_IS_ELEMENT (pair->old_node))
+    return;
+
+  diff_emit_attributes (state,
+                        SOPA_ELEMENT (pair->old_node),
+                        SOPA_ELEMENT (pair->new_node));
+
+  for (j = 0; j < pair->deleted->len; j++)
+    {
+      child = g_ptr_array_index (pair->deleted, j);
+
+      if (!g_hash_table_contains (state->moved_from, child))
+        diff_add_operation (state, SOPA_PATCH_OPERATION_DELETE, child);
+    }
+
+  new_nodes = g_new (SopaNode *, pair->n_matches);
+  for (child = sopa_node_get_first_child (pair->new_node), j = 0;
+       child != NULL;
+       child = sopa_node_get_next_sibling (child), j++)
+    new_nodes[j] = child;
+
+  stable = diff_find_stable (pair->matches, pair->n_matches);
+  parent = _sopa_node_get_index (pair->old_node);
+
+  /* backwards, so that each child goes before the one following it */
+  before = NO_NODE;
+  for (j = pair->n_matches; j-- > 0; )
+    {
+      SopaNode *old_node = NULL;
+
+      if (pair->matches[j] >= 0)
+        {
+          old_node = pair->old_children[pair->matches[j]];
+          if (stable[j])
+            {
+              before = _sopa_node_get_index (old_node);
+              continue;
+            }
+        }
+      else
+        old_node = g_hash_table_lookup (state->moved, new_nodes[j]);
+
+      if (old_node != NULL)
+        {
+          operation = diff_add_operation (state,
+                                          SOPA_PATCH_OPERATION_MOVE,
+                                          old_node);
+        }
+      else
+        {
+          operation = diff_add_operation (state,
+                                          SOPA_PATCH_OPERATION_INSERT,
+                                          NULL);
+          operation->subtree =
+            g_object_ref_sink (sopa_node_clone (new_nodes[j],
+                                                SOPA_NODE_CLONE_COPY_ON_WRITE));
+          operation->node = state->next_id++;
+        }
+
+      operation->parent = parent;
+      operation->before = before;
+      before = operation->node;
+    }
+
+  g_free (stable);
+  g_free (new_nodes);
+}
+
+/*< private >
+ * _sopa_patch_diff:
+ * @old_document: a #SopaDocument
+ * @new_document: a #SopaDocument
+ *
+ * Makes the patch turning @old_document into @new_document; see
+ * sopa_document_diff().
+ *
+ * Return value: (transfer full): a new #SopaPatch
+ */
+SopaPatch *
+_sopa_patch_diff (SopaDocument *old_document,
+                  SopaDocument *new_document)
+{
+  DiffState state;
+  DiffPair root = { NULL, };
+  guint i;
+
+  state.patch = sopa_patch_new ();
+  state.patch->base_hash = sopa_node_get_hash (SOPA_NODE (old_document));
+  state.patch->n_base_nodes =
+    _sopa_node_get_subtree_size (SOPA_NODE (old_document));
+  state.next_id = state.patch->n_base_nodes;
+
+  /* identical documents; equal hashes are checked node by node */
+  if (sopa_node_equal (SOPA_NODE (old_document), SOPA_NODE (new_document)))
+    return state.patch;
+
+  state.pairs = g_array_new (FALSE, FALSE, sizeof (DiffPair));
+  state.buckets = g_hash_table_new (g_int64_hash, g_int64_equal);
+  state.moved = g_hash_table_new (NULL, NULL);
+  state.moved_from = g_hash_table_new (NULL, NULL);
+
+  root.old_node = SOPA_NODE (old_document);
+  root.new_node = SOPA_NODE (new_document);
+  g_array_append_val (state.pairs, root);
+
+  /* breadth first; the array grows while it is walked */
+  for (i = 0; i < state.pairs->len; i++)
+    {
+      DiffPair *pair = &g_array_index (state.pairs, DiffPair, i);
+
+      if (SOPA_IS_ELEMENT (pair->old_node))
+        diff_match_children (&state, i);
+      else
+        pair->deleted = g_ptr_array_new ();
+    }
+
+  diff_find_moves (&state);
+
+  for (i = 0; i < state.pairs->len; i++)
+    diff_emit_pair (&state, &g_array_index (state.pairs, DiffPair, i));
+
+  for (i = 0; i < state.pairs->len; i++)
+    {
+      DiffPair *pair = &g_array_index (state.pairs, DiffPair, i);
+
+      g_free (pair->old_children);
+      g_free (pair->matches);
+      g_ptr_array_unref (pair->deleted);
+    }
+
+  g_array_unref (state.pairs);
+  g_hash_table_unref (state.buckets);
+  g_hash_table_unref (state.moved);
+  g_hash_table_unref (state.moved_from);
+
+  return state.patch;
+}
+
+static void
+patch_insert (SopaNode *parent,
+              SopaNode *child,
+              SopaNode *before)
+{
+  if (before != NULL)
+    sopa_node_insert_child_below (parent, child, before);
+  else
+    sopa_node_add_child (parent, child);
+}
+
+/*< private >
+ * _sopa_patch_apply:
+ * @patch: a #SopaPatch
+ * @document: the #SopaDocument to change
+ * @error: return location for a #GError
+ *
+ * Applies @patch to @document; see sopa_document_apply_patch().
+ *
+ * Return value: %TRUE on success, %FALSE if there was an error
+ */
+gboolean
+_sopa_patch_apply (SopaPatch     *patch,
+                   SopaDocument  *document,
+                   GError       **error)
+{
+  GPtrArray *nodes;
+  SopaNode *node;
+  guint i;
+
+  if (sopa_node_get_hash (SOPA_NODE (document)) != patch->base_hash ||
+      _sopa_node_get_subtree_size (SOPA_NODE (document)) != patch->n_base_nodes)
+    {
+      g_set_error_literal (error,
+                           SOPA_PATCH_ERROR,
+                           SOPA_PATCH_ERROR_MISMATCH,
+                           "The document is not the one the patch was made from");
+      return FALSE;
+    }
+
+  nodes = g_ptr_array_sized_new (patch->n_base_nodes);
+  for (node = SOPA_NODE (document);
+       node != NULL;
+       node = _sopa_node_next_in_tree (node, SOPA_NODE (document)))
+    g_ptr_array_add (nodes, node);
+
+  for (i = 0; i < patch->operations->len; i++)
+    {
+      const PatchOperation *operation;
+      SopaNode *parent, *before;
+
+      operation = &g_array_index (patch->operations, PatchOperation, i);
+
+      node = NULL;
+      if (operation->node < nodes->len)
+        node = g_ptr_array_index (nodes, operation->node);
+
+      parent = before = NULL;
+      if (operation->parent != NO_NODE)
+        parent = g_ptr_array_index (nodes, operation->parent);
+      if (operation->before != NO_NODE)
+        before = g_ptr_array_index (nodes, operation->before);
+
+      switch (operation->type)
+        {
+        case SOPA_PATCH_OPERATION_DELETE:
+          sopa_node_destroy (node);
+          break;
+
+        case SOPA_PATCH_OPERATION_INSERT:
+          node = sopa_node_clone (operation->subtree,
+                                  SOPA_NODE_CLONE_COPY_ON_WRITE);
+          patch_insert (parent, node, before);
+          g_ptr_array_add (nodes, node);
+          break;
+
+        case SOPA_PATCH_OPERATION_MOVE:
+          g_object_ref (node);
+          sopa_node_remove_child (sopa_node_get_parent (node), node);
+          patch_insert (parent, node, before);
+          g_object_unref (node);
+          break;
+
+        case SOPA_PATCH_OPERATION_SET_ATTRIBUTE:
+          sopa_element_set_attribute (SOPA_ELEMENT (node),
+                                      operation->name,
+                                      operation->value);
+          break;
+
+        case SOPA_PATCH_OPERATION_REMOVE_ATTRIBUTE:
+          sopa_element_remove_attribute (SOPA_ELEMENT (node),
+                                         operation->name);
+          break;
+
+        case SOPA_PATCH_OPERATION_SET_TEXT:
+          sopa_text_set_content (SOPA_TEXT (node), operation->value);
+          break;
+        }
+    }
+
+  g_ptr_array_unref (nodes);
+
+  return TRUE;
+}
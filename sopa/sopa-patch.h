@@ -0,0 +1,93 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-patch.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#if !defined(SOPA_H_INSIDE) && !defined(SOPA_COMPILATION)
+#error "Only <sopa/sopa.h> can be included directly.h"
+#endif
+
+#ifndef __SOPA_PATCH_H__
+#define __SOPA_PATCH_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define SOPA_TYPE_PATCH (sopa_patch_get_type ())
+
+/**
+ * SOPA_PATCH_ERROR:
+ *
+ * Error domain for applying patches. Errors in this domain will be
+ * from the #SopaPatchError enumeration.
+ */
+#define SOPA_PATCH_ERROR (sopa_patch_error_quark ())
+
+/**
+ * SopaPatchError:
+ * @SOPA_PATCH_ERROR_MISMATCH: the document is not the one the patch
+ * was made from
+ *
+ * Error codes returned when applying a patch.
+ *
+ * Since: 0.2
+ */
+typedef enum {
+  SOPA_PATCH_ERROR_MISMATCH
+} SopaPatchError;
+
+/**
+ * SopaPatchOperationType:
+ * @SOPA_PATCH_OPERATION_DELETE: a node is removed, with its descendants
+ * @SOPA_PATCH_OPERATION_INSERT: a new sub-tree is inserted
+ * @SOPA_PATCH_OPERATION_MOVE: a node is moved, with its descendants
+ * @SOPA_PATCH_OPERATION_SET_ATTRIBUTE: an attribute is added or changed
+ * @SOPA_PATCH_OPERATION_REMOVE_ATTRIBUTE: an attribute is removed
+ * @SOPA_PATCH_OPERATION_SET_TEXT: the content of a text node changes
+ *
+ * The operations of a #SopaPatch.
+ *
+ * Since: 0.2
+ */
+typedef enum {
+  SOPA_PATCH_OPERATION_DELETE,
+  SOPA_PATCH_OPERATION_INSERT,
+  SOPA_PATCH_OPERATION_MOVE,
+  SOPA_PATCH_OPERATION_SET_ATTRIBUTE,
+  SOPA_PATCH_OPERATION_REMOVE_ATTRIBUTE,
+  SOPA_PATCH_OPERATION_SET_TEXT
+} SopaPatchOperationType;
+
+typedef struct _SopaPatch SopaPatch;
+
+GType sopa_patch_get_type (void) G_GNUC_CONST;
+GQuark sopa_patch_error_quark (void);
+
+SopaPatch *                         sopa_patch_ref                              (SopaPatch              *self);
+void                                sopa_patch_unref                            (SopaPatch              *self);
+guint                               sopa_patch_get_n_operations                 (SopaPatch              *self);
+SopaPatchOperationType              sopa_patch_get_operation_type               (SopaPatch              *self,
+                                                                                 guint                   index_);
+gchar *                             sopa_patch_to_string                        (SopaPatch              *self);
+
+G_END_DECLS
+
+#endif /* __SOPA_PATCH_H__ */
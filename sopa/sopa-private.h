@@ -0,0 +1,45 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-private.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#ifndef __SOPA_PRIVATE_H__
+#define __SOPA_PRIVATE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* the finalizer of MurmurHash3, so that close values spread */
+static inline guint64
+_sopa_hash_mix (guint64 value)
+{
+  value ^= value >> 33;
+  value *= G_GUINT64_CONSTANT (0xff51afd7ed558ccd);
+  value ^= value >> 33;
+  value *= G_GUINT64_CONSTANT (0xc4ceb9fe1a85ec53);
+  value ^= value >> 33;
+
+  return value;
+}
+
+G_END_DECLS
+
+#endif /* __SOPA_PRIVATE_H__ */
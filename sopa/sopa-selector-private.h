@@ -0,0 +1,56 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-selector-private.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#ifndef __SOPA_SELECTOR_PRIVATE_H__
+#define __SOPA_SELECTOR_PRIVATE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*< private >
+ * SopaSelectorAdapter:
+ * @get_tag: retrieves the (lower case) tag of a subject
+ * @get_attribute: retrieves the value of an attribute of a subject
+ * @get_parent: retrieves the parent element of a subject, or %NULL
+ *
+ * Accessors used to match a compiled #SopaSelector against something
+ * that is not (yet) a #SopaElement, like the open element stack of a
+ * #SopaParser.
+ */
+typedef struct _SopaSelectorAdapter SopaSelectorAdapter;
+
+struct _SopaSelectorAdapter
+{
+  const gchar *   (* get_tag)         (gconstpointer   subject);
+  const gchar *   (* get_attribute)   (gconstpointer   subject,
+                                       const gchar    *name);
+  gconstpointer   (* get_parent)      (gconstpointer   subject);
+};
+
+gboolean                            _sopa_selector_match_subject                (SopaSelector               *self,
+                                                                                 const SopaSelectorAdapter  *adapter,
+                                                                                 gconstpointer               subject);
+
+G_END_DECLS
+
+#endif /* __SOPA_SELECTOR_PRIVATE_H__ */
@@ -0,0 +1,777 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-selector.c
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+/**
+ * SECTION:sopa-selector
+ * @short_description: Compiled element selectors
+ *
+ * A #SopaSelector is a compiled, immutable representation of a subset
+ * of the CSS selector syntax. The supported syntax is:
+ *
+ * - type selectors (`div`) and the universal selector (`*`)
+ * - id (`#main`) and class (`.item`) selectors
+ * - attribute selectors: `[attr]`, `[attr=value]`, `[attr~=value]`,
+ *   `[attr|=value]`, `[attr^=value]`, `[attr$=value]` and `[attr*=value]`
+ * - the descendant (whitespace) and child (`>`) combinators
+ * - selector lists separated by commas
+ *
+ * Selectors are reference counted and can be shared between threads.
+ */
+
+#include <string.h>
+
+#include "sopa-selector.h"
+#include "sopa-selector-private.h"
+
+#include "sopa-document.h"
+#include "sopa-node-private.h"
+
+G_DEFINE_BOXED_TYPE (SopaSelector, sopa_selector,
+                     sopa_selector_ref,
+                     sopa_selector_unref)
+
+G_DEFINE_QUARK (sopa-selector-error-quark, sopa_selector_error)
+
+typedef enum {
+  ATTR_EXISTS,
+  ATTR_EQUALS,
+  ATTR_INCLUDES,
+  ATTR_DASH,
+  ATTR_PREFIX,
+  ATTR_SUFFIX,
+  ATTR_SUBSTRING
+} AttrOperator;
+
+typedef enum {
+  COMBINATOR_NONE,
+  COMBINATOR_DESCENDANT,
+  COMBINATOR_CHILD
+} Combinator;
+
+typedef struct
+{
+  gchar         *name;
+  gchar         *value;
+  AttrOperator   op;
+} AttrCondition;
+
+typedef struct
+{
+  /* relation with the compound on the left */
+  Combinator     combinator;
+
+  /* NULL matches any tag */
+  gchar         *tag;
+
+  AttrCondition *conditions;
+  guint          n_conditions;
+} Compound;
+
+typedef struct
+{
+  Compound      *compounds;
+  guint          n_compounds;
+} Complex;
+
+struct _SopaSelector
+{
+  volatile gint  ref_count;
+
+  gchar         *source;
+
+  Complex       *complexes;
+  guint          n_complexes;
+};
+
+/* Parsing */
+
+typedef struct
+{
+  const gchar   *source;
+  const gchar   *cur;
+  GError       **error;
+} ParseState;
+
+static void
+set_syntax_error (ParseState  *state,
+                  const gchar *message)
+{
+  g_set_error (state->error,
+               SOPA_SELECTOR_ERROR,
+               SOPA_SELECTOR_ERROR_SYNTAX,
+               "Invalid selector '%s' at offset %d: %s",
+               state->source,
+               (gint) (state->cur - state->source),
+               message);
+}
+
+static inline gboolean
+is_ident_char (gchar c)
+{
+  return g_ascii_isalnum (c) || c == '-' || c == '_' || (guchar) c >= 0x80;
+}
+
+static inline void
+skip_spaces (ParseState *state)
+{
+  while (g_ascii_isspace (*state->cur))
+    state->cur++;
+}
+
+static gchar *
+parse_ident (ParseState *state)
+{
+  const gchar *start = state->cur;
+
+  while (is_ident_char (*state->cur))
+    state->cur++;
+
+  if (state->cur == start)
+    {
+      set_syntax_error (state, "identifier expected");
+      return NULL;
+    }
+
+  return g_strndup (start, state->cur - start);
+}
+
+static gchar *
+parse_value (ParseState *state)
+{
+  gchar quote = *state->cur;
+  const gchar *start;
+
+  if (quote != '"' && quote != '\'')
+    return parse_ident (state);
+
+  start = ++state->cur;
+  while (*state->cur != '\0' && *state->cur != quote)
+    state->cur++;
+
+  if (*state->cur != quote)
+    {
+      set_syntax_error (state, "unterminated string");
+      return NULL;
+    }
+
+  state->cur++;
+
+  return g_strndup (start, state->cur - start - 1);
+}
+
+static gboolean
+parse_attribute (ParseState *state,
+                 GArray     *conditions)
+{
+  AttrCondition cond = { NULL, NULL, ATTR_EXISTS };
+
+  /* skip '[' */
+  state->cur++;
+  skip_spaces (state);
+
+  cond.name = parse_ident (state);
+  if (cond.name == NULL)
+    return FALSE;
+
+  skip_spaces (state);
+
+  switch (*state->cur)
+    {
+    case ']':
+      break;
+
+    case '=':
+      cond.op = ATTR_EQUALS;
+      break;
+
+    case '~':
+      cond.op = ATTR_INCLUDES;
+      break;
+
+    case '|':
+      cond.op = ATTR_DASH;
+      break;
+
+    case '^':
+      cond.op = ATTR_PREFIX;
+      break;
+
+    case '$':
+      cond.op = ATTR_SUFFIX;
+      break;
+
+    case '*':
+      cond.op = ATTR_SUBSTRING;
+      break;
+
+    default:
+      set_syntax_error (state, "attribute operator expected");
+      goto error;
+    }
+
+  if (cond.op != ATTR_EXISTS)
+    {
+      state->cur += cond.op == ATTR_EQUALS ? 1 : 2;
+
+      if (cond.op != ATTR_EQUALS && state->cur[-1] != '=')
+        {
+          state->cur--;
+          set_syntax_error (state, "'=' expected");
+          goto error;
+        }
+
+      skip_spaces (state);
+
+      cond.value = parse_value (state);
+      if (cond.value == NULL)
+        goto error;
+
+      skip_spaces (state);
+    }
+
+  if (*state->cur != ']')
+    {
+      set_syntax_error (state, "']' expected");
+      goto error;
+    }
+
+  state->cur++;
+
+  g_array_append_val (conditions, cond);
+
+  return TRUE;
+
+error:
+  g_free (cond.name);
+  g_free (cond.value);
+
+  return FALSE;
+}
+
+static void
+compound_clear (Compound *compound)
+{
+  guint i;
+
+  for (i = 0; i < compound->n_conditions; i++)
+    {
+      g_free (compound->conditions[i].name);
+      g_free (compound->conditions[i].value);
+    }
+
+  g_free (compound->conditions);
+  g_free (compound->tag);
+}
+
+static gboolean
+parse_compound (ParseState *state,
+                Compound   *compound)
+{
+  GArray *conditions;
+  AttrCondition cond;
+  const gchar *start = state->cur;
+
+  conditions = g_array_new (FALSE, FALSE, sizeof (AttrCondition));
+
+  if (*state->cur == '*')
+    state->cur++;
+  else if (is_ident_char (*state->cur))
+    {
+      gchar *tag = parse_ident (state);
+
+      compound->tag = g_ascii_strdown (tag, -1);
+      g_free (tag);
+    }
+
+  for (;;)
+    {
+      switch (*state->cur)
+        {
+        case '#':
+        case '.':
+          cond.op = *state->cur == '#' ? ATTR_EQUALS : ATTR_INCLUDES;
+          cond.name = g_strdup (*state->cur == '#' ? "id" : "class");
+          state->cur++;
+
+          cond.value = parse_ident (state);
+          if (cond.value == NULL)
+            {
+              g_free (cond.name);
+              goto error;
+            }
+
+          g_array_append_val (conditions, cond);
+          continue;
+
+        case '[':
+          if (!parse_attribute (state, conditions))
+            goto error;
+          continue;
+
+        case ':':
+          g_set_error (state->error,
+                       SOPA_SELECTOR_ERROR,
+                       SOPA_SELECTOR_ERROR_UNSUPPORTED,
+                       "Invalid selector '%s': pseudo-classes are "
+                       "not supported",
+                       state->source);
+          goto error;
+
+        default:
+          break;
+        }
+
+      break;
+    }
+
+  if (state->cur == start)
+    {
+      set_syntax_error (state, "selector expected");
+      goto error;
+    }
+
+  compound->n_conditions = conditions->len;
+  compound->conditions = (AttrCondition *) g_array_free (conditions, FALSE);
+
+  return TRUE;
+
+error:
+  compound->n_conditions = conditions->len;
+  compound->conditions = (AttrCondition *) g_array_free (conditions, FALSE);
+
+  return FALSE;
+}
+
+static gboolean
+parse_complex (ParseState *state,
+               Complex    *complex)
+{
+  GArray *compounds;
+  Compound compound;
+  Combinator combinator = COMBINATOR_NONE;
+
+  compounds = g_array_new (FALSE, TRUE, sizeof (Compound));
+
+  skip_spaces (state);
+
+  for (;;)
+    {
+      memset (&compound, 0, sizeof (Compound));
+      compound.combinator = combinator;
+
+      if (!parse_compound (state, &compound))
+        {
+          compound_clear (&compound);
+          goto error;
+        }
+
+      g_array_append_val (compounds, compound);
+
+      /* combinator */
+      combinator = g_ascii_isspace (*state->cur) ? COMBINATOR_DESCENDANT
+                                                 : COMBINATOR_NONE;
+      skip_spaces (state);
+
+      if (*state->cur == '>')
+        {
+          combinator = COMBINATOR_CHILD;
+          state->cur++;
+          skip_spaces (state);
+        }
+
+      if (*state->cur == '\0' || *state->cur == ',')
+        {
+          if (combinator == COMBINATOR_CHILD)
+            {
+              set_syntax_error (state, "selector expected after '>'");
+              goto error;
+            }
+
+          break;
+        }
+
+      if (combinator == COMBINATOR_NONE)
+        {
+          set_syntax_error (state, "unexpected character");
+          goto error;
+        }
+    }
+
+  complex->n_compounds = compounds->len;
+  complex->compounds = (Compound *) g_array_free (compounds, FALSE);
+
+  return TRUE;
+
+error:
+  complex->n_compounds = compounds->len;
+  complex->compounds = (Compound *) g_array_free (compounds, FALSE);
+
+  return FALSE;
+}
+
+static void
+complex_clear (Complex *complex)
+{
+  guint i;
+
+  for (i = 0; i < complex->n_compounds; i++)
+    compound_clear (&complex->compounds[i]);
+
+  g_free (complex->compounds);
+}
+
+/* Matching */
+
+static inline gboolean
+match_condition (const AttrCondition *cond,
+                 const gchar         *value)
+{
+  gsize len;
+  const gchar *p;
+
+  if (value == NULL)
+    return FALSE;
+
+  switch (cond->op)
+    {
+    case ATTR_EXISTS:
+      return TRUE;
+
+    case ATTR_EQUALS:
+      return strcmp (value, cond->value) == 0;
+
+    case ATTR_INCLUDES:
+      len = strlen (cond->value);
+      if (len == 0)
+        return FALSE;
+
+      for (p = value; (p = strstr (p, cond->value)) != NULL; p += len)
+        {
+          if ((p == value || g_ascii_isspace (p[-1])) &&
+              (p[len] == '\0' || g_ascii_isspace (p[len])))
+            return TRUE;
+        }
+      return FALSE;
+
+    case ATTR_DASH:
+      len = strlen (cond->value);
+      return strncmp (value, cond->value, len) == 0 &&
+             (value[len] == '\0' || value[len] == '-');
+
+    case ATTR_PREFIX:
+      return cond->value[0] != '\0' &&
+             g_str_has_prefix (value, cond->value);
+
+    case ATTR_SUFFIX:
+      return cond->value[0] != '\0' &&
+             g_str_has_suffix (value, cond->value);
+
+    case ATTR_SUBSTRING:
+      return cond->value[0] != '\0' && strstr (value, cond->value) != NULL;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+match_compound (const Compound             *compound,
+                const SopaSelectorAdapter  *adapter,
+                gconstpointer               subject)
+{
+  guint i;
+
+  if (compound->tag != NULL &&
+      g_strcmp0 (compound->tag, adapter->get_tag (subject)) != 0)
+    return FALSE;
+
+  for (i = 0; i < compound->n_conditions; i++)
+    {
+      const AttrCondition *cond = &compound->conditions[i];
+
+      if (!match_condition (cond,
+                            adapter->get_attribute (subject, cond->name)))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+match_complex (const Complex              *complex,
+               guint                       idx,
+               const SopaSelectorAdapter  *adapter,
+               gconstpointer               subject)
+{
+  const Compound *compound = &complex->compounds[idx];
+  gconstpointer ancestor;
+
+  if (!match_compound (compound, adapter, subject))
+    return FALSE;
+
+  if (idx == 0)
+    return TRUE;
+
+  ancestor = adapter->get_parent (subject);
+
+  if (compound->combinator == COMBINATOR_CHILD)
+    return ancestor != NULL &&
+           match_complex (complex, idx - 1, adapter, ancestor);
+
+  for (; ancestor != NULL; ancestor = adapter->get_parent (ancestor))
+    {
+      if (match_complex (complex, idx - 1, adapter, ancestor))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+gboolean
+_sopa_selector_match_subject (SopaSelector              *self,
+                              const SopaSelectorAdapter *adapter,
+                              gconstpointer              subject)
+{
+  guint i;
+
+  for (i = 0; i < self->n_complexes; i++)
+    {
+      const Complex *complex = &self->complexes[i];
+
+      if (match_complex (complex, complex->n_compounds - 1, adapter, subject))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static const gchar *
+element_get_tag (gconstpointer subject)
+{
+  return sopa_element_get_tag ((SopaElement *) subject);
+}
+
+static const gchar *
+element_get_attribute (gconstpointer  subject,
+                       const gchar   *name)
+{
+  return sopa_element_get_attribute ((SopaElement *) subject, name);
+}
+
+static gconstpointer
+element_get_parent (gconstpointer subject)
+{
+  SopaNode *parent = sopa_node_get_parent ((SopaNode *) subject);
+
+  /* the document is not an element as far as selectors are concerned */
+  if (parent == NULL || !SOPA_IS_ELEMENT (parent) || SOPA_IS_DOCUMENT (parent))
+    return NULL;
+
+  return parent;
+}
+
+static const SopaSelectorAdapter element_adapter = {
+  element_get_tag,
+  element_get_attribute,
+  element_get_parent
+};
+
+/**
+ * sopa_selector_new:
+ * @selector: the selector source
+ * @error: return location for a #GError
+ *
+ * Compiles @selector into a #SopaSelector.
+ *
+ * Return value: (transfer full): the newly created #SopaSelector, or %NULL
+ *      if @selector is invalid. Use sopa_selector_unref() to release it.
+ */
+SopaSelector *
+sopa_selector_new (const gchar  *selector,
+                   GError      **error)
+{
+  SopaSelector *self;
+  GArray *complexes;
+  Complex complex;
+  ParseState state;
+
+  g_return_val_if_fail (selector != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  state.source = selector;
+  state.cur = selector;
+  state.error = error;
+
+  complexes = g_array_new (FALSE, TRUE, sizeof (Complex));
+
+  for (;;)
+    {
+      memset (&complex, 0, sizeof (Complex));
+
+      if (!parse_complex (&state, &complex))
+        {
+          complex_clear (&complex);
+          goto error;
+        }
+
+      g_array_append_val (complexes, complex);
+
+      if (*state.cur == '\0')
+        break;
+
+      /* skip ',' */
+      state.cur++;
+    }
+
+  self = g_slice_new0 (SopaSelector);
+  self->ref_count = 1;
+  self->source = g_strdup (selector);
+  self->n_complexes = complexes->len;
+  self->complexes = (Complex *) g_array_free (complexes, FALSE);
+
+  return self;
+
+error:
+  while (complexes->len > 0)
+    {
+      complex_clear (&g_array_index (complexes, Complex, complexes->len - 1));
+      g_array_set_size (complexes, complexes->len - 1);
+    }
+
+  g_array_free (complexes, TRUE);
+
+  return NULL;
+}
+
+/**
+ * sopa_selector_ref:
+ * @self: a #SopaSelector
+ *
+ * Acquires a reference on @self.
+ *
+ * Return value: (transfer full): the #SopaSelector
+ */
+SopaSelector *
+sopa_selector_ref (SopaSelector *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+/**
+ * sopa_selector_unref:
+ * @self: a #SopaSelector
+ *
+ * Releases a reference on @self. When the last reference is released
+ * the selector is freed.
+ */
+void
+sopa_selector_unref (SopaSelector *self)
+{
+  guint i;
+
+  g_return_if_fail (self != NULL);
+
+  if (!g_atomic_int_dec_and_test (&self->ref_count))
+    return;
+
+  for (i = 0; i < self->n_complexes; i++)
+    complex_clear (&self->complexes[i]);
+
+  g_free (self->complexes);
+  g_free (self->source);
+
+  g_slice_free (SopaSelector, self);
+}
+
+/**
+ * sopa_selector_get_source:
+ * @self: a #SopaSelector
+ *
+ * Retrieves the string @self was compiled from.
+ *
+ * Return value: (transfer none): the selector source
+ */
+const gchar *
+sopa_selector_get_source (SopaSelector *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->source;
+}
+
+/**
+ * sopa_selector_matches:
+ * @self: a #SopaSelector
+ * @element: a #SopaElement
+ *
+ * Checks whether @element is matched by @self.
+ *
+ * Return value: %TRUE if @element matches, %FALSE otherwise
+ */
+gboolean
+sopa_selector_matches (SopaSelector *self,
+                       SopaElement  *element)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (SOPA_IS_ELEMENT (element), FALSE);
+
+  return _sopa_selector_match_subject (self, &element_adapter, element);
+}
+
+/**
+ * sopa_selector_query_all:
+ * @self: a #SopaSelector
+ * @root: a #SopaNode
+ *
+ * Collects, in document order, all the elements below @root that are
+ * matched by @self. @root itself is not considered.
+ *
+ * Return value: (transfer container) (element-type SopaElement): an
+ *      array with the matching elements. The elements are owned by
+ *      the document; free the array with g_ptr_array_unref().
+ */
+GPtrArray *
+sopa_selector_query_all (SopaSelector *self,
+                         SopaNode     *root)
+{
+  GPtrArray *result;
+  SopaNode *node;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (SOPA_IS_NODE (root), NULL);
+
+  result = g_ptr_array_new ();
+
+  for (node = _sopa_node_next_in_tree (root, root);
+       node != NULL;
+       node = _sopa_node_next_in_tree (node, root))
+    {
+      if (SOPA_IS_ELEMENT (node) &&
+          _sopa_selector_match_subject (self, &element_adapter, node))
+        g_ptr_array_add (result, node);
+    }
+
+  return result;
+}
@@ -0,0 +1,77 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-selector.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#if !defined(SOPA_H_INSIDE) && !defined(SOPA_COMPILATION)
+#error "Only <sopa/sopa.h> can be included directly.h"
+#endif
+
+#ifndef __SOPA_SELECTOR_H__
+#define __SOPA_SELECTOR_H__
+
+#include <glib-object.h>
+#include <sopa/sopa-element.h>
+
+G_BEGIN_DECLS
+
+#define SOPA_TYPE_SELECTOR (sopa_selector_get_type ())
+
+/**
+ * SOPA_SELECTOR_ERROR:
+ *
+ * Error domain for selector compilation. Errors in this domain will
+ * be from the #SopaSelectorError enumeration.
+ */
+#define SOPA_SELECTOR_ERROR (sopa_selector_error_quark ())
+
+/**
+ * SopaSelectorError:
+ * @SOPA_SELECTOR_ERROR_SYNTAX: the selector is malformed
+ * @SOPA_SELECTOR_ERROR_UNSUPPORTED: the selector uses a feature that
+ * is not supported
+ *
+ * Error codes returned by selector compilation.
+ *
+ * Since: 0.2
+ */
+typedef enum {
+  SOPA_SELECTOR_ERROR_SYNTAX,
+  SOPA_SELECTOR_ERROR_UNSUPPORTED
+} SopaSelectorError;
+
+typedef struct _SopaSelector SopaSelector;
+
+GType sopa_selector_get_type (void) G_GNUC_CONST;
+GQuark sopa_selector_error_quark (void);
+
+SopaSelector *                      sopa_selector_new                           (const gchar            *selector,
+                                                                                 GError                **error);
+SopaSelector *                      sopa_selector_ref                           (SopaSelector           *self);
+void                                sopa_selector_unref                         (SopaSelector           *self);
+const gchar *                       sopa_selector_get_source                    (SopaSelector           *self);
+gboolean                            sopa_selector_matches                       (SopaSelector           *self,
+                                                                                 SopaElement            *element);
+GPtrArray *                         sopa_selector_query_all                     (SopaSelector           *self,
+                                                                                 SopaNode               *root);
+
+G_END_DECLS
+
+#endif /* __SOPA_SELECTOR_H__ */
@@ -0,0 +1,215 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-serialize-options.c
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+/**
+ * SECTION:sopa-serialize-options
+ * @short_description: How markup is serialized
+ *
+ * #SopaSerializeOptions selects the layout used by
+ * sopa_element_serialize(): indented for people to read, minified for
+ * storage and transfer, or faithful to the structure of the source.
+ */
+
+#include "sopa-serialize-options.h"
+
+struct _SopaSerializeOptions
+{
+  SopaSerializeMode mode;
+  guint             indent_width;
+  guint             n_threads;
+};
+
+G_DEFINE_BOXED_TYPE (SopaSerializeOptions, sopa_serialize_options,
+                     sopa_serialize_options_copy,
+                     sopa_serialize_options_free)
+
+/**
+ * sopa_serialize_options_new:
+ * @mode: a #SopaSerializeMode
+ *
+ * Creates serialization options for @mode. The indent width, which
+ * only applies to %SOPA_SERIALIZE_MODE_PRETTY, is 2, and the markup
+ * is written from the calling thread only.
+ *
+ * Return value: (transfer full): the newly created options, to be
+ *      freed with sopa_serialize_options_free()
+ *
+ * Since: 0.2
+ */
+SopaSerializeOptions *
+sopa_serialize_options_new (SopaSerializeMode mode)
+{
+  SopaSerializeOptions *options;
+
+  options = g_slice_new (SopaSerializeOptions);
+  options->mode = mode;
+  options->indent_width = 2;
+  options->n_threads = 1;
+
+  return options;
+}
+
+/**
+ * sopa_serialize_options_copy:
+ * @options: a #SopaSerializeOptions
+ *
+ * Copies @options.
+ *
+ * Return value: (transfer full): a copy of @options
+ *
+ * Since: 0.2
+ */
+SopaSerializeOptions *
+sopa_serialize_options_copy (SopaSerializeOptions *options)
+{
+  g_return_val_if_fail (options != NULL, NULL);
+
+  return g_slice_dup (SopaSerializeOptions, options);
+}
+
+/**
+ * sopa_serialize_options_free:
+ * @options: a #SopaSerializeOptions
+ *
+ * Frees @options.
+ *
+ * Since: 0.2
+ */
+void
+sopa_serialize_options_free (SopaSerializeOptions *options)
+{
+  if (options != NULL)
+    g_slice_free (SopaSerializeOptions, options);
+}
+
+/**
+ * sopa_serialize_options_set_mode:
+ * @options: a #SopaSerializeOptions
+ * @mode: a #SopaSerializeMode
+ *
+ * Sets the layout of the serialized markup.
+ *
+ * Since: 0.2
+ */
+void
+sopa_serialize_options_set_mode (SopaSerializeOptions *options,
+                                 SopaSerializeMode     mode)
+{
+  g_return_if_fail (options != NULL);
+
+  options->mode = mode;
+}
+
+/**
+ * sopa_serialize_options_get_mode:
+ * @options: a #SopaSerializeOptions
+ *
+ * Retrieves the layout of the serialized markup.
+ *
+ * Return value: a #SopaSerializeMode
+ *
+ * Since: 0.2
+ */
+SopaSerializeMode
+sopa_serialize_options_get_mode (const SopaSerializeOptions *options)
+{
+  g_return_val_if_fail (options != NULL, SOPA_SERIALIZE_MODE_PRETTY);
+
+  return options->mode;
+}
+
+/**
+ * sopa_serialize_options_set_indent_width:
+ * @options: a #SopaSerializeOptions
+ * @indent_width: number of spaces per nesting level
+ *
+ * Sets the indentation used by %SOPA_SERIALIZE_MODE_PRETTY.
+ *
+ * Since: 0.2
+ */
+void
+sopa_serialize_options_set_indent_width (SopaSerializeOptions *options,
+                                         guint                 indent_width)
+{
+  g_return_if_fail (options != NULL);
+
+  options->indent_width = indent_width;
+}
+
+/**
+ * sopa_serialize_options_get_indent_width:
+ * @options: a #SopaSerializeOptions
+ *
+ * Retrieves the indentation used by %SOPA_SERIALIZE_MODE_PRETTY.
+ *
+ * Return value: the number of spaces per nesting level
+ *
+ * Since: 0.2
+ */
+guint
+sopa_serialize_options_get_indent_width (const SopaSerializeOptions *options)
+{
+  g_return_val_if_fail (options != NULL, 0);
+
+  return options->indent_width;
+}
+
+/**
+ * sopa_serialize_options_set_n_threads:
+ * @options: a #SopaSerializeOptions
+ * @n_threads: the maximum number of threads to use, or 0 to use one
+ *      per processor
+ *
+ * Sets the number of threads the markup is written from. With more
+ * than one thread, large documents are split into chunks of similar
+ * sizes that are written at the same time, each in its place of the
+ * result; small documents are still written from the calling thread.
+ *
+ * Since: 0.2
+ */
+void
+sopa_serialize_options_set_n_threads (SopaSerializeOptions *options,
+                                      guint                 n_threads)
+{
+  g_return_if_fail (options != NULL);
+
+  options->n_threads = n_threads;
+}
+
+/**
+ * sopa_serialize_options_get_n_threads:
+ * @options: a #SopaSerializeOptions
+ *
+ * Retrieves the number of threads the markup is written from.
+ *
+ * Return value: the maximum number of threads, or 0 for one per
+ *      processor
+ *
+ * Since: 0.2
+ */
+guint
+sopa_serialize_options_get_n_threads (const SopaSerializeOptions *options)
+{
+  g_return_val_if_fail (options != NULL, 1);
+
+  return options->n_threads;
+}
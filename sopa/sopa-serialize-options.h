@@ -0,0 +1,78 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-serialize-options.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#if !defined(SOPA_H_INSIDE) && !defined(SOPA_COMPILATION)
+#error "Only <sopa/sopa.h> can be included directly.h"
+#endif
+
+#ifndef __SOPA_SERIALIZE_OPTIONS_H__
+#define __SOPA_SERIALIZE_OPTIONS_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define SOPA_TYPE_SERIALIZE_OPTIONS (sopa_serialize_options_get_type ())
+
+/**
+ * SopaSerializeMode:
+ * @SOPA_SERIALIZE_MODE_PRETTY: each child on a line of its own,
+ * indented by the indent width per nesting level; this is the output
+ * of sopa_element_to_string()
+ * @SOPA_SERIALIZE_MODE_MINIFIED: no added whitespace, attributes
+ * quoted only when needed and with the shortest quoting, boolean
+ * attributes without a value, and void elements without end tags
+ * @SOPA_SERIALIZE_MODE_FAITHFUL: no added whitespace, attributes in
+ * their original order and always quoted, and all end tags written;
+ * the nodes that did not change since their document was parsed with
+ * the #SopaParser:track-offsets property set are copied from the source
+ *
+ * The layout of serialized markup.
+ *
+ * Since: 0.2
+ */
+typedef enum {
+  SOPA_SERIALIZE_MODE_PRETTY,
+  SOPA_SERIALIZE_MODE_MINIFIED,
+  SOPA_SERIALIZE_MODE_FAITHFUL
+} SopaSerializeMode;
+
+typedef struct _SopaSerializeOptions SopaSerializeOptions;
+
+GType sopa_serialize_options_get_type (void) G_GNUC_CONST;
+
+SopaSerializeOptions *              sopa_serialize_options_new                  (SopaSerializeMode           mode);
+SopaSerializeOptions *              sopa_serialize_options_copy                 (SopaSerializeOptions       *options);
+void                                sopa_serialize_options_free                 (SopaSerializeOptions       *options);
+void                                sopa_serialize_options_set_mode             (SopaSerializeOptions       *options,
+                                                                                 SopaSerializeMode           mode);
+SopaSerializeMode                   sopa_serialize_options_get_mode             (const SopaSerializeOptions *options);
+void                                sopa_serialize_options_set_indent_width     (SopaSerializeOptions       *options,
+                                                                                 guint                       indent_width);
+guint                               sopa_serialize_options_get_indent_width     (const SopaSerializeOptions *options);
+void                                sopa_serialize_options_set_n_threads        (SopaSerializeOptions       *options,
+                                                                                 guint                       n_threads);
+guint                               sopa_serialize_options_get_n_threads        (const SopaSerializeOptions *options);
+
+G_END_DECLS
+
+#endif /* __SOPA_SERIALIZE_OPTIONS_H__ */
@@ -0,0 +1,81 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-source-map-private.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#ifndef __SOPA_SOURCE_MAP_PRIVATE_H__
+#define __SOPA_SOURCE_MAP_PRIVATE_H__
+
+#include <glib.h>
+
+#include "sopa-node.h"
+
+G_BEGIN_DECLS
+
+typedef struct _SopaSourceMap SopaSourceMap;
+typedef struct _SopaSourceSpan SopaSourceSpan;
+
+/*< private >
+ * SopaSourceSpan:
+ * @node: the node
+ * @start: the offset of the first byte of the markup of @node
+ * @end: the offset right after the last byte of the markup of @node
+ *
+ * Where the markup of a parsed node is found in the source.
+ */
+struct _SopaSourceSpan
+{
+  SopaNode *node;
+  guint32   start;
+  guint32   end;
+};
+
+gsize                               _sopa_source_find                           (const gchar              *data,
+                                                                                 gsize                     len,
+                                                                                 gsize                     from,
+                                                                                 const gchar              *needle);
+gsize                               _sopa_source_skip_markup                    (const gchar              *data,
+                                                                                 gsize                     len,
+                                                                                 gsize                     start,
+                                                                                 gboolean                 *empty_tag);
+SopaSourceMap *                     _sopa_source_map_new                        (GBytes                   *source,
+                                                                                 GArray                   *spans);
+void                                _sopa_source_map_free                       (SopaSourceMap            *map);
+GBytes *                            _sopa_source_map_get_source                 (SopaSourceMap            *map);
+gboolean                            _sopa_source_map_lookup                     (SopaSourceMap            *map,
+                                                                                 SopaNode                 *node,
+                                                                                 gsize                    *start,
+                                                                                 gsize                    *end);
+void                                _sopa_source_map_get_position               (SopaSourceMap            *map,
+                                                                                 gsize                     offset,
+                                                                                 guint                    *line,
+                                                                                 guint                    *column);
+void                                _sopa_source_map_splice                     (SopaSourceMap            *map,
+                                                                                 SopaNode                 *parent,
+                                                                                 gsize                     start,
+                                                                                 gsize                     end,
+                                                                                 SopaSourceMap            *fragment,
+                                                                                 SopaNode                 *fragment_root,
+                                                                                 gsize                     fragment_start,
+                                                                                 gsize                     fragment_end);
+
+G_END_DECLS
+
+#endif /* __SOPA_SOURCE_MAP_PRIVATE_H__ */
@@ -0,0 +1,407 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-source-map.c
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#include <string.h>
+
+#include "sopa-source-map-private.h"
+
+/* the offsets of the markup of the nodes of a parsed document within
+ * its source, kept out of the nodes so that documents parsed without
+ * tracking offsets pay nothing for them
+ */
+struct _SopaSourceMap
+{
+  GBytes  *source;
+
+  /* SopaSourceSpan, sorted by node */
+  GArray  *spans;
+
+  /* the offset where each line starts, built on first use */
+  GArray  *lines;
+};
+
+/*< private >
+ * _sopa_source_find:
+ * @data: the source
+ * @len: the length of @data
+ * @from: the offset to search from
+ * @needle: the string to find
+ *
+ * Return value: the offset of the first @needle at or after @from in
+ *   @data, or @len if there is none
+ */
+gsize
+_sopa_source_find (const gchar *data,
+                   gsize        len,
+                   gsize        from,
+                   const gchar *needle)
+{
+  const gchar *p, *end = data + len;
+  gsize needle_len = strlen (needle);
+
+  for (p = data + from;
+       (p = memchr (p, needle[0], end - p)) != NULL;
+       p++)
+    {
+      if ((gsize) (end - p) < needle_len)
+        break;
+
+      if (memcmp (p, needle, needle_len) == 0)
+        return p - data;
+    }
+
+  return len;
+}
+
+/*< private >
+ * _sopa_source_skip_markup:
+ * @data: the source
+ * @len: the length of @data
+ * @start: the offset of the '<' the markup starts with
+ * @empty_tag: (out): return location for whether the markup is an
+ *   empty element tag
+ *
+ * Finds the end of a tag, comment, CDATA section, processing
+ * instruction or declaration, which the markup parser already checked
+ * to be well formed.
+ *
+ * Return value: the offset right after the markup
+ */
+gsize
+_sopa_source_skip_markup (const gchar *data,
+                          gsize        len,
+                          gsize        start,
+                          gboolean    *empty_tag)
+{
+  gsize i;
+  gchar quote = 0;
+  gint depth = 0;
+
+  *empty_tag = FALSE;
+
+  if (len - start >= 4 && memcmp (data + start, "<!--", 4) == 0)
+    return MIN (_sopa_source_find (data, len, start + 4, "-->") + 3, len);
+
+  if (len - start >= 9 && memcmp (data + start, "<![CDATA[", 9) == 0)
+    return MIN (_sopa_source_find (data, len, start + 9, "]]>") + 3, len);
+
+  if (len - start >= 2 && memcmp (data + start, "<?", 2) == 0)
+    return MIN (_sopa_source_find (data, len, start + 2, "?>") + 2, len);
+
+  /* tags, and declarations which may have an internal subset */
+  for (i = start + 1; i < len; i++)
+    {
+      if (quote != 0)
+        {
+          if (data[i] == quote)
+            quote = 0;
+        }
+      else if (data[i] == '"' || data[i] == '\'')
+        quote = data[i];
+      else if (data[i] == '[')
+        depth++;
+      else if (data[i] == ']')
+        depth--;
+      else if (data[i] == '>' && depth <= 0)
+        {
+          *empty_tag = data[i - 1] == '/';
+          return i + 1;
+        }
+    }
+
+  return len;
+}
+
+static gint
+compare_spans (gconstpointer a,
+               gconstpointer b)
+{
+  const SopaSourceSpan *span_a = a;
+  const SopaSourceSpan *span_b = b;
+
+  if (span_a->node < span_b->node)
+    return -1;
+
+  return span_a->node > span_b->node;
+}
+
+/*< private >
+ * _sopa_source_map_new:
+ * @source: (transfer full): the parsed text
+ * @spans: (transfer full): an array of #SopaSourceSpan
+ *
+ * Creates a source map. The spans are only looked up for nodes that
+ * did not change since they were parsed, which the caller checks.
+ *
+ * Return value: the new map, to be freed with _sopa_source_map_free()
+ */
+SopaSourceMap *
+_sopa_source_map_new (GBytes *source,
+                      GArray *spans)
+{
+  SopaSourceMap *map;
+
+  map = g_slice_new0 (SopaSourceMap);
+  map->source = source;
+  map->spans = spans;
+
+  g_array_sort (map->spans, compare_spans);
+
+  return map;
+}
+
+void
+_sopa_source_map_free (SopaSourceMap *map)
+{
+  g_bytes_unref (map->source);
+  g_array_unref (map->spans);
+
+  if (map->lines != NULL)
+    g_array_unref (map->lines);
+
+  g_slice_free (SopaSourceMap, map);
+}
+
+GBytes *
+_sopa_source_map_get_source (SopaSourceMap *map)
+{
+  return map->source;
+}
+
+/*< private >
+ * _sopa_source_map_lookup:
+ * @map: a #SopaSourceMap
+ * @node: a #SopaNode
+ * @start: (out): return location for the offset of the first byte
+ * @end: (out): return location for the offset after the last byte
+ *
+ * Finds the markup of @node in the source.
+ *
+ * Return value: %TRUE if @node was recorded in @map
+ */
+gboolean
+_sopa_source_map_lookup (SopaSourceMap *map,
+                         SopaNode      *node,
+                         gsize         *start,
+                         gsize         *end)
+{
+  const SopaSourceSpan *spans = (const SopaSourceSpan *) map->spans->data;
+  guint low = 0, high = map->spans->len;
+
+  while (low < high)
+    {
+      guint middle = low + (high - low) / 2;
+
+      if (spans[middle].node == node)
+        {
+          if (start != NULL)
+            *start = spans[middle].start;
+          if (end != NULL)
+            *end = spans[middle].end;
+
+          return TRUE;
+        }
+
+      if (spans[middle].node < node)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+
+  return FALSE;
+}
+
+/*< private >
+ * _sopa_source_map_get_position:
+ * @map: a #SopaSourceMap
+ * @offset: an offset within the source
+ * @line: (out): return location for the line, starting at 1
+ * @column: (out): return location for the character within the line,
+ *   starting at 1
+ *
+ * Converts a byte offset into a line and a column.
+ */
+void
+_sopa_source_map_get_position (SopaSourceMap *map,
+                               gsize          offset,
+                               guint         *line,
+                               guint         *column)
+{
+  const gchar *data;
+  const guint32 *lines;
+  guint low, high;
+  gsize size;
+
+  data = g_bytes_get_data (map->source, &size);
+
+  if (g_once_init_enter (&map->lines))
+    {
+      const gchar *p, *end = data + size;
+      GArray *new_lines;
+      guint32 line_start = 0;
+
+      new_lines = g_array_new (FALSE, FALSE, sizeof (guint32));
+      g_array_append_val (new_lines, line_start);
+
+      for (p = data; (p = memchr (p, '\n', end - p)) != NULL; )
+        {
+          p++;
+          line_start = p - data;
+          g_array_append_val (new_lines, line_start);
+        }
+
+      g_once_init_leave (&map->lines, new_lines);
+    }
+
+  offset = MIN (offset, size);
+  lines = (const guint32 *) map->lines->data;
+
+  /* the last line starting at or before @offset */
+  low = 0;
+  high = map->lines->len;
+  while (high - low > 1)
+    {
+      guint middle = low + (high - low) / 2;
+
+      if (lines[middle] <= offset)
+        low = middle;
+      else
+        high = middle;
+    }
+
+  if (line != NULL)
+    *line = low + 1;
+  if (column != NULL)
+    *column = g_utf8_strlen (data + lines[low], offset - lines[low]) + 1;
+}
+
+/*< private >
+ * _sopa_source_map_splice:
+ * @map: a #SopaSourceMap
+ * @parent: the node whose content is replaced
+ * @start: the offset where the content of @parent starts
+ * @end: the offset where the content of @parent ends
+ * @fragment: the map of the parsed replacement
+ * @fragment_root: the node holding the replacement in @fragment
+ * @fragment_start: the offset where the replacement starts in the
+ *   source of @fragment
+ * @fragment_end: the offset where the replacement ends in the source
+ *   of @fragment
+ *
+ * Replaces the source between @start and @end with the one of the
+ * children of @fragment_root, which are about to become the children
+ * of @parent. The spans of the previous descendants of @parent are
+ * dropped, the ones of the new descendants are added, and the ones
+ * of the nodes after the content, or enclosing it, are shifted.
+ */
+void
+_sopa_source_map_splice (SopaSourceMap *map,
+                         SopaNode      *parent,
+                         gsize          start,
+                         gsize          end,
+                         SopaSourceMap *fragment,
+                         SopaNode      *fragment_root,
+                         gsize          fragment_start,
+                         gsize          fragment_end)
+{
+  const SopaSourceSpan *old_spans, *new_spans;
+  const gchar *data, *fragment_data;
+  GArray *added, *spans;
+  gchar *new_data;
+  gsize size, new_size, length;
+  gssize delta;
+  guint i, j;
+
+  data = g_bytes_get_data (map->source, &size);
+  fragment_data = g_bytes_get_data (fragment->source, NULL);
+
+  length = fragment_end - fragment_start;
+  delta = (gssize) length - (gssize) (end - start);
+  new_size = size + delta;
+
+  new_data = g_malloc (new_size);
+  memcpy (new_data, data, start);
+  memcpy (new_data + start, fragment_data + fragment_start, length);
+  memcpy (new_data + start + length, data + end, size - end);
+
+  g_bytes_unref (map->source);
+  map->source = g_bytes_new_take (new_data, new_size);
+
+  if (map->lines != NULL)
+    {
+      g_array_unref (map->lines);
+      map->lines = NULL;
+    }
+
+  /* the spans of the replacement, still sorted by node */
+  added = g_array_new (FALSE, FALSE, sizeof (SopaSourceSpan));
+  new_spans = (const SopaSourceSpan *) fragment->spans->data;
+  for (i = 0; i < fragment->spans->len; i++)
+    {
+      SopaSourceSpan span = new_spans[i];
+
+      if (span.node == fragment_root ||
+          span.start < fragment_start ||
+          span.end > fragment_end)
+        continue;
+
+      span.start = span.start - fragment_start + start;
+      span.end = span.end - fragment_start + start;
+      g_array_append_val (added, span);
+    }
+
+  /* a single pass merging both, as the spans nest */
+  spans = g_array_sized_new (FALSE, FALSE,
+                             sizeof (SopaSourceSpan),
+                             map->spans->len + added->len);
+  old_spans = (const SopaSourceSpan *) map->spans->data;
+  new_spans = (const SopaSourceSpan *) added->data;
+
+  for (i = 0, j = 0; i < map->spans->len; i++)
+    {
+      SopaSourceSpan span = old_spans[i];
+
+      /* a previous descendant of @parent */
+      if (span.node != parent && span.start >= start && span.start < end)
+        continue;
+
+      if (span.start >= end)
+        {
+          span.start += delta;
+          span.end += delta;
+        }
+      else if (span.end >= end)
+        span.end += delta;
+
+      while (j < added->len && new_spans[j].node < span.node)
+        g_array_append_val (spans, new_spans[j++]);
+
+      g_array_append_val (spans, span);
+    }
+
+  for (; j < added->len; j++)
+    g_array_append_val (spans, new_spans[j]);
+
+  g_array_unref (map->spans);
+  g_array_unref (added);
+  map->spans = spans;
+}
@@ -0,0 +1,38 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-subtree-pool-private.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#ifndef __SOPA_SUBTREE_POOL_PRIVATE_H__
+#define __SOPA_SUBTREE_POOL_PRIVATE_H__
+
+#include <glib.h>
+
+#include "sopa-document.h"
+#include "sopa-subtree-pool.h"
+
+G_BEGIN_DECLS
+
+void                                _sopa_subtree_pool_intern                   (SopaSubtreePool          *self,
+                                                                                 SopaDocument             *document);
+
+G_END_DECLS
+
+#endif /* __SOPA_SUBTREE_POOL_PRIVATE_H__ */
@@ -0,0 +1,423 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-subtree-pool.c
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+/**
+ * SECTION:sopa-subtree-pool
+ * @short_description: Data of repeated subtrees shared across documents
+ *
+ * A #SopaSubtreePool lets the documents parsed by the #SopaParser
+ * objects it is set on with sopa_parser_set_subtree_pool() share a
+ * single copy of the data of the subtrees they repeat, such as the
+ * navigation, footers and scripts found on every page of a site.
+ *
+ * After a document is parsed its elements are looked up in the pool,
+ * from the top down, by their structural hash; see sopa_node_get_hash().
+ * When the pool holds an equal subtree, the tags, attributes and text
+ * contents of the subtree of the document are replaced by those of
+ * the pooled one, and its descendants are not looked at. A subtree is
+ * added to the pool the second time its hash is met, so that the pool
+ * only holds subtrees that do repeat.
+ *
+ * Nodes themselves cannot be shared, as each has a single parent, so
+ * each document keeps its own nodes; what is saved is the data, which
+ * makes up most of the memory of text-heavy markup. The shared data is
+ * copied on write, so the documents can still be changed freely.
+ *
+ * A pool can be shared by parsers running in different threads. It
+ * grows with the number of distinct repeated subtrees, and can be
+ * emptied with sopa_subtree_pool_clear().
+ */
+
+#include "sopa-subtree-pool-private.h"
+
+#include "sopa-element-private.h"
+#include "sopa-node-private.h"
+#include "sopa-text-private.h"
+
+G_DEFINE_BOXED_TYPE (SopaSubtreePool, sopa_subtree_pool,
+                     sopa_subtree_pool_ref,
+                     sopa_subtree_pool_unref)
+
+/* the hashes met once are only a hint, so their number is bound by
+ * forgetting them all now and then
+ */
+#define MAX_SEEN 65536
+
+typedef struct _PoolEntry PoolEntry;
+
+struct _PoolEntry
+{
+  guint64            hash;
+
+  /* a copy-on-write clone, which is never changed */
+  SopaNode          *subtree;
+};
+
+struct _SopaSubtreePool
+{
+  volatile gint      ref_count;
+
+  guint              min_nodes;
+
+  GMutex             mutex;
+
+  /* everything below is protected by the mutex */
+  GHashTable        *subtrees;
+  GHashTable        *seen;
+  guint64            n_shared_nodes;
+};
+
+static void
+pool_entry_free (PoolEntry *entry)
+{
+  g_object_unref (entry->subtree);
+
+  g_slice_free (PoolEntry, entry);
+}
+
+/* the node after the subtree of @node, within @root */
+static SopaNode *
+next_after_subtree (SopaNode *node,
+                    SopaNode *root)
+{
+  for (; node != root; node = sopa_node_get_parent (node))
+    {
+      SopaNode *next = sopa_node_get_next_sibling (node);
+
+      if (next != NULL)
+        return next;
+    }
+
+  return NULL;
+}
+
+/* replaces the data of the subtree of @node with that of @pooled, an
+ * equal subtree, so both trees are walked in the same order
+ */
+static guint
+share_subtree (SopaNode *node,
+               SopaNode *pooled)
+{
+  SopaNode *root = node;
+  SopaNode *pooled_root = pooled;
+  guint n_nodes = 0;
+
+  for (; node != NULL; n_nodes++)
+    {
+      if (SOPA_IS_ELEMENT (node))
+        _sopa_element_share_data (SOPA_ELEMENT (node),
+                                  SOPA_ELEMENT (pooled));
+      else if (SOPA_IS_TEXT (node))
+        _sopa_text_share_data (SOPA_TEXT (node), SOPA_TEXT (pooled));
+
+      node = _sopa_node_next_in_tree (node, root);
+      pooled = _sopa_node_next_in_tree (pooled, pooled_root);
+    }
+
+  return n_nodes;
+}
+
+/* looks @node up in the pool; returns %TRUE if its subtree is done
+ * with, either shared with the pool or added to it
+ */
+static gboolean
+intern_subtree (SopaSubtreePool *self,
+                SopaNode        *node)
+{
+  PoolEntry *entry;
+  SopaNode *pooled = NULL;
+  gpointer seen_key;
+  gboolean repeated = FALSE;
+  guint64 hash;
+
+  hash = sopa_node_get_hash (node);
+  seen_key = GUINT_TO_POINTER ((guint) (hash ^ (hash >> 32)));
+
+  g_mutex_lock (&self->mutex);
+
+  entry = g_hash_table_lookup (self->subtrees, &hash);
+  if (entry != NULL)
+    pooled = g_object_ref (entry->subtree);
+  else if (g_hash_table_remove (self->seen, seen_key))
+    repeated = TRUE;
+  else
+    {
+      if (g_hash_table_size (self->seen) >= MAX_SEEN)
+        g_hash_table_remove_all (self->seen);
+
+      g_hash_table_add (self->seen, seen_key);
+    }
+
+  g_mutex_unlock (&self->mutex);
+
+  if (pooled != NULL)
+    {
+      gboolean equal;
+
+      /* the pooled subtrees are only ever read, so no lock is needed;
+       * on a mere hash collision the children are looked at instead
+       */
+      equal = sopa_node_equal (node, pooled);
+      if (equal)
+        {
+          guint n_nodes = share_subtree (node, pooled);
+
+          g_mutex_lock (&self->mutex);
+          self->n_shared_nodes += n_nodes;
+          g_mutex_unlock (&self->mutex);
+        }
+
+      g_object_unref (pooled);
+
+      return equal;
+    }
+
+  /* met for the first time */
+  if (!repeated)
+    return FALSE;
+
+  /* met for the second time; the clone shares the data of @node, and
+   * has its hashes already computed
+   */
+  entry = g_slice_new (PoolEntry);
+  entry->hash = hash;
+  entry->subtree = g_object_ref_sink (sopa_node_clone (node,
+                                                       SOPA_NODE_CLONE_COPY_ON_WRITE));
+
+  g_mutex_lock (&self->mutex);
+
+  if (!g_hash_table_contains (self->subtrees, &entry->hash))
+    {
+      g_hash_table_insert (self->subtrees, &entry->hash, entry);
+      entry = NULL;
+    }
+
+  g_mutex_unlock (&self->mutex);
+
+  /* added by another thread in the meantime */
+  if (entry != NULL)
+    pool_entry_free (entry);
+
+  return TRUE;
+}
+
+/**
+ * sopa_subtree_pool_new:
+ * @min_nodes: the fewest nodes a subtree must have to be pooled
+ *
+ * Creates a new, empty #SopaSubtreePool.
+ *
+ * Subtrees of fewer than @min_nodes nodes, counting their root, are
+ * left alone, which keeps small and common elements from filling the
+ * pool; 2 is enough to pool scripts and styles.
+ *
+ * Return value: (transfer full): a new #SopaSubtreePool
+ *
+ * Since: 0.2
+ */
+SopaSubtreePool *
+sopa_subtree_pool_new (guint min_nodes)
+{
+  SopaSubtreePool *self;
+
+  self = g_slice_new0 (SopaSubtreePool);
+  self->ref_count = 1;
+  self->min_nodes = MAX (min_nodes, 1);
+
+  g_mutex_init (&self->mutex);
+  self->subtrees = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+                                          NULL,
+                                          (GDestroyNotify) pool_entry_free);
+  self->seen = g_hash_table_new (NULL, NULL);
+
+  return self;
+}
+
+/**
+ * sopa_subtree_pool_ref:
+ * @self: a #SopaSubtreePool
+ *
+ * Acquires a reference on @self.
+ *
+ * Return value: (transfer full): the #SopaSubtreePool
+ *
+ * Since: 0.2
+ */
+SopaSubtreePool *
+sopa_subtree_pool_ref (SopaSubtreePool *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+/**
+ * sopa_subtree_pool_unref:
+ * @self: a #SopaSubtreePool
+ *
+ * Releases a reference on @self. When the last reference is released
+ * the pool is freed; the documents sharing its data are not affected.
+ *
+ * Since: 0.2
+ */
+void
+sopa_subtree_pool_unref (SopaSubtreePool *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (!g_atomic_int_dec_and_test (&self->ref_count))
+    return;
+
+  g_hash_table_unref (self->subtrees);
+  g_hash_table_unref (self->seen);
+  g_mutex_clear (&self->mutex);
+
+  g_slice_free (SopaSubtreePool, self);
+}
+
+/**
+ * sopa_subtree_pool_get_min_nodes:
+ * @self: a #SopaSubtreePool
+ *
+ * Retrieves the fewest nodes a subtree must have to be pooled.
+ *
+ * Return value: the minimum number of nodes
+ *
+ * Since: 0.2
+ */
+guint
+sopa_subtree_pool_get_min_nodes (SopaSubtreePool *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->min_nodes;
+}
+
+/**
+ * sopa_subtree_pool_get_n_subtrees:
+ * @self: a #SopaSubtreePool
+ *
+ * Retrieves the number of subtrees held by @self.
+ *
+ * Return value: the number of pooled subtrees
+ *
+ * Since: 0.2
+ */
+guint
+sopa_subtree_pool_get_n_subtrees (SopaSubtreePool *self)
+{
+  guint n_subtrees;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->mutex);
+  n_subtrees = g_hash_table_size (self->subtrees);
+  g_mutex_unlock (&self->mutex);
+
+  return n_subtrees;
+}
+
+/**
+ * sopa_subtree_pool_get_n_shared_nodes:
+ * @self: a #SopaSubtreePool
+ *
+ * Retrieves the number of parsed nodes that were given the data of a
+ * pooled node instead of keeping their own.
+ *
+ * Return value: the number of shared nodes
+ *
+ * Since: 0.2
+ */
+guint64
+sopa_subtree_pool_get_n_shared_nodes (SopaSubtreePool *self)
+{
+  guint64 n_shared_nodes;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->mutex);
+  n_shared_nodes = self->n_shared_nodes;
+  g_mutex_unlock (&self->mutex);
+
+  return n_shared_nodes;
+}
+
+/**
+ * sopa_subtree_pool_clear:
+ * @self: a #SopaSubtreePool
+ *
+ * Drops all the subtrees held by @self, and forgets the ones met so
+ * far. The documents sharing their data keep it.
+ *
+ * Since: 0.2
+ */
+void
+sopa_subtree_pool_clear (SopaSubtreePool *self)
+{
+  GHashTable *subtrees;
+
+  g_return_if_fail (self != NULL);
+
+  g_mutex_lock (&self->mutex);
+
+  subtrees = self->subtrees;
+  self->subtrees = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+                                          NULL,
+                                          (GDestroyNotify) pool_entry_free);
+  g_hash_table_remove_all (self->seen);
+
+  g_mutex_unlock (&self->mutex);
+
+  /* the subtrees are released unlocked, as it may take a while */
+  g_hash_table_unref (subtrees);
+}
+
+/*
+ * _sopa_subtree_pool_intern:
+ * @self: a #SopaSubtreePool
+ * @document: a #SopaDocument just parsed, not yet handed out
+ *
+ * Shares the data of the subtrees of @document found in @self with
+ * the pooled ones, and pools those met for the second time.
+ */
+void
+_sopa_subtree_pool_intern (SopaSubtreePool *self,
+                           SopaDocument    *document)
+{
+  SopaNode *root = SOPA_NODE (document);
+  SopaNode *node;
+
+  node = sopa_node_get_first_child (root);
+
+  while (node != NULL)
+    {
+      /* the descendants of a small subtree are smaller still */
+      if (!SOPA_IS_ELEMENT (node) ||
+          _sopa_node_get_subtree_size (node) < self->min_nodes ||
+          intern_subtree (self, node))
+        node = next_after_subtree (node, root);
+      else
+        node = _sopa_node_next_in_tree (node, root);
+    }
+}
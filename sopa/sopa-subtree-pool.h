@@ -0,0 +1,50 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-subtree-pool.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#if !defined(SOPA_H_INSIDE) && !defined(SOPA_COMPILATION)
+#error "Only <sopa/sopa.h> can be included directly.h"
+#endif
+
+#ifndef __SOPA_SUBTREE_POOL_H__
+#define __SOPA_SUBTREE_POOL_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define SOPA_TYPE_SUBTREE_POOL (sopa_subtree_pool_get_type ())
+
+typedef struct _SopaSubtreePool SopaSubtreePool;
+
+GType sopa_subtree_pool_get_type (void) G_GNUC_CONST;
+
+SopaSubtreePool *                   sopa_subtree_pool_new                       (guint                   min_nodes);
+SopaSubtreePool *                   sopa_subtree_pool_ref                       (SopaSubtreePool        *self);
+void                                sopa_subtree_pool_unref                     (SopaSubtreePool        *self);
+guint                               sopa_subtree_pool_get_min_nodes             (SopaSubtreePool        *self);
+guint                               sopa_subtree_pool_get_n_subtrees            (SopaSubtreePool        *self);
+guint64                             sopa_subtree_pool_get_n_shared_nodes        (SopaSubtreePool        *self);
+void                                sopa_subtree_pool_clear                     (SopaSubtreePool        *self);
+
+G_END_DECLS
+
+#endif /* __SOPA_SUBTREE_POOL_H__ */
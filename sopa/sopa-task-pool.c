@@ -0,0 +1,301 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-task-pool.c
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+/*< private >
+ * SECTION:sopa-task-pool
+ * @short_description: Work-stealing execution of parallel jobs
+ *
+ * A job is a fixed set of independent tasks. The tasks are dealt out
+ * to one queue per worker; each worker runs the tasks from the front
+ * of its own queue and, once it is empty, steals from the back of the
+ * queues of the other workers.
+ *
+ * The thread that starts a job is always one of its workers, and the
+ * other workers run on a thread pool shared by all jobs. A helper that
+ * only gets to run after the job is finished returns immediately, so a
+ * job never waits for threads of the pool that are busy elsewhere, and
+ * jobs can be started from within tasks.
+ */
+
+#include "sopa-task-pool-private.h"
+
+typedef struct
+{
+  GMutex         lock;
+
+  /* the queue is the range [head, tail) of the job tasks */
+  guint          head;
+  guint          tail;
+} SopaTaskWorker;
+
+typedef struct
+{
+  volatile gint  ref_count;
+
+  GMutex         lock;
+  GCond          cond;
+
+  /* protected by lock */
+  gboolean       finished;
+  guint          n_running;
+  guint          next_worker;
+
+  gpointer      *tasks;
+  SopaTaskFunc   func;
+  gpointer       user_data;
+
+  SopaTaskWorker *workers;
+  guint          n_workers;
+} SopaTaskJob;
+
+static SopaTaskJob *
+sopa_task_job_ref (SopaTaskJob *job)
+{
+  g_atomic_int_inc (&job->ref_count);
+
+  return job;
+}
+
+static void
+sopa_task_job_unref (SopaTaskJob *job)
+{
+  guint i;
+
+  if (!g_atomic_int_dec_and_test (&job->ref_count))
+    return;
+
+  for (i = 0; i < job->n_workers; i++)
+    g_mutex_clear (&job->workers[i].lock);
+
+  g_mutex_clear (&job->lock);
+  g_cond_clear (&job->cond);
+
+  g_free (job->workers);
+  g_slice_free (SopaTaskJob, job);
+}
+
+static gboolean
+sopa_task_worker_pop (SopaTaskWorker *worker,
+                      guint          *index_)
+{
+  gboolean retval = FALSE;
+
+  g_mutex_lock (&worker->lock);
+
+  if (worker->head < worker->tail)
+    {
+      *index_ = worker->head++;
+      retval = TRUE;
+    }
+
+  g_mutex_unlock (&worker->lock);
+
+  return retval;
+}
+
+static gboolean
+sopa_task_worker_steal (SopaTaskWorker *victim,
+                        guint          *index_)
+{
+  gboolean retval = FALSE;
+
+  g_mutex_lock (&victim->lock);
+
+  if (victim->head < victim->tail)
+    {
+      *index_ = --victim->tail;
+      retval = TRUE;
+    }
+
+  g_mutex_unlock (&victim->lock);
+
+  return retval;
+}
+
+static void
+sopa_task_job_work (SopaTaskJob *job,
+                    guint        self)
+{
+  guint index_, i;
+
+  for (;;)
+    {
+      if (!sopa_task_worker_pop (&job->workers[self], &index_))
+        {
+          for (i = 1; i < job->n_workers; i++)
+            {
+              guint victim = (self + i) % job->n_workers;
+
+              if (sopa_task_worker_steal (&job->workers[victim], &index_))
+                break;
+            }
+
+          if (i == job->n_workers)
+            return;
+        }
+
+      job->func (job->tasks[index_], job->user_data);
+    }
+}
+
+static void
+sopa_task_helper (gpointer data,
+                  gpointer user_data)
+{
+  SopaTaskJob *job = data;
+  guint self;
+
+  g_mutex_lock (&job->lock);
+
+  if (job->finished || job->next_worker == job->n_workers)
+    {
+      g_mutex_unlock (&job->lock);
+      sopa_task_job_unref (job);
+      return;
+    }
+
+  self = job->next_worker++;
+  job->n_running += 1;
+
+  g_mutex_unlock (&job->lock);
+
+  sopa_task_job_work (job, self);
+
+  g_mutex_lock (&job->lock);
+
+  job->n_running -= 1;
+  if (job->n_running == 0)
+    g_cond_signal (&job->cond);
+
+  g_mutex_unlock (&job->lock);
+
+  sopa_task_job_unref (job);
+}
+
+static GThreadPool *
+sopa_task_get_thread_pool (void)
+{
+  static gsize pool = 0;
+
+  if (g_once_init_enter (&pool))
+    {
+      GThreadPool *new_pool;
+
+      new_pool = g_thread_pool_new (sopa_task_helper,
+                                    NULL,
+                                    g_get_num_processors (),
+                                    FALSE,
+                                    NULL);
+
+      g_once_init_leave (&pool, (gsize) new_pool);
+    }
+
+  return (GThreadPool *) pool;
+}
+
+/*< private >
+ * _sopa_task_pool_run:
+ * @tasks: (array length=n_tasks): the tasks to run
+ * @n_tasks: the number of tasks
+ * @n_threads: the number of threads to use, including the calling one,
+ *      or 0 to use one per processor
+ * @func: the function running each task
+ * @user_data: data passed to @func
+ *
+ * Runs @func on each of @tasks, in no particular order, using up to
+ * @n_threads threads. Returns once all tasks are done.
+ */
+void
+_sopa_task_pool_run (gpointer     *tasks,
+                     guint         n_tasks,
+                     guint         n_threads,
+                     SopaTaskFunc  func,
+                     gpointer      user_data)
+{
+  SopaTaskJob *job;
+  guint i, per_worker, extra, start;
+
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+
+  n_threads = CLAMP (n_threads, 1, MAX (n_tasks, 1));
+
+  if (n_threads == 1)
+    {
+      for (i = 0; i < n_tasks; i++)
+        func (tasks[i], user_data);
+
+      return;
+    }
+
+  job = g_slice_new0 (SopaTaskJob);
+  job->ref_count = 1;
+  job->tasks = tasks;
+  job->func = func;
+  job->user_data = user_data;
+  job->n_workers = n_threads;
+  job->workers = g_new0 (SopaTaskWorker, n_threads);
+
+  g_mutex_init (&job->lock);
+  g_cond_init (&job->cond);
+
+  /* deal contiguous ranges, so that neighbouring tasks tend to run
+   * on the same thread
+   */
+  per_worker = n_tasks / n_threads;
+  extra = n_tasks % n_threads;
+
+  for (i = 0, start = 0; i < n_threads; i++)
+    {
+      SopaTaskWorker *worker = &job->workers[i];
+
+      g_mutex_init (&worker->lock);
+      worker->head = start;
+      worker->tail = start + per_worker + (i < extra ? 1 : 0);
+
+      start = worker->tail;
+    }
+
+  /* the calling thread is the first worker */
+  job->next_worker = 1;
+
+  for (i = 1; i < n_threads; i++)
+    {
+      sopa_task_job_ref (job);
+
+      if (!g_thread_pool_push (sopa_task_get_thread_pool (), job, NULL))
+        sopa_task_job_unref (job);
+    }
+
+  sopa_task_job_work (job, 0);
+
+  /* the helpers that did not start yet will not find any work */
+  g_mutex_lock (&job->lock);
+
+  job->finished = TRUE;
+  while (job->n_running > 0)
+    g_cond_wait (&job->cond, &job->lock);
+
+  g_mutex_unlock (&job->lock);
+
+  sopa_task_job_unref (job);
+}
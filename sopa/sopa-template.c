@@ -0,0 +1,283 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-template.c
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+/**
+ * SECTION:sopa-template
+ * @short_description: Fragments parsed once and inserted many times
+ *
+ * A #SopaTemplate holds a fragment of markup, parsed once, which
+ * sopa_template_instantiate() inserts into elements any number of
+ * times without parsing it again.
+ *
+ * The nodes of the fragment are kept in a flat array, in document
+ * order and each with the position of its parent, so an instance is
+ * built in a single pass that copies the nodes and links each to its
+ * parent. The copies share the tags, attributes and text contents of
+ * the template, as with %SOPA_NODE_CLONE_COPY_ON_WRITE, and start with
+ * their structural hashes already computed.
+ *
+ * Templates are immutable and reference counted, and can be shared
+ * and instantiated between threads.
+ */
+
+#include <string.h>
+
+#include "sopa-template.h"
+
+#include "sopa-document.h"
+#include "sopa-document-private.h"
+#include "sopa-node-private.h"
+#include "sopa-parser.h"
+
+G_DEFINE_BOXED_TYPE (SopaTemplate, sopa_template,
+                     sopa_template_ref,
+                     sopa_template_unref)
+
+#define NO_PARENT G_MAXUINT
+
+typedef struct _TemplateNode TemplateNode;
+
+struct _TemplateNode
+{
+  /* the parsed node the data is shared from */
+  SopaNode          *node;
+
+  /* the position of the parent in the array, or NO_PARENT for the
+   * top-level nodes
+   */
+  guint              parent;
+};
+
+struct _SopaTemplate
+{
+  volatile gint      ref_count;
+
+  /* holds the parsed nodes, which are never changed */
+  SopaDocument      *fragment;
+
+  TemplateNode      *nodes;
+  guint              n_nodes;
+
+  /* the positions of the top-level nodes */
+  guint             *roots;
+  guint              n_roots;
+};
+
+/**
+ * sopa_template_new:
+ * @markup: a fragment of markup
+ * @length: the length of @markup, or -1 if it is nul-terminated
+ * @error: return location for a #GError
+ *
+ * Parses @markup into a new #SopaTemplate. The fragment may have any
+ * number of top-level nodes, including none.
+ *
+ * Return value: (transfer full): a new #SopaTemplate, or %NULL if
+ *      @markup could not be parsed
+ *
+ * Since: 0.2
+ */
+SopaTemplate *
+sopa_template_new (const gchar  *markup,
+                   gssize        length,
+                   GError      **error)
+{
+  SopaTemplate *self;
+  SopaDocument *fragment;
+  SopaParser *parser;
+  SopaNode *root, *node;
+  GString *text;
+  guint base, i, j;
+
+  g_return_val_if_fail (markup != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  if (length < 0)
+    length = strlen (markup);
+
+  text = g_string_sized_new (strlen (SOPA_FRAGMENT_START_TAG) +
+                             length +
+                             strlen (SOPA_FRAGMENT_END_TAG));
+  g_string_append (text, SOPA_FRAGMENT_START_TAG);
+  g_string_append_len (text, markup, length);
+  g_string_append (text, SOPA_FRAGMENT_END_TAG);
+
+  parser = sopa_parser_new ();
+  fragment = sopa_parser_parse (parser, text->str, text->len, error);
+
+  g_object_unref (parser);
+  g_string_free (text, TRUE);
+
+  if (fragment == NULL)
+    return NULL;
+
+  root = sopa_node_get_first_child (SOPA_NODE (fragment));
+
+  /* computed now, so that instantiating only reads the nodes */
+  sopa_node_get_hash (root);
+
+  self = g_slice_new (SopaTemplate);
+  self->ref_count = 1;
+  self->fragment = fragment;
+  self->n_nodes = _sopa_node_get_subtree_size (root) - 1;
+  self->nodes = g_new (TemplateNode, self->n_nodes);
+  self->n_roots = sopa_node_get_n_children (root);
+  self->roots = g_new (guint, self->n_roots);
+
+  /* the positions in the array are the ones in document order */
+  base = _sopa_node_get_index (root) + 1;
+
+  for (node = _sopa_node_next_in_tree (root, root), i = 0, j = 0;
+       node != NULL;
+       node = _sopa_node_next_in_tree (node, root), i++)
+    {
+      SopaNode *parent = sopa_node_get_parent (node);
+
+      self->nodes[i].node = node;
+
+      if (parent == root)
+        {
+          self->nodes[i].parent = NO_PARENT;
+          self->roots[j++] = i;
+        }
+      else
+        self->nodes[i].parent = _sopa_node_get_index (parent) - base;
+    }
+
+  return self;
+}
+
+/**
+ * sopa_template_ref:
+ * @self: a #SopaTemplate
+ *
+ * Acquires a reference on @self.
+ *
+ * Return value: (transfer full): the #SopaTemplate
+ *
+ * Since: 0.2
+ */
+SopaTemplate *
+sopa_template_ref (SopaTemplate *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+/**
+ * sopa_template_unref:
+ * @self: a #SopaTemplate
+ *
+ * Releases a reference on @self. When the last reference is released
+ * the template is freed; the nodes made from it are not affected.
+ *
+ * Since: 0.2
+ */
+void
+sopa_template_unref (SopaTemplate *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (!g_atomic_int_dec_and_test (&self->ref_count))
+    return;
+
+  g_free (self->nodes);
+  g_free (self->roots);
+  g_object_unref (self->fragment);
+
+  g_slice_free (SopaTemplate, self);
+}
+
+/**
+ * sopa_template_get_n_nodes:
+ * @self: a #SopaTemplate
+ *
+ * Retrieves the number of nodes each instance of @self is made of.
+ *
+ * Return value: the number of nodes
+ *
+ * Since: 0.2
+ */
+guint
+sopa_template_get_n_nodes (SopaTemplate *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_nodes;
+}
+
+/**
+ * sopa_template_instantiate:
+ * @self: a #SopaTemplate
+ * @parent: the #SopaElement to add the instance to
+ *
+ * Makes a new copy of the nodes of @self, and appends its top-level
+ * nodes to the children of @parent.
+ *
+ * Only the addition of the top-level nodes to @parent goes through
+ * the usual bookkeeping of tree changes; the nodes below them are
+ * linked directly, as nothing can observe them yet.
+ *
+ * Return value: (transfer none): the first of the nodes added to
+ *      @parent, or %NULL if the template is empty
+ *
+ * Since: 0.2
+ */
+SopaNode *
+sopa_template_instantiate (SopaTemplate *self,
+                           SopaElement  *parent)
+{
+  SopaNode **copies;
+  SopaNode *first;
+  guint i;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (SOPA_IS_ELEMENT (parent), NULL);
+
+  if (self->n_nodes == 0)
+    return NULL;
+
+  copies = g_new (SopaNode *, self->n_nodes);
+
+  /* parents come before their children, in order */
+  for (i = 0; i < self->n_nodes; i++)
+    {
+      const TemplateNode *template_node = &self->nodes[i];
+
+      copies[i] = _sopa_node_clone_shallow (template_node->node, TRUE);
+
+      if (template_node->parent != NO_PARENT)
+        _sopa_node_link_child (copies[template_node->parent], copies[i]);
+    }
+
+  first = copies[self->roots[0]];
+
+  for (i = 0; i < self->n_roots; i++)
+    sopa_element_add_child (parent, copies[self->roots[i]]);
+
+  g_free (copies);
+
+  return first;
+}
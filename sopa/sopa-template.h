@@ -0,0 +1,52 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-template.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#if !defined(SOPA_H_INSIDE) && !defined(SOPA_COMPILATION)
+#error "Only <sopa/sopa.h> can be included directly.h"
+#endif
+
+#ifndef __SOPA_TEMPLATE_H__
+#define __SOPA_TEMPLATE_H__
+
+#include <glib-object.h>
+#include <sopa/sopa-element.h>
+
+G_BEGIN_DECLS
+
+#define SOPA_TYPE_TEMPLATE (sopa_template_get_type ())
+
+typedef struct _SopaTemplate SopaTemplate;
+
+GType sopa_template_get_type (void) G_GNUC_CONST;
+
+SopaTemplate *                      sopa_template_new                           (const gchar            *markup,
+                                                                                 gssize                  length,
+                                                                                 GError                **error);
+SopaTemplate *                      sopa_template_ref                           (SopaTemplate           *self);
+void                                sopa_template_unref                         (SopaTemplate           *self);
+guint                               sopa_template_get_n_nodes                   (SopaTemplate           *self);
+SopaNode *                          sopa_template_instantiate                   (SopaTemplate           *self,
+                                                                                 SopaElement            *parent);
+
+G_END_DECLS
+
+#endif /* __SOPA_TEMPLATE_H__ */
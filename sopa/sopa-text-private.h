@@ -0,0 +1,40 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-text-private.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#ifndef __SOPA_TEXT_PRIVATE_H__
+#define __SOPA_TEXT_PRIVATE_H__
+
+#include <glib.h>
+
+#include "sopa-text.h"
+
+G_BEGIN_DECLS
+
+void                                _sopa_text_copy_data                        (SopaText                 *self,
+                                                                                 SopaText                 *source,
+                                                                                 gboolean                  share);
+void                                _sopa_text_share_data                       (SopaText                 *self,
+                                                                                 SopaText                 *source);
+
+G_END_DECLS
+
+#endif /* __SOPA_TEXT_PRIVATE_H__ */
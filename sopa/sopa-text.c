@@ -21,6 +21,9 @@
  */
 
 #include "sopa-text.h"
+#include "sopa-text-private.h"
+#include "sopa-mutation-observer-private.h"
+#include "sopa-node-private.h"
 
 G_DEFINE_TYPE (SopaText, sopa_text, SOPA_TYPE_NODE)
 
@@ -29,6 +32,7 @@ G_DEFINE_TYPE (SopaText, sopa_text, SOPA_TYPE_NODE)
 
 struct _SopaTextPrivate
 {
+  /* a #GRefString, shared with the copy-on-write clones */
   gchar *content;
 };
 
@@ -85,7 +89,8 @@ sopa_text_finalize (GObject *object)
 {
   SopaText *text = SOPA_TEXT (object);
 
-  g_free (text->priv->content);
+  if (text->priv->content != NULL)
+    g_ref_string_release (text->priv->content);
 
   G_OBJECT_CLASS (sopa_text_parent_class)->finalize (object);
 }
@@ -146,12 +151,26 @@ sopa_text_set_content (SopaText *self,
 {
   g_return_if_fail (SOPA_IS_TEXT (self));
 
-  g_free (self->priv->content);
+  if (G_UNLIKELY (_sopa_node_is_frozen (SOPA_NODE (self))))
+    {
+      g_critical ("The content of '%s' cannot be changed while its tree "
+                  "is being read from other threads.",
+                  _sopa_node_get_debug_name (SOPA_NODE (self)));
+      return;
+    }
+
+  _sopa_mutation_observer_content_changed (SOPA_NODE (self),
+                                           self->priv->content);
+
+  if (self->priv->content != NULL)
+    g_ref_string_release (self->priv->content);
 
   if (content != NULL)
-    self->priv->content = g_strdup (content);
+    self->priv->content = g_ref_string_new (content);
   else
     self->priv->content = NULL;
+
+  _sopa_node_mark_dirty (SOPA_NODE (self));
 }
 
 /**
@@ -170,3 +189,48 @@ sopa_text_get_content (SopaText *self)
 
   return self->priv->content;
 }
+
+/*< private >
+ * _sopa_text_copy_data:
+ * @self: a #SopaText just created, without content
+ * @source: the #SopaText to copy
+ * @share: whether to share the content of @source instead of copying it
+ *
+ * Gives @self the content of @source.
+ */
+void
+_sopa_text_copy_data (SopaText *self,
+                      SopaText *source,
+                      gboolean  share)
+{
+  const gchar *content = source->priv->content;
+
+  if (content == NULL)
+    return;
+
+  if (share)
+    self->priv->content = g_ref_string_acquire ((gchar *) content);
+  else
+    self->priv->content = g_ref_string_new (content);
+}
+
+/*< private >
+ * _sopa_text_share_data:
+ * @self: a #SopaText
+ * @source: a #SopaText with the same content as @self
+ *
+ * Replaces the content of @self with that of @source, so that equal
+ * text nodes of different trees keep a single copy of it.
+ */
+void
+_sopa_text_share_data (SopaText *self,
+                       SopaText *source)
+{
+  gchar *content = self->priv->content;
+
+  self->priv->content = NULL;
+  _sopa_text_copy_data (self, source, TRUE);
+
+  if (content != NULL)
+    g_ref_string_release (content);
+}
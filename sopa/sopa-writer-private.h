@@ -0,0 +1,62 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-writer-private.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#ifndef __SOPA_WRITER_PRIVATE_H__
+#define __SOPA_WRITER_PRIVATE_H__
+
+#include <gio/gio.h>
+
+#include "sopa-serialize-options.h"
+
+G_BEGIN_DECLS
+
+gchar *                             _sopa_writer_to_string                      (SopaNode                 *root,
+                                                                                 SopaSerializeMode         mode,
+                                                                                 guint                     indent_width,
+                                                                                 gsize                    *length);
+gchar *                             _sopa_writer_to_string_parallel             (SopaNode                 *root,
+                                                                                 SopaSerializeMode         mode,
+                                                                                 guint                     indent_width,
+                                                                                 guint                     n_threads,
+                                                                                 gsize                    *length);
+gchar *                             _sopa_writer_range_to_string                (SopaNode                 *first,
+                                                                                 SopaNode                 *last,
+                                                                                 guint                     n_siblings,
+                                                                                 SopaSerializeMode         mode,
+                                                                                 guint                     indent_width,
+                                                                                 gsize                    *length);
+gboolean                            _sopa_writer_write_to_stream                (SopaNode                 *root,
+                                                                                 SopaSerializeMode         mode,
+                                                                                 guint                     indent_width,
+                                                                                 GOutputStream            *stream,
+                                                                                 GCancellable             *cancellable,
+                                                                                 GError                  **error);
+gchar *                             _sopa_writer_to_json                        (SopaNode                 *root,
+                                                                                 gsize                    *length);
+gboolean                            _sopa_writer_write_json_to_stream           (SopaNode                 *root,
+                                                                                 GOutputStream            *stream,
+                                                                                 GCancellable             *cancellable,
+                                                                                 GError                  **error);
+
+G_END_DECLS
+
+#endif /* __SOPA_WRITER_PRIVATE_H__ */
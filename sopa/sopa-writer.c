@@ -0,0 +1,1486 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-writer.c
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+/*< private >
+ * SECTION:sopa-writer
+ * @short_description: Markup serialization
+ *
+ * The writer serializes the children of a node in two passes over the
+ * tree: the first one only adds up the length of the output, and the
+ * second one copies the pieces into a buffer allocated once with the
+ * exact size. Both passes share the same code, and the tree is walked
+ * without recursing.
+ *
+ * When writing to a #GOutputStream there is a single pass instead:
+ * small pieces are copied into a fixed-size staging buffer, large ones
+ * are referenced in place, and both are handed to the stream as one
+ * vector of buffers whenever the staging buffer or the vector fills up.
+ * Memory use does not depend on the size of the document.
+ *
+ * In the faithful layout, the nodes that did not change since their
+ * document was parsed with the #SopaParser:track-offsets property set
+ * are copied from the source, found through the source map of the
+ * document, instead of being walked.
+ *
+ * Text and attribute values are escaped. Where SSE2 is available, the
+ * characters that need escaping are looked for 16 bytes at a time, and
+ * the runs between them are copied as a whole.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <gio/gio.h>
+
+#include "sopa-document.h"
+#include "sopa-document-private.h"
+#include "sopa-element.h"
+#include "sopa-element-private.h"
+#include "sopa-node-private.h"
+#include "sopa-source-map-private.h"
+#include "sopa-task-pool-private.h"
+#include "sopa-text.h"
+#include "sopa-writer-private.h"
+
+/* size of the staging buffer for streams */
+#define STREAM_BUFFER_SIZE      (64 * 1024)
+
+/* pieces at least this long are written in place, without copying */
+#define STREAM_DIRECT_SIZE      1024
+
+#define STREAM_MAX_VECTORS      64
+
+typedef struct
+{
+  GOutputStream *stream;
+  GCancellable  *cancellable;
+  GError        *error;
+
+  /* the bytes in [segment_start, len) are not in a vector yet */
+  gchar          buffer[STREAM_BUFFER_SIZE];
+  gsize          len;
+  gsize          segment_start;
+
+  GOutputVector  vectors[STREAM_MAX_VECTORS];
+  guint          n_vectors;
+} SopaWriterStream;
+
+typedef struct
+{
+  /* %NULL while measuring, or when writing to a stream */
+  gchar         *out;
+  gsize          len;
+
+  SopaWriterStream *stream;
+
+  SopaSerializeMode mode;
+  guint          indent_width;
+
+  /* the source the nodes were parsed from, in the faithful layout */
+  SopaSourceMap *source_map;
+  const gchar   *source;
+
+  /* whether to remember where the markup of each node is */
+  gboolean       record;
+} SopaWriter;
+
+static void
+stream_end_segment (SopaWriterStream *stream)
+{
+  if (stream->len == stream->segment_start)
+    return;
+
+  stream->vectors[stream->n_vectors].buffer = stream->buffer + stream->segment_start;
+  stream->vectors[stream->n_vectors].size = stream->len - stream->segment_start;
+  stream->n_vectors += 1;
+
+  stream->segment_start = stream->len;
+}
+
+static void
+stream_flush (SopaWriterStream *stream)
+{
+  stream_end_segment (stream);
+
+  if (stream->n_vectors > 0 && stream->error == NULL)
+    g_output_stream_writev_all (stream->stream,
+                                stream->vectors,
+                                stream->n_vectors,
+                                NULL,
+                                stream->cancellable,
+                                &stream->error);
+
+  stream->n_vectors = 0;
+  stream->len = 0;
+  stream->segment_start = 0;
+}
+
+static void
+stream_append (SopaWriterStream *stream,
+               const gchar      *str,
+               gsize             len)
+{
+  if (len >= STREAM_DIRECT_SIZE)
+    {
+      /* room for the pending segment and the piece itself */
+      if (stream->n_vectors + 2 > STREAM_MAX_VECTORS)
+        stream_flush (stream);
+
+      stream_end_segment (stream);
+
+      stream->vectors[stream->n_vectors].buffer = str;
+      stream->vectors[stream->n_vectors].size = len;
+      stream->n_vectors += 1;
+
+      return;
+    }
+
+  if (stream->len + len > STREAM_BUFFER_SIZE ||
+      stream->n_vectors + 1 > STREAM_MAX_VECTORS)
+    stream_flush (stream);
+
+  memcpy (stream->buffer + stream->len, str, len);
+  stream->len += len;
+}
+
+static inline void
+writer_append (SopaWriter  *writer,
+               const gchar *str,
+               gsize        len)
+{
+  if (writer->out != NULL)
+    memcpy (writer->out + writer->len, str, len);
+  else if (writer->stream != NULL)
+    stream_append (writer->stream, str, len);
+
+  writer->len += len;
+}
+
+static inline void
+writer_append_c (SopaWriter *writer,
+                 gchar       c)
+{
+  if (writer->out != NULL)
+    writer->out[writer->len] = c;
+  else if (writer->stream != NULL)
+    stream_append (writer->stream, &c, 1);
+
+  writer->len += 1;
+}
+
+static inline void
+writer_append_str (SopaWriter  *writer,
+                   const gchar *str)
+{
+  writer_append (writer, str, strlen (str));
+}
+
+static inline void
+writer_append_spaces (SopaWriter *writer,
+                      guint       n_spaces)
+{
+  static const gchar spaces[] = "                                ";
+  guint n;
+
+  if (writer->out != NULL)
+    memset (writer->out + writer->len, ' ', n_spaces);
+  else if (writer->stream != NULL)
+    {
+      for (n = n_spaces; n > 0; n -= MIN (n, sizeof (spaces) - 1))
+        stream_append (writer->stream, spaces, MIN (n, sizeof (spaces) - 1));
+    }
+
+  writer->len += n_spaces;
+}
+
+typedef enum {
+  ESCAPE_TEXT,
+  ESCAPE_ATTRIBUTE,
+  ESCAPE_JSON
+} EscapeContext;
+
+#define CONTROL_CHARS \
+  [0x00] = 1, [0x01] = 1, [0x02] = 1, [0x03] = 1, \
+  [0x04] = 1, [0x05] = 1, [0x06] = 1, [0x07] = 1, \
+  [0x08] = 1, [0x09] = 1, [0x0a] = 1, [0x0b] = 1, \
+  [0x0c] = 1, [0x0d] = 1, [0x0e] = 1, [0x0f] = 1, \
+  [0x10] = 1, [0x11] = 1, [0x12] = 1, [0x13] = 1, \
+  [0x14] = 1, [0x15] = 1, [0x16] = 1, [0x17] = 1, \
+  [0x18] = 1, [0x19] = 1, [0x1a] = 1, [0x1b] = 1, \
+  [0x1c] = 1, [0x1d] = 1, [0x1e] = 1, [0x1f] = 1
+
+/* the characters escaped in each context */
+static const guint8 escape_table[3][256] = {
+  [ESCAPE_TEXT] = {
+    ['&'] = 1, ['<'] = 1, ['>'] = 1
+  },
+  [ESCAPE_ATTRIBUTE] = {
+    ['&'] = 1, ['<'] = 1, ['>'] = 1, ['"'] = 1
+  },
+  [ESCAPE_JSON] = {
+    ['"'] = 1, ['\\'] = 1, CONTROL_CHARS
+  }
+};
+
+/* the offset of the first character to escape in @str, or @len */
+static inline gsize
+find_escape (const gchar   *str,
+             gsize          len,
+             EscapeContext  context)
+{
+  const guint8 *table = escape_table[context];
+  gsize i = 0;
+
+#ifdef __SSE2__
+  if (context == ESCAPE_JSON)
+    {
+      const __m128i quot = _mm_set1_epi8 ('"');
+      const __m128i backslash = _mm_set1_epi8 ('\\');
+      const __m128i control = _mm_set1_epi8 (0x1f);
+
+      for (; i + 16 <= len; i += 16)
+        {
+          __m128i chunk = _mm_loadu_si128 ((const __m128i *) (str + i));
+          __m128i hits;
+          gint mask;
+
+          /* the bytes up to 0x1f are left unchanged by an unsigned max */
+          hits = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (chunk, quot),
+                                             _mm_cmpeq_epi8 (chunk, backslash)),
+                               _mm_cmpeq_epi8 (_mm_max_epu8 (chunk, control),
+                                               control));
+
+          mask = _mm_movemask_epi8 (hits);
+          if (mask != 0)
+            return i + g_bit_nth_lsf (mask, -1);
+        }
+    }
+  else
+    {
+      const __m128i amp = _mm_set1_epi8 ('&');
+      const __m128i lt = _mm_set1_epi8 ('<');
+      const __m128i gt = _mm_set1_epi8 ('>');
+      const __m128i quot = _mm_set1_epi8 (context == ESCAPE_ATTRIBUTE ? '"' : '&');
+
+      for (; i + 16 <= len; i += 16)
+        {
+          __m128i chunk = _mm_loadu_si128 ((const __m128i *) (str + i));
+          __m128i hits;
+          gint mask;
+
+          hits = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (chunk, amp),
+                                             _mm_cmpeq_epi8 (chunk, lt)),
+                               _mm_or_si128 (_mm_cmpeq_epi8 (chunk, gt),
+                                             _mm_cmpeq_epi8 (chunk, quot)));
+
+          mask = _mm_movemask_epi8 (hits);
+          if (mask != 0)
+            return i + g_bit_nth_lsf (mask, -1);
+        }
+    }
+#endif
+
+  for (; i < len; i++)
+    {
+      if (table[(guint8) str[i]])
+        return i;
+    }
+
+  return len;
+}
+
+static void
+writer_append_json_escape (SopaWriter *writer,
+                           gchar       c)
+{
+  static const gchar hex[] = "0123456789abcdef";
+  gchar escape[6] = { '\\', 'u', '0', '0', 0, 0 };
+
+  switch (c)
+    {
+    case '"':
+      writer_append (writer, "\\\"", 2);
+      break;
+    case '\\':
+      writer_append (writer, "\\\\", 2);
+      break;
+    case '\n':
+      writer_append (writer, "\\n", 2);
+      break;
+    case '\r':
+      writer_append (writer, "\\r", 2);
+      break;
+    case '\t':
+      writer_append (writer, "\\t", 2);
+      break;
+    default:
+      escape[4] = hex[((guint8) c) >> 4];
+      escape[5] = hex[((guint8) c) & 0xf];
+      writer_append (writer, escape, 6);
+      break;
+    }
+}
+
+static void
+writer_append_escaped (SopaWriter    *writer,
+                       const gchar   *str,
+                       EscapeContext  context)
+{
+  gsize len, i, run;
+
+  len = strlen (str);
+
+  for (i = 0; i < len; i++)
+    {
+      run = find_escape (str + i, len - i, context);
+      if (run > 0)
+        writer_append (writer, str + i, run);
+
+      i += run;
+      if (i == len)
+        break;
+
+      if (context == ESCAPE_JSON)
+        {
+          writer_append_json_escape (writer, str[i]);
+          continue;
+        }
+
+      switch (str[i])
+        {
+        case '&':
+          writer_append (writer, "&amp;", 5);
+          break;
+        case '<':
+          writer_append (writer, "&lt;", 4);
+          break;
+        case '>':
+          writer_append (writer, "&gt;", 4);
+          break;
+        case '"':
+          writer_append (writer, "&quot;", 6);
+          break;
+        }
+    }
+}
+
+/* the HTML elements that cannot have content, sorted */
+static const gchar *void_elements[] = {
+  "area", "base", "br", "col", "embed", "hr", "img", "input",
+  "keygen", "link", "meta", "param", "source", "track", "wbr"
+};
+
+static gint
+compare_tags (gconstpointer a,
+              gconstpointer b)
+{
+  return strcmp (a, *((const gchar **) b));
+}
+
+static gboolean
+is_void_element (const gchar *tag)
+{
+  return bsearch (tag,
+                  void_elements,
+                  G_N_ELEMENTS (void_elements),
+                  sizeof (const gchar *),
+                  compare_tags) != NULL;
+}
+
+typedef enum {
+  QUOTE_NONE,
+  QUOTE_DOUBLE,
+  QUOTE_SINGLE
+} QuoteStyle;
+
+/* the shortest way of quoting an attribute value in HTML */
+static QuoteStyle
+shortest_quote_style (const gchar *value)
+{
+  gboolean has_double = FALSE, has_single = FALSE, needs_quotes = FALSE;
+  const gchar *p;
+
+  if (*value == '\0')
+    return QUOTE_DOUBLE;
+
+  for (p = value; *p != '\0'; p++)
+    {
+      switch (*p)
+        {
+        case '"':
+          has_double = TRUE;
+          break;
+        case '\'':
+          has_single = TRUE;
+          break;
+        case ' ': case '\t': case '\n': case '\f': case '\r':
+        case '=': case '<': case '>': case '`':
+          needs_quotes = TRUE;
+          break;
+        }
+    }
+
+  if (!needs_quotes && !has_double && !has_single)
+    return QUOTE_NONE;
+
+  if (has_double && !has_single)
+    return QUOTE_SINGLE;
+
+  return QUOTE_DOUBLE;
+}
+
+static void
+writer_write_attribute (SopaWriter                 *writer,
+                        const SopaElementAttribute *attr)
+{
+  writer_append_c (writer, ' ');
+  writer_append_str (writer, attr->name);
+
+  if (writer->mode != SOPA_SERIALIZE_MODE_MINIFIED)
+    {
+      writer_append (writer, "=\"", 2);
+      writer_append_escaped (writer, attr->value, ESCAPE_ATTRIBUTE);
+      writer_append_c (writer, '"');
+      return;
+    }
+
+  /* boolean attributes are written without a value */
+  if (attr->value[0] == '\0')
+    return;
+
+  switch (shortest_quote_style (attr->value))
+    {
+    case QUOTE_NONE:
+      writer_append_c (writer, '=');
+      writer_append_escaped (writer, attr->value, ESCAPE_TEXT);
+      break;
+
+    case QUOTE_SINGLE:
+      writer_append (writer, "='", 2);
+      writer_append_escaped (writer, attr->value, ESCAPE_TEXT);
+      writer_append_c (writer, '\'');
+      break;
+
+    case QUOTE_DOUBLE:
+      writer_append (writer, "=\"", 2);
+      writer_append_escaped (writer, attr->value, ESCAPE_ATTRIBUTE);
+      writer_append_c (writer, '"');
+      break;
+    }
+}
+
+static void
+writer_open_tag (SopaWriter  *writer,
+                 SopaElement *element)
+{
+  const SopaElementAttribute *attrs;
+  guint i, n_attrs;
+
+  writer_append_c (writer, '<');
+  writer_append_str (writer, sopa_element_get_tag (element));
+
+  attrs = _sopa_element_get_attributes (element, &n_attrs);
+  for (i = 0; i < n_attrs; i++)
+    writer_write_attribute (writer, &attrs[i]);
+
+  writer_append_c (writer, '>');
+}
+
+/* puts a node that is not at the top on a line of its own */
+static inline void
+writer_begin_line (SopaWriter *writer,
+                   guint       cur_indent)
+{
+  if (cur_indent > 0 && writer->mode == SOPA_SERIALIZE_MODE_PRETTY)
+    {
+      writer_append_c (writer, '\n');
+      writer_append_spaces (writer, cur_indent);
+    }
+}
+
+static void
+writer_close_tag (SopaWriter  *writer,
+                  SopaElement *element,
+                  guint        cur_indent)
+{
+  const gchar *tag = sopa_element_get_tag (element);
+
+  switch (writer->mode)
+    {
+    case SOPA_SERIALIZE_MODE_PRETTY:
+      writer_append_c (writer, '\n');
+      writer_append_spaces (writer, cur_indent);
+      break;
+
+    case SOPA_SERIALIZE_MODE_MINIFIED:
+      if (sopa_node_get_first_child (SOPA_NODE (element)) == NULL &&
+          is_void_element (tag))
+        return;
+      break;
+
+    case SOPA_SERIALIZE_MODE_FAITHFUL:
+      break;
+    }
+
+  writer_append (writer, "</", 2);
+  writer_append_str (writer, tag);
+  writer_append_c (writer, '>');
+}
+
+typedef struct
+{
+  /* where the markup of the node starts in the output */
+  gsize        start;
+
+  /* the last markup of the node, or %NULL if there is none */
+  const gchar *old;
+} WriterFrame;
+
+/* remembers where the markup of @node is, once it is written, and
+ * whether it was copied from the source
+ */
+static void
+writer_record (SopaWriter *writer,
+               SopaNode   *node,
+               gsize       parent_start,
+               gsize       start,
+               gboolean    sourced)
+{
+  SopaNodeSerial *serial;
+
+  if (!writer->record || writer->out == NULL)
+    return;
+
+  serial = _sopa_node_get_serial (node);
+  serial->offset = start - parent_start;
+  serial->length = writer->len - start;
+  serial->cached = TRUE;
+  serial->dirty = FALSE;
+  serial->sourced = sourced;
+}
+
+/* writes @n_siblings siblings from @first on, and their descendants,
+ * with @first at @indent; @old is the last markup of their parent
+ */
+static void
+writer_write_siblings (SopaWriter  *writer,
+                       SopaNode    *first,
+                       guint        n_siblings,
+                       guint        indent,
+                       const gchar *old)
+{
+  SopaNode *node, *next;
+  SopaNodeSerial *serial;
+  WriterFrame frame, *parent;
+  GArray *stack;
+  guint cur_indent = indent;
+  guint n_written = 0;
+  gsize start, source_start, source_end;
+
+  stack = g_array_sized_new (FALSE, FALSE, sizeof (WriterFrame), 16);
+
+  frame.start = writer->len;
+  frame.old = old;
+  g_array_append_val (stack, frame);
+
+  node = first;
+
+  while (node != NULL)
+    {
+      parent = &g_array_index (stack, WriterFrame, stack->len - 1);
+      serial = _sopa_node_get_serial (node);
+      start = writer->len;
+
+      /* unchanged since the last time: copy the markup it had */
+      if (parent->old != NULL && serial->cached && !serial->dirty)
+        {
+          writer_append (writer, parent->old + serial->offset, serial->length);
+          writer_record (writer, node, parent->start, start, serial->sourced);
+          goto written;
+        }
+
+      /* unchanged since parsed: copy the markup it has in the source */
+      if (writer->source_map != NULL &&
+          serial->parsed &&
+          _sopa_source_map_lookup (writer->source_map, node,
+                                   &source_start, &source_end))
+        {
+          writer_append (writer,
+                         writer->source + source_start,
+                         source_end - source_start);
+          writer_record (writer, node, parent->start, start, TRUE);
+          goto written;
+        }
+
+      writer_begin_line (writer, cur_indent);
+
+      if (SOPA_IS_ELEMENT (node))
+        {
+          writer_open_tag (writer, SOPA_ELEMENT (node));
+
+          next = sopa_node_get_first_child (node);
+          if (next != NULL)
+            {
+              /* the children of a copy of the source were not recorded */
+              frame.start = start;
+              frame.old = parent->old != NULL &&
+                          serial->cached && !serial->sourced
+                        ? parent->old + serial->offset
+                        : NULL;
+              g_array_append_val (stack, frame);
+
+              node = next;
+              cur_indent += writer->indent_width;
+              continue;
+            }
+
+          writer_close_tag (writer, SOPA_ELEMENT (node), cur_indent);
+        }
+      else if (SOPA_IS_TEXT (node))
+        {
+          const gchar *content = sopa_text_get_content (SOPA_TEXT (node));
+
+          if (content != NULL)
+            writer_append_escaped (writer, content, ESCAPE_TEXT);
+        }
+
+      writer_record (writer, node, parent->start, start, FALSE);
+
+    written:
+      /* stop at the first write error */
+      if (G_UNLIKELY (writer->stream != NULL && writer->stream->error != NULL))
+        break;
+
+      /* close the elements whose last child was written */
+      while (stack->len > 1 && sopa_node_get_next_sibling (node) == NULL)
+        {
+          node = sopa_node_get_parent (node);
+
+          cur_indent -= writer->indent_width;
+          writer_close_tag (writer, SOPA_ELEMENT (node), cur_indent);
+
+          frame = g_array_index (stack, WriterFrame, stack->len - 1);
+          g_array_set_size (stack, stack->len - 1);
+
+          parent = &g_array_index (stack, WriterFrame, stack->len - 1);
+          writer_record (writer, node, parent->start, frame.start, FALSE);
+        }
+
+      if (stack->len == 1 && ++n_written == n_siblings)
+        break;
+
+      node = sopa_node_get_next_sibling (node);
+    }
+
+  g_array_free (stack, TRUE);
+}
+
+static inline void
+writer_write_children (SopaWriter  *writer,
+                       SopaNode    *root,
+                       const gchar *old)
+{
+  SopaNode *first = sopa_node_get_first_child (root);
+
+  if (first != NULL)
+    writer_write_siblings (writer, first, G_MAXUINT, 0, old);
+}
+
+static void
+writer_init (SopaWriter        *writer,
+             SopaSerializeMode  mode,
+             guint              indent_width)
+{
+  memset (writer, 0, sizeof (SopaWriter));
+
+  writer->mode = mode;
+
+  /* only the pretty layout indents */
+  if (mode == SOPA_SERIALIZE_MODE_PRETTY)
+    writer->indent_width = indent_width;
+}
+
+/* lets the writer copy the nodes below @node that did not change since
+ * they were parsed from the source of their document, in the faithful
+ * layout, where that is their markup
+ */
+static void
+writer_use_source (SopaWriter *writer,
+                   SopaNode   *node)
+{
+  SopaNode *parent;
+  SopaSourceMap *map;
+
+  if (writer->mode != SOPA_SERIALIZE_MODE_FAITHFUL)
+    return;
+
+  while ((parent = sopa_node_get_parent (node)) != NULL)
+    node = parent;
+
+  if (!SOPA_IS_DOCUMENT (node))
+    return;
+
+  map = _sopa_document_get_source_map (SOPA_DOCUMENT (node));
+  if (map == NULL)
+    return;
+
+  writer->source_map = map;
+  writer->source = g_bytes_get_data (_sopa_source_map_get_source (map), NULL);
+}
+
+/*< private >
+ * _sopa_writer_to_string:
+ * @root: a #SopaNode
+ * @mode: the #SopaSerializeMode
+ * @indent_width: number of spaces per nesting level, in pretty mode
+ * @length: (out) (allow-none): return location for the length of the
+ *      string
+ *
+ * Serializes the children of @root into a single allocation.
+ *
+ * When @root is the root of its tree, the markup is kept along with
+ * where each node is within it; the next time, the nodes that did
+ * not change since are copied from there instead of being written
+ * again, so the work done depends on the size of the changes rather
+ * than on the size of the tree. In the faithful layout, the nodes that
+ * did not change since they were parsed are copied from the source
+ * instead, so that the first serialization of a parsed document does
+ * not walk it either. The kept markup is read and replaced
+ * under the serialization lock of the tree, so that several threads
+ * can serialize the same tree.
+ *
+ * Return value: (transfer full): the markup, to be freed with g_free()
+ */
+gchar *
+_sopa_writer_to_string (SopaNode          *root,
+                        SopaSerializeMode  mode,
+                        guint              indent_width,
+                        gsize             *length)
+{
+  SopaNodeSerial *serial = NULL;
+  SopaWriter writer;
+  const gchar *old = NULL;
+
+  writer_init (&writer, mode, indent_width);
+
+  if (sopa_node_get_parent (root) == NULL)
+    {
+      _sopa_node_lock_serial (root);
+
+      serial = _sopa_node_get_serial (root);
+      writer.record = TRUE;
+
+      if (serial->bytes != NULL &&
+          serial->mode == (gint) mode &&
+          serial->indent_width == writer.indent_width)
+        {
+          gsize old_length;
+
+          old = g_bytes_get_data (serial->bytes, &old_length);
+
+          if (!serial->dirty)
+            {
+              gchar *retval = g_strndup (old, old_length);
+
+              _sopa_node_unlock_serial (root);
+
+              if (length != NULL)
+                *length = old_length;
+
+              return retval;
+            }
+        }
+    }
+
+  writer_use_source (&writer, root);
+
+  writer_write_children (&writer, root, old);
+
+  writer.out = g_malloc (writer.len + 1);
+  writer.len = 0;
+
+  writer_write_children (&writer, root, old);
+  writer.out[writer.len] = '\0';
+
+  if (serial != NULL)
+    {
+      if (serial->bytes != NULL)
+        g_bytes_unref (serial->bytes);
+
+      serial->bytes = g_bytes_new (writer.out, writer.len);
+      serial->mode = mode;
+      serial->indent_width = writer.indent_width;
+      serial->dirty = FALSE;
+
+      _sopa_node_unlock_serial (root);
+    }
+
+  if (length != NULL)
+    *length = writer.len;
+
+  return writer.out;
+}
+
+/* finds the markup of the siblings from @first to @last in the last
+ * serialization of their tree, if they did not change since
+ */
+static const gchar *
+writer_find_cached_range (SopaNode          *first,
+                          SopaNode          *last,
+                          SopaSerializeMode  mode,
+                          gsize             *length)
+{
+  SopaNodeSerial *serial, *last_serial;
+  SopaNode *node, *parent;
+  const gchar *data;
+  gsize start, end, size;
+
+  /* the layout of pretty markup depends on the depth */
+  if (mode == SOPA_SERIALIZE_MODE_PRETTY)
+    return NULL;
+
+  for (node = first; ; node = sopa_node_get_next_sibling (node))
+    {
+      serial = _sopa_node_get_serial (node);
+      if (!serial->cached || serial->dirty)
+        return NULL;
+
+      if (node == last)
+        break;
+    }
+
+  start = 0;
+  for (node = first;
+       (parent = sopa_node_get_parent (node)) != NULL;
+       node = parent)
+    {
+      serial = _sopa_node_get_serial (node);
+      if (!serial->cached ||
+          (node != first && serial->sourced))
+        return NULL;
+
+      start += serial->offset;
+    }
+
+  serial = _sopa_node_get_serial (node);
+  if (serial->bytes == NULL || serial->mode != (gint) mode)
+    return NULL;
+
+  /* the siblings are relative to the same parent */
+  last_serial = _sopa_node_get_serial (last);
+  end = start - _sopa_node_get_serial (first)->offset
+      + last_serial->offset + last_serial->length;
+
+  data = g_bytes_get_data (serial->bytes, &size);
+  if (G_UNLIKELY (end > size || end < start))
+    return NULL;
+
+  *length = end - start;
+
+  return data + start;
+}
+
+/*< private >
+ * _sopa_writer_range_to_string:
+ * @first: a #SopaNode
+ * @last: a sibling of @first that follows it, or @first itself
+ * @n_siblings: the number of siblings from @first to @last
+ * @mode: the #SopaSerializeMode
+ * @indent_width: number of spaces per nesting level, in pretty mode
+ * @length: (out) (allow-none): return location for the length of the
+ *      string
+ *
+ * Serializes the siblings from @first to @last and their descendants.
+ * When none of them changed since their tree was serialized with
+ * _sopa_writer_to_string() in the same mode, their markup is copied
+ * from there.
+ *
+ * Return value: (transfer full): the markup, to be freed with g_free()
+ */
+gchar *
+_sopa_writer_range_to_string (SopaNode          *first,
+                              SopaNode          *last,
+                              guint              n_siblings,
+                              SopaSerializeMode  mode,
+                              guint              indent_width,
+                              gsize             *length)
+{
+  SopaWriter writer;
+  SopaNode *root, *parent;
+  const gchar *cached;
+  gchar *retval = NULL;
+  gsize cached_length;
+
+  for (root = first;
+       (parent = sopa_node_get_parent (root)) != NULL;
+       root = parent)
+    ;
+
+  _sopa_node_lock_serial (root);
+
+  cached = writer_find_cached_range (first, last, mode, &cached_length);
+  if (cached != NULL)
+    retval = g_strndup (cached, cached_length);
+
+  _sopa_node_unlock_serial (root);
+
+  if (retval != NULL)
+    {
+      if (length != NULL)
+        *length = cached_length;
+
+      return retval;
+    }
+
+  writer_init (&writer, mode, indent_width);
+  writer_use_source (&writer, first);
+
+  writer_write_siblings (&writer, first, n_siblings, 0, NULL);
+
+  writer.out = g_malloc (writer.len + 1);
+  writer.len = 0;
+
+  writer_write_siblings (&writer, first, n_siblings, 0, NULL);
+  writer.out[writer.len] = '\0';
+
+  if (length != NULL)
+    *length = writer.len;
+
+  return writer.out;
+}
+
+typedef enum {
+  PIECE_OPEN_TAG,
+  PIECE_CLOSE_TAG,
+  PIECE_SIBLINGS
+} WriterPieceType;
+
+/* a part of the markup that can be written on its own */
+typedef struct
+{
+  WriterPieceType  type;
+  SopaNode        *first;
+  guint            n_siblings;
+  guint            indent;
+
+  /* the length of the markup, and where it goes */
+  gsize            len;
+  gchar           *out;
+} WriterPiece;
+
+typedef struct
+{
+  SopaSerializeMode mode;
+  guint             indent_width;
+} WriterPieceClosure;
+
+static void
+add_piece (GArray          *pieces,
+           WriterPieceType  type,
+           SopaNode        *first,
+           guint            n_siblings,
+           guint            indent)
+{
+  WriterPiece piece;
+
+  piece.type = type;
+  piece.first = first;
+  piece.n_siblings = n_siblings;
+  piece.indent = indent;
+  piece.len = 0;
+  piece.out = NULL;
+
+  g_array_append_val (pieces, piece);
+}
+
+typedef struct
+{
+  /* the element whose children are being split, or %NULL for the root */
+  SopaNode *element;
+  SopaNode *next_child;
+  guint     indent;
+} SplitFrame;
+
+/* splits the markup of the children of @root, in document order, into
+ * pieces of about @grain nodes: elements with larger sub-trees are
+ * split into their tags and the pieces of their children, and small
+ * siblings are grouped in runs
+ */
+static void
+writer_split (SopaNode *root,
+              guint     indent_width,
+              guint     grain,
+              GArray   *pieces)
+{
+  SplitFrame frame, *top;
+  SopaNode *child, *run = NULL;
+  guint run_length = 0, run_size = 0, size;
+  GArray *stack;
+
+  stack = g_array_new (FALSE, FALSE, sizeof (SplitFrame));
+
+  frame.element = NULL;
+  frame.next_child = sopa_node_get_first_child (root);
+  frame.indent = 0;
+  g_array_append_val (stack, frame);
+
+  while (stack->len > 0)
+    {
+      top = &g_array_index (stack, SplitFrame, stack->len - 1);
+      child = top->next_child;
+      frame = *top;
+
+      size = child != NULL ? _sopa_node_get_subtree_size (child) : 0;
+
+      /* a run ends at the end of the siblings, or before a large one */
+      if (child == NULL || size > grain)
+        {
+          if (run != NULL)
+            add_piece (pieces, PIECE_SIBLINGS, run, run_length, frame.indent);
+
+          run = NULL;
+          run_length = run_size = 0;
+        }
+
+      if (child == NULL)
+        {
+          if (frame.element != NULL)
+            add_piece (pieces, PIECE_CLOSE_TAG, frame.element, 1,
+                       frame.indent - indent_width);
+
+          g_array_set_size (stack, stack->len - 1);
+          continue;
+        }
+
+      top->next_child = sopa_node_get_next_sibling (child);
+
+      if (size > grain &&
+          SOPA_IS_ELEMENT (child) &&
+          sopa_node_get_first_child (child) != NULL)
+        {
+          add_piece (pieces, PIECE_OPEN_TAG, child, 1, frame.indent);
+
+          frame.element = child;
+          frame.next_child = sopa_node_get_first_child (child);
+          frame.indent += indent_width;
+          g_array_append_val (stack, frame);
+          continue;
+        }
+
+      if (run == NULL)
+        run = child;
+
+      run_length += 1;
+      run_size += size;
+
+      if (run_size >= grain)
+        {
+          add_piece (pieces, PIECE_SIBLINGS, run, run_length, frame.indent);
+
+          run = NULL;
+          run_length = run_size = 0;
+        }
+    }
+
+  g_array_free (stack, TRUE);
+}
+
+static void
+writer_piece_run (gpointer task,
+                  gpointer user_data)
+{
+  WriterPiece *piece = task;
+  WriterPieceClosure *closure = user_data;
+  SopaWriter writer;
+
+  writer_init (&writer, closure->mode, closure->indent_width);
+  writer_use_source (&writer, piece->first);
+  writer.out = piece->out;
+
+  switch (piece->type)
+    {
+    case PIECE_OPEN_TAG:
+      writer_begin_line (&writer, piece->indent);
+      writer_open_tag (&writer, SOPA_ELEMENT (piece->first));
+      break;
+
+    case PIECE_CLOSE_TAG:
+      writer_close_tag (&writer, SOPA_ELEMENT (piece->first), piece->indent);
+      break;
+
+    case PIECE_SIBLINGS:
+      writer_write_siblings (&writer,
+                             piece->first,
+                             piece->n_siblings,
+                             piece->indent,
+                             NULL);
+      break;
+    }
+
+  piece->len = writer.len;
+}
+
+/*< private >
+ * _sopa_writer_to_string_parallel:
+ * @root: a #SopaNode
+ * @mode: the #SopaSerializeMode
+ * @indent_width: number of spaces per nesting level, in pretty mode
+ * @n_threads: the maximum number of threads to use, or 0 to use one
+ *      per processor
+ * @length: (out) (allow-none): return location for the length of the
+ *      string
+ *
+ * Serializes the children of @root as _sopa_writer_to_string() does,
+ * from up to @n_threads threads. The markup is split into pieces of
+ * similar node counts, which are measured in parallel; once the place
+ * of each piece in the result is known, they are written in parallel,
+ * straight into the single allocation that is returned.
+ *
+ * Return value: (transfer full): the markup, to be freed with g_free()
+ */
+gchar *
+_sopa_writer_to_string_parallel (SopaNode          *root,
+                                 SopaSerializeMode  mode,
+                                 guint              indent_width,
+                                 guint              n_threads,
+                                 gsize             *length)
+{
+  WriterPieceClosure closure;
+  WriterPiece *piece;
+  SopaNode *frozen_root;
+  GArray *pieces;
+  GPtrArray *tasks;
+  gchar *retval;
+  gsize len;
+  guint grain, i;
+
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+
+  if (n_threads == 1)
+    return _sopa_writer_to_string (root, mode, indent_width, length);
+
+  frozen_root = _sopa_node_freeze_tree (root);
+
+  /* a few pieces per thread, so that idle threads can steal some */
+  grain = MAX (_sopa_node_get_subtree_size (root) / (n_threads * 8), 256);
+
+  if (_sopa_node_get_subtree_size (root) <= grain)
+    {
+      _sopa_node_thaw_tree (frozen_root);
+      return _sopa_writer_to_string (root, mode, indent_width, length);
+    }
+
+  closure.mode = mode;
+  closure.indent_width = mode == SOPA_SERIALIZE_MODE_PRETTY ? indent_width : 0;
+
+  pieces = g_array_new (FALSE, FALSE, sizeof (WriterPiece));
+  writer_split (root, closure.indent_width, grain, pieces);
+
+  tasks = g_ptr_array_sized_new (pieces->len);
+  for (i = 0; i < pieces->len; i++)
+    g_ptr_array_add (tasks, &g_array_index (pieces, WriterPiece, i));
+
+  /* measure */
+  _sopa_task_pool_run (tasks->pdata, tasks->len, n_threads,
+                       writer_piece_run, &closure);
+
+  len = 0;
+  for (i = 0; i < pieces->len; i++)
+    len += g_array_index (pieces, WriterPiece, i).len;
+
+  retval = g_malloc (len + 1);
+  retval[len] = '\0';
+
+  len = 0;
+  for (i = 0; i < pieces->len; i++)
+    {
+      piece = &g_array_index (pieces, WriterPiece, i);
+      piece->out = retval + len;
+      len += piece->len;
+    }
+
+  /* write */
+  _sopa_task_pool_run (tasks->pdata, tasks->len, n_threads,
+                       writer_piece_run, &closure);
+
+  _sopa_node_thaw_tree (frozen_root);
+
+  g_ptr_array_unref (tasks);
+  g_array_free (pieces, TRUE);
+
+  if (length != NULL)
+    *length = len;
+
+  return retval;
+}
+
+typedef void (* WriterFunc) (SopaWriter *writer,
+                             SopaNode   *root);
+
+static void
+writer_write_all_children (SopaWriter *writer,
+                           SopaNode   *root)
+{
+  writer_write_children (writer, root, NULL);
+}
+
+/* runs @func with the output of @writer going to @stream; large
+ * pieces are written straight from the nodes, so the tree is frozen
+ * until they are all flushed
+ */
+static gboolean
+writer_run_on_stream (SopaWriter     *writer,
+                      WriterFunc      func,
+                      SopaNode       *root,
+                      GOutputStream  *stream,
+                      GCancellable   *cancellable,
+                      GError        **error)
+{
+  SopaWriterStream *state;
+  SopaNode *frozen_root;
+  gboolean retval;
+
+  state = g_slice_new (SopaWriterStream);
+  state->stream = stream;
+  state->cancellable = cancellable;
+  state->error = NULL;
+  state->len = 0;
+  state->segment_start = 0;
+  state->n_vectors = 0;
+
+  writer->stream = state;
+  frozen_root = _sopa_node_freeze_tree (root);
+
+  func (writer, root);
+  stream_flush (state);
+
+  _sopa_node_thaw_tree (frozen_root);
+
+  retval = state->error == NULL;
+  if (!retval)
+    g_propagate_error (error, state->error);
+
+  writer->stream = NULL;
+  g_slice_free (SopaWriterStream, state);
+
+  return retval;
+}
+
+/*< private >
+ * _sopa_writer_write_to_stream:
+ * @root: a #SopaNode
+ * @mode: the #SopaSerializeMode
+ * @indent_width: number of spaces per nesting level, in pretty mode
+ * @stream: a #GOutputStream
+ * @cancellable: (allow-none): a #GCancellable
+ * @error: return location for a #GError
+ *
+ * Serializes the children of @root to @stream, as
+ * _sopa_writer_to_string() would, using a fixed amount of memory.
+ *
+ * Return value: %TRUE on success, %FALSE if there was an error
+ */
+gboolean
+_sopa_writer_write_to_stream (SopaNode          *root,
+                              SopaSerializeMode  mode,
+                              guint              indent_width,
+                              GOutputStream     *stream,
+                              GCancellable      *cancellable,
+                              GError           **error)
+{
+  SopaWriter writer;
+
+  writer_init (&writer, mode, indent_width);
+  writer_use_source (&writer, root);
+
+  return writer_run_on_stream (&writer,
+                               writer_write_all_children,
+                               root,
+                               stream,
+                               cancellable,
+                               error);
+}
+
+static void
+writer_json_open_node (SopaWriter *writer,
+                       SopaNode   *node)
+{
+  const SopaElementAttribute *attrs;
+  guint i, n_attrs;
+
+  if (SOPA_IS_DOCUMENT (node))
+    {
+      writer_append_str (writer, "{\"type\":\"document\"");
+      return;
+    }
+
+  if (SOPA_IS_TEXT (node))
+    {
+      const gchar *content = sopa_text_get_content (SOPA_TEXT (node));
+
+      writer_append_str (writer, "{\"type\":\"text\",\"text\":\"");
+      if (content != NULL)
+        writer_append_escaped (writer, content, ESCAPE_JSON);
+      writer_append_c (writer, '"');
+      return;
+    }
+
+  writer_append_str (writer, "{\"type\":\"element\",\"tag\":\"");
+  writer_append_escaped (writer, sopa_element_get_tag (SOPA_ELEMENT (node)), ESCAPE_JSON);
+  writer_append_c (writer, '"');
+
+  attrs = _sopa_element_get_attributes (SOPA_ELEMENT (node), &n_attrs);
+  if (n_attrs == 0)
+    return;
+
+  writer_append_str (writer, ",\"attributes\":{");
+  for (i = 0; i < n_attrs; i++)
+    {
+      if (i > 0)
+        writer_append_c (writer, ',');
+
+      writer_append_c (writer, '"');
+      writer_append_escaped (writer, attrs[i].name, ESCAPE_JSON);
+      writer_append (writer, "\":\"", 3);
+      writer_append_escaped (writer, attrs[i].value, ESCAPE_JSON);
+      writer_append_c (writer, '"');
+    }
+  writer_append_c (writer, '}');
+}
+
+/* writes @root and its descendants as JSON, without recursing */
+static void
+writer_write_json (SopaWriter *writer,
+                   SopaNode   *root)
+{
+  SopaNode *node = root, *child;
+  gboolean need_comma = FALSE;
+
+  while (node != NULL)
+    {
+      /* comments and data have nothing to export */
+      if (SOPA_IS_ELEMENT (node) || SOPA_IS_TEXT (node))
+        {
+          if (need_comma)
+            writer_append_c (writer, ',');
+
+          writer_json_open_node (writer, node);
+
+          child = sopa_node_get_first_child (node);
+          if (SOPA_IS_ELEMENT (node) && child != NULL)
+            {
+              writer_append_str (writer, ",\"children\":[");
+              need_comma = FALSE;
+
+              node = child;
+              continue;
+            }
+
+          writer_append_c (writer, '}');
+          need_comma = TRUE;
+        }
+
+      /* stop at the first write error */
+      if (G_UNLIKELY (writer->stream != NULL && writer->stream->error != NULL))
+        return;
+
+      /* close the elements whose last child was written */
+      while (node != root && sopa_node_get_next_sibling (node) == NULL)
+        {
+          node = sopa_node_get_parent (node);
+          writer_append (writer, "]}", 2);
+          need_comma = TRUE;
+        }
+
+      if (node == root)
+        return;
+
+      node = sopa_node_get_next_sibling (node);
+    }
+}
+
+/*< private >
+ * _sopa_writer_to_json:
+ * @root: a #SopaNode
+ * @length: (out) (allow-none): return location for the length of the
+ *      string
+ *
+ * Exports @root and its descendants as JSON, into a single allocation.
+ *
+ * Return value: (transfer full): the JSON text, to be freed with g_free()
+ */
+gchar *
+_sopa_writer_to_json (SopaNode *root,
+                      gsize    *length)
+{
+  SopaWriter writer;
+
+  writer_init (&writer, SOPA_SERIALIZE_MODE_MINIFIED, 0);
+
+  writer_write_json (&writer, root);
+
+  writer.out = g_malloc (writer.len + 1);
+  writer.len = 0;
+
+  writer_write_json (&writer, root);
+  writer.out[writer.len] = '\0';
+
+  if (length != NULL)
+    *length = writer.len;
+
+  return writer.out;
+}
+
+/*< private >
+ * _sopa_writer_write_json_to_stream:
+ * @root: a #SopaNode
+ * @stream: a #GOutputStream
+ * @cancellable: (allow-none): a #GCancellable
+ * @error: return location for a #GError
+ *
+ * Exports @root and its descendants as JSON to @stream, as
+ * _sopa_writer_to_json() would, using a fixed amount of memory.
+ *
+ * Return value: %TRUE on success, %FALSE if there was an error
+ */
+gboolean
+_sopa_writer_write_json_to_stream (SopaNode       *root,
+                                   GOutputStream  *stream,
+                                   GCancellable   *cancellable,
+                                   GError        **error)
+{
+  SopaWriter writer;
+
+  writer_init (&writer, SOPA_SERIALIZE_MODE_MINIFIED, 0);
+
+  return writer_run_on_stream (&writer,
+                               writer_write_json,
+                               root,
+                               stream,
+                               cancellable,
+                               error);
+}
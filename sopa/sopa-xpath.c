@@ -0,0 +1,2798 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-xpath.c
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+/**
+ * SECTION:sopa-xpath
+ * @short_description: XPath 1.0 expressions over #SopaNode trees
+ *
+ * #SopaXPath evaluates a subset of XPath 1.0 directly on a #SopaNode
+ * tree. Expressions are compiled once with sopa_xpath_compile() and can
+ * then be evaluated any number of times, from any thread, against any
+ * context node.
+ *
+ * The supported subset includes absolute and relative location paths
+ * with the abbreviated syntax, the child, descendant, descendant-or-self,
+ * self, parent, ancestor, ancestor-or-self, following-sibling,
+ * preceding-sibling and attribute axes, the node(), text() and comment()
+ * node tests, predicates, unions, the arithmetic, relational and boolean
+ * operators and the following functions: last(), position(), count(),
+ * name(), local-name(), string(), concat(), starts-with(), contains(),
+ * substring-before(), substring-after(), substring(), string-length(),
+ * normalize-space(), boolean(), not(), true(), false() and number().
+ *
+ * Attributes are not nodes in Sopa, so an attribute step can only be the
+ * last step of a path; such a path evaluates to the values of the
+ * selected attributes.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "sopa-xpath.h"
+
+#include "sopa-comment.h"
+#include "sopa-document.h"
+#include "sopa-element.h"
+#include "sopa-element-private.h"
+#include "sopa-node-private.h"
+#include "sopa-text.h"
+
+G_DEFINE_BOXED_TYPE (SopaXPath, sopa_xpath,
+                     sopa_xpath_ref,
+                     sopa_xpath_unref)
+
+G_DEFINE_QUARK (sopa-xpath-error-quark, sopa_xpath_error)
+
+typedef enum {
+  AXIS_CHILD,
+  AXIS_DESCENDANT,
+  AXIS_DESCENDANT_OR_SELF,
+  AXIS_SELF,
+  AXIS_PARENT,
+  AXIS_ANCESTOR,
+  AXIS_ANCESTOR_OR_SELF,
+  AXIS_FOLLOWING_SIBLING,
+  AXIS_PRECEDING_SIBLING,
+  AXIS_ATTRIBUTE
+} Axis;
+
+typedef enum {
+  TEST_NAME,
+  TEST_ANY,
+  TEST_NODE,
+  TEST_TEXT,
+  TEST_COMMENT
+} NodeTest;
+
+typedef enum {
+  EXPR_OR,
+  EXPR_AND,
+  EXPR_EQ,
+  EXPR_NE,
+  EXPR_LT,
+  EXPR_LE,
+  EXPR_GT,
+  EXPR_GE,
+  EXPR_ADD,
+  EXPR_SUB,
+  EXPR_MUL,
+  EXPR_DIV,
+  EXPR_MOD,
+  EXPR_NEG,
+  EXPR_UNION,
+  EXPR_LITERAL,
+  EXPR_NUMBER,
+  EXPR_FUNCTION,
+  EXPR_PATH,
+  EXPR_FILTER
+} ExprType;
+
+typedef struct _Expr Expr;
+typedef struct _Step Step;
+typedef struct _Path Path;
+typedef struct _Function Function;
+
+struct _Step
+{
+  Axis           axis;
+  NodeTest       test;
+  gchar         *name;
+
+  Expr         **predicates;
+  guint          n_predicates;
+};
+
+struct _Path
+{
+  gboolean       absolute;
+
+  Step          *steps;
+  guint          n_steps;
+};
+
+struct _Expr
+{
+  ExprType       type;
+
+  /* operands; EXPR_NEG only uses left, EXPR_FILTER uses left as the
+   * filtered primary expression
+   */
+  Expr          *left;
+  Expr          *right;
+
+  gchar         *literal;
+  gdouble        number;
+
+  /* function arguments or filter predicates */
+  Expr         **args;
+  guint          n_args;
+  const Function *function;
+
+  /* location path, or the path following a filter */
+  Path          *path;
+};
+
+struct _SopaXPath
+{
+  volatile gint  ref_count;
+
+  gchar         *source;
+  Expr          *root;
+};
+
+struct _SopaXPathResult
+{
+  SopaXPathResultType type;
+
+  /* nodes, or attribute values */
+  GPtrArray     *items;
+
+  gchar         *string;
+  gdouble        number;
+  gboolean       boolean;
+};
+
+typedef SopaXPathResult Value;
+
+typedef struct
+{
+  SopaNode      *node;
+  gint           position;
+  gint           size;
+} EvalContext;
+
+typedef Value * (* FunctionImpl) (Value             **args,
+                                  guint               n_args,
+                                  const EvalContext  *ctx,
+                                  GError            **error);
+
+struct _Function
+{
+  const gchar   *name;
+  guint          min_args;
+  guint          max_args;
+  FunctionImpl   impl;
+};
+
+static void expr_free (Expr *expr);
+
+static Value *eval_expr (const Expr         *expr,
+                         const EvalContext  *ctx,
+                         GError            **error);
+
+/* Values */
+
+static Value *
+value_new (SopaXPathResultType type)
+{
+  Value *value = g_slice_new0 (Value);
+
+  value->type = type;
+
+  return value;
+}
+
+static Value *
+value_new_items (SopaXPathResultType  type,
+                 GPtrArray           *items)
+{
+  Value *value = value_new (type);
+
+  value->items = items;
+
+  return value;
+}
+
+static Value *
+value_new_string (gchar *string)
+{
+  Value *value = value_new (SOPA_XPATH_RESULT_STRING);
+
+  value->string = string;
+
+  return value;
+}
+
+static Value *
+value_new_number (gdouble number)
+{
+  Value *value = value_new (SOPA_XPATH_RESULT_NUMBER);
+
+  value->number = number;
+
+  return value;
+}
+
+static Value *
+value_new_boolean (gboolean boolean)
+{
+  Value *value = value_new (SOPA_XPATH_RESULT_BOOLEAN);
+
+  value->boolean = boolean;
+
+  return value;
+}
+
+static void
+value_free (Value *value)
+{
+  if (value == NULL)
+    return;
+
+  if (value->items != NULL)
+    g_ptr_array_unref (value->items);
+
+  g_free (value->string);
+
+  g_slice_free (Value, value);
+}
+
+static inline gboolean
+value_is_set (const Value *value)
+{
+  return value->type == SOPA_XPATH_RESULT_NODES ||
+         value->type == SOPA_XPATH_RESULT_ATTRIBUTES;
+}
+
+static void
+append_string_value (GString  *buffer,
+                     SopaNode *root)
+{
+  SopaNode *node;
+
+  if (SOPA_IS_TEXT (root))
+    {
+      const gchar *content = sopa_text_get_content (SOPA_TEXT (root));
+
+      if (content != NULL)
+        g_string_append (buffer, content);
+
+      return;
+    }
+
+  for (node = _sopa_node_next_in_tree (root, root);
+       node != NULL;
+       node = _sopa_node_next_in_tree (node, root))
+    {
+      if (SOPA_IS_TEXT (node))
+        {
+          const gchar *content = sopa_text_get_content (SOPA_TEXT (node));
+
+          if (content != NULL)
+            g_string_append (buffer, content);
+        }
+    }
+}
+
+static gchar *
+node_string_value (SopaNode *node)
+{
+  GString *buffer = g_string_new (NULL);
+
+  append_string_value (buffer, node);
+
+  return g_string_free (buffer, FALSE);
+}
+
+/* string-value of the i-th item of a set */
+static gchar *
+set_item_string (const Value *value,
+                 guint        i)
+{
+  if (value->type == SOPA_XPATH_RESULT_ATTRIBUTES)
+    return g_strdup (g_ptr_array_index (value->items, i));
+
+  return node_string_value (g_ptr_array_index (value->items, i));
+}
+
+static gdouble
+xpath_floor (gdouble x)
+{
+  gint64 i;
+
+  if (isnan (x) || isinf (x) || x >= 4.5e15 || x <= -4.5e15)
+    return x;
+
+  i = (gint64) x;
+  if ((gdouble) i > x)
+    i -= 1;
+
+  return (gdouble) i;
+}
+
+static gdouble
+xpath_round (gdouble x)
+{
+  return xpath_floor (x + 0.5);
+}
+
+static gdouble
+string_to_number (const gchar *str)
+{
+  const gchar *p = str;
+  gboolean digits = FALSE;
+  gchar *end;
+  gdouble result;
+
+  while (g_ascii_isspace (*p))
+    p++;
+
+  str = p;
+
+  /* XPath numbers: -?(Digits('.'Digits?)?|'.'Digits) */
+  if (*p == '-')
+    p++;
+
+  while (g_ascii_isdigit (*p))
+    p++, digits = TRUE;
+
+  if (*p == '.')
+    {
+      p++;
+      while (g_ascii_isdigit (*p))
+        p++, digits = TRUE;
+    }
+
+  if (!digits)
+    return NAN;
+
+  result = g_ascii_strtod (str, &end);
+  if (end != p)
+    return NAN;
+
+  while (g_ascii_isspace (*p))
+    p++;
+
+  if (*p != '\0')
+    return NAN;
+
+  return result;
+}
+
+static gchar *
+number_to_string (gdouble number)
+{
+  gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+  if (isnan (number))
+    return g_strdup ("NaN");
+
+  if (isinf (number))
+    return g_strdup (number > 0 ? "Infinity" : "-Infinity");
+
+  if (number == xpath_floor (number) && fabs (number) < 1e15)
+    return g_strdup_printf ("%" G_GINT64_FORMAT, (gint64) number);
+
+  return g_strdup (g_ascii_dtostr (buffer, sizeof (buffer), number));
+}
+
+static gchar *
+value_to_string (const Value *value)
+{
+  switch (value->type)
+    {
+    case SOPA_XPATH_RESULT_NODES:
+    case SOPA_XPATH_RESULT_ATTRIBUTES:
+      if (value->items->len == 0)
+        return g_strdup ("");
+      return set_item_string (value, 0);
+
+    case SOPA_XPATH_RESULT_STRING:
+      return g_strdup (value->string);
+
+    case SOPA_XPATH_RESULT_NUMBER:
+      return number_to_string (value->number);
+
+    case SOPA_XPATH_RESULT_BOOLEAN:
+      return g_strdup (value->boolean ? "true" : "false");
+    }
+
+  return NULL;
+}
+
+static gdouble
+value_to_number (const Value *value)
+{
+  gchar *string;
+  gdouble result;
+
+  switch (value->type)
+    {
+    case SOPA_XPATH_RESULT_NUMBER:
+      return value->number;
+
+    case SOPA_XPATH_RESULT_BOOLEAN:
+      return value->boolean ? 1 : 0;
+
+    case SOPA_XPATH_RESULT_STRING:
+      return string_to_number (value->string);
+
+    default:
+      string = value_to_string (value);
+      result = string_to_number (string);
+      g_free (string);
+
+      return result;
+    }
+}
+
+static gboolean
+value_to_boolean (const Value *value)
+{
+  switch (value->type)
+    {
+    case SOPA_XPATH_RESULT_NUMBER:
+      return value->number != 0 && !isnan (value->number);
+
+    case SOPA_XPATH_RESULT_BOOLEAN:
+      return value->boolean;
+
+    case SOPA_XPATH_RESULT_STRING:
+      return value->string[0] != '\0';
+
+    default:
+      return value->items->len > 0;
+    }
+}
+
+/* Comparisons */
+
+static gboolean
+compare_numbers (ExprType op,
+                 gdouble  a,
+                 gdouble  b)
+{
+  switch (op)
+    {
+    case EXPR_EQ:
+      return a == b;
+    case EXPR_NE:
+      return a != b;
+    case EXPR_LT:
+      return a < b;
+    case EXPR_LE:
+      return a <= b;
+    case EXPR_GT:
+      return a > b;
+    case EXPR_GE:
+      return a >= b;
+    default:
+      g_assert_not_reached ();
+    }
+
+  return FALSE;
+}
+
+static gboolean
+compare_strings (ExprType     op,
+                 const gchar *a,
+                 const gchar *b)
+{
+  if (op == EXPR_EQ)
+    return strcmp (a, b) == 0;
+
+  if (op == EXPR_NE)
+    return strcmp (a, b) != 0;
+
+  return compare_numbers (op, string_to_number (a), string_to_number (b));
+}
+
+/* swaps the operator so that "a op b" is "b op' a" */
+static ExprType
+swap_operator (ExprType op)
+{
+  switch (op)
+    {
+    case EXPR_LT:
+      return EXPR_GT;
+    case EXPR_LE:
+      return EXPR_GE;
+    case EXPR_GT:
+      return EXPR_LT;
+    case EXPR_GE:
+      return EXPR_LE;
+    default:
+      return op;
+    }
+}
+
+/* compares a set with a value that is not a set */
+static gboolean
+compare_set (ExprType     op,
+             const Value *set,
+             const Value *other)
+{
+  gboolean result = FALSE;
+  gchar *item, *other_str;
+  gdouble other_num;
+  guint i;
+
+  switch (other->type)
+    {
+    case SOPA_XPATH_RESULT_BOOLEAN:
+      return compare_numbers (op,
+                              value_to_boolean (set),
+                              other->boolean);
+
+    case SOPA_XPATH_RESULT_NUMBER:
+      other_num = other->number;
+
+      for (i = 0; i < set->items->len && !result; i++)
+        {
+          item = set_item_string (set, i);
+          result = compare_numbers (op, string_to_number (item), other_num);
+          g_free (item);
+        }
+
+      return result;
+
+    default:
+      other_str = value_to_string (other);
+
+      for (i = 0; i < set->items->len && !result; i++)
+        {
+          item = set_item_string (set, i);
+          result = compare_strings (op, item, other_str);
+          g_free (item);
+        }
+
+      g_free (other_str);
+
+      return result;
+    }
+}
+
+static gboolean
+compare_values (ExprType     op,
+                const Value *a,
+                const Value *b)
+{
+  gboolean result = FALSE;
+  gchar **strings;
+  guint i, j;
+
+  if (value_is_set (a) && value_is_set (b))
+    {
+      /* true if any pair of string-values satisfies the comparison */
+      strings = g_new0 (gchar *, b->items->len + 1);
+      for (j = 0; j < b->items->len; j++)
+        strings[j] = set_item_string (b, j);
+
+      for (i = 0; i < a->items->len && !result; i++)
+        {
+          gchar *item = set_item_string (a, i);
+
+          for (j = 0; j < b->items->len && !result; j++)
+            result = compare_strings (op, item, strings[j]);
+
+          g_free (item);
+        }
+
+      g_strfreev (strings);
+
+      return result;
+    }
+
+  if (value_is_set (a))
+    return compare_set (op, a, b);
+
+  if (value_is_set (b))
+    return compare_set (swap_operator (op), b, a);
+
+  if (op == EXPR_EQ || op == EXPR_NE)
+    {
+      if (a->type == SOPA_XPATH_RESULT_BOOLEAN ||
+          b->type == SOPA_XPATH_RESULT_BOOLEAN)
+        return compare_numbers (op, value_to_boolean (a), value_to_boolean (b));
+
+      if (a->type == SOPA_XPATH_RESULT_STRING &&
+          b->type == SOPA_XPATH_RESULT_STRING)
+        return compare_strings (op, a->string, b->string);
+    }
+
+  return compare_numbers (op, value_to_number (a), value_to_number (b));
+}
+
+/* Node-sets */
+
+static gint
+compare_document_order (gconstpointer a,
+                        gconstpointer b)
+{
+  return _sopa_node_compare_order (*((SopaNode **) a), *((SopaNode **) b));
+}
+
+/* sorts @nodes in document order and removes duplicates */
+static void
+sort_nodes (GPtrArray *nodes)
+{
+  guint i, j;
+
+  if (nodes->len < 2)
+    return;
+
+  g_ptr_array_sort (nodes, compare_document_order);
+
+  for (i = 1, j = 1; i < nodes->len; i++)
+    {
+      if (g_ptr_array_index (nodes, i) != g_ptr_array_index (nodes, j - 1))
+        g_ptr_array_index (nodes, j++) = g_ptr_array_index (nodes, i);
+    }
+
+  g_ptr_array_set_size (nodes, j);
+}
+
+/* merges two node-sets in document order, without duplicates */
+static GPtrArray *
+merge_nodes (GPtrArray *a,
+             GPtrArray *b)
+{
+  GPtrArray *result;
+  guint i = 0, j = 0;
+  gint cmp;
+
+  result = g_ptr_array_sized_new (a->len + b->len);
+
+  while (i < a->len && j < b->len)
+    {
+      cmp = _sopa_node_compare_order (g_ptr_array_index (a, i),
+                                      g_ptr_array_index (b, j));
+
+      if (cmp <= 0)
+        g_ptr_array_add (result, g_ptr_array_index (a, i++));
+      else
+        g_ptr_array_add (result, g_ptr_array_index (b, j++));
+
+      if (cmp == 0)
+        j++;
+    }
+
+  for (; i < a->len; i++)
+    g_ptr_array_add (result, g_ptr_array_index (a, i));
+
+  for (; j < b->len; j++)
+    g_ptr_array_add (result, g_ptr_array_index (b, j));
+
+  return result;
+}
+
+static inline gboolean
+is_element (SopaNode *node)
+{
+  return SOPA_IS_ELEMENT (node) && !SOPA_IS_DOCUMENT (node);
+}
+
+static inline gboolean
+match_node_test (const Step *step,
+                 SopaNode   *node)
+{
+  switch (step->test)
+    {
+    case TEST_NODE:
+      return TRUE;
+
+    case TEST_TEXT:
+      return SOPA_IS_TEXT (node);
+
+    case TEST_COMMENT:
+      return SOPA_IS_COMMENT (node);
+
+    case TEST_ANY:
+      return is_element (node);
+
+    case TEST_NAME:
+      return is_element (node) &&
+             strcmp (sopa_element_get_tag (SOPA_ELEMENT (node)), step->name) == 0;
+    }
+
+  return FALSE;
+}
+
+/* the candidates of @step for @node, in axis order */
+static void
+collect_axis (const Step *step,
+              SopaNode   *node,
+              GPtrArray  *out)
+{
+  SopaNode *iter;
+
+  switch (step->axis)
+    {
+    case AXIS_CHILD:
+      for (iter = sopa_node_get_first_child (node);
+           iter != NULL;
+           iter = sopa_node_get_next_sibling (iter))
+        {
+          if (match_node_test (step, iter))
+            g_ptr_array_add (out, iter);
+        }
+      break;
+
+    case AXIS_DESCENDANT_OR_SELF:
+      if (match_node_test (step, node))
+        g_ptr_array_add (out, node);
+      /* fall through */
+
+    case AXIS_DESCENDANT:
+      for (iter = _sopa_node_next_in_tree (node, node);
+           iter != NULL;
+           iter = _sopa_node_next_in_tree (iter, node))
+        {
+          if (match_node_test (step, iter))
+            g_ptr_array_add (out, iter);
+        }
+      break;
+
+    case AXIS_SELF:
+      if (match_node_test (step, node))
+        g_ptr_array_add (out, node);
+      break;
+
+    case AXIS_PARENT:
+      iter = sopa_node_get_parent (node);
+      if (iter != NULL && match_node_test (step, iter))
+        g_ptr_array_add (out, iter);
+      break;
+
+    case AXIS_ANCESTOR_OR_SELF:
+      if (match_node_test (step, node))
+        g_ptr_array_add (out, node);
+      /* fall through */
+
+    case AXIS_ANCESTOR:
+      for (iter = sopa_node_get_parent (node);
+           iter != NULL;
+           iter = sopa_node_get_parent (iter))
+        {
+          if (match_node_test (step, iter))
+            g_ptr_array_add (out, iter);
+        }
+      break;
+
+    case AXIS_FOLLOWING_SIBLING:
+      for (iter = sopa_node_get_next_sibling (node);
+           iter != NULL;
+           iter = sopa_node_get_next_sibling (iter))
+        {
+          if (match_node_test (step, iter))
+            g_ptr_array_add (out, iter);
+        }
+      break;
+
+    case AXIS_PRECEDING_SIBLING:
+      for (iter = sopa_node_get_previous_sibling (node);
+           iter != NULL;
+           iter = sopa_node_get_previous_sibling (iter))
+        {
+          if (match_node_test (step, iter))
+            g_ptr_array_add (out, iter);
+        }
+      break;
+
+    case AXIS_ATTRIBUTE:
+      g_assert_not_reached ();
+      break;
+    }
+}
+
+static inline gboolean
+is_reverse_axis (Axis axis)
+{
+  return axis == AXIS_ANCESTOR ||
+         axis == AXIS_ANCESTOR_OR_SELF ||
+         axis == AXIS_PRECEDING_SIBLING;
+}
+
+/* filters @nodes in place, keeping the ones for which @predicate holds */
+static gboolean
+apply_predicate (const Expr  *predicate,
+                 GPtrArray   *nodes,
+                 GError     **error)
+{
+  EvalContext ctx;
+  Value *value;
+  gboolean keep;
+  guint i, j;
+
+  ctx.size = nodes->len;
+
+  for (i = 0, j = 0; i < nodes->len; i++)
+    {
+      ctx.node = g_ptr_array_index (nodes, i);
+      ctx.position = i + 1;
+
+      value = eval_expr (predicate, &ctx, error);
+      if (value == NULL)
+        return FALSE;
+
+      if (value->type == SOPA_XPATH_RESULT_NUMBER)
+        keep = value->number == ctx.position;
+      else
+        keep = value_to_boolean (value);
+
+      value_free (value);
+
+      if (keep)
+        g_ptr_array_index (nodes, j++) = ctx.node;
+    }
+
+  g_ptr_array_set_size (nodes, j);
+
+  return TRUE;
+}
+
+/* positional child steps are answered without collecting the children
+ * and evaluating the predicate on each: node()[n] with the indexed
+ * child access of the node, other tests by counting the matching
+ * children up to the one asked for, from the end for last()
+ */
+static gboolean
+eval_indexed_child_step (const Step *step,
+                         SopaNode   *node,
+                         GPtrArray  *out)
+{
+  const Expr *predicate;
+  SopaNode *child;
+  gboolean from_end;
+  gint n_children, position, index_;
+
+  if (step->axis != AXIS_CHILD ||
+      step->n_predicates != 1)
+    return FALSE;
+
+  predicate = step->predicates[0];
+
+  if (predicate->type == EXPR_NUMBER)
+    {
+      /* only integral positions from 1 select a node; the range is
+       * checked before the cast, which also rules out NaN
+       */
+      if (!(predicate->number >= 1 && predicate->number <= G_MAXINT) ||
+          predicate->number != xpath_floor (predicate->number))
+        return TRUE;
+
+      position = (gint) predicate->number;
+      from_end = FALSE;
+    }
+  else if (predicate->type == EXPR_FUNCTION &&
+           strcmp (predicate->function->name, "last") == 0)
+    {
+      position = 1;
+      from_end = TRUE;
+    }
+  else
+    return FALSE;
+
+  if (step->test == TEST_NODE)
+    {
+      n_children = sopa_node_get_n_children (node);
+      index_ = from_end ? n_children - position : position - 1;
+
+      if (index_ >= 0 && index_ < n_children)
+        g_ptr_array_add (out, sopa_node_get_child_at_index (node, index_));
+
+      return TRUE;
+    }
+
+  for (child = from_end ? sopa_node_get_last_child (node)
+                        : sopa_node_get_first_child (node);
+       child != NULL;
+       child = from_end ? sopa_node_get_previous_sibling (child)
+                        : sopa_node_get_next_sibling (child))
+    {
+      if (match_node_test (step, child) && --position == 0)
+        {
+          g_ptr_array_add (out, child);
+          break;
+        }
+    }
+
+  return TRUE;
+}
+
+static GPtrArray *
+eval_step (const Step  *step,
+           GPtrArray   *context,
+           GError     **error)
+{
+  GPtrArray *result, *candidates;
+  guint i, j;
+
+  result = g_ptr_array_new ();
+  candidates = g_ptr_array_new ();
+
+  for (i = 0; i < context->len; i++)
+    {
+      SopaNode *node = g_ptr_array_index (context, i);
+
+      if (eval_indexed_child_step (step, node, result))
+        continue;
+
+      g_ptr_array_set_size (candidates, 0);
+      collect_axis (step, node, candidates);
+
+      for (j = 0; j < step->n_predicates && candidates->len > 0; j++)
+        {
+          if (!apply_predicate (step->predicates[j], candidates, error))
+            {
+              g_ptr_array_unref (candidates);
+              g_ptr_array_unref (result);
+              return NULL;
+            }
+        }
+
+      for (j = 0; j < candidates->len; j++)
+        g_ptr_array_add (result, g_ptr_array_index (candidates, j));
+    }
+
+  g_ptr_array_unref (candidates);
+
+  /* a single context node yields the nodes in axis order, otherwise the
+   * results of different context nodes may overlap or interleave
+   */
+  if (context->len > 1)
+    sort_nodes (result);
+  else if (is_reverse_axis (step->axis))
+    {
+      for (i = 0, j = result->len; i + 1 < j; i++, j--)
+        {
+          gpointer tmp = g_ptr_array_index (result, i);
+
+          g_ptr_array_index (result, i) = g_ptr_array_index (result, j - 1);
+          g_ptr_array_index (result, j - 1) = tmp;
+        }
+    }
+
+  return result;
+}
+
+static GPtrArray *
+collect_attributes (const Step *step,
+                    GPtrArray  *context)
+{
+  GPtrArray *result = g_ptr_array_new ();
+  guint i;
+
+  for (i = 0; i < context->len; i++)
+    {
+      SopaNode *node = g_ptr_array_index (context, i);
+      const gchar *value;
+
+      if (!is_element (node))
+        continue;
+
+      if (step->test == TEST_NAME)
+        {
+          value = sopa_element_get_attribute (SOPA_ELEMENT (node), step->name);
+          if (value != NULL)
+            g_ptr_array_add (result, (gpointer) value);
+        }
+      else
+        _sopa_element_collect_attribute_values (SOPA_ELEMENT (node), result);
+    }
+
+  return result;
+}
+
+static Value *
+eval_path (const Path   *path,
+           GPtrArray    *start,
+           GError      **error)
+{
+  GPtrArray *current, *next;
+  guint i;
+
+  current = g_ptr_array_ref (start);
+
+  for (i = 0; i < path->n_steps; i++)
+    {
+      const Step *step = &path->steps[i];
+
+      if (step->axis == AXIS_ATTRIBUTE)
+        {
+          next = collect_attributes (step, current);
+          g_ptr_array_unref (current);
+
+          return value_new_items (SOPA_XPATH_RESULT_ATTRIBUTES, next);
+        }
+
+      next = eval_step (step, current, error);
+      g_ptr_array_unref (current);
+
+      if (next == NULL)
+        return NULL;
+
+      current = next;
+    }
+
+  return value_new_items (SOPA_XPATH_RESULT_NODES, current);
+}
+
+/* Functions */
+
+static Value *
+fn_last (Value             **args,
+         guint               n_args,
+         const EvalContext  *ctx,
+         GError            **error)
+{
+  return value_new_number (ctx->size);
+}
+
+static Value *
+fn_position (Value             **args,
+             guint               n_args,
+             const EvalContext  *ctx,
+             GError            **error)
+{
+  return value_new_number (ctx->position);
+}
+
+static gboolean
+check_node_set (Value       *value,
+                const gchar *function,
+                GError     **error)
+{
+  if (value->type == SOPA_XPATH_RESULT_NODES)
+    return TRUE;
+
+  g_set_error (error,
+               SOPA_XPATH_ERROR,
+               SOPA_XPATH_ERROR_TYPE,
+               "The argument of %s() must be a node-set",
+               function);
+
+  return FALSE;
+}
+
+static Value *
+fn_count (Value             **args,
+          guint               n_args,
+          const EvalContext  *ctx,
+          GError            **error)
+{
+  if (!value_is_set (args[0]))
+    {
+      check_node_set (args[0], "count", error);
+      return NULL;
+    }
+
+  return value_new_number (args[0]->items->len);
+}
+
+static Value *
+fn_name (Value             **args,
+         guint               n_args,
+         const EvalContext  *ctx,
+         GError            **error)
+{
+  SopaNode *node = ctx->node;
+
+  if (n_args > 0)
+    {
+      if (!check_node_set (args[0], "name", error))
+        return NULL;
+
+      node = args[0]->items->len > 0 ? g_ptr_array_index (args[0]->items, 0)
+                                     : NULL;
+    }
+
+  if (node == NULL || !is_element (node))
+    return value_new_string (g_strdup (""));
+
+  return value_new_string (g_strdup (sopa_element_get_tag (SOPA_ELEMENT (node))));
+}
+
+static Value *
+fn_local_name (Value             **args,
+               guint               n_args,
+               const EvalContext  *ctx,
+               GError            **error)
+{
+  Value *result;
+  gchar *colon;
+
+  result = fn_name (args, n_args, ctx, error);
+  if (result == NULL)
+    return NULL;
+
+  colon = strchr (result->string, ':');
+  if (colon != NULL)
+    memmove (result->string, colon + 1, strlen (colon + 1) + 1);
+
+  return result;
+}
+
+static Value *
+fn_string (Value             **args,
+           guint               n_args,
+           const EvalContext  *ctx,
+           GError            **error)
+{
+  if (n_args == 0)
+    return value_new_string (node_string_value (ctx->node));
+
+  return value_new_string (value_to_string (args[0]));
+}
+
+static Value *
+fn_concat (Value             **args,
+           guint               n_args,
+           const EvalContext  *ctx,
+           GError            **error)
+{
+  GString *buffer = g_string_new (NULL);
+  guint i;
+
+  for (i = 0; i < n_args; i++)
+    {
+      gchar *string = value_to_string (args[i]);
+
+      g_string_append (buffer, string);
+      g_free (string);
+    }
+
+  return value_new_string (g_string_free (buffer, FALSE));
+}
+
+/* evaluates the two string arguments of a function */
+#define STRING_ARGS(a, b) \
+  gchar *a = value_to_string (args[0]); \
+  gchar *b = value_to_string (args[1])
+
+static Value *
+fn_starts_with (Value             **args,
+                guint               n_args,
+                const EvalContext  *ctx,
+                GError            **error)
+{
+  STRING_ARGS (haystack, needle);
+  gboolean result = g_str_has_prefix (haystack, needle);
+
+  g_free (haystack);
+  g_free (needle);
+
+  return value_new_boolean (result);
+}
+
+static Value *
+fn_contains (Value             **args,
+             guint               n_args,
+             const EvalContext  *ctx,
+             GError            **error)
+{
+  STRING_ARGS (haystack, needle);
+  gboolean result = strstr (haystack, needle) != NULL;
+
+  g_free (haystack);
+  g_free (needle);
+
+  return value_new_boolean (result);
+}
+
+static Value *
+fn_substring_before (Value             **args,
+                     guint               n_args,
+                     const EvalContext  *ctx,
+                     GError            **error)
+{
+  STRING_ARGS (haystack, needle);
+  const gchar *p = strstr (haystack, needle);
+  gchar *result;
+
+  result = p != NULL ? g_strndup (haystack, p - haystack) : g_strdup ("");
+
+  g_free (haystack);
+  g_free (needle);
+
+  return value_new_string (result);
+}
+
+static Value *
+fn_substring_after (Value             **args,
+                    guint               n_args,
+                    const EvalContext  *ctx,
+                    GError            **error)
+{
+  STRING_ARGS (haystack, needle);
+  const gchar *p = strstr (haystack, needle);
+  gchar *result;
+
+  result = g_strdup (p != NULL ? p + strlen (needle) : "");
+
+  g_free (haystack);
+  g_free (needle);
+
+  return value_new_string (result);
+}
+
+static Value *
+fn_substring (Value             **args,
+              guint               n_args,
+              const EvalContext  *ctx,
+              GError            **error)
+{
+  gchar *string = value_to_string (args[0]);
+  glong length = g_utf8_strlen (string, -1);
+  gdouble first, last;
+  glong start, end;
+  gchar *result;
+
+  /* characters are kept when round(start) <= position < round(start) +
+   * round(length), with 1-based positions
+   */
+  first = xpath_round (value_to_number (args[1]));
+  last = n_args > 2 ? first + xpath_round (value_to_number (args[2]))
+                    : INFINITY;
+
+  if (isnan (first) || isnan (last) || last <= 1 || first > length)
+    {
+      g_free (string);
+      return value_new_string (g_strdup (""));
+    }
+
+  start = first < 1 ? 0 : (glong) first - 1;
+  end = last > length ? length : (glong) last - 1;
+
+  if (end <= start)
+    result = g_strdup ("");
+  else
+    result = g_utf8_substring (string, start, end);
+
+  g_free (string);
+
+  return value_new_string (result);
+}
+
+static Value *
+fn_string_length (Value             **args,
+                  guint               n_args,
+                  const EvalContext  *ctx,
+                  GError            **error)
+{
+  gchar *string;
+  glong length;
+
+  string = n_args > 0 ? value_to_string (args[0])
+                      : node_string_value (ctx->node);
+  length = g_utf8_strlen (string, -1);
+  g_free (string);
+
+  return value_new_number (length);
+}
+
+static Value *
+fn_normalize_space (Value             **args,
+                    guint               n_args,
+                    const EvalContext  *ctx,
+                    GError            **error)
+{
+  gchar *string, *src, *dst;
+  gboolean space = FALSE;
+
+  string = n_args > 0 ? value_to_string (args[0])
+                      : node_string_value (ctx->node);
+
+  for (src = dst = string; *src != '\0'; src++)
+    {
+      if (g_ascii_isspace (*src))
+        {
+          space = dst != string;
+          continue;
+        }
+
+      if (space)
+        *dst++ = ' ';
+
+      *dst++ = *src;
+      space = FALSE;
+    }
+
+  *dst = '\0';
+
+  return value_new_string (string);
+}
+
+static Value *
+fn_boolean (Value             **args,
+            guint               n_args,
+            const EvalContext  *ctx,
+            GError            **error)
+{
+  return value_new_boolean (value_to_boolean (args[0]));
+}
+
+static Value *
+fn_not (Value             **args,
+        guint               n_args,
+        const EvalContext  *ctx,
+        GError            **error)
+{
+  return value_new_boolean (!value_to_boolean (args[0]));
+}
+
+static Value *
+fn_true (Value             **args,
+         guint               n_args,
+         const EvalContext  *ctx,
+         GError            **error)
+{
+  return value_new_boolean (TRUE);
+}
+
+static Value *
+fn_false (Value             **args,
+          guint               n_args,
+          const EvalContext  *ctx,
+          GError            **error)
+{
+  return value_new_boolean (FALSE);
+}
+
+static Value *
+fn_number (Value             **args,
+           guint               n_args,
+           const EvalContext  *ctx,
+           GError            **error)
+{
+  gchar *string;
+  gdouble result;
+
+  if (n_args > 0)
+    return value_new_number (value_to_number (args[0]));
+
+  string = node_string_value (ctx->node);
+  result = string_to_number (string);
+  g_free (string);
+
+  return value_new_number (result);
+}
+
+static const Function functions[] = {
+  { "last",              0, 0,        fn_last },
+  { "position",          0, 0,        fn_position },
+  { "count",             1, 1,        fn_count },
+  { "name",              0, 1,        fn_name },
+  { "local-name",        0, 1,        fn_local_name },
+  { "string",            0, 1,        fn_string },
+  { "concat",            2, G_MAXINT, fn_concat },
+  { "starts-with",       2, 2,        fn_starts_with },
+  { "contains",          2, 2,        fn_contains },
+  { "substring-before",  2, 2,        fn_substring_before },
+  { "substring-after",   2, 2,        fn_substring_after },
+  { "substring",         2, 3,        fn_substring },
+  { "string-length",     0, 1,        fn_string_length },
+  { "normalize-space",   0, 1,        fn_normalize_space },
+  { "boolean",           1, 1,        fn_boolean },
+  { "not",               1, 1,        fn_not },
+  { "true",              0, 0,        fn_true },
+  { "false",             0, 0,        fn_false },
+  { "number",            0, 1,        fn_number },
+};
+
+/* Evaluation */
+
+static Value *
+eval_function (const Expr         *expr,
+               const EvalContext  *ctx,
+               GError            **error)
+{
+  Value **args, *result = NULL;
+  guint i;
+
+  args = g_newa (Value *, MAX (expr->n_args, 1));
+
+  for (i = 0; i < expr->n_args; i++)
+    {
+      args[i] = eval_expr (expr->args[i], ctx, error);
+      if (args[i] == NULL)
+        goto out;
+    }
+
+  result = expr->function->impl (args, expr->n_args, ctx, error);
+
+out:
+  while (i-- > 0)
+    value_free (args[i]);
+
+  return result;
+}
+
+static SopaNode *
+find_root (SopaNode *node)
+{
+  SopaNode *parent;
+
+  while ((parent = sopa_node_get_parent (node)) != NULL)
+    node = parent;
+
+  return node;
+}
+
+static Value *
+eval_location_path (const Path         *path,
+                    const EvalContext  *ctx,
+                    GError            **error)
+{
+  GPtrArray *start;
+  Value *result;
+
+  start = g_ptr_array_sized_new (1);
+  g_ptr_array_add (start, path->absolute ? find_root (ctx->node) : ctx->node);
+
+  result = eval_path (path, start, error);
+  g_ptr_array_unref (start);
+
+  return result;
+}
+
+static Value *
+eval_filter (const Expr         *expr,
+             const EvalContext  *ctx,
+             GError            **error)
+{
+  Value *value, *result;
+  guint i;
+
+  value = eval_expr (expr->left, ctx, error);
+  if (value == NULL)
+    return NULL;
+
+  if (expr->n_args == 0 && expr->path == NULL)
+    return value;
+
+  if (value->type != SOPA_XPATH_RESULT_NODES)
+    {
+      g_set_error_literal (error,
+                           SOPA_XPATH_ERROR,
+                           SOPA_XPATH_ERROR_TYPE,
+                           "Predicates and paths can only be applied "
+                           "to node-sets");
+      value_free (value);
+      return NULL;
+    }
+
+  for (i = 0; i < expr->n_args; i++)
+    {
+      if (!apply_predicate (expr->args[i], value->items, error))
+        {
+          value_free (value);
+          return NULL;
+        }
+    }
+
+  if (expr->path == NULL)
+    return value;
+
+  result = eval_path (expr->path, value->items, error);
+  value_free (value);
+
+  return result;
+}
+
+static Value *
+eval_union (const Expr         *expr,
+            const EvalContext  *ctx,
+            GError            **error)
+{
+  Value *left, *right, *result;
+  guint i;
+
+  left = eval_expr (expr->left, ctx, error);
+  if (left == NULL)
+    return NULL;
+
+  right = eval_expr (expr->right, ctx, error);
+  if (right == NULL)
+    {
+      value_free (left);
+      return NULL;
+    }
+
+  if (!value_is_set (left) || left->type != right->type)
+    {
+      g_set_error_literal (error,
+                           SOPA_XPATH_ERROR,
+                           SOPA_XPATH_ERROR_TYPE,
+                           "The operands of '|' must be node-sets");
+      value_free (left);
+      value_free (right);
+      return NULL;
+    }
+
+  if (left->type == SOPA_XPATH_RESULT_NODES)
+    {
+      result = value_new_items (SOPA_XPATH_RESULT_NODES,
+                                merge_nodes (left->items, right->items));
+      value_free (left);
+      value_free (right);
+
+      return result;
+    }
+
+  for (i = 0; i < right->items->len; i++)
+    g_ptr_array_add (left->items, g_ptr_array_index (right->items, i));
+
+  value_free (right);
+
+  return left;
+}
+
+static Value *
+eval_expr (const Expr         *expr,
+           const EvalContext  *ctx,
+           GError            **error)
+{
+  Value *left, *right, *result;
+  gdouble a, b;
+
+  switch (expr->type)
+    {
+    case EXPR_LITERAL:
+      return value_new_string (g_strdup (expr->literal));
+
+    case EXPR_NUMBER:
+      return value_new_number (expr->number);
+
+    case EXPR_FUNCTION:
+      return eval_function (expr, ctx, error);
+
+    case EXPR_PATH:
+      return eval_location_path (expr->path, ctx, error);
+
+    case EXPR_FILTER:
+      return eval_filter (expr, ctx, error);
+
+    case EXPR_UNION:
+      return eval_union (expr, ctx, error);
+
+    case EXPR_OR:
+    case EXPR_AND:
+      left = eval_expr (expr->left, ctx, error);
+      if (left == NULL)
+        return NULL;
+
+      /* short-circuit */
+      if (value_to_boolean (left) == (expr->type == EXPR_OR))
+        {
+          value_free (left);
+          return value_new_boolean (expr->type == EXPR_OR);
+        }
+
+      value_free (left);
+
+      right = eval_expr (expr->right, ctx, error);
+      if (right == NULL)
+        return NULL;
+
+      result = value_new_boolean (value_to_boolean (right));
+      value_free (right);
+
+      return result;
+
+    case EXPR_NEG:
+      left = eval_expr (expr->left, ctx, error);
+      if (left == NULL)
+        return NULL;
+
+      result = value_new_number (-value_to_number (left));
+      value_free (left);
+
+      return result;
+
+    default:
+      break;
+    }
+
+  /* binary operators */
+  left = eval_expr (expr->left, ctx, error);
+  if (left == NULL)
+    return NULL;
+
+  right = eval_expr (expr->right, ctx, error);
+  if (right == NULL)
+    {
+      value_free (left);
+      return NULL;
+    }
+
+  switch (expr->type)
+    {
+    case EXPR_EQ:
+    case EXPR_NE:
+    case EXPR_LT:
+    case EXPR_LE:
+    case EXPR_GT:
+    case EXPR_GE:
+      result = value_new_boolean (compare_values (expr->type, left, right));
+      break;
+
+    default:
+      a = value_to_number (left);
+      b = value_to_number (right);
+
+      switch (expr->type)
+        {
+        case EXPR_ADD:
+          result = value_new_number (a + b);
+          break;
+        case EXPR_SUB:
+          result = value_new_number (a - b);
+          break;
+        case EXPR_MUL:
+          result = value_new_number (a * b);
+          break;
+        case EXPR_DIV:
+          result = value_new_number (a / b);
+          break;
+        default:
+          result = value_new_number (fmod (a, b));
+          break;
+        }
+      break;
+    }
+
+  value_free (left);
+  value_free (right);
+
+  return result;
+}
+
+/* Parsing */
+
+typedef struct
+{
+  const gchar   *source;
+  const gchar   *cur;
+  GError       **error;
+} Parser;
+
+static Expr *parse_expr (Parser *p);
+
+static void
+set_syntax_error (Parser      *p,
+                  const gchar *message)
+{
+  g_set_error (p->error,
+               SOPA_XPATH_ERROR,
+               SOPA_XPATH_ERROR_SYNTAX,
+               "Invalid expression '%s' at offset %d: %s",
+               p->source,
+               (gint) (p->cur - p->source),
+               message);
+}
+
+static Expr *
+expr_new (ExprType type)
+{
+  Expr *expr = g_slice_new0 (Expr);
+
+  expr->type = type;
+
+  return expr;
+}
+
+static Expr *
+expr_new_binary (ExprType  type,
+                 Expr     *left,
+                 Expr     *right)
+{
+  Expr *expr = expr_new (type);
+
+  expr->left = left;
+  expr->right = right;
+
+  return expr;
+}
+
+static void
+free_predicates (Expr  **predicates,
+                 guint   n_predicates)
+{
+  guint i;
+
+  for (i = 0; i < n_predicates; i++)
+    expr_free (predicates[i]);
+
+  g_free (predicates);
+}
+
+static void
+step_clear (Step *step)
+{
+  g_free (step->name);
+  free_predicates (step->predicates, step->n_predicates);
+}
+
+static void
+path_free (Path *path)
+{
+  guint i;
+
+  if (path == NULL)
+    return;
+
+  for (i = 0; i < path->n_steps; i++)
+    step_clear (&path->steps[i]);
+
+  g_free (path->steps);
+  g_slice_free (Path, path);
+}
+
+static void
+expr_free (Expr *expr)
+{
+  if (expr == NULL)
+    return;
+
+  expr_free (expr->left);
+  expr_free (expr->right);
+  free_predicates (expr->args, expr->n_args);
+  path_free (expr->path);
+  g_free (expr->literal);
+
+  g_slice_free (Expr, expr);
+}
+
+static inline void
+skip_spaces (Parser *p)
+{
+  while (g_ascii_isspace (*p->cur))
+    p->cur++;
+}
+
+static inline gboolean
+is_name_start_char (gchar c)
+{
+  return g_ascii_isalpha (c) || c == '_' || (guchar) c >= 0x80;
+}
+
+static inline gboolean
+is_name_char (gchar c)
+{
+  return is_name_start_char (c) || g_ascii_isdigit (c) || c == '-' || c == '.';
+}
+
+static gboolean
+peek (Parser      *p,
+      const gchar *token)
+{
+  skip_spaces (p);
+
+  return strncmp (p->cur, token, strlen (token)) == 0;
+}
+
+static gboolean
+accept (Parser      *p,
+        const gchar *token)
+{
+  if (!peek (p, token))
+    return FALSE;
+
+  p->cur += strlen (token);
+
+  return TRUE;
+}
+
+/* operator names, which must not be followed by other name characters */
+static gboolean
+accept_keyword (Parser      *p,
+                const gchar *keyword)
+{
+  gsize len = strlen (keyword);
+
+  if (!peek (p, keyword) || is_name_char (p->cur[len]))
+    return FALSE;
+
+  p->cur += len;
+
+  return TRUE;
+}
+
+static gboolean
+expect (Parser      *p,
+        const gchar *token)
+{
+  gchar *message;
+
+  if (accept (p, token))
+    return TRUE;
+
+  message = g_strdup_printf ("'%s' expected", token);
+  set_syntax_error (p, message);
+  g_free (message);
+
+  return FALSE;
+}
+
+/* a (possibly prefixed) name; the cursor must be on a name start char */
+static gchar *
+parse_name (Parser *p)
+{
+  const gchar *start = p->cur;
+
+  while (is_name_char (*p->cur))
+    p->cur++;
+
+  /* prefix:local, but not the axis separator */
+  if (p->cur[0] == ':' && p->cur[1] != ':' && is_name_start_char (p->cur[1]))
+    {
+      p->cur++;
+      while (is_name_char (*p->cur))
+        p->cur++;
+    }
+
+  return g_strndup (start, p->cur - start);
+}
+
+/* the name at the cursor, without consuming it; %NULL if there is none */
+static gchar *
+peek_name (Parser       *p,
+           const gchar **after)
+{
+  const gchar *saved;
+  gchar *name;
+
+  skip_spaces (p);
+  if (!is_name_start_char (*p->cur))
+    return NULL;
+
+  saved = p->cur;
+  name = parse_name (p);
+  skip_spaces (p);
+
+  *after = p->cur;
+  p->cur = saved;
+
+  return name;
+}
+
+static gboolean
+parse_predicates (Parser   *p,
+                  Expr   ***predicates,
+                  guint    *n_predicates)
+{
+  GPtrArray *array;
+  Expr *expr;
+
+  array = g_ptr_array_new_with_free_func ((GDestroyNotify) expr_free);
+
+  while (accept (p, "["))
+    {
+      expr = parse_expr (p);
+      if (expr == NULL || !expect (p, "]"))
+        {
+          expr_free (expr);
+          g_ptr_array_unref (array);
+          return FALSE;
+        }
+
+      g_ptr_array_add (array, expr);
+    }
+
+  *n_predicates = array->len;
+  *predicates = (Expr **) g_ptr_array_free (array, FALSE);
+
+  return TRUE;
+}
+
+static const struct {
+  const gchar *name;
+  Axis axis;
+} axes[] = {
+  { "child",              AXIS_CHILD },
+  { "descendant",         AXIS_DESCENDANT },
+  { "descendant-or-self", AXIS_DESCENDANT_OR_SELF },
+  { "self",               AXIS_SELF },
+  { "parent",             AXIS_PARENT },
+  { "ancestor",           AXIS_ANCESTOR },
+  { "ancestor-or-self",   AXIS_ANCESTOR_OR_SELF },
+  { "following-sibling",  AXIS_FOLLOWING_SIBLING },
+  { "preceding-sibling",  AXIS_PRECEDING_SIBLING },
+  { "attribute",          AXIS_ATTRIBUTE },
+};
+
+static gboolean
+parse_step (Parser *p,
+            Step   *step)
+{
+  const gchar *after;
+  gchar *name;
+  guint i;
+
+  memset (step, 0, sizeof (Step));
+  step->axis = AXIS_CHILD;
+
+  if (accept (p, ".."))
+    {
+      step->axis = AXIS_PARENT;
+      step->test = TEST_NODE;
+      return TRUE;
+    }
+
+  if (accept (p, "."))
+    {
+      step->axis = AXIS_SELF;
+      step->test = TEST_NODE;
+      return TRUE;
+    }
+
+  if (accept (p, "@"))
+    step->axis = AXIS_ATTRIBUTE;
+  else if ((name = peek_name (p, &after)) != NULL)
+    {
+      if (strncmp (after, "::", 2) == 0)
+        {
+          for (i = 0; i < G_N_ELEMENTS (axes); i++)
+            {
+              if (strcmp (axes[i].name, name) == 0)
+                break;
+            }
+
+          g_free (name);
+
+          if (i == G_N_ELEMENTS (axes))
+            {
+              g_set_error (p->error,
+                           SOPA_XPATH_ERROR,
+                           SOPA_XPATH_ERROR_UNSUPPORTED,
+                           "Invalid expression '%s': unsupported axis "
+                           "at offset %d",
+                           p->source, (gint) (p->cur - p->source));
+              return FALSE;
+            }
+
+          step->axis = axes[i].axis;
+          p->cur = after + 2;
+        }
+      else
+        g_free (name);
+    }
+
+  /* node test */
+  if (accept (p, "*"))
+    step->test = TEST_ANY;
+  else if ((name = peek_name (p, &after)) != NULL)
+    {
+      if (*after == '(')
+        {
+          if (strcmp (name, "node") == 0)
+            step->test = TEST_NODE;
+          else if (strcmp (name, "text") == 0)
+            step->test = TEST_TEXT;
+          else if (strcmp (name, "comment") == 0)
+            step->test = TEST_COMMENT;
+          else
+            {
+              g_free (name);
+              set_syntax_error (p, "unknown node type");
+              return FALSE;
+            }
+
+          g_free (name);
+          p->cur = after + 1;
+
+          if (!expect (p, ")"))
+            return FALSE;
+        }
+      else
+        {
+          step->test = TEST_NAME;
+          step->name = g_ascii_strdown (name, -1);
+          g_free (name);
+          p->cur = after;
+        }
+    }
+  else
+    {
+      set_syntax_error (p, "node test expected");
+      return FALSE;
+    }
+
+  if (step->axis == AXIS_ATTRIBUTE &&
+      step->test != TEST_NAME && step->test != TEST_ANY)
+    {
+      set_syntax_error (p, "attribute name expected");
+      return FALSE;
+    }
+
+  if (!parse_predicates (p, &step->predicates, &step->n_predicates))
+    return FALSE;
+
+  if (step->axis == AXIS_ATTRIBUTE && step->n_predicates > 0)
+    {
+      g_set_error (p->error,
+                   SOPA_XPATH_ERROR,
+                   SOPA_XPATH_ERROR_UNSUPPORTED,
+                   "Invalid expression '%s': predicates on attributes "
+                   "are not supported",
+                   p->source);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+append_descendant_or_self_step (GArray *steps)
+{
+  Step step;
+
+  memset (&step, 0, sizeof (Step));
+  step.axis = AXIS_DESCENDANT_OR_SELF;
+  step.test = TEST_NODE;
+
+  g_array_append_val (steps, step);
+}
+
+/* '//name' expands to '/descendant-or-self::node()/child::name', which
+ * is the same as '/descendant::name' unless there are predicates
+ */
+static void
+optimize_steps (GArray *steps)
+{
+  guint i;
+
+  for (i = 0; i + 1 < steps->len; i++)
+    {
+      Step *step = &g_array_index (steps, Step, i);
+      Step *next = &g_array_index (steps, Step, i + 1);
+
+      if (step->axis == AXIS_DESCENDANT_OR_SELF &&
+          step->test == TEST_NODE &&
+          step->n_predicates == 0 &&
+          next->axis == AXIS_CHILD &&
+          next->n_predicates == 0)
+        {
+          next->axis = AXIS_DESCENDANT;
+          step_clear (step);
+          g_array_remove_index (steps, i);
+        }
+    }
+}
+
+/* parses steps until the end of the relative path */
+static Path *
+parse_relative_path (Parser   *p,
+                     gboolean  absolute,
+                     gboolean  descendant)
+{
+  GArray *steps;
+  Path *path;
+  Step step;
+  guint i;
+
+  steps = g_array_new (FALSE, FALSE, sizeof (Step));
+
+  if (descendant)
+    append_descendant_or_self_step (steps);
+
+  for (;;)
+    {
+      if (steps->len > 0 &&
+          g_array_index (steps, Step, steps->len - 1).axis == AXIS_ATTRIBUTE)
+        {
+          g_set_error (p->error,
+                       SOPA_XPATH_ERROR,
+                       SOPA_XPATH_ERROR_UNSUPPORTED,
+                       "Invalid expression '%s': an attribute step must "
+                       "be the last step of a path",
+                       p->source);
+          goto error;
+        }
+
+      if (!parse_step (p, &step))
+        {
+          step_clear (&step);
+          goto error;
+        }
+
+      g_array_append_val (steps, step);
+
+      if (accept (p, "//"))
+        append_descendant_or_self_step (steps);
+      else if (!accept (p, "/"))
+        break;
+    }
+
+  optimize_steps (steps);
+
+  path = g_slice_new0 (Path);
+  path->absolute = absolute;
+  path->n_steps = steps->len;
+  path->steps = (Step *) g_array_free (steps, FALSE);
+
+  return path;
+
+error:
+  for (i = 0; i < steps->len; i++)
+    step_clear (&g_array_index (steps, Step, i));
+
+  g_array_free (steps, TRUE);
+
+  return NULL;
+}
+
+static gboolean
+starts_step (Parser *p)
+{
+  skip_spaces (p);
+
+  return *p->cur == '.' || *p->cur == '@' || *p->cur == '*' ||
+         is_name_start_char (*p->cur);
+}
+
+static Expr *
+parse_location_path (Parser *p)
+{
+  Expr *expr;
+  Path *path;
+
+  if (accept (p, "//"))
+    path = parse_relative_path (p, TRUE, TRUE);
+  else if (accept (p, "/"))
+    {
+      /* a lone '/' selects the root */
+      if (!starts_step (p))
+        {
+          path = g_slice_new0 (Path);
+          path->absolute = TRUE;
+        }
+      else
+        path = parse_relative_path (p, TRUE, FALSE);
+    }
+  else
+    path = parse_relative_path (p, FALSE, FALSE);
+
+  if (path == NULL)
+    return NULL;
+
+  expr = expr_new (EXPR_PATH);
+  expr->path = path;
+
+  return expr;
+}
+
+static Expr *
+parse_function_call (Parser *p,
+                     gchar  *name)
+{
+  const Function *function = NULL;
+  GPtrArray *args;
+  Expr *expr, *arg;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (functions); i++)
+    {
+      if (strcmp (functions[i].name, name) == 0)
+        {
+          function = &functions[i];
+          break;
+        }
+    }
+
+  if (function == NULL)
+    {
+      g_set_error (p->error,
+                   SOPA_XPATH_ERROR,
+                   SOPA_XPATH_ERROR_UNKNOWN_FUNCTION,
+                   "Invalid expression '%s': unknown function %s()",
+                   p->source, name);
+      g_free (name);
+      return NULL;
+    }
+
+  /* skip '(' */
+  accept (p, "(");
+
+  args = g_ptr_array_new_with_free_func ((GDestroyNotify) expr_free);
+
+  if (!accept (p, ")"))
+    {
+      do
+        {
+          arg = parse_expr (p);
+          if (arg == NULL)
+            goto error;
+
+          g_ptr_array_add (args, arg);
+        }
+      while (accept (p, ","));
+
+      if (!expect (p, ")"))
+        goto error;
+    }
+
+  if (args->len < function->min_args || args->len > function->max_args)
+    {
+      g_set_error (p->error,
+                   SOPA_XPATH_ERROR,
+                   SOPA_XPATH_ERROR_UNKNOWN_FUNCTION,
+                   "Invalid expression '%s': wrong number of arguments "
+                   "for %s()",
+                   p->source, name);
+      goto error;
+    }
+
+  g_free (name);
+
+  expr = expr_new (EXPR_FUNCTION);
+  expr->function = function;
+  expr->n_args = args->len;
+  expr->args = (Expr **) g_ptr_array_free (args, FALSE);
+
+  return expr;
+
+error:
+  g_free (name);
+  g_ptr_array_unref (args);
+
+  return NULL;
+}
+
+static Expr *
+parse_primary (Parser *p)
+{
+  Expr *expr;
+  const gchar *start, *after;
+  gchar quote, *end;
+
+  skip_spaces (p);
+
+  if (accept (p, "("))
+    {
+      expr = parse_expr (p);
+      if (expr != NULL && !expect (p, ")"))
+        {
+          expr_free (expr);
+          return NULL;
+        }
+
+      return expr;
+    }
+
+  if (*p->cur == '"' || *p->cur == '\'')
+    {
+      quote = *p->cur;
+      start = ++p->cur;
+
+      while (*p->cur != '\0' && *p->cur != quote)
+        p->cur++;
+
+      if (*p->cur != quote)
+        {
+          set_syntax_error (p, "unterminated string");
+          return NULL;
+        }
+
+      expr = expr_new (EXPR_LITERAL);
+      expr->literal = g_strndup (start, p->cur - start);
+      p->cur++;
+
+      return expr;
+    }
+
+  if (g_ascii_isdigit (*p->cur) || *p->cur == '.')
+    {
+      expr = expr_new (EXPR_NUMBER);
+      expr->number = g_ascii_strtod (p->cur, &end);
+      p->cur = end;
+
+      return expr;
+    }
+
+  /* function call, the caller already checked the parenthesis */
+  end = peek_name (p, &after);
+  p->cur = after;
+
+  return parse_function_call (p, end);
+}
+
+static gboolean
+starts_filter_expr (Parser *p)
+{
+  const gchar *after;
+  gchar *name;
+  gboolean result;
+
+  skip_spaces (p);
+
+  if (*p->cur == '(' || *p->cur == '"' || *p->cur == '\'' ||
+      g_ascii_isdigit (*p->cur) ||
+      (*p->cur == '.' && g_ascii_isdigit (p->cur[1])))
+    return TRUE;
+
+  name = peek_name (p, &after);
+  if (name == NULL)
+    return FALSE;
+
+  result = *after == '(' &&
+           strcmp (name, "node") != 0 &&
+           strcmp (name, "text") != 0 &&
+           strcmp (name, "comment") != 0 &&
+           strcmp (name, "processing-instruction") != 0;
+
+  g_free (name);
+
+  return result;
+}
+
+static Expr *
+parse_path_expr (Parser *p)
+{
+  Expr *expr, *primary;
+
+  if (!starts_filter_expr (p))
+    return parse_location_path (p);
+
+  primary = parse_primary (p);
+  if (primary == NULL)
+    return NULL;
+
+  expr = expr_new (EXPR_FILTER);
+  expr->left = primary;
+
+  if (!parse_predicates (p, &expr->args, &expr->n_args))
+    goto error;
+
+  if (accept (p, "//"))
+    expr->path = parse_relative_path (p, FALSE, TRUE);
+  else if (accept (p, "/"))
+    expr->path = parse_relative_path (p, FALSE, FALSE);
+  else
+    return expr;
+
+  if (expr->path == NULL)
+    goto error;
+
+  return expr;
+
+error:
+  expr_free (expr);
+
+  return NULL;
+}
+
+static Expr *
+parse_union (Parser *p)
+{
+  Expr *left, *right;
+
+  left = parse_path_expr (p);
+
+  while (left != NULL && accept (p, "|"))
+    {
+      right = parse_path_expr (p);
+      if (right == NULL)
+        {
+          expr_free (left);
+          return NULL;
+        }
+
+      left = expr_new_binary (EXPR_UNION, left, right);
+    }
+
+  return left;
+}
+
+static Expr *
+parse_unary (Parser *p)
+{
+  Expr *expr;
+
+  if (!accept (p, "-"))
+    return parse_union (p);
+
+  expr = parse_unary (p);
+  if (expr == NULL)
+    return NULL;
+
+  return expr_new_binary (EXPR_NEG, expr, NULL);
+}
+
+typedef Expr * (* ParseFunc) (Parser *p);
+
+typedef struct
+{
+  const gchar   *token;
+  gboolean       keyword;
+  ExprType       type;
+} Operator;
+
+static Expr *
+parse_binary (Parser          *p,
+              ParseFunc        operand,
+              const Operator  *operators,
+              guint            n_operators)
+{
+  Expr *left, *right;
+  guint i;
+
+  left = operand (p);
+
+  while (left != NULL)
+    {
+      for (i = 0; i < n_operators; i++)
+        {
+          if (operators[i].keyword ? accept_keyword (p, operators[i].token)
+                                   : accept (p, operators[i].token))
+            break;
+        }
+
+      if (i == n_operators)
+        break;
+
+      right = operand (p);
+      if (right == NULL)
+        {
+          expr_free (left);
+          return NULL;
+        }
+
+      left = expr_new_binary (operators[i].type, left, right);
+    }
+
+  return left;
+}
+
+static Expr *
+parse_multiplicative (Parser *p)
+{
+  static const Operator operators[] = {
+    { "*",   FALSE, EXPR_MUL },
+    { "div", TRUE,  EXPR_DIV },
+    { "mod", TRUE,  EXPR_MOD },
+  };
+
+  return parse_binary (p, parse_unary, operators, G_N_ELEMENTS (operators));
+}
+
+static Expr *
+parse_additive (Parser *p)
+{
+  static const Operator operators[] = {
+    { "+", FALSE, EXPR_ADD },
+    { "-", FALSE, EXPR_SUB },
+  };
+
+  return parse_binary (p, parse_multiplicative, operators, G_N_ELEMENTS (operators));
+}
+
+static Expr *
+parse_relational (Parser *p)
+{
+  /* longest tokens first */
+  static const Operator operators[] = {
+    { "<=", FALSE, EXPR_LE },
+    { ">=", FALSE, EXPR_GE },
+    { "<",  FALSE, EXPR_LT },
+    { ">",  FALSE, EXPR_GT },
+  };
+
+  return parse_binary (p, parse_additive, operators, G_N_ELEMENTS (operators));
+}
+
+static Expr *
+parse_equality (Parser *p)
+{
+  static const Operator operators[] = {
+    { "=",  FALSE, EXPR_EQ },
+    { "!=", FALSE, EXPR_NE },
+  };
+
+  return parse_binary (p, parse_relational, operators, G_N_ELEMENTS (operators));
+}
+
+static Expr *
+parse_and (Parser *p)
+{
+  static const Operator operators[] = {
+    { "and", TRUE, EXPR_AND },
+  };
+
+  return parse_binary (p, parse_equality, operators, G_N_ELEMENTS (operators));
+}
+
+static Expr *
+parse_expr (Parser *p)
+{
+  static const Operator operators[] = {
+    { "or", TRUE, EXPR_OR },
+  };
+
+  return parse_binary (p, parse_and, operators, G_N_ELEMENTS (operators));
+}
+
+/**
+ * sopa_xpath_compile:
+ * @expression: an XPath expression
+ * @error: return location for a #GError
+ *
+ * Compiles @expression into a #SopaXPath that can be evaluated with
+ * sopa_xpath_evaluate().
+ *
+ * Return value: (transfer full): the newly created #SopaXPath, or %NULL
+ *      if @expression is invalid. Use sopa_xpath_unref() to release it.
+ */
+SopaXPath *
+sopa_xpath_compile (const gchar  *expression,
+                    GError      **error)
+{
+  SopaXPath *self;
+  Parser p;
+  Expr *root;
+
+  g_return_val_if_fail (expression != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  p.source = expression;
+  p.cur = expression;
+  p.error = error;
+
+  root = parse_expr (&p);
+  if (root == NULL)
+    return NULL;
+
+  skip_spaces (&p);
+  if (*p.cur != '\0')
+    {
+      set_syntax_error (&p, "unexpected character");
+      expr_free (root);
+      return NULL;
+    }
+
+  self = g_slice_new0 (SopaXPath);
+  self->ref_count = 1;
+  self->source = g_strdup (expression);
+  self->root = root;
+
+  return self;
+}
+
+/**
+ * sopa_xpath_ref:
+ * @self: a #SopaXPath
+ *
+ * Acquires a reference on @self.
+ *
+ * Return value: (transfer full): the #SopaXPath
+ */
+SopaXPath *
+sopa_xpath_ref (SopaXPath *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+/**
+ * sopa_xpath_unref:
+ * @self: a #SopaXPath
+ *
+ * Releases a reference on @self. When the last reference is released
+ * the expression is freed.
+ */
+void
+sopa_xpath_unref (SopaXPath *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (!g_atomic_int_dec_and_test (&self->ref_count))
+    return;
+
+  expr_free (self->root);
+  g_free (self->source);
+
+  g_slice_free (SopaXPath, self);
+}
+
+/**
+ * sopa_xpath_get_source:
+ * @self: a #SopaXPath
+ *
+ * Retrieves the expression @self was compiled from.
+ *
+ * Return value: (transfer none): the expression source
+ */
+const gchar *
+sopa_xpath_get_source (SopaXPath *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->source;
+}
+
+/**
+ * sopa_xpath_evaluate:
+ * @self: a #SopaXPath
+ * @context: the context #SopaNode
+ * @error: return location for a #GError
+ *
+ * Evaluates @self with @context as the context node. Absolute paths
+ * start at the top-most ancestor of @context.
+ *
+ * The nodes and attribute values in the result are owned by the tree,
+ * and are only valid while it is not modified.
+ *
+ * Return value: (transfer full): a #SopaXPathResult, or %NULL if the
+ *      evaluation failed. Free it with sopa_xpath_result_free().
+ */
+SopaXPathResult *
+sopa_xpath_evaluate (SopaXPath  *self,
+                     SopaNode   *context,
+                     GError    **error)
+{
+  EvalContext ctx;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (SOPA_IS_NODE (context), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  ctx.node = context;
+  ctx.position = 1;
+  ctx.size = 1;
+
+  return eval_expr (self->root, &ctx, error);
+}
+
+/**
+ * sopa_xpath_result_get_result_type:
+ * @result: a #SopaXPathResult
+ *
+ * Retrieves the type of the value @result holds.
+ *
+ * Return value: a #SopaXPathResultType
+ */
+SopaXPathResultType
+sopa_xpath_result_get_result_type (SopaXPathResult *result)
+{
+  g_return_val_if_fail (result != NULL, SOPA_XPATH_RESULT_BOOLEAN);
+
+  return result->type;
+}
+
+/**
+ * sopa_xpath_result_get_nodes:
+ * @result: a #SopaXPathResult
+ *
+ * Retrieves the nodes of a %SOPA_XPATH_RESULT_NODES result, in
+ * document order.
+ *
+ * Return value: (transfer none) (element-type SopaNode): the nodes, or
+ *      %NULL if @result is not a node-set
+ */
+GPtrArray *
+sopa_xpath_result_get_nodes (SopaXPathResult *result)
+{
+  g_return_val_if_fail (result != NULL, NULL);
+
+  if (result->type != SOPA_XPATH_RESULT_NODES)
+    return NULL;
+
+  return result->items;
+}
+
+/**
+ * sopa_xpath_result_get_attributes:
+ * @result: a #SopaXPathResult
+ *
+ * Retrieves the attribute values of a %SOPA_XPATH_RESULT_ATTRIBUTES
+ * result.
+ *
+ * Return value: (transfer none) (element-type utf8): the attribute
+ *      values, or %NULL if @result does not hold attributes
+ */
+GPtrArray *
+sopa_xpath_result_get_attributes (SopaXPathResult *result)
+{
+  g_return_val_if_fail (result != NULL, NULL);
+
+  if (result->type != SOPA_XPATH_RESULT_ATTRIBUTES)
+    return NULL;
+
+  return result->items;
+}
+
+/**
+ * sopa_xpath_result_get_string:
+ * @result: a #SopaXPathResult
+ *
+ * Converts @result to a string, following the rules of the XPath
+ * string() function.
+ *
+ * Return value: (transfer full): a newly allocated string
+ */
+gchar *
+sopa_xpath_result_get_string (SopaXPathResult *result)
+{
+  g_return_val_if_fail (result != NULL, NULL);
+
+  return value_to_string (result);
+}
+
+/**
+ * sopa_xpath_result_get_number:
+ * @result: a #SopaXPathResult
+ *
+ * Converts @result to a number, following the rules of the XPath
+ * number() function.
+ *
+ * Return value: the number value of @result
+ */
+gdouble
+sopa_xpath_result_get_number (SopaXPathResult *result)
+{
+  g_return_val_if_fail (result != NULL, NAN);
+
+  return value_to_number (result);
+}
+
+/**
+ * sopa_xpath_result_get_boolean:
+ * @result: a #SopaXPathResult
+ *
+ * Converts @result to a boolean, following the rules of the XPath
+ * boolean() function.
+ *
+ * Return value: the boolean value of @result
+ */
+gboolean
+sopa_xpath_result_get_boolean (SopaXPathResult *result)
+{
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  return value_to_boolean (result);
+}
+
+/**
+ * sopa_xpath_result_free:
+ * @result: a #SopaXPathResult
+ *
+ * Frees @result.
+ */
+void
+sopa_xpath_result_free (SopaXPathResult *result)
+{
+  value_free (result);
+}
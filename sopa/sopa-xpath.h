@@ -0,0 +1,112 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 2; tab-width: 2 -*-  */
+/*
+ * sopa-xpath.h
+ * Copyright (C) 2014 Tektorque, Lda <geral@tektorque.com>
+ * 
+ * sopa is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * sopa is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *    Emanuel Fernandes <efernandes@tektorque.com>
+ */
+
+#if !defined(SOPA_H_INSIDE) && !defined(SOPA_COMPILATION)
+#error "Only <sopa/sopa.h> can be included directly.h"
+#endif
+
+#ifndef __SOPA_XPATH_H__
+#define __SOPA_XPATH_H__
+
+#include <glib-object.h>
+#include <sopa/sopa-node.h>
+
+G_BEGIN_DECLS
+
+#define SOPA_TYPE_XPATH (sopa_xpath_get_type ())
+
+/**
+ * SOPA_XPATH_ERROR:
+ *
+ * Error domain for XPath compilation and evaluation. Errors in this
+ * domain will be from the #SopaXPathError enumeration.
+ */
+#define SOPA_XPATH_ERROR (sopa_xpath_error_quark ())
+
+/**
+ * SopaXPathError:
+ * @SOPA_XPATH_ERROR_SYNTAX: the expression is malformed
+ * @SOPA_XPATH_ERROR_UNSUPPORTED: the expression uses a feature outside
+ * of the supported subset
+ * @SOPA_XPATH_ERROR_UNKNOWN_FUNCTION: the expression calls an unknown
+ * function, or a function with the wrong number of arguments
+ * @SOPA_XPATH_ERROR_TYPE: an operand has the wrong type, e.g. a number
+ * used where a node-set is required
+ *
+ * Error codes returned by XPath compilation and evaluation.
+ *
+ * Since: 0.2
+ */
+typedef enum {
+  SOPA_XPATH_ERROR_SYNTAX,
+  SOPA_XPATH_ERROR_UNSUPPORTED,
+  SOPA_XPATH_ERROR_UNKNOWN_FUNCTION,
+  SOPA_XPATH_ERROR_TYPE
+} SopaXPathError;
+
+/**
+ * SopaXPathResultType:
+ * @SOPA_XPATH_RESULT_NODES: a node-set
+ * @SOPA_XPATH_RESULT_ATTRIBUTES: the values of the attributes selected
+ * by a path ending in an attribute step
+ * @SOPA_XPATH_RESULT_STRING: a string
+ * @SOPA_XPATH_RESULT_NUMBER: a number
+ * @SOPA_XPATH_RESULT_BOOLEAN: a boolean
+ *
+ * The type of the value an XPath expression evaluated to.
+ *
+ * Since: 0.2
+ */
+typedef enum {
+  SOPA_XPATH_RESULT_NODES,
+  SOPA_XPATH_RESULT_ATTRIBUTES,
+  SOPA_XPATH_RESULT_STRING,
+  SOPA_XPATH_RESULT_NUMBER,
+  SOPA_XPATH_RESULT_BOOLEAN
+} SopaXPathResultType;
+
+typedef struct _SopaXPath SopaXPath;
+typedef struct _SopaXPathResult SopaXPathResult;
+
+GType sopa_xpath_get_type (void) G_GNUC_CONST;
+GQuark sopa_xpath_error_quark (void);
+
+SopaXPath *                         sopa_xpath_compile                          (const gchar            *expression,
+                                                                                 GError                **error);
+SopaXPath *                         sopa_xpath_ref                              (SopaXPath              *self);
+void                                sopa_xpath_unref                            (SopaXPath              *self);
+const gchar *                       sopa_xpath_get_source                       (SopaXPath              *self);
+SopaXPathResult *                   sopa_xpath_evaluate                         (SopaXPath              *self,
+                                                                                 SopaNode               *context,
+                                                                                 GError                **error);
+
+SopaXPathResultType                 sopa_xpath_result_get_result_type           (SopaXPathResult        *result);
+GPtrArray *                         sopa_xpath_result_get_nodes                 (SopaXPathResult        *result);
+GPtrArray *                         sopa_xpath_result_get_attributes            (SopaXPathResult        *result);
+gchar *                             sopa_xpath_result_get_string                (SopaXPathResult        *result);
+gdouble                             sopa_xpath_result_get_number                (SopaXPathResult        *result);
+gboolean                            sopa_xpath_result_get_boolean               (SopaXPathResult        *result);
+void                                sopa_xpath_result_free                      (SopaXPathResult        *result);
+
+G_END_DECLS
+
+#endif /* __SOPA_XPATH_H__ */
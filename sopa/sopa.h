@@ -25,13 +25,22 @@
 #include <sopa/sopa-comment.h>
 #include <sopa/sopa-data.h>
 #include <sopa/sopa-document.h>
+#include <sopa/sopa-document-image.h>
 #include <sopa/sopa-element.h>
 #include <sopa/sopa-enum-types.h>
 #include <sopa/sopa-macros.h>
+#include <sopa/sopa-mutation-observer.h>
 #include <sopa/sopa-node.h>
+#include <sopa/sopa-parse-cache.h>
 #include <sopa/sopa-parser.h>
+#include <sopa/sopa-patch.h>
+#include <sopa/sopa-selector.h>
+#include <sopa/sopa-serialize-options.h>
+#include <sopa/sopa-subtree-pool.h>
+#include <sopa/sopa-template.h>
 #include <sopa/sopa-text.h>
 #include <sopa/sopa-version.h>
+#include <sopa/sopa-xpath.h>
 
 #undef SOPA_H_INSIDE
 
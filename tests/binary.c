@@ -0,0 +1,308 @@
+#include <string.h>
+#include <glib/gstdio.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static const char *html =
+  "<html>"
+    "<body class=\"main\">"
+      "<p id=\"a\" class=\"x\">one &amp; two</p>"
+      "<p id=\"b\">three<br/></p>"
+      "<ul><li class=\"x\">four</li><li>five</li></ul>"
+    "</body>"
+  "</html>";
+
+/* the layout of the header: the magic, the byte order, the version
+ * and the doctype, then the sizes of the tables
+ */
+#define BYTE_ORDER_OFFSET       4
+#define VERSION_OFFSET          8
+#define N_NODES_OFFSET          16
+#define HEADER_SIZE             32
+
+typedef struct
+{
+  gchar        *dir;
+  gchar        *filename;
+  SopaDocument *document;
+} Fixture;
+
+static void
+fixture_setup (Fixture       *fixture,
+               gconstpointer  data)
+{
+  GError *error = NULL;
+
+  fixture->dir = g_dir_make_tmp ("sopa-binary-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  fixture->filename = g_build_filename (fixture->dir, "document.sopa", NULL);
+
+  fixture->document = test_parse (html);
+  g_assert (sopa_document_save_binary (fixture->document,
+                                       fixture->filename,
+                                       &error));
+  g_assert_no_error (error);
+}
+
+static void
+fixture_teardown (Fixture       *fixture,
+                  gconstpointer  data)
+{
+  g_object_unref (fixture->document);
+
+  g_unlink (fixture->filename);
+  g_rmdir (fixture->dir);
+
+  g_free (fixture->filename);
+  g_free (fixture->dir);
+}
+
+static gchar *
+serialize (SopaDocument *document)
+{
+  SopaSerializeOptions *options;
+  gchar *markup;
+
+  options = sopa_serialize_options_new (SOPA_SERIALIZE_MODE_FAITHFUL);
+  markup = sopa_element_serialize (SOPA_ELEMENT (document), options, NULL);
+  sopa_serialize_options_free (options);
+
+  return markup;
+}
+
+static void
+test_binary_round_trip (Fixture       *fixture,
+                        gconstpointer  data)
+{
+  SopaDocument *document;
+  GError *error = NULL;
+  gchar *expected, *markup;
+
+  document = sopa_document_load_binary (fixture->filename, &error);
+  g_assert_no_error (error);
+  g_assert (SOPA_IS_DOCUMENT (document));
+  g_assert (!g_object_is_floating (document));
+
+  g_assert (sopa_node_equal (SOPA_NODE (document),
+                             SOPA_NODE (fixture->document)));
+
+  expected = serialize (fixture->document);
+  markup = serialize (document);
+  g_assert_cmpstr (markup, ==, expected);
+
+  g_free (markup);
+  g_free (expected);
+  g_object_unref (document);
+}
+
+static void
+test_binary_image (Fixture       *fixture,
+                   gconstpointer  data)
+{
+  SopaDocumentImage *image;
+  SopaSelector *selector;
+  GError *error = NULL;
+  GArray *matches;
+  guint html_node, body, p, text;
+
+  image = sopa_document_image_new_from_file (fixture->filename, &error);
+  g_assert_no_error (error);
+  g_assert (image != NULL);
+
+  /* the document, html, body, two paragraphs with a text each, a br,
+   * the list with two items and their texts
+   */
+  g_assert_cmpuint (sopa_document_image_get_n_nodes (image), ==, 13);
+  g_assert (sopa_document_image_get_node_type (image, 0) == SOPA_TYPE_DOCUMENT);
+  g_assert_cmpuint (sopa_document_image_get_parent (image, 0), ==,
+                    SOPA_DOCUMENT_IMAGE_NO_NODE);
+
+  html_node = sopa_document_image_get_first_child (image, 0);
+  g_assert_cmpstr (sopa_document_image_get_tag (image, html_node), ==, "html");
+  g_assert_cmpuint (sopa_document_image_get_next_sibling (image, html_node), ==,
+                    SOPA_DOCUMENT_IMAGE_NO_NODE);
+
+  body = sopa_document_image_get_first_child (image, html_node);
+  g_assert_cmpuint (sopa_document_image_get_parent (image, body), ==, html_node);
+  g_assert_cmpstr (sopa_document_image_get_attribute (image, body, "class"), ==,
+                   "main");
+  g_assert (sopa_document_image_get_attribute (image, body, "id") == NULL);
+
+  p = sopa_document_image_get_first_child (image, body);
+  g_assert (sopa_document_image_get_node_type (image, p) == SOPA_TYPE_ELEMENT);
+  g_assert_cmpstr (sopa_document_image_get_attribute (image, p, "id"), ==, "a");
+
+  text = sopa_document_image_get_first_child (image, p);
+  g_assert (sopa_document_image_get_node_type (image, text) == SOPA_TYPE_TEXT);
+  g_assert_cmpstr (sopa_document_image_get_content (image, text), ==,
+                   "one & two");
+  g_assert (sopa_document_image_get_tag (image, text) == NULL);
+  g_assert_cmpuint (sopa_document_image_get_first_child (image, text), ==,
+                    SOPA_DOCUMENT_IMAGE_NO_NODE);
+
+  /* selectors run on the image itself */
+  selector = sopa_selector_new (".x", &error);
+  g_assert_no_error (error);
+
+  matches = sopa_document_image_query_selector_all (image, selector);
+  g_assert_cmpuint (matches->len, ==, 2);
+  g_assert_cmpuint (g_array_index (matches, guint, 0), ==, p);
+  g_assert_cmpstr (sopa_document_image_get_tag (image,
+                                                g_array_index (matches, guint, 1)),
+                   ==, "li");
+  g_array_unref (matches);
+
+  sopa_selector_unref (selector);
+  sopa_document_image_unref (image);
+}
+
+/* loads the saved image after @corrupt changed it */
+static void
+check_invalid (Fixture *fixture,
+               void   (*corrupt) (guint8 *data, gsize *size),
+               gint     code)
+{
+  SopaDocumentImage *image;
+  SopaDocument *document;
+  GError *error = NULL;
+  GBytes *bytes;
+  gchar *data;
+  gsize size;
+
+  g_assert (g_file_get_contents (fixture->filename, &data, &size, NULL));
+  corrupt ((guint8 *) data, &size);
+
+  bytes = g_bytes_new (data, size);
+  image = sopa_document_image_new_from_bytes (bytes, &error);
+  g_assert_error (error, SOPA_DOCUMENT_IMAGE_ERROR, code);
+  g_assert (image == NULL);
+  g_clear_error (&error);
+  g_bytes_unref (bytes);
+
+  /* the same from a file */
+  g_assert (g_file_set_contents (fixture->filename, data, size, NULL));
+
+  document = sopa_document_load_binary (fixture->filename, &error);
+  g_assert_error (error, SOPA_DOCUMENT_IMAGE_ERROR, code);
+  g_assert (document == NULL);
+  g_clear_error (&error);
+
+  g_free (data);
+
+  /* restore the valid image */
+  g_assert (sopa_document_save_binary (fixture->document,
+                                       fixture->filename,
+                                       NULL));
+}
+
+static void
+set_uint32 (guint8  *data,
+            gsize    offset,
+            guint32  value)
+{
+  memcpy (data + offset, &value, sizeof (guint32));
+}
+
+static guint32
+get_uint32 (const guint8 *data,
+            gsize         offset)
+{
+  guint32 value;
+
+  memcpy (&value, data + offset, sizeof (guint32));
+
+  return value;
+}
+
+static void
+corrupt_magic (guint8 *data,
+               gsize  *size)
+{
+  data[0] = 'X';
+}
+
+static void
+corrupt_truncate (guint8 *data,
+                  gsize  *size)
+{
+  *size -= 1;
+}
+
+static void
+corrupt_header (guint8 *data,
+                gsize  *size)
+{
+  *size = 10;
+}
+
+static void
+corrupt_n_nodes (guint8 *data,
+                 gsize  *size)
+{
+  set_uint32 (data, N_NODES_OFFSET, get_uint32 (data, N_NODES_OFFSET) + 1);
+}
+
+static void
+corrupt_version (guint8 *data,
+                 gsize  *size)
+{
+  set_uint32 (data, VERSION_OFFSET, get_uint32 (data, VERSION_OFFSET) + 1);
+}
+
+static void
+corrupt_byte_order (guint8 *data,
+                    gsize  *size)
+{
+  set_uint32 (data, BYTE_ORDER_OFFSET,
+              GUINT32_SWAP_LE_BE (get_uint32 (data, BYTE_ORDER_OFFSET)));
+}
+
+/* every byte of the tables set, which breaks some index or offset */
+static void
+corrupt_tables (guint8 *data,
+                gsize  *size)
+{
+  memset (data + HEADER_SIZE, 0xff, *size - HEADER_SIZE);
+}
+
+static void
+test_binary_invalid (Fixture       *fixture,
+                     gconstpointer  data)
+{
+  SopaDocument *document;
+  GError *error = NULL;
+  gchar *missing;
+
+  check_invalid (fixture, corrupt_magic, SOPA_DOCUMENT_IMAGE_ERROR_INVALID);
+  check_invalid (fixture, corrupt_truncate, SOPA_DOCUMENT_IMAGE_ERROR_INVALID);
+  check_invalid (fixture, corrupt_header, SOPA_DOCUMENT_IMAGE_ERROR_INVALID);
+  check_invalid (fixture, corrupt_n_nodes, SOPA_DOCUMENT_IMAGE_ERROR_INVALID);
+  check_invalid (fixture, corrupt_tables, SOPA_DOCUMENT_IMAGE_ERROR_INVALID);
+  check_invalid (fixture, corrupt_version, SOPA_DOCUMENT_IMAGE_ERROR_VERSION);
+  check_invalid (fixture, corrupt_byte_order, SOPA_DOCUMENT_IMAGE_ERROR_VERSION);
+
+  /* a file that cannot be mapped */
+  missing = g_build_filename (fixture->dir, "missing.sopa", NULL);
+  document = sopa_document_load_binary (missing, &error);
+  g_assert_error (error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+  g_assert (document == NULL);
+  g_clear_error (&error);
+  g_free (missing);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/binary/round-trip", Fixture, NULL,
+              fixture_setup, test_binary_round_trip, fixture_teardown);
+  g_test_add ("/binary/image", Fixture, NULL,
+              fixture_setup, test_binary_image, fixture_teardown);
+  g_test_add ("/binary/invalid", Fixture, NULL,
+              fixture_setup, test_binary_invalid, fixture_teardown);
+
+  return g_test_run ();
+}
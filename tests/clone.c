@@ -0,0 +1,159 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static const char *html =
+  "<div id=\"a\" class=\"c\">"
+    "<p title=\"t\">text</p>"
+    "<p>more <b>text</b></p>"
+  "</div>";
+
+static SopaDocument *
+clone (SopaDocument      *document,
+       SopaNodeCloneMode  mode)
+{
+  SopaNode *copy;
+
+  copy = g_object_ref_sink (sopa_node_clone (SOPA_NODE (document), mode));
+  g_assert (SOPA_IS_DOCUMENT (copy));
+  g_assert (sopa_node_equal (SOPA_NODE (document), copy));
+
+  return SOPA_DOCUMENT (copy);
+}
+
+static SopaElement *
+get_div (SopaDocument *document)
+{
+  return SOPA_ELEMENT (sopa_node_get_first_child (SOPA_NODE (document)));
+}
+
+static SopaElement *
+get_p (SopaDocument *document)
+{
+  return SOPA_ELEMENT (sopa_node_get_first_child (SOPA_NODE (get_div (document))));
+}
+
+static void
+test_clone_deep (void)
+{
+  SopaDocument *document, *copy;
+
+  document = test_parse (html);
+  copy = clone (document, SOPA_NODE_CLONE_DEEP);
+
+  g_assert (sopa_element_get_attribute (get_div (document), "id") !=
+            sopa_element_get_attribute (get_div (copy), "id"));
+  g_assert_cmpstr (sopa_element_get_attribute (get_div (copy), "id"), ==, "a");
+
+  sopa_element_set_attribute (get_div (copy), "id", "b");
+  g_assert_cmpstr (sopa_element_get_attribute (get_div (document), "id"), ==, "a");
+  g_assert_cmpstr (sopa_element_get_attribute (get_div (copy), "id"), ==, "b");
+  g_assert (!sopa_node_equal (SOPA_NODE (document), SOPA_NODE (copy)));
+
+  g_object_unref (copy);
+  g_object_unref (document);
+}
+
+static void
+test_clone_copy_on_write (void)
+{
+  SopaDocument *document, *copy;
+  const gchar *id, *title;
+
+  document = test_parse (html);
+  copy = clone (document, SOPA_NODE_CLONE_COPY_ON_WRITE);
+
+  /* the attributes are shared until either side changes them */
+  id = sopa_element_get_attribute (get_div (document), "id");
+  title = sopa_element_get_attribute (get_p (document), "title");
+  g_assert (sopa_element_get_attribute (get_div (copy), "id") == id);
+  g_assert (sopa_element_get_attribute (get_p (copy), "title") == title);
+
+  /* changing the clone leaves the original alone */
+  sopa_element_set_attribute (get_div (copy), "id", "b");
+  g_assert (sopa_element_get_attribute (get_div (document), "id") == id);
+  g_assert_cmpstr (id, ==, "a");
+  g_assert_cmpstr (sopa_element_get_attribute (get_div (copy), "id"), ==, "b");
+  g_assert_cmpstr (sopa_element_get_attribute (get_div (copy), "class"), ==, "c");
+  g_assert (!sopa_node_equal (SOPA_NODE (document), SOPA_NODE (copy)));
+
+  /* and the other way round, on a node the clone did not change */
+  sopa_element_remove_attribute (get_p (document), "title");
+  g_assert (!sopa_element_has_attribute (get_p (document), "title"));
+  g_assert (sopa_element_get_attribute (get_p (copy), "title") == title);
+  g_assert_cmpstr (title, ==, "t");
+
+  sopa_element_set_attribute (get_div (copy), "id", "a");
+  sopa_element_set_attribute (get_p (document), "title", "t");
+  g_assert (sopa_node_equal (SOPA_NODE (document), SOPA_NODE (copy)));
+
+  g_object_unref (copy);
+  g_object_unref (document);
+}
+
+static void
+test_clone_serialize (void)
+{
+  SopaDocument *document, *copy;
+  gchar *before, *after, *copied;
+
+  document = test_parse (html);
+  before = sopa_element_to_string (SOPA_ELEMENT (document), 0);
+
+  copy = clone (document, SOPA_NODE_CLONE_COPY_ON_WRITE);
+  copied = sopa_element_to_string (SOPA_ELEMENT (copy), 0);
+  g_assert_cmpstr (copied, ==, before);
+  g_free (copied);
+
+  /* the markup kept from the original is not used for the change */
+  sopa_element_set_attribute (get_p (copy), "title", "changed");
+  copied = sopa_element_to_string (SOPA_ELEMENT (copy), 0);
+  g_assert (strstr (copied, "changed") != NULL);
+  g_free (copied);
+
+  after = sopa_element_to_string (SOPA_ELEMENT (document), 0);
+  g_assert_cmpstr (after, ==, before);
+  g_free (after);
+
+  g_free (before);
+  g_object_unref (copy);
+  g_object_unref (document);
+}
+
+static void
+test_clone_subtree (void)
+{
+  SopaDocument *document;
+  SopaNode *copy;
+
+  document = test_parse (html);
+
+  copy = g_object_ref_sink (sopa_node_clone (SOPA_NODE (get_div (document)),
+                                             SOPA_NODE_CLONE_COPY_ON_WRITE));
+  g_assert (SOPA_IS_ELEMENT (copy) && !SOPA_IS_DOCUMENT (copy));
+  g_assert (sopa_node_get_parent (copy) == NULL);
+  g_assert (sopa_node_equal (SOPA_NODE (get_div (document)), copy));
+  g_assert_cmpuint (sopa_node_get_hash (SOPA_NODE (get_div (document))), ==,
+                    sopa_node_get_hash (copy));
+
+  sopa_element_set_attribute (SOPA_ELEMENT (copy), "class", "d");
+  g_assert_cmpstr (sopa_element_get_attribute (get_div (document), "class"), ==, "c");
+  g_assert (!sopa_node_equal (SOPA_NODE (get_div (document)), copy));
+
+  g_object_unref (copy);
+  g_object_unref (document);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/clone/deep", test_clone_deep);
+  g_test_add_func ("/clone/copy-on-write", test_clone_copy_on_write);
+  g_test_add_func ("/clone/serialize", test_clone_serialize);
+  g_test_add_func ("/clone/subtree", test_clone_subtree);
+
+  return g_test_run ();
+}
@@ -0,0 +1,210 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+/* the characters to escape, and what they become */
+static const struct {
+  gchar        c;
+  const gchar *text;
+  const gchar *attribute;
+} escapes[] = {
+  { '&', "&amp;", "&amp;" },
+  { '<', "&lt;", "&lt;" },
+  { '>', "&gt;", "&gt;" },
+  { '"', "\"", "&quot;" }
+};
+
+/* escapes @str one byte at a time */
+static void
+append_escaped (GString     *out,
+                const gchar *str,
+                gboolean     attribute)
+{
+  const gchar *p;
+  guint i;
+
+  for (p = str; *p != '\0'; p++)
+    {
+      for (i = 0; i < G_N_ELEMENTS (escapes); i++)
+        {
+          if (escapes[i].c == *p)
+            break;
+        }
+
+      if (i < G_N_ELEMENTS (escapes))
+        g_string_append (out, attribute ? escapes[i].attribute : escapes[i].text);
+      else
+        g_string_append_c (out, *p);
+    }
+}
+
+typedef struct
+{
+  SopaElement *root;
+  SopaElement *element;
+  SopaText    *text;
+  SopaSerializeOptions *options;
+} Fixture;
+
+static void
+fixture_init (Fixture *fixture)
+{
+  fixture->root = g_object_ref_sink (sopa_element_new ("div"));
+  fixture->element = sopa_element_new ("p");
+  fixture->text = sopa_text_new ();
+
+  sopa_element_add_child (fixture->root, SOPA_NODE (fixture->element));
+  sopa_element_add_child (fixture->element, SOPA_NODE (fixture->text));
+
+  fixture->options = sopa_serialize_options_new (SOPA_SERIALIZE_MODE_FAITHFUL);
+}
+
+static void
+fixture_clear (Fixture *fixture)
+{
+  sopa_serialize_options_free (fixture->options);
+  g_object_unref (fixture->root);
+}
+
+/* serializes @value as the content and as an attribute, and compares
+ * the result with the escaping done one byte at a time
+ */
+static void
+check_value (Fixture     *fixture,
+             const gchar *value)
+{
+  GString *expected;
+  gchar *markup;
+  gsize length;
+
+  sopa_text_set_content (fixture->text, value);
+  sopa_element_set_attribute (fixture->element, "a", value);
+
+  expected = g_string_new ("<p a=\"");
+  append_escaped (expected, value, TRUE);
+  g_string_append (expected, "\">");
+  append_escaped (expected, value, FALSE);
+  g_string_append (expected, "</p>");
+
+  markup = sopa_element_serialize (fixture->root, fixture->options, &length);
+  g_assert_cmpstr (markup, ==, expected->str);
+  g_assert_cmpuint (length, ==, expected->len);
+
+  g_free (markup);
+  g_string_free (expected, TRUE);
+}
+
+static void
+test_escape_boundaries (void)
+{
+  Fixture fixture;
+  gchar value[70];
+  guint length, position, i;
+
+  fixture_init (&fixture);
+
+  /* a single character to escape at every offset of values that end
+   * before, at and after one or more blocks of 16 bytes
+   */
+  for (length = 1; length < sizeof (value) - 1; length++)
+    {
+      for (position = 0; position < length; position++)
+        {
+          for (i = 0; i < G_N_ELEMENTS (escapes); i++)
+            {
+              memset (value, 'x', length);
+              value[length] = '\0';
+              value[position] = escapes[i].c;
+
+              check_value (&fixture, value);
+            }
+        }
+    }
+
+  fixture_clear (&fixture);
+}
+
+static void
+test_escape_runs (void)
+{
+  Fixture fixture;
+  GString *value;
+  guint i;
+
+  fixture_init (&fixture);
+
+  check_value (&fixture, "");
+  check_value (&fixture, "clean text, nothing to escape at all");
+
+  /* only characters to escape */
+  check_value (&fixture, "&<>\"&<>\"&<>\"&<>\"&<>\"");
+
+  /* several in the same block, and bytes above 0x7f around them */
+  check_value (&fixture, "caf\xc3\xa9 & cr\xc3\xa8me <br> \"\xe2\x82\xac\" > done");
+
+  /* one every 7 bytes, so that they fall at every offset of a block */
+  value = g_string_new (NULL);
+  for (i = 0; i < 200; i++)
+    {
+      if (i % 7 == 6)
+        g_string_append_c (value, escapes[i % G_N_ELEMENTS (escapes)].c);
+      else
+        g_string_append_c (value, 'a' + i % 26);
+    }
+  check_value (&fixture, value->str);
+  g_string_free (value, TRUE);
+
+  fixture_clear (&fixture);
+}
+
+static void
+test_escape_round_trip (void)
+{
+  SopaSerializeOptions *options;
+  SopaDocument *document, *copy;
+  SopaElement *p;
+  SopaNode *text;
+  gchar *markup, *again;
+
+  document = test_parse ("<p title=\"a &amp; &lt;b&gt; &quot;c&quot;\">"
+                         "x &lt; y &amp;&amp; z &gt; w</p>");
+  p = SOPA_ELEMENT (sopa_node_get_first_child (SOPA_NODE (document)));
+  text = sopa_node_get_first_child (SOPA_NODE (p));
+
+  /* the entities are resolved when parsing */
+  g_assert_cmpstr (sopa_element_get_attribute (p, "title"), ==,
+                   "a & <b> \"c\"");
+  g_assert_cmpstr (sopa_text_get_content (SOPA_TEXT (text)), ==,
+                   "x < y && z > w");
+
+  /* and written back when serializing */
+  options = sopa_serialize_options_new (SOPA_SERIALIZE_MODE_FAITHFUL);
+  markup = sopa_element_serialize (SOPA_ELEMENT (document), options, NULL);
+  g_assert_cmpstr (markup, ==,
+                   "<p title=\"a &amp; &lt;b&gt; &quot;c&quot;\">"
+                   "x &lt; y &amp;&amp; z &gt; w</p>");
+
+  /* so that the markup parses to the same tree */
+  copy = test_parse (markup);
+  again = sopa_element_serialize (SOPA_ELEMENT (copy), options, NULL);
+  g_assert_cmpstr (again, ==, markup);
+
+  g_free (again);
+  g_object_unref (copy);
+  g_free (markup);
+  sopa_serialize_options_free (options);
+  g_object_unref (document);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/escape/boundaries", test_escape_boundaries);
+  g_test_add_func ("/escape/runs", test_escape_runs);
+  g_test_add_func ("/escape/round-trip", test_escape_round_trip);
+
+  return g_test_run ();
+}
@@ -0,0 +1,148 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+/* a root holding @n_items elements with a text each */
+static SopaDocument *
+make_document (guint n_items)
+{
+  SopaDocument *document;
+  GString *text;
+  guint i;
+
+  text = g_string_new ("<root>");
+  for (i = 0; i < n_items; i++)
+    g_string_append_printf (text, "<item n=\"%u\">text</item>", i);
+  g_string_append (text, "</root>");
+
+  document = test_parse (text->str);
+  g_string_free (text, TRUE);
+
+  return document;
+}
+
+typedef struct
+{
+  GMutex      lock;
+  GHashTable *visited;
+  gint        n_visits;
+} Visits;
+
+static void
+count_node (SopaNode *node,
+            gpointer  user_data)
+{
+  Visits *visits = user_data;
+
+  g_atomic_int_inc (&visits->n_visits);
+
+  g_mutex_lock (&visits->lock);
+  g_assert (!g_hash_table_contains (visits->visited, node));
+  g_hash_table_add (visits->visited, node);
+  g_mutex_unlock (&visits->lock);
+}
+
+static void
+check_visits (SopaNode *root,
+              guint     n_threads,
+              guint     expected)
+{
+  Visits visits;
+
+  g_mutex_init (&visits.lock);
+  visits.visited = g_hash_table_new (NULL, NULL);
+  visits.n_visits = 0;
+
+  sopa_node_foreach_parallel (root, count_node, &visits, n_threads);
+
+  g_assert_cmpint (visits.n_visits, ==, expected);
+  g_assert_cmpuint (g_hash_table_size (visits.visited), ==, expected);
+  g_assert (g_hash_table_contains (visits.visited, root));
+
+  g_hash_table_unref (visits.visited);
+  g_mutex_clear (&visits.lock);
+}
+
+static void
+test_foreach_parallel_visits (void)
+{
+  SopaDocument *document;
+  SopaNode *root;
+  guint n_items = 5000;
+
+  document = make_document (n_items);
+  root = sopa_node_get_first_child (SOPA_NODE (document));
+
+  /* the document, the root, and an element and a text per item */
+  check_visits (SOPA_NODE (document), 4, 2 + 2 * n_items);
+  check_visits (SOPA_NODE (document), 0, 2 + 2 * n_items);
+  check_visits (SOPA_NODE (document), 1, 2 + 2 * n_items);
+
+  /* a sub-tree */
+  check_visits (root, 4, 1 + 2 * n_items);
+  check_visits (sopa_node_get_last_child (root), 4, 2);
+
+  g_object_unref (document);
+}
+
+static void
+try_changes (SopaNode *node,
+             gpointer  user_data)
+{
+  if (SOPA_IS_TEXT (node))
+    {
+      g_test_expect_message ("Sopa", G_LOG_LEVEL_CRITICAL,
+                             "*cannot be changed while its tree is being read*");
+      sopa_text_set_content (SOPA_TEXT (node), "changed");
+      g_test_assert_expected_messages ();
+    }
+  else if (SOPA_IS_ELEMENT (node) && sopa_node_get_parent (node) != NULL)
+    {
+      g_test_expect_message ("Sopa", G_LOG_LEVEL_CRITICAL,
+                             "*cannot be changed while its tree is being read*");
+      sopa_element_set_attribute (SOPA_ELEMENT (node), "n", "changed");
+      g_test_assert_expected_messages ();
+
+      g_test_expect_message ("Sopa", G_LOG_LEVEL_CRITICAL,
+                             "*cannot be changed while its tree is being read*");
+      g_assert (!sopa_element_remove_attribute (SOPA_ELEMENT (node), "n"));
+      g_test_assert_expected_messages ();
+    }
+}
+
+static void
+test_foreach_parallel_frozen (void)
+{
+  SopaDocument *document;
+  SopaElement *item;
+  SopaNode *root, *text;
+
+  document = make_document (2);
+  root = sopa_node_get_first_child (SOPA_NODE (document));
+  item = SOPA_ELEMENT (sopa_node_get_first_child (root));
+  text = sopa_node_get_first_child (SOPA_NODE (item));
+
+  /* a single thread runs the function inline, with the tree frozen */
+  sopa_node_foreach_parallel (SOPA_NODE (item), try_changes, NULL, 1);
+
+  g_assert_cmpstr (sopa_element_get_attribute (item, "n"), ==, "0");
+  g_assert_cmpstr (sopa_text_get_content (SOPA_TEXT (text)), ==, "text");
+
+  /* and thawed once it returns */
+  sopa_element_set_attribute (item, "n", "changed");
+  g_assert_cmpstr (sopa_element_get_attribute (item, "n"), ==, "changed");
+
+  g_object_unref (document);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/foreach-parallel/visits", test_foreach_parallel_visits);
+  g_test_add_func ("/foreach-parallel/frozen", test_foreach_parallel_frozen);
+
+  return g_test_run ();
+}
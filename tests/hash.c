@@ -0,0 +1,144 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static const char *page =
+  "<html>"
+    "<div class=\"header\"><a href=\"/\">Home</a><a href=\"/about\">About</a></div>"
+    "<p>first page</p>"
+    "<div class=\"header\"><a href=\"/\">Home</a><a href=\"/about\">About</a></div>"
+  "</html>";
+
+static void
+test_hash_identical (void)
+{
+  SopaDocument *document, *other;
+  SopaNode *html, *first, *last, *other_header;
+
+  document = test_parse (page);
+  other = test_parse ("<body><p>another page</p>"
+                      "<div class=\"header\"><a href=\"/\">Home</a>"
+                      "<a href=\"/about\">About</a></div></body>");
+
+  html = sopa_node_get_first_child (SOPA_NODE (document));
+  first = sopa_node_get_first_child (html);
+  last = sopa_node_get_last_child (html);
+  other_header = sopa_node_get_first_child (SOPA_NODE (other));
+  other_header = sopa_node_get_last_child (other_header);
+
+  /* the same blocks, in the same tree or in another one */
+  g_assert_cmpuint (sopa_node_get_hash (first), ==, sopa_node_get_hash (last));
+  g_assert_cmpuint (sopa_node_get_hash (first), ==,
+                    sopa_node_get_hash (other_header));
+  g_assert (sopa_node_equal (first, last));
+  g_assert (sopa_node_equal (last, other_header));
+
+  /* and different ones */
+  g_assert_cmpuint (sopa_node_get_hash (first), !=,
+                    sopa_node_get_hash (sopa_node_get_next_sibling (first)));
+  g_assert (!sopa_node_equal (first, sopa_node_get_next_sibling (first)));
+  g_assert (!sopa_node_equal (SOPA_NODE (document), SOPA_NODE (other)));
+
+  /* a node is equal to itself, and asking again gives the same hash */
+  g_assert (sopa_node_equal (html, html));
+  g_assert_cmpuint (sopa_node_get_hash (html), ==, sopa_node_get_hash (html));
+
+  g_object_unref (other);
+  g_object_unref (document);
+}
+
+static void
+check_different (const gchar *a,
+                 const gchar *b)
+{
+  SopaDocument *document_a, *document_b;
+
+  document_a = test_parse (a);
+  document_b = test_parse (b);
+
+  g_assert_cmpuint (sopa_node_get_hash (SOPA_NODE (document_a)), !=,
+                    sopa_node_get_hash (SOPA_NODE (document_b)));
+  g_assert (!sopa_node_equal (SOPA_NODE (document_a), SOPA_NODE (document_b)));
+
+  g_object_unref (document_b);
+  g_object_unref (document_a);
+}
+
+static void
+test_hash_structure (void)
+{
+  /* tags, attributes in order, texts, and where the children are */
+  check_different ("<p>text</p>", "<b>text</b>");
+  check_different ("<p a=\"1\" b=\"2\"/>", "<p b=\"2\" a=\"1\"/>");
+  check_different ("<p a=\"1\"/>", "<p a=\"2\"/>");
+  check_different ("<p a=\"1\"/>", "<p b=\"1\"/>");
+  check_different ("<p>text</p>", "<p>other</p>");
+  check_different ("<p><b/><i/></p>", "<p><i/><b/></p>");
+  check_different ("<p><b><i/></b></p>", "<p><b/><i/></p>");
+  check_different ("<p>ab<b/></p>", "<p>a<b/>b</p>");
+}
+
+static void
+test_hash_changes (void)
+{
+  SopaDocument *document;
+  SopaNode *html, *first, *last, *link, *text;
+  SopaElement *element;
+  guint64 hash, first_hash;
+
+  document = test_parse (page);
+  html = sopa_node_get_first_child (SOPA_NODE (document));
+  first = sopa_node_get_first_child (html);
+  last = sopa_node_get_last_child (html);
+  link = sopa_node_get_first_child (last);
+  text = sopa_node_get_first_child (link);
+
+  hash = sopa_node_get_hash (SOPA_NODE (document));
+  first_hash = sopa_node_get_hash (first);
+
+  /* a change deep down reaches every ancestor, and only them */
+  sopa_element_set_attribute (SOPA_ELEMENT (link), "href", "/index");
+  g_assert_cmpuint (sopa_node_get_hash (SOPA_NODE (document)), !=, hash);
+  g_assert_cmpuint (sopa_node_get_hash (first), ==, first_hash);
+  g_assert (!sopa_node_equal (first, last));
+
+  /* and undoing it gives the same hash again */
+  sopa_element_set_attribute (SOPA_ELEMENT (link), "href", "/");
+  g_assert_cmpuint (sopa_node_get_hash (SOPA_NODE (document)), ==, hash);
+  g_assert (sopa_node_equal (first, last));
+
+  sopa_text_set_content (SOPA_TEXT (text), "Start");
+  g_assert_cmpuint (sopa_node_get_hash (SOPA_NODE (document)), !=, hash);
+  sopa_text_set_content (SOPA_TEXT (text), "Home");
+  g_assert_cmpuint (sopa_node_get_hash (SOPA_NODE (document)), ==, hash);
+
+  sopa_element_remove_attribute (SOPA_ELEMENT (link), "href");
+  g_assert_cmpuint (sopa_node_get_hash (SOPA_NODE (document)), !=, hash);
+  sopa_element_set_attribute (SOPA_ELEMENT (link), "href", "/");
+  g_assert_cmpuint (sopa_node_get_hash (SOPA_NODE (document)), ==, hash);
+
+  /* adding and removing nodes */
+  element = sopa_element_new ("span");
+  sopa_element_add_child (SOPA_ELEMENT (last), SOPA_NODE (element));
+  g_assert_cmpuint (sopa_node_get_hash (SOPA_NODE (document)), !=, hash);
+  g_assert (!sopa_node_equal (first, last));
+
+  sopa_element_remove_child (SOPA_ELEMENT (last), SOPA_NODE (element));
+  g_assert_cmpuint (sopa_node_get_hash (SOPA_NODE (document)), ==, hash);
+  g_assert (sopa_node_equal (first, last));
+
+  g_object_unref (document);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/hash/identical", test_hash_identical);
+  g_test_add_func ("/hash/structure", test_hash_structure);
+  g_test_add_func ("/hash/changes", test_hash_changes);
+
+  return g_test_run ();
+}
@@ -0,0 +1,118 @@
+#include <string.h>
+#include <gio/gio.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static void
+test_json_tree (void)
+{
+  SopaDocument *document;
+  SopaNode *p;
+  gchar *json;
+  gsize length;
+
+  document = test_parse ("<p class=\"note\" id=\"x\">Hello <b>world</b>"
+                         "<!-- left out --><br/></p>");
+  p = sopa_node_get_first_child (SOPA_NODE (document));
+
+  /* attributes in order, children in document order, no comments */
+  json = sopa_element_to_json (SOPA_ELEMENT (p), &length);
+  g_assert_cmpstr (json, ==,
+                   "{\"type\":\"element\",\"tag\":\"p\","
+                    "\"attributes\":{\"class\":\"note\",\"id\":\"x\"},"
+                    "\"children\":["
+                     "{\"type\":\"text\",\"text\":\"Hello \"},"
+                     "{\"type\":\"element\",\"tag\":\"b\",\"children\":["
+                      "{\"type\":\"text\",\"text\":\"world\"}]},"
+                     "{\"type\":\"element\",\"tag\":\"br\"}]}");
+  g_assert_cmpuint (length, ==, strlen (json));
+  g_free (json);
+
+  json = sopa_element_to_json (SOPA_ELEMENT (document), NULL);
+  g_assert (g_str_has_prefix (json, "{\"type\":\"document\",\"children\":["
+                                    "{\"type\":\"element\",\"tag\":\"p\","));
+  g_assert (g_str_has_suffix (json, "]}]}"));
+  g_free (json);
+
+  g_object_unref (document);
+}
+
+static void
+test_json_escape (void)
+{
+  SopaElement *element;
+  SopaText *text;
+  gchar *json;
+
+  element = g_object_ref_sink (sopa_element_new ("p"));
+  sopa_element_set_attribute (element, "data-\"x\"", "a\\b\nc");
+
+  text = sopa_text_new ();
+  sopa_text_set_content (text,
+                         "quote \" back \\ tab \t cr \r bell \x07 "
+                         "unit \x1f <&> caf\xc3\xa9 /");
+  sopa_element_add_child (element, SOPA_NODE (text));
+
+  /* the quotes, backslashes and control characters, nothing else */
+  json = sopa_element_to_json (element, NULL);
+  g_assert_cmpstr (json, ==,
+                   "{\"type\":\"element\",\"tag\":\"p\","
+                    "\"attributes\":{\"data-\\\"x\\\"\":\"a\\\\b\\nc\"},"
+                    "\"children\":[{\"type\":\"text\",\"text\":"
+                     "\"quote \\\" back \\\\ tab \\t cr \\r bell \\u0007 "
+                     "unit \\u001f <&> caf\xc3\xa9 /\"}]}");
+  g_free (json);
+
+  g_object_unref (element);
+}
+
+static void
+test_json_stream (void)
+{
+  SopaDocument *document;
+  GOutputStream *stream;
+  GError *error = NULL;
+  GString *markup;
+  gchar *expected, *data;
+  guint i;
+
+  markup = g_string_new ("<ul>");
+  for (i = 0; i < 2000; i++)
+    g_string_append_printf (markup, "<li n=\"%u\">item \"%u\"</li>", i, i);
+  g_string_append (markup, "</ul>");
+
+  document = test_parse (markup->str);
+  g_string_free (markup, TRUE);
+
+  expected = sopa_element_to_json (SOPA_ELEMENT (document), NULL);
+
+  /* the same JSON, written in pieces */
+  stream = g_memory_output_stream_new_resizable ();
+  g_assert (sopa_element_write_json_to_stream (SOPA_ELEMENT (document),
+                                               stream, NULL, &error));
+  g_assert_no_error (error);
+
+  g_assert (g_output_stream_write (stream, "", 1, NULL, &error) == 1);
+  g_assert (g_output_stream_close (stream, NULL, &error));
+
+  data = g_memory_output_stream_steal_data (G_MEMORY_OUTPUT_STREAM (stream));
+  g_assert_cmpstr (data, ==, expected);
+
+  g_free (data);
+  g_object_unref (stream);
+  g_free (expected);
+  g_object_unref (document);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/json/tree", test_json_tree);
+  g_test_add_func ("/json/escape", test_json_escape);
+  g_test_add_func ("/json/stream", test_json_stream);
+
+  return g_test_run ();
+}
@@ -0,0 +1,291 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static const char *html =
+  "<ul>"
+    "<li>a</li>"
+    "<li>b</li>"
+  "</ul>";
+
+/* the batches delivered to an observer, with the records copied out */
+typedef struct
+{
+  guint   n_batches;
+  GArray *records;
+} Delivered;
+
+static void
+record_clear (gpointer data)
+{
+  SopaMutationRecord *record = data;
+
+  g_clear_object (&record->target);
+  g_clear_object (&record->added_node);
+  g_clear_object (&record->removed_node);
+  g_clear_object (&record->previous_sibling);
+  g_clear_object (&record->next_sibling);
+  g_free (record->name);
+  g_free (record->old_value);
+}
+
+static SopaNode *
+ref_node (SopaNode *node)
+{
+  return node != NULL ? g_object_ref (node) : NULL;
+}
+
+static void
+collect (SopaMutationObserver     *observer,
+         const SopaMutationRecord *records,
+         guint                     n_records,
+         gpointer                  user_data)
+{
+  Delivered *delivered = user_data;
+  SopaMutationRecord copy;
+  guint i;
+
+  g_assert_cmpuint (n_records, >, 0);
+  delivered->n_batches += 1;
+
+  for (i = 0; i < n_records; i++)
+    {
+      copy.type = records[i].type;
+      copy.target = ref_node (records[i].target);
+      copy.added_node = ref_node (records[i].added_node);
+      copy.removed_node = ref_node (records[i].removed_node);
+      copy.previous_sibling = ref_node (records[i].previous_sibling);
+      copy.next_sibling = ref_node (records[i].next_sibling);
+      copy.name = g_strdup (records[i].name);
+      copy.old_value = g_strdup (records[i].old_value);
+
+      g_array_append_val (delivered->records, copy);
+    }
+}
+
+static void
+delivered_init (Delivered *delivered)
+{
+  delivered->n_batches = 0;
+  delivered->records = g_array_new (FALSE, FALSE, sizeof (SopaMutationRecord));
+  g_array_set_clear_func (delivered->records, record_clear);
+}
+
+static void
+delivered_clear (Delivered *delivered)
+{
+  g_array_unref (delivered->records);
+}
+
+#define RECORD(d,i) (&g_array_index ((d)->records, SopaMutationRecord, (i)))
+
+static void
+test_observer_records (void)
+{
+  SopaDocument *document;
+  SopaMutationObserver *observer;
+  SopaNode *list, *first, *second, *text;
+  SopaElement *item;
+  SopaMutationRecord *record;
+  Delivered delivered;
+
+  document = test_parse (html);
+  list = sopa_node_get_first_child (SOPA_NODE (document));
+  first = sopa_node_get_first_child (list);
+  second = sopa_node_get_last_child (list);
+  text = sopa_node_get_first_child (first);
+
+  delivered_init (&delivered);
+  observer = sopa_mutation_observer_new (collect, &delivered, NULL);
+  sopa_mutation_observer_observe (observer, list,
+                                  SOPA_MUTATION_OBSERVE_CHILD_LIST |
+                                  SOPA_MUTATION_OBSERVE_ATTRIBUTES |
+                                  SOPA_MUTATION_OBSERVE_CHARACTER_DATA |
+                                  SOPA_MUTATION_OBSERVE_SUBTREE |
+                                  SOPA_MUTATION_OBSERVE_OLD_VALUES);
+
+  sopa_element_set_attribute (SOPA_ELEMENT (list), "class", "x");
+  sopa_element_set_attribute (SOPA_ELEMENT (list), "class", "y");
+  sopa_text_set_content (SOPA_TEXT (text), "changed");
+
+  item = sopa_element_new ("li");
+  sopa_element_add_child (SOPA_ELEMENT (list), SOPA_NODE (item));
+
+  /* the record keeps the removed node alive */
+  sopa_element_remove_child (SOPA_ELEMENT (list), first);
+
+  /* nothing is delivered until the flush, and then all at once */
+  g_assert_cmpuint (delivered.n_batches, ==, 0);
+  g_assert_cmpuint (sopa_mutation_observer_get_n_pending (observer), ==, 5);
+
+  sopa_mutation_observer_flush (observer);
+  g_assert_cmpuint (delivered.n_batches, ==, 1);
+  g_assert_cmpuint (delivered.records->len, ==, 5);
+  g_assert_cmpuint (sopa_mutation_observer_get_n_pending (observer), ==, 0);
+
+  record = RECORD (&delivered, 0);
+  g_assert_cmpint (record->type, ==, SOPA_MUTATION_ATTRIBUTE);
+  g_assert (record->target == list);
+  g_assert_cmpstr (record->name, ==, "class");
+  g_assert (record->old_value == NULL);
+
+  record = RECORD (&delivered, 1);
+  g_assert_cmpint (record->type, ==, SOPA_MUTATION_ATTRIBUTE);
+  g_assert_cmpstr (record->old_value, ==, "x");
+
+  record = RECORD (&delivered, 2);
+  g_assert_cmpint (record->type, ==, SOPA_MUTATION_CHARACTER_DATA);
+  g_assert (record->target == text);
+  g_assert (record->name == NULL);
+  g_assert_cmpstr (record->old_value, ==, "a");
+
+  record = RECORD (&delivered, 3);
+  g_assert_cmpint (record->type, ==, SOPA_MUTATION_CHILD_LIST);
+  g_assert (record->target == list);
+  g_assert (record->added_node == SOPA_NODE (item));
+  g_assert (record->removed_node == NULL);
+  g_assert (record->previous_sibling == second);
+  g_assert (record->next_sibling == NULL);
+
+  record = RECORD (&delivered, 4);
+  g_assert_cmpint (record->type, ==, SOPA_MUTATION_CHILD_LIST);
+  g_assert (record->target == list);
+  g_assert (record->added_node == NULL);
+  g_assert (record->removed_node == first);
+  g_assert (record->previous_sibling == NULL);
+  g_assert (record->next_sibling == second);
+  g_assert (sopa_node_get_parent (first) == NULL);
+
+  /* an empty flush calls nothing */
+  sopa_mutation_observer_flush (observer);
+  g_assert_cmpuint (delivered.n_batches, ==, 1);
+
+  g_object_unref (observer);
+  delivered_clear (&delivered);
+  g_object_unref (document);
+}
+
+static void
+test_observer_filters (void)
+{
+  SopaDocument *document;
+  SopaMutationObserver *observer;
+  SopaNode *list, *first, *text;
+  Delivered delivered;
+
+  document = test_parse (html);
+  list = sopa_node_get_first_child (SOPA_NODE (document));
+  first = sopa_node_get_first_child (list);
+  text = sopa_node_get_first_child (first);
+
+  delivered_init (&delivered);
+  observer = sopa_mutation_observer_new (collect, &delivered, NULL);
+
+  /* only the attributes of the node itself, without old values */
+  sopa_mutation_observer_observe (observer, list,
+                                  SOPA_MUTATION_OBSERVE_ATTRIBUTES);
+
+  sopa_element_set_attribute (SOPA_ELEMENT (first), "class", "x");
+  sopa_text_set_content (SOPA_TEXT (text), "changed");
+  sopa_element_add_child (SOPA_ELEMENT (list),
+                          SOPA_NODE (sopa_element_new ("li")));
+  g_assert_cmpuint (sopa_mutation_observer_get_n_pending (observer), ==, 0);
+
+  sopa_element_set_attribute (SOPA_ELEMENT (list), "class", "x");
+  sopa_element_set_attribute (SOPA_ELEMENT (list), "class", "y");
+  g_assert_cmpuint (sopa_mutation_observer_get_n_pending (observer), ==, 2);
+
+  sopa_mutation_observer_flush (observer);
+  g_assert_cmpuint (delivered.records->len, ==, 2);
+  g_assert (RECORD (&delivered, 1)->old_value == NULL);
+
+  /* observing the node again replaces the flags; observing an
+   * ancestor as well still gives a single record per mutation
+   */
+  sopa_mutation_observer_observe (observer, list,
+                                  SOPA_MUTATION_OBSERVE_CHARACTER_DATA |
+                                  SOPA_MUTATION_OBSERVE_SUBTREE);
+  sopa_mutation_observer_observe (observer, SOPA_NODE (document),
+                                  SOPA_MUTATION_OBSERVE_CHARACTER_DATA |
+                                  SOPA_MUTATION_OBSERVE_SUBTREE);
+
+  sopa_element_set_attribute (SOPA_ELEMENT (list), "class", "z");
+  sopa_text_set_content (SOPA_TEXT (text), "again");
+  g_assert_cmpuint (sopa_mutation_observer_get_n_pending (observer), ==, 1);
+
+  /* disconnecting drops the pending records, and observes nothing */
+  sopa_mutation_observer_disconnect (observer);
+  g_assert_cmpuint (sopa_mutation_observer_get_n_pending (observer), ==, 0);
+
+  sopa_text_set_content (SOPA_TEXT (text), "once more");
+  g_assert_cmpuint (sopa_mutation_observer_get_n_pending (observer), ==, 0);
+
+  sopa_mutation_observer_flush (observer);
+  g_assert_cmpuint (delivered.n_batches, ==, 1);
+
+  g_object_unref (observer);
+  delivered_clear (&delivered);
+  g_object_unref (document);
+}
+
+static void
+change_in_flush (SopaMutationObserver     *observer,
+                 const SopaMutationRecord *records,
+                 guint                     n_records,
+                 gpointer                  user_data)
+{
+  guint *n_calls = user_data;
+
+  *n_calls += 1;
+
+  /* mutations made while delivering go to the next batch */
+  if (*n_calls == 1)
+    {
+      sopa_element_set_attribute (SOPA_ELEMENT (records[0].target), "b", "2");
+      g_assert_cmpuint (sopa_mutation_observer_get_n_pending (observer), ==, 1);
+    }
+}
+
+static void
+test_observer_lifetime (void)
+{
+  SopaDocument *document;
+  SopaMutationObserver *observer;
+  SopaNode *list;
+  guint n_calls = 0;
+
+  document = test_parse (html);
+  list = sopa_node_get_first_child (SOPA_NODE (document));
+
+  observer = sopa_mutation_observer_new (change_in_flush, &n_calls, NULL);
+  sopa_mutation_observer_observe (observer, list,
+                                  SOPA_MUTATION_OBSERVE_ATTRIBUTES);
+
+  sopa_element_set_attribute (SOPA_ELEMENT (list), "a", "1");
+  sopa_mutation_observer_flush (observer);
+  g_assert_cmpuint (n_calls, ==, 1);
+
+  sopa_mutation_observer_flush (observer);
+  g_assert_cmpuint (n_calls, ==, 2);
+
+  /* the observer does not keep the nodes alive, nor they the observer */
+  g_object_unref (document);
+  g_assert_cmpuint (sopa_mutation_observer_get_n_pending (observer), ==, 0);
+  sopa_mutation_observer_flush (observer);
+  g_assert_cmpuint (n_calls, ==, 2);
+
+  g_object_unref (observer);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/mutation-observer/records", test_observer_records);
+  g_test_add_func ("/mutation-observer/filters", test_observer_filters);
+  g_test_add_func ("/mutation-observer/lifetime", test_observer_lifetime);
+
+  return g_test_run ();
+}
@@ -0,0 +1,126 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static const char *html =
+  "<html>"
+    "<body>"
+      "<p id=\"p1\"><b>x</b></p>"
+      "<p id=\"p2\"/>"
+    "</body>"
+  "</html>";
+
+typedef struct
+{
+  SopaDocument *document;
+  SopaNode     *body;
+  SopaNode     *p1;
+  SopaNode     *b;
+  SopaNode     *p2;
+} Tree;
+
+static void
+tree_init (Tree *tree)
+{
+  SopaNode *html_node;
+
+  tree->document = test_parse (html);
+
+  html_node = sopa_node_get_first_child (SOPA_NODE (tree->document));
+  tree->body = sopa_node_get_first_child (html_node);
+  tree->p1 = sopa_node_get_first_child (tree->body);
+  tree->b = sopa_node_get_first_child (tree->p1);
+  tree->p2 = sopa_node_get_next_sibling (tree->p1);
+
+  g_assert (tree->p2 != NULL);
+}
+
+static void
+test_node_order_contains (void)
+{
+  Tree tree;
+
+  tree_init (&tree);
+
+  g_assert (sopa_node_contains (tree.body, tree.b));
+  g_assert (sopa_node_contains (tree.body, tree.body));
+  g_assert (sopa_node_contains (SOPA_NODE (tree.document), tree.p2));
+  g_assert (!sopa_node_contains (tree.b, tree.body));
+  g_assert (!sopa_node_contains (tree.p1, tree.p2));
+  g_assert (!sopa_node_contains (tree.p2, tree.b));
+
+  g_object_unref (tree.document);
+}
+
+static void
+test_node_order_position (void)
+{
+  Tree tree;
+
+  tree_init (&tree);
+
+  g_assert_cmpint (sopa_node_compare_document_position (tree.p1, tree.p1), ==, 0);
+  g_assert_cmpint (sopa_node_compare_document_position (tree.p1, tree.p2), ==,
+                   SOPA_NODE_POSITION_FOLLOWING);
+  g_assert_cmpint (sopa_node_compare_document_position (tree.p2, tree.p1), ==,
+                   SOPA_NODE_POSITION_PRECEDING);
+  g_assert_cmpint (sopa_node_compare_document_position (tree.b, tree.p2), ==,
+                   SOPA_NODE_POSITION_FOLLOWING);
+  g_assert_cmpint (sopa_node_compare_document_position (tree.body, tree.b), ==,
+                   SOPA_NODE_POSITION_CONTAINED_BY | SOPA_NODE_POSITION_FOLLOWING);
+  g_assert_cmpint (sopa_node_compare_document_position (tree.b, tree.body), ==,
+                   SOPA_NODE_POSITION_CONTAINS | SOPA_NODE_POSITION_PRECEDING);
+
+  g_object_unref (tree.document);
+}
+
+static void
+test_node_order_changes (void)
+{
+  SopaElement *extra;
+  Tree tree;
+
+  tree_init (&tree);
+
+  /* number the tree, then move p2 in front of p1 */
+  g_assert (sopa_node_compare_document_position (tree.p1, tree.p2) ==
+            SOPA_NODE_POSITION_FOLLOWING);
+
+  g_object_ref (tree.p2);
+  sopa_element_remove_child (SOPA_ELEMENT (tree.body), tree.p2);
+  sopa_element_insert_child_at_index (SOPA_ELEMENT (tree.body), tree.p2, 0);
+  g_object_unref (tree.p2);
+
+  g_assert_cmpint (sopa_node_compare_document_position (tree.p1, tree.p2), ==,
+                   SOPA_NODE_POSITION_PRECEDING);
+  g_assert_cmpint (sopa_node_compare_document_position (tree.p2, tree.b), ==,
+                   SOPA_NODE_POSITION_FOLLOWING);
+
+  /* a node out of the tree is disconnected until it is added */
+  extra = g_object_ref_sink (sopa_element_new ("i"));
+  g_assert (!sopa_node_contains (tree.body, SOPA_NODE (extra)));
+  g_assert (sopa_node_compare_document_position (tree.body, SOPA_NODE (extra)) &
+            SOPA_NODE_POSITION_DISCONNECTED);
+
+  sopa_element_add_child (SOPA_ELEMENT (tree.b), SOPA_NODE (extra));
+  g_assert (sopa_node_contains (tree.p1, SOPA_NODE (extra)));
+  g_assert (!sopa_node_contains (tree.p2, SOPA_NODE (extra)));
+  g_assert_cmpint (sopa_node_compare_document_position (SOPA_NODE (extra), tree.p2), ==,
+                   SOPA_NODE_POSITION_PRECEDING);
+
+  g_object_unref (extra);
+  g_object_unref (tree.document);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/node-order/contains", test_node_order_contains);
+  g_test_add_func ("/node-order/position", test_node_order_position);
+  g_test_add_func ("/node-order/changes", test_node_order_changes);
+
+  return g_test_run ();
+}
@@ -0,0 +1,199 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static void
+assert_stats (SopaParseCache *cache,
+              guint64         hits,
+              guint64         misses)
+{
+  guint64 n_hits, n_misses;
+
+  sopa_parse_cache_get_stats (cache, &n_hits, &n_misses);
+  g_assert_cmpuint (n_hits, ==, hits);
+  g_assert_cmpuint (n_misses, ==, misses);
+}
+
+/* the estimated size of the cached document of @text */
+static gsize
+get_document_size (const gchar *text)
+{
+  SopaParseCache *cache;
+  SopaParser *parser;
+  gsize size;
+
+  cache = sopa_parse_cache_new (G_MAXSIZE, SOPA_PARSE_CACHE_SHARE);
+  parser = sopa_parser_new ();
+  sopa_parser_set_cache (parser, cache);
+
+  g_object_unref (test_parse_with (parser, text));
+  size = sopa_parse_cache_get_size (cache);
+  g_assert_cmpuint (size, >, strlen (text));
+
+  g_object_unref (parser);
+  sopa_parse_cache_unref (cache);
+
+  return size;
+}
+
+static void
+test_parse_cache_share (void)
+{
+  SopaParseCache *cache;
+  SopaParser *parser;
+  SopaDocument *a, *b, *c;
+
+  cache = sopa_parse_cache_new (G_MAXSIZE, SOPA_PARSE_CACHE_SHARE);
+  parser = sopa_parser_new ();
+  sopa_parser_set_cache (parser, cache);
+
+  a = test_parse_with (parser, "<p>a</p>");
+  assert_stats (cache, 0, 1);
+  g_assert_cmpuint (sopa_parse_cache_get_n_documents (cache), ==, 1);
+
+  /* the same text gives the same document */
+  b = test_parse_with (parser, "<p>a</p>");
+  assert_stats (cache, 1, 1);
+  g_assert (b == a);
+
+  c = test_parse_with (parser, "<p>b</p>");
+  assert_stats (cache, 1, 2);
+  g_assert (c != a);
+  g_assert_cmpuint (sopa_parse_cache_get_n_documents (cache), ==, 2);
+
+  g_object_unref (c);
+  g_object_unref (b);
+  g_object_unref (a);
+
+  sopa_parse_cache_clear (cache);
+  g_assert_cmpuint (sopa_parse_cache_get_n_documents (cache), ==, 0);
+  g_assert_cmpuint (sopa_parse_cache_get_size (cache), ==, 0);
+
+  g_object_unref (parser);
+  sopa_parse_cache_unref (cache);
+}
+
+static void
+test_parse_cache_clone (void)
+{
+  SopaParseCache *cache;
+  SopaParser *parser;
+  SopaDocument *a, *b, *c;
+  SopaElement *p;
+
+  cache = sopa_parse_cache_new (G_MAXSIZE, SOPA_PARSE_CACHE_CLONE);
+  parser = sopa_parser_new ();
+  sopa_parser_set_cache (parser, cache);
+
+  a = test_parse_with (parser, "<p id=\"x\">a</p>");
+  b = test_parse_with (parser, "<p id=\"x\">a</p>");
+  assert_stats (cache, 1, 1);
+  g_assert (b != a);
+  g_assert (sopa_node_equal (SOPA_NODE (a), SOPA_NODE (b)));
+
+  /* changes to either do not reach the cached document */
+  p = SOPA_ELEMENT (sopa_node_get_first_child (SOPA_NODE (a)));
+  sopa_element_set_attribute (p, "id", "y");
+  p = SOPA_ELEMENT (sopa_node_get_first_child (SOPA_NODE (b)));
+  sopa_element_set_attribute (p, "id", "z");
+
+  c = test_parse_with (parser, "<p id=\"x\">a</p>");
+  assert_stats (cache, 2, 1);
+  p = SOPA_ELEMENT (sopa_node_get_first_child (SOPA_NODE (c)));
+  g_assert_cmpstr (sopa_element_get_attribute (p, "id"), ==, "x");
+
+  g_object_unref (c);
+  g_object_unref (b);
+  g_object_unref (a);
+
+  /* clones do not carry offsets, so those documents are not cached */
+  sopa_parser_set_track_offsets (parser, TRUE);
+  g_object_unref (test_parse_with (parser, "<p>offsets</p>"));
+  g_assert_cmpuint (sopa_parse_cache_get_n_documents (cache), ==, 1);
+
+  g_object_unref (parser);
+  sopa_parse_cache_unref (cache);
+}
+
+static void
+test_parse_cache_eviction (void)
+{
+  SopaParseCache *cache;
+  SopaParser *parser;
+  gsize size;
+
+  /* room for two of the documents, which have the same size */
+  size = get_document_size ("<p>a</p>");
+  cache = sopa_parse_cache_new (size * 2 + size / 2, SOPA_PARSE_CACHE_SHARE);
+  parser = sopa_parser_new ();
+  sopa_parser_set_cache (parser, cache);
+
+  g_object_unref (test_parse_with (parser, "<p>a</p>"));
+  g_object_unref (test_parse_with (parser, "<p>b</p>"));
+  g_assert_cmpuint (sopa_parse_cache_get_n_documents (cache), ==, 2);
+  g_assert_cmpuint (sopa_parse_cache_get_size (cache), ==, size * 2);
+  assert_stats (cache, 0, 2);
+
+  /* a becomes the most recently used, so c evicts b */
+  g_object_unref (test_parse_with (parser, "<p>a</p>"));
+  g_object_unref (test_parse_with (parser, "<p>c</p>"));
+  g_assert_cmpuint (sopa_parse_cache_get_n_documents (cache), ==, 2);
+  assert_stats (cache, 1, 3);
+
+  g_object_unref (test_parse_with (parser, "<p>a</p>"));
+  assert_stats (cache, 2, 3);
+  g_object_unref (test_parse_with (parser, "<p>b</p>"));
+  assert_stats (cache, 2, 4);
+
+  g_assert_cmpuint (sopa_parse_cache_get_n_documents (cache), ==, 2);
+  g_assert_cmpuint (sopa_parse_cache_get_size (cache), <=,
+                    sopa_parse_cache_get_max_size (cache));
+
+  g_object_unref (parser);
+  sopa_parse_cache_unref (cache);
+}
+
+static void
+test_parse_cache_too_large (void)
+{
+  SopaParseCache *cache;
+  SopaParser *parser;
+
+  cache = sopa_parse_cache_new (1, SOPA_PARSE_CACHE_SHARE);
+  parser = sopa_parser_new ();
+  sopa_parser_set_cache (parser, cache);
+
+  g_object_unref (test_parse_with (parser, "<p>a</p>"));
+  g_object_unref (test_parse_with (parser, "<p>a</p>"));
+  assert_stats (cache, 0, 2);
+  g_assert_cmpuint (sopa_parse_cache_get_n_documents (cache), ==, 0);
+  g_assert_cmpuint (sopa_parse_cache_get_size (cache), ==, 0);
+
+  g_object_unref (parser);
+  sopa_parse_cache_unref (cache);
+}
+
+static void
+test_parse_cache_none (void)
+{
+  SopaParser *parser;
+
+  parser = sopa_parser_new ();
+  g_object_unref (test_parse_with (parser, "<p>a</p>"));
+  g_object_unref (parser);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/parse-cache/share", test_parse_cache_share);
+  g_test_add_func ("/parse-cache/clone", test_parse_cache_clone);
+  g_test_add_func ("/parse-cache/eviction", test_parse_cache_eviction);
+  g_test_add_func ("/parse-cache/too-large", test_parse_cache_too_large);
+  g_test_add_func ("/parse-cache/none", test_parse_cache_none);
+
+  return g_test_run ();
+}
@@ -0,0 +1,144 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static gboolean
+has_operation (SopaPatch              *patch,
+               SopaPatchOperationType  type)
+{
+  guint i;
+
+  for (i = 0; i < sopa_patch_get_n_operations (patch); i++)
+    {
+      if (sopa_patch_get_operation_type (patch, i) == type)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* checks that applying the diff of @a and @b to @a gives @b, and
+ * returns the patch to check its operations
+ */
+static SopaPatch *
+check_round_trip (const gchar *a,
+                  const gchar *b)
+{
+  SopaDocument *doc_a, *doc_b;
+  SopaPatch *patch;
+  GError *error = NULL;
+  gboolean res;
+
+  doc_a = test_parse (a);
+  doc_b = test_parse (b);
+
+  patch = sopa_document_diff (doc_a, doc_b);
+  g_assert (patch != NULL);
+
+  res = sopa_document_apply_patch (doc_a, patch, &error);
+  g_assert_no_error (error);
+  g_assert (res);
+
+  g_assert (sopa_node_equal (SOPA_NODE (doc_a), SOPA_NODE (doc_b)));
+
+  g_object_unref (doc_b);
+  g_object_unref (doc_a);
+
+  return patch;
+}
+
+static void
+test_patch_identical (void)
+{
+  const gchar *html = "<html><body><p>one</p><p>two</p></body></html>";
+  SopaPatch *patch;
+
+  patch = check_round_trip (html, html);
+  g_assert_cmpuint (sopa_patch_get_n_operations (patch), ==, 0);
+  sopa_patch_unref (patch);
+}
+
+static void
+test_patch_reorder (void)
+{
+  SopaPatch *patch;
+
+  /* the last item goes first */
+  patch = check_round_trip ("<ul><li id=\"a\">a</li><li id=\"b\">b</li><li id=\"c\">c</li></ul>",
+                            "<ul><li id=\"c\">c</li><li id=\"a\">a</li><li id=\"b\">b</li></ul>");
+  g_assert (has_operation (patch, SOPA_PATCH_OPERATION_MOVE));
+  sopa_patch_unref (patch);
+
+  /* reversed */
+  patch = check_round_trip ("<ul><li>1</li><li>2</li><li>3</li><li>4</li></ul>",
+                            "<ul><li>4</li><li>3</li><li>2</li><li>1</li></ul>");
+  g_assert (has_operation (patch, SOPA_PATCH_OPERATION_MOVE));
+  sopa_patch_unref (patch);
+}
+
+static void
+test_patch_move_across (void)
+{
+  SopaPatch *patch;
+
+  /* a whole sub-tree moves to another parent */
+  patch = check_round_trip ("<div><section><p>moved <b>here</b></p></section><section/></div>",
+                            "<div><section/><section><p>moved <b>here</b></p></section></div>");
+  sopa_patch_unref (patch);
+}
+
+static void
+test_patch_edits (void)
+{
+  SopaPatch *patch;
+
+  patch = check_round_trip ("<div id=\"x\" class=\"a\"><p>text</p><br/></div>",
+                            "<div id=\"x\" title=\"t\"><p>new text</p><hr/><p>added</p></div>");
+  g_assert (has_operation (patch, SOPA_PATCH_OPERATION_SET_ATTRIBUTE));
+  g_assert (has_operation (patch, SOPA_PATCH_OPERATION_REMOVE_ATTRIBUTE));
+  g_assert (has_operation (patch, SOPA_PATCH_OPERATION_SET_TEXT));
+  sopa_patch_unref (patch);
+
+  /* reorders and edits at once */
+  patch = check_round_trip ("<ul><li id=\"a\" class=\"x\">a</li><li id=\"b\">b</li><li id=\"c\">c</li></ul>",
+                            "<ul><li id=\"b\">b!</li><li id=\"d\">d</li><li id=\"a\" class=\"y\">a</li></ul>");
+  sopa_patch_unref (patch);
+}
+
+static void
+test_patch_mismatch (void)
+{
+  SopaDocument *a, *b, *other;
+  SopaPatch *patch;
+  GError *error = NULL;
+
+  a = test_parse ("<p>a</p>");
+  b = test_parse ("<p>b</p>");
+  other = test_parse ("<p>other</p>");
+
+  patch = sopa_document_diff (a, b);
+
+  g_assert (!sopa_document_apply_patch (other, patch, &error));
+  g_assert (g_error_matches (error, SOPA_PATCH_ERROR, SOPA_PATCH_ERROR_MISMATCH));
+  g_clear_error (&error);
+
+  sopa_patch_unref (patch);
+  g_object_unref (other);
+  g_object_unref (b);
+  g_object_unref (a);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/patch/identical", test_patch_identical);
+  g_test_add_func ("/patch/reorder", test_patch_reorder);
+  g_test_add_func ("/patch/move-across", test_patch_move_across);
+  g_test_add_func ("/patch/edits", test_patch_edits);
+  g_test_add_func ("/patch/mismatch", test_patch_mismatch);
+
+  return g_test_run ();
+}
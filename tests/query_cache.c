@@ -0,0 +1,131 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static const char *html =
+  "<ul>"
+    "<li class=\"on\">a</li>"
+    "<li>b</li>"
+    "<li class=\"on\">c</li>"
+  "</ul>";
+
+static SopaSelector *
+compile (const gchar *source)
+{
+  SopaSelector *selector;
+  GError *error = NULL;
+
+  selector = sopa_selector_new (source, &error);
+  g_assert_no_error (error);
+
+  return selector;
+}
+
+static void
+test_query_cache_hits (void)
+{
+  SopaDocument *document;
+  SopaSelector *a, *b;
+  GPtrArray *first, *second;
+
+  document = test_parse (html);
+  g_assert (!sopa_document_get_query_cache_enabled (document));
+
+  sopa_document_set_query_cache_enabled (document, TRUE);
+  g_assert (sopa_document_get_query_cache_enabled (document));
+
+  /* results are looked up by the source of the selector */
+  a = compile ("li.on");
+  b = compile ("li.on");
+
+  first = sopa_document_query_selector_all (document, a);
+  second = sopa_document_query_selector_all (document, b);
+  g_assert (first == second);
+  g_assert_cmpuint (first->len, ==, 2);
+
+  g_ptr_array_unref (second);
+  g_ptr_array_unref (first);
+
+  /* without the cache, each query is run again */
+  sopa_document_set_query_cache_enabled (document, FALSE);
+
+  first = sopa_document_query_selector_all (document, a);
+  second = sopa_document_query_selector_all (document, a);
+  g_assert (first != second);
+  g_assert_cmpuint (first->len, ==, 2);
+  g_assert_cmpuint (second->len, ==, 2);
+
+  g_ptr_array_unref (second);
+  g_ptr_array_unref (first);
+
+  sopa_selector_unref (b);
+  sopa_selector_unref (a);
+  g_object_unref (document);
+}
+
+static void
+test_query_cache_changes (void)
+{
+  SopaDocument *document;
+  SopaSelector *selector;
+  SopaNode *list, *second;
+  SopaElement *item;
+  GPtrArray *result, *kept;
+
+  document = test_parse (html);
+  sopa_document_set_query_cache_enabled (document, TRUE);
+
+  list = sopa_node_get_first_child (SOPA_NODE (document));
+  second = sopa_node_get_next_sibling (sopa_node_get_first_child (list));
+  selector = compile ("li.on");
+
+  kept = sopa_document_query_selector_all (document, selector);
+  g_assert_cmpuint (kept->len, ==, 2);
+
+  /* an attribute change drops the cached results */
+  sopa_element_set_attribute (SOPA_ELEMENT (second), "class", "on");
+
+  result = sopa_document_query_selector_all (document, selector);
+  g_assert (result != kept);
+  g_assert_cmpuint (result->len, ==, 3);
+  g_assert (g_ptr_array_index (result, 1) == (gpointer) second);
+
+  /* the arrays handed out before stay as they were */
+  g_assert_cmpuint (kept->len, ==, 2);
+  g_ptr_array_unref (kept);
+  kept = result;
+
+  /* and so does adding a node */
+  item = sopa_element_new ("li");
+  sopa_element_set_attribute (item, "class", "on");
+  sopa_element_add_child (SOPA_ELEMENT (list), SOPA_NODE (item));
+
+  result = sopa_document_query_selector_all (document, selector);
+  g_assert (result != kept);
+  g_assert_cmpuint (result->len, ==, 4);
+  g_assert (g_ptr_array_index (result, 3) == (gpointer) item);
+  g_ptr_array_unref (result);
+
+  /* or removing one */
+  sopa_element_remove_child (SOPA_ELEMENT (list), second);
+
+  result = sopa_document_query_selector_all (document, selector);
+  g_assert_cmpuint (result->len, ==, 3);
+  g_ptr_array_unref (result);
+
+  g_ptr_array_unref (kept);
+  sopa_selector_unref (selector);
+  g_object_unref (document);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/query-cache/hits", test_query_cache_hits);
+  g_test_add_func ("/query-cache/changes", test_query_cache_changes);
+
+  return g_test_run ();
+}
@@ -0,0 +1,187 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static gchar *
+serialize_range (SopaNode          *first,
+                 SopaNode          *last,
+                 SopaSerializeMode  mode)
+{
+  SopaSerializeOptions *options;
+  gchar *markup;
+  gsize length;
+
+  options = sopa_serialize_options_new (mode);
+
+  markup = sopa_node_serialize_range (first, last, options, &length);
+  g_assert_cmpuint (length, ==, strlen (markup));
+
+  sopa_serialize_options_free (options);
+
+  return markup;
+}
+
+static SopaDocument *
+make_table (gboolean tracked)
+{
+  SopaDocument *document;
+  GString *text;
+  guint i;
+
+  text = g_string_new ("<table>");
+  for (i = 0; i < 10; i++)
+    g_string_append_printf (text, "<tr  id='r%u'><td>%u &amp;</td></tr>", i, i);
+  g_string_append (text, "</table>");
+
+  document = tracked ? test_parse_tracked (text->str) : test_parse (text->str);
+  g_string_free (text, TRUE);
+
+  return document;
+}
+
+static void
+test_range_written (void)
+{
+  SopaDocument *document;
+  SopaNode *table, *first, *last, *text;
+  SopaSerializeOptions *options;
+  gchar *markup;
+
+  document = make_table (FALSE);
+  table = sopa_node_get_first_child (SOPA_NODE (document));
+  first = sopa_node_get_child_at_index (table, 2);
+  last = sopa_node_get_child_at_index (table, 4);
+
+  markup = serialize_range (first, last, SOPA_SERIALIZE_MODE_FAITHFUL);
+  g_assert_cmpstr (markup, ==,
+                   "<tr id=\"r2\"><td>2 &amp;</td></tr>"
+                   "<tr id=\"r3\"><td>3 &amp;</td></tr>"
+                   "<tr id=\"r4\"><td>4 &amp;</td></tr>");
+  g_free (markup);
+
+  markup = serialize_range (first, first, SOPA_SERIALIZE_MODE_PRETTY);
+  g_assert_cmpstr (markup, ==,
+                   "<tr id=\"r2\">\n"
+                   "  <td>\n"
+                   "    2 &amp;\n"
+                   "  </td>\n"
+                   "</tr>");
+  g_free (markup);
+
+  /* a single node, in the faithful layout */
+  markup = sopa_node_get_outer_html (last, NULL);
+  g_assert_cmpstr (markup, ==, "<tr id=\"r4\"><td>4 &amp;</td></tr>");
+  g_free (markup);
+
+  text = sopa_node_get_first_child (sopa_node_get_first_child (last));
+  markup = sopa_node_get_outer_html (text, NULL);
+  g_assert_cmpstr (markup, ==, "4 &amp;");
+  g_free (markup);
+
+  /* copied from the markup of the tree, and written again once changed */
+  options = sopa_serialize_options_new (SOPA_SERIALIZE_MODE_MINIFIED);
+  g_free (sopa_element_serialize (SOPA_ELEMENT (document), options, NULL));
+  sopa_serialize_options_free (options);
+
+  markup = serialize_range (first, last, SOPA_SERIALIZE_MODE_MINIFIED);
+  g_assert_cmpstr (markup, ==,
+                   "<tr id=r2><td>2 &amp;</td></tr>"
+                   "<tr id=r3><td>3 &amp;</td></tr>"
+                   "<tr id=r4><td>4 &amp;</td></tr>");
+  g_free (markup);
+
+  sopa_element_set_attribute (SOPA_ELEMENT (last), "id", "changed");
+
+  markup = serialize_range (first, last, SOPA_SERIALIZE_MODE_MINIFIED);
+  g_assert_cmpstr (markup, ==,
+                   "<tr id=r2><td>2 &amp;</td></tr>"
+                   "<tr id=r3><td>3 &amp;</td></tr>"
+                   "<tr id=changed><td>4 &amp;</td></tr>");
+  g_free (markup);
+
+  g_object_unref (document);
+}
+
+static void
+test_range_source (void)
+{
+  SopaDocument *document;
+  SopaNode *table, *first, *last, *text;
+  gchar *markup;
+  gsize length;
+
+  document = make_table (TRUE);
+  table = sopa_node_get_first_child (SOPA_NODE (document));
+  first = sopa_node_get_child_at_index (table, 2);
+  last = sopa_node_get_child_at_index (table, 3);
+
+  /* slices of the source */
+  markup = serialize_range (first, last, SOPA_SERIALIZE_MODE_FAITHFUL);
+  g_assert_cmpstr (markup, ==,
+                   "<tr  id='r2'><td>2 &amp;</td></tr>"
+                   "<tr  id='r3'><td>3 &amp;</td></tr>");
+  g_free (markup);
+
+  markup = sopa_node_get_outer_html (first, &length);
+  g_assert_cmpstr (markup, ==, "<tr  id='r2'><td>2 &amp;</td></tr>");
+  g_assert_cmpuint (length, ==, strlen (markup));
+  g_free (markup);
+
+  /* the other layouts are written */
+  markup = serialize_range (first, first, SOPA_SERIALIZE_MODE_MINIFIED);
+  g_assert_cmpstr (markup, ==, "<tr id=r2><td>2 &amp;</td></tr>");
+  g_free (markup);
+
+  /* a change inside the range */
+  text = sopa_node_get_first_child (sopa_node_get_first_child (last));
+  sopa_text_set_content (SOPA_TEXT (text), "new");
+
+  markup = serialize_range (first, last, SOPA_SERIALIZE_MODE_FAITHFUL);
+  g_assert_cmpstr (markup, ==,
+                   "<tr  id='r2'><td>2 &amp;</td></tr>"
+                   "<tr id=\"r3\"><td>new</td></tr>");
+  g_free (markup);
+
+  markup = sopa_node_get_outer_html (first, NULL);
+  g_assert_cmpstr (markup, ==, "<tr  id='r2'><td>2 &amp;</td></tr>");
+  g_free (markup);
+
+  markup = sopa_node_get_outer_html (last, NULL);
+  g_assert_cmpstr (markup, ==, "<tr id=\"r3\"><td>new</td></tr>");
+  g_free (markup);
+
+  g_object_unref (document);
+}
+
+static void
+test_range_invalid (void)
+{
+  SopaDocument *document;
+  SopaNode *table, *first, *last;
+
+  document = make_table (FALSE);
+  table = sopa_node_get_first_child (SOPA_NODE (document));
+  first = sopa_node_get_child_at_index (table, 2);
+  last = sopa_node_get_child_at_index (table, 4);
+
+  /* the last node must follow the first one */
+  g_test_expect_message ("Sopa", G_LOG_LEVEL_CRITICAL,
+                         "*is not a following sibling of*");
+  g_assert (sopa_node_serialize_range (last, first, NULL, NULL) == NULL);
+  g_test_assert_expected_messages ();
+
+  g_object_unref (document);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/range/written", test_range_written);
+  g_test_add_func ("/range/source", test_range_source);
+  g_test_add_func ("/range/invalid", test_range_invalid);
+
+  return g_test_run ();
+}
@@ -0,0 +1,160 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static const char *html =
+  "<html>"
+    "<body>"
+      "<p>one</p>"
+      "<div id=\"d\"><p>two</p><p>three</p></div>"
+      "<p>four</p>"
+    "</body>"
+  "</html>";
+
+/* replaces @removed_len bytes at @offset of @text with @inserted */
+static gchar *
+edit (const gchar *text,
+      gsize        offset,
+      gsize        removed_len,
+      const gchar *inserted)
+{
+  GString *result;
+
+  result = g_string_new_len (text, offset);
+  g_string_append (result, inserted);
+  g_string_append (result, text + offset + removed_len);
+
+  return g_string_free (result, FALSE);
+}
+
+static void
+assert_same_offsets (SopaNode *a,
+                     SopaNode *b)
+{
+  gsize a_start = 0, a_end = 0, b_start = 0, b_end = 0;
+  gboolean a_known, b_known;
+
+  a_known = sopa_node_get_source_range (a, &a_start, &a_end);
+  b_known = sopa_node_get_source_range (b, &b_start, &b_end);
+
+  g_assert (a_known == b_known);
+  g_assert_cmpuint (a_start, ==, b_start);
+  g_assert_cmpuint (a_end, ==, b_end);
+
+  for (a = sopa_node_get_first_child (a), b = sopa_node_get_first_child (b);
+       a != NULL && b != NULL;
+       a = sopa_node_get_next_sibling (a), b = sopa_node_get_next_sibling (b))
+    assert_same_offsets (a, b);
+
+  g_assert (a == NULL && b == NULL);
+}
+
+/* reparses the edit, and checks the result against a full parse */
+static void
+check_reparse (const gchar *text,
+               gsize        offset,
+               gsize        removed_len,
+               const gchar *inserted)
+{
+  SopaDocument *document, *expected;
+  GError *error = NULL;
+  GBytes *source;
+  gchar *edited;
+  gboolean res;
+
+  edited = edit (text, offset, removed_len, inserted);
+
+  document = test_parse_tracked (text);
+  res = sopa_document_reparse_range (document,
+                                     offset, removed_len,
+                                     inserted, -1,
+                                     &error);
+  g_assert_no_error (error);
+  g_assert (res);
+
+  source = sopa_document_get_source (document);
+  g_assert_cmpuint (g_bytes_get_size (source), ==, strlen (edited));
+  g_assert (memcmp (g_bytes_get_data (source, NULL), edited, strlen (edited)) == 0);
+
+  expected = test_parse_tracked (edited);
+  g_assert (sopa_node_equal (SOPA_NODE (document), SOPA_NODE (expected)));
+  assert_same_offsets (SOPA_NODE (document), SOPA_NODE (expected));
+
+  g_object_unref (expected);
+  g_object_unref (document);
+  g_free (edited);
+}
+
+static void
+test_reparse_text (void)
+{
+  const gchar *two = strstr (html, "two");
+
+  /* the new content is longer, the nodes after it are shifted */
+  check_reparse (html, two - html, strlen ("two"), "<b>2</b> and a half");
+
+  /* and shorter */
+  check_reparse (html, two - html, strlen ("two"), "");
+}
+
+static void
+test_reparse_elements (void)
+{
+  const gchar *end = strstr (html, "</p><p>three");
+
+  /* merges two paragraphs of the div */
+  check_reparse (html, end - html, strlen ("</p><p>"), "");
+}
+
+static void
+test_reparse_enclosing (void)
+{
+  const gchar *two = strstr (html, "two");
+
+  /* closes the paragraph, which is not well formed on its own */
+  check_reparse (html, two - html, 0, "</p><p>");
+}
+
+static void
+test_reparse_invalid (void)
+{
+  SopaDocument *document, *expected;
+  GError *error = NULL;
+  GBytes *source;
+  const gchar *two = strstr (html, "two");
+  gboolean res;
+
+  document = test_parse_tracked (html);
+  expected = test_parse_tracked (html);
+
+  res = sopa_document_reparse_range (document,
+                                     two - html, 0,
+                                     "</div>", -1,
+                                     &error);
+  g_assert (!res);
+  g_assert (error != NULL);
+  g_clear_error (&error);
+
+  /* the document is left untouched */
+  source = sopa_document_get_source (document);
+  g_assert_cmpuint (g_bytes_get_size (source), ==, strlen (html));
+  g_assert (sopa_node_equal (SOPA_NODE (document), SOPA_NODE (expected)));
+  assert_same_offsets (SOPA_NODE (document), SOPA_NODE (expected));
+
+  g_object_unref (expected);
+  g_object_unref (document);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/reparse-range/text", test_reparse_text);
+  g_test_add_func ("/reparse-range/elements", test_reparse_elements);
+  g_test_add_func ("/reparse-range/enclosing", test_reparse_enclosing);
+  g_test_add_func ("/reparse-range/invalid", test_reparse_invalid);
+
+  return g_test_run ();
+}
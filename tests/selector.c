@@ -0,0 +1,173 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static const char *html =
+  "<html>"
+    "<body>"
+      "<ul id=\"list\" class=\"menu main\">"
+        "<li id=\"a\" class=\"item\" data-key=\"alpha\">a</li>"
+        "<li id=\"b\" class=\"item keep\" data-key=\"beta\">b"
+          "<ul><li id=\"c\" class=\"item keep\" lang=\"en-GB\">c</li></ul>"
+        "</li>"
+      "</ul>"
+      "<p id=\"d\" class=\"keep\">d</p>"
+    "</body>"
+  "</html>";
+
+/* the ids of the elements matched by @source below @root, joined */
+static gchar *
+query_ids (SopaNode    *root,
+           const gchar *source)
+{
+  SopaSelector *selector;
+  GPtrArray *matches;
+  GString *ids;
+  GError *error = NULL;
+  guint i;
+
+  selector = sopa_selector_new (source, &error);
+  g_assert_no_error (error);
+
+  matches = sopa_selector_query_all (selector, root);
+
+  ids = g_string_new (NULL);
+  for (i = 0; i < matches->len; i++)
+    {
+      SopaElement *element = g_ptr_array_index (matches, i);
+
+      g_assert (sopa_selector_matches (selector, element));
+      g_string_append (ids, sopa_element_get_attribute (element, "id"));
+    }
+
+  g_ptr_array_unref (matches);
+  sopa_selector_unref (selector);
+
+  return g_string_free (ids, FALSE);
+}
+
+static void
+assert_query (SopaNode    *root,
+              const gchar *source,
+              const gchar *expected)
+{
+  gchar *ids;
+
+  ids = query_ids (root, source);
+  g_assert_cmpstr (ids, ==, expected);
+  g_free (ids);
+}
+
+static void
+test_selector_query (void)
+{
+  SopaDocument *document;
+  SopaNode *root;
+
+  document = test_parse (html);
+  root = SOPA_NODE (document);
+
+  assert_query (root, "li", "abc");
+  assert_query (root, "*[id=list]", "list");
+  assert_query (root, "#b", "b");
+  assert_query (root, ".keep", "bcd");
+  assert_query (root, "ul.main > li", "ab");
+  assert_query (root, "ul li li", "c");
+  assert_query (root, "[data-key]", "ab");
+  assert_query (root, "[data-key^=al]", "a");
+  assert_query (root, "[data-key$=ta]", "b");
+  assert_query (root, "[data-key*='lph']", "a");
+  assert_query (root, "[class~=menu]", "list");
+  assert_query (root, "[lang|=en]", "c");
+  assert_query (root, "p, #a", "ad");
+  assert_query (root, "section", "");
+
+  g_object_unref (document);
+}
+
+static void
+test_selector_errors (void)
+{
+  const gchar *invalid[] = { "", "#", "[id", "[id=\"x]", "a >", "a,,b" };
+  SopaSelector *selector;
+  GError *error = NULL;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (invalid); i++)
+    {
+      selector = sopa_selector_new (invalid[i], &error);
+      g_assert (selector == NULL);
+      g_assert_error (error, SOPA_SELECTOR_ERROR, SOPA_SELECTOR_ERROR_SYNTAX);
+      g_clear_error (&error);
+    }
+
+  selector = sopa_selector_new ("li:first-child", &error);
+  g_assert (selector == NULL);
+  g_assert_error (error, SOPA_SELECTOR_ERROR, SOPA_SELECTOR_ERROR_UNSUPPORTED);
+  g_clear_error (&error);
+}
+
+static void
+collect_match (SopaParser  *parser,
+               SopaElement *element,
+               gpointer     user_data)
+{
+  GString *ids = user_data;
+
+  /* matches are handed out whole and detached */
+  g_assert (sopa_node_get_parent (SOPA_NODE (element)) == NULL);
+  g_assert (sopa_node_get_first_child (SOPA_NODE (element)) != NULL);
+
+  g_string_append (ids, sopa_element_get_attribute (element, "id"));
+}
+
+static void
+test_selector_streaming (void)
+{
+  SopaParser *parser;
+  SopaSelector *selector;
+  SopaDocument *document;
+  GString *ids;
+  GError *error = NULL;
+  guint id;
+
+  parser = sopa_parser_new ();
+  ids = g_string_new (NULL);
+
+  selector = sopa_selector_new ("body > ul > li.keep, p", &error);
+  g_assert_no_error (error);
+
+  id = sopa_parser_add_selector (parser, selector, collect_match, ids, NULL);
+  sopa_selector_unref (selector);
+
+  /* c is within b, so it is not handed out on its own */
+  document = test_parse_with (parser, html);
+  g_assert_cmpstr (ids->str, ==, "bd");
+  g_assert (sopa_node_get_first_child (SOPA_NODE (document)) == NULL);
+  g_object_unref (document);
+
+  /* without selectors, the whole document is built again */
+  sopa_parser_remove_selector (parser, id);
+  g_string_truncate (ids, 0);
+
+  document = test_parse_with (parser, html);
+  g_assert_cmpstr (ids->str, ==, "");
+  g_assert (sopa_node_get_first_child (SOPA_NODE (document)) != NULL);
+  g_object_unref (document);
+
+  g_string_free (ids, TRUE);
+  g_object_unref (parser);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/selector/query", test_selector_query);
+  g_test_add_func ("/selector/errors", test_selector_errors);
+  g_test_add_func ("/selector/streaming", test_selector_streaming);
+
+  return g_test_run ();
+}
@@ -0,0 +1,333 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static gchar *
+serialize (SopaElement       *element,
+           SopaSerializeMode  mode,
+           guint              indent_width)
+{
+  SopaSerializeOptions *options;
+  gchar *markup;
+  gsize length;
+
+  options = sopa_serialize_options_new (mode);
+  sopa_serialize_options_set_indent_width (options, indent_width);
+
+  markup = sopa_element_serialize (element, options, &length);
+  g_assert_cmpuint (length, ==, strlen (markup));
+
+  sopa_serialize_options_free (options);
+
+  return markup;
+}
+
+static void
+test_serialize_pretty (void)
+{
+  SopaDocument *document;
+  gchar *markup;
+
+  document = test_parse ("<div><p>text</p><br/></div>");
+
+  markup = serialize (SOPA_ELEMENT (document), SOPA_SERIALIZE_MODE_PRETTY, 2);
+  g_assert_cmpstr (markup, ==,
+                   "<div>\n"
+                   "  <p>\n"
+                   "    text\n"
+                   "  </p>\n"
+                   "  <br>\n"
+                   "  </br>\n"
+                   "</div>");
+  g_free (markup);
+
+  /* the same as sopa_element_to_string() */
+  markup = sopa_element_to_string (SOPA_ELEMENT (document), 4);
+  g_assert_cmpstr (markup, ==,
+                   "<div>\n"
+                   "    <p>\n"
+                   "        text\n"
+                   "    </p>\n"
+                   "    <br>\n"
+                   "    </br>\n"
+                   "</div>");
+  g_free (markup);
+
+  g_object_unref (document);
+}
+
+static void
+test_serialize_minified (void)
+{
+  SopaDocument *document;
+  gchar *markup;
+
+  document = test_parse ("<div class=\"a b\" id=\"x\" hidden=\"\" "
+                         "title='say \"hi\"' alt=\"it's &amp; &quot;that&quot;\">"
+                         "<br/><p>a &lt; b</p><img src=\"a.png\"/><b></b>"
+                         "</div>");
+
+  /* no added whitespace, the shortest quoting, boolean attributes
+   * without a value and void elements without end tags
+   */
+  markup = serialize (SOPA_ELEMENT (document), SOPA_SERIALIZE_MODE_MINIFIED, 2);
+  g_assert_cmpstr (markup, ==,
+                   "<div class=\"a b\" id=x hidden title='say \"hi\"' "
+                   "alt=\"it's &amp; &quot;that&quot;\">"
+                   "<br><p>a &lt; b</p><img src=a.png><b></b>"
+                   "</div>");
+  g_free (markup);
+
+  g_object_unref (document);
+}
+
+static void
+test_serialize_faithful (void)
+{
+  SopaDocument *document;
+  gchar *markup;
+
+  document = test_parse ("<div id='x' hidden=\"\"><br/><p>text</p></div>");
+
+  /* no added whitespace, always quoted and all the end tags */
+  markup = serialize (SOPA_ELEMENT (document), SOPA_SERIALIZE_MODE_FAITHFUL, 2);
+  g_assert_cmpstr (markup, ==,
+                   "<div id=\"x\" hidden=\"\"><br></br><p>text</p></div>");
+  g_free (markup);
+
+  g_object_unref (document);
+}
+
+static void
+test_serialize_faithful_source (void)
+{
+  static const gchar *source =
+    "<div  id='x'   class=\"y\">"
+      "<p  lang='en'>one</p>"
+      "<p title='t'>two<br/></p>"
+    "</div>";
+  SopaDocument *document;
+  SopaElement *div, *p;
+  gchar *markup;
+
+  document = test_parse_tracked (source);
+  div = SOPA_ELEMENT (sopa_node_get_first_child (SOPA_NODE (document)));
+  p = SOPA_ELEMENT (sopa_node_get_last_child (SOPA_NODE (div)));
+
+  /* a parsed tree is its source */
+  markup = serialize (SOPA_ELEMENT (document), SOPA_SERIALIZE_MODE_FAITHFUL, 2);
+  g_assert_cmpstr (markup, ==, source);
+  g_free (markup);
+
+  /* and so is a part of it */
+  markup = serialize (div, SOPA_SERIALIZE_MODE_FAITHFUL, 2);
+  g_assert_cmpstr (markup, ==, "<p  lang='en'>one</p><p title='t'>two<br/></p>");
+  g_free (markup);
+
+  /* the changed nodes are written again, the others still copied */
+  sopa_element_set_attribute (p, "title", "u");
+
+  markup = serialize (SOPA_ELEMENT (document), SOPA_SERIALIZE_MODE_FAITHFUL, 2);
+  g_assert_cmpstr (markup, ==,
+                   "<div id=\"x\" class=\"y\">"
+                     "<p  lang='en'>one</p>"
+                     "<p title=\"u\">two<br/></p>"
+                   "</div>");
+  g_free (markup);
+
+  /* the other modes do not use the source */
+  markup = serialize (SOPA_ELEMENT (document), SOPA_SERIALIZE_MODE_MINIFIED, 2);
+  g_assert_cmpstr (markup, ==,
+                   "<div id=x class=y><p lang=en>one</p><p title=u>two<br></p></div>");
+  g_free (markup);
+
+  g_object_unref (document);
+}
+
+/* the markup of a tree, kept and copied from one time to the next,
+ * must be what writing it again gives
+ */
+static void
+check_incremental (SopaDocument *document)
+{
+  static const SopaSerializeMode modes[] = {
+    SOPA_SERIALIZE_MODE_MINIFIED,
+    SOPA_SERIALIZE_MODE_FAITHFUL
+  };
+  SopaElement *root;
+  gchar *markup, *again, *inner, *expected;
+  guint i;
+
+  root = SOPA_ELEMENT (sopa_node_get_first_child (SOPA_NODE (document)));
+
+  for (i = 0; i < G_N_ELEMENTS (modes); i++)
+    {
+      markup = serialize (SOPA_ELEMENT (document), modes[i], 0);
+      again = serialize (SOPA_ELEMENT (document), modes[i], 0);
+      g_assert_cmpstr (again, ==, markup);
+
+      /* below the root of the tree, nothing is kept */
+      inner = serialize (root, modes[i], 0);
+      expected = g_strconcat ("<root>", inner, "</root>", NULL);
+      g_assert_cmpstr (markup, ==, expected);
+
+      g_free (expected);
+      g_free (inner);
+      g_free (again);
+      g_free (markup);
+    }
+}
+
+static void
+check_edits (SopaDocument *document)
+{
+  SopaNode *list, *item, *text;
+  SopaElement *element;
+
+  list = sopa_node_get_first_child (SOPA_NODE (document));
+  list = sopa_node_get_first_child (list);
+  check_incremental (document);
+
+  item = sopa_node_get_child_at_index (list, 10);
+  sopa_element_set_attribute (SOPA_ELEMENT (item), "id", "changed");
+  check_incremental (document);
+
+  item = sopa_node_get_child_at_index (list, 20);
+  text = sopa_node_get_first_child (item);
+  sopa_text_set_content (SOPA_TEXT (text), "a < b");
+  check_incremental (document);
+
+  sopa_element_remove_attribute (SOPA_ELEMENT (item), "id");
+  check_incremental (document);
+
+  /* a node added deep down, at the end, and one removed */
+  item = sopa_node_get_child_at_index (list, 5);
+  element = sopa_element_new ("b");
+  sopa_element_add_child (SOPA_ELEMENT (item), SOPA_NODE (element));
+  check_incremental (document);
+
+  element = sopa_element_new ("li");
+  sopa_element_set_attribute (element, "id", "last");
+  sopa_element_add_child (SOPA_ELEMENT (list), SOPA_NODE (element));
+  check_incremental (document);
+
+  sopa_element_remove_child (SOPA_ELEMENT (list),
+                             sopa_node_get_child_at_index (list, 30));
+  check_incremental (document);
+
+  /* a change to a node that was just added */
+  sopa_element_set_attribute (element, "class", "x");
+  check_incremental (document);
+}
+
+static void
+test_serialize_incremental (void)
+{
+  SopaDocument *document;
+  GString *text;
+  guint i;
+
+  text = g_string_new ("<root><ul>");
+  for (i = 0; i < 50; i++)
+    g_string_append_printf (text, "<li  id='i%u'>item &amp; %u</li>", i, i);
+  g_string_append (text, "</ul></root>");
+
+  document = test_parse (text->str);
+  check_edits (document);
+  g_object_unref (document);
+
+  /* copying from the source as well */
+  document = test_parse_tracked (text->str);
+  check_edits (document);
+  g_object_unref (document);
+
+  g_string_free (text, TRUE);
+}
+
+static void
+check_parallel (SopaElement *element)
+{
+  static const SopaSerializeMode modes[] = {
+    SOPA_SERIALIZE_MODE_PRETTY,
+    SOPA_SERIALIZE_MODE_MINIFIED,
+    SOPA_SERIALIZE_MODE_FAITHFUL
+  };
+  SopaSerializeOptions *options;
+  gchar *expected, *markup;
+  gsize length;
+  guint i, n_threads;
+
+  for (i = 0; i < G_N_ELEMENTS (modes); i++)
+    {
+      expected = serialize (element, modes[i], 2);
+
+      for (n_threads = 0; n_threads <= 4; n_threads++)
+        {
+          options = sopa_serialize_options_new (modes[i]);
+          sopa_serialize_options_set_n_threads (options, n_threads);
+
+          markup = sopa_element_serialize (element, options, &length);
+          g_assert_cmpstr (markup, ==, expected);
+          g_assert_cmpuint (length, ==, strlen (expected));
+
+          g_free (markup);
+          sopa_serialize_options_free (options);
+        }
+
+      g_free (expected);
+    }
+}
+
+static void
+test_serialize_parallel (void)
+{
+  SopaDocument *document;
+  SopaElement *root, *item;
+  GString *text;
+  guint i;
+
+  text = g_string_new ("<root>");
+  for (i = 0; i < 3000; i++)
+    {
+      g_string_append_printf (text,
+                              "<div  class='c%u'><p>text &lt; %u</p>%s</div>",
+                              i % 7, i, i % 100 == 0 ? "<br/>" : "");
+    }
+  g_string_append (text, "</root>");
+
+  /* split in pieces of whole sub-trees, tags and runs of siblings */
+  document = test_parse (text->str);
+  root = SOPA_ELEMENT (sopa_node_get_first_child (SOPA_NODE (document)));
+  check_parallel (SOPA_ELEMENT (document));
+  check_parallel (root);
+
+  /* the tree is not frozen once done */
+  item = SOPA_ELEMENT (sopa_node_get_child_at_index (SOPA_NODE (root), 10));
+  sopa_element_set_attribute (item, "class", "changed");
+  g_assert_cmpstr (sopa_element_get_attribute (item, "class"), ==, "changed");
+  check_parallel (SOPA_ELEMENT (document));
+  g_object_unref (document);
+
+  /* with pieces copied from the source */
+  document = test_parse_tracked (text->str);
+  check_parallel (SOPA_ELEMENT (document));
+  g_object_unref (document);
+
+  g_string_free (text, TRUE);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/serialize/pretty", test_serialize_pretty);
+  g_test_add_func ("/serialize/minified", test_serialize_minified);
+  g_test_add_func ("/serialize/faithful", test_serialize_faithful);
+  g_test_add_func ("/serialize/faithful-source", test_serialize_faithful_source);
+  g_test_add_func ("/serialize/incremental", test_serialize_incremental);
+  g_test_add_func ("/serialize/parallel", test_serialize_parallel);
+
+  return g_test_run ();
+}
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sopa/sopa.h>
+
+/* Measures the throughput of the serializer on a generated document of
+ * mostly clean text, with a character to escape every few dozen bytes.
+ *
+ * Usage: serialize_benchmark [N_PARAGRAPHS [N_ITERATIONS]]
+ */
+
+static const gchar *words[] = {
+  "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+  "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "&amp;", "&lt;",
+  "ut", "labore", "et", "dolore", "magna", "aliqua", "enim", "&quot;"
+};
+
+static gchar *
+make_markup (guint n_paragraphs)
+{
+  GString *text;
+  guint i, j, n = 0;
+
+  text = g_string_new ("<html><body>");
+
+  for (i = 0; i < n_paragraphs; i++)
+    {
+      g_string_append_printf (text,
+                              "<div class=\"section item-%u\" title=\"a &amp; b\">"
+                              "<p id=\"p%u\">",
+                              i % 16, i);
+
+      for (j = 0; j < 40; j++)
+        {
+          g_string_append (text, words[n++ % G_N_ELEMENTS (words)]);
+          g_string_append_c (text, ' ');
+        }
+
+      g_string_append (text, "<b>bold</b> tail</p></div>");
+    }
+
+  g_string_append (text, "</body></html>");
+
+  return g_string_free (text, FALSE);
+}
+
+static void
+run (SopaElement       *element,
+     SopaSerializeMode  mode,
+     const gchar       *name,
+     guint              n_iterations)
+{
+  SopaSerializeOptions *options;
+  GTimer *timer;
+  gsize length, total = 0;
+  gdouble elapsed;
+  guint i;
+
+  options = sopa_serialize_options_new (mode);
+  timer = g_timer_new ();
+
+  for (i = 0; i < n_iterations; i++)
+    {
+      g_free (sopa_element_serialize (element, options, &length));
+      total += length;
+    }
+
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  g_print ("%-10s %8.1f MB/s  (%" G_GSIZE_FORMAT " bytes, %u runs, %.3f s)\n",
+           name,
+           total / elapsed / (1024 * 1024),
+           length,
+           n_iterations,
+           elapsed);
+
+  g_timer_destroy (timer);
+  sopa_serialize_options_free (options);
+}
+
+int
+main (int argc, char **argv)
+{
+  SopaParser *parser;
+  SopaDocument *document;
+  SopaElement *html;
+  GError *error = NULL;
+  guint n_paragraphs = 20000, n_iterations = 20;
+  gchar *markup;
+
+  if (argc > 1)
+    n_paragraphs = MAX (atoi (argv[1]), 1);
+  if (argc > 2)
+    n_iterations = MAX (atoi (argv[2]), 1);
+
+  markup = make_markup (n_paragraphs);
+
+  parser = sopa_parser_new ();
+  document = sopa_parser_parse (parser, markup, -1, &error);
+  if (document == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return EXIT_FAILURE;
+    }
+
+  /* the root of a tree keeps its markup, so serialize below it to
+   * measure the writer every time
+   */
+  html = SOPA_ELEMENT (sopa_node_get_first_child (SOPA_NODE (document)));
+
+  run (html, SOPA_SERIALIZE_MODE_PRETTY, "pretty", n_iterations);
+  run (html, SOPA_SERIALIZE_MODE_MINIFIED, "minified", n_iterations);
+  run (html, SOPA_SERIALIZE_MODE_FAITHFUL, "faithful", n_iterations);
+
+  g_object_unref (document);
+  g_object_unref (parser);
+  g_free (markup);
+
+  return EXIT_SUCCESS;
+}
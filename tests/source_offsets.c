@@ -0,0 +1,118 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+#define P_MARKUP    "<p id=\"a\">caf\xc3\xa9 &amp; <b>bold</b></p>"
+#define BODY_MARKUP "<body>\n    " P_MARKUP "\n  </body>"
+#define HTML_MARKUP "<html>\n  " BODY_MARKUP "\n</html>"
+
+static const char *source = HTML_MARKUP "\n";
+
+/* checks that the markup of @node is @markup, which is found at
+ * @line and @column of the source
+ */
+static void
+check_node (SopaNode    *node,
+            const gchar *markup,
+            guint        line,
+            guint        column)
+{
+  const gchar *found;
+  guint node_line, node_column;
+  gsize start, end;
+
+  found = strstr (source, markup);
+  g_assert (found != NULL);
+
+  g_assert (sopa_node_get_source_range (node, &start, &end));
+  g_assert_cmpuint (start, ==, found - source);
+  g_assert_cmpuint (end, ==, found - source + strlen (markup));
+
+  g_assert (sopa_node_get_source_position (node, &node_line, &node_column));
+  g_assert_cmpuint (node_line, ==, line);
+  g_assert_cmpuint (node_column, ==, column);
+}
+
+static void
+test_source_offsets (void)
+{
+  SopaDocument *document;
+  SopaNode *html, *body, *p, *text, *b;
+  GBytes *bytes;
+  gsize start, end;
+
+  document = test_parse_tracked (source);
+
+  bytes = sopa_document_get_source (document);
+  g_assert (bytes != NULL);
+  g_assert_cmpmem (g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes),
+                   source, strlen (source));
+
+  html = sopa_node_get_first_child (SOPA_NODE (document));
+  body = sopa_node_get_first_child (html);
+  p = sopa_node_get_first_child (body);
+  text = sopa_node_get_first_child (p);
+  b = sopa_node_get_last_child (p);
+
+  /* the document covers the whole source */
+  g_assert (sopa_node_get_source_range (SOPA_NODE (document), &start, &end));
+  g_assert_cmpuint (start, ==, 0);
+  g_assert_cmpuint (end, ==, strlen (source));
+
+  check_node (html, HTML_MARKUP, 1, 1);
+  check_node (body, BODY_MARKUP, 2, 3);
+  check_node (p, P_MARKUP, 3, 5);
+
+  /* texts as written, and columns counted in characters */
+  check_node (text, "caf\xc3\xa9 &amp; ", 3, 15);
+  check_node (b, "<b>bold</b>", 3, 26);
+  check_node (sopa_node_get_first_child (b), "bold", 3, 29);
+
+  /* the output arguments are optional */
+  g_assert (sopa_node_get_source_range (b, NULL, NULL));
+  g_assert (sopa_node_get_source_position (b, NULL, NULL));
+
+  /* a change drops the offsets of the node and of its ancestors */
+  sopa_element_set_attribute (SOPA_ELEMENT (b), "class", "x");
+  g_assert (!sopa_node_get_source_range (b, &start, &end));
+  g_assert (!sopa_node_get_source_range (p, &start, &end));
+  g_assert (!sopa_node_get_source_position (body, NULL, NULL));
+
+  g_object_unref (document);
+}
+
+static void
+test_source_untracked (void)
+{
+  SopaDocument *document;
+  SopaNode *html;
+  SopaElement *element;
+
+  /* nothing is recorded without the property */
+  document = test_parse (source);
+  html = sopa_node_get_first_child (SOPA_NODE (document));
+
+  g_assert (sopa_document_get_source (document) == NULL);
+  g_assert (!sopa_node_get_source_range (SOPA_NODE (document), NULL, NULL));
+  g_assert (!sopa_node_get_source_range (html, NULL, NULL));
+  g_assert (!sopa_node_get_source_position (html, NULL, NULL));
+
+  g_object_unref (document);
+
+  /* nor for nodes that were not parsed */
+  element = g_object_ref_sink (sopa_element_new ("p"));
+  g_assert (!sopa_node_get_source_range (SOPA_NODE (element), NULL, NULL));
+  g_object_unref (element);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/source/offsets", test_source_offsets);
+  g_test_add_func ("/source/untracked", test_source_untracked);
+
+  return g_test_run ();
+}
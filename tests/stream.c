@@ -0,0 +1,279 @@
+#include <string.h>
+#include <gio/gio.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+/* an output stream whose writes wait until it is opened */
+typedef struct
+{
+  GOutputStream parent;
+
+  GMutex        lock;
+  GCond         cond;
+  gboolean      open;
+  GString      *data;
+} GatedStream;
+
+typedef GOutputStreamClass GatedStreamClass;
+
+static GType gated_stream_get_type (void);
+
+G_DEFINE_TYPE (GatedStream, gated_stream, G_TYPE_OUTPUT_STREAM)
+
+static gssize
+gated_stream_write (GOutputStream  *stream,
+                    const void     *buffer,
+                    gsize           count,
+                    GCancellable   *cancellable,
+                    GError        **error)
+{
+  GatedStream *self = (GatedStream *) stream;
+
+  g_mutex_lock (&self->lock);
+  while (!self->open)
+    g_cond_wait (&self->cond, &self->lock);
+  g_string_append_len (self->data, buffer, count);
+  g_mutex_unlock (&self->lock);
+
+  return count;
+}
+
+static void
+gated_stream_finalize (GObject *object)
+{
+  GatedStream *self = (GatedStream *) object;
+
+  g_string_free (self->data, TRUE);
+  g_cond_clear (&self->cond);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (gated_stream_parent_class)->finalize (object);
+}
+
+static void
+gated_stream_class_init (GatedStreamClass *klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = gated_stream_finalize;
+  klass->write_fn = gated_stream_write;
+}
+
+static void
+gated_stream_init (GatedStream *self)
+{
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  self->data = g_string_new (NULL);
+}
+
+static void
+gated_stream_open (GatedStream *self)
+{
+  g_mutex_lock (&self->lock);
+  self->open = TRUE;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+/* a document with small and large text and attribute values, so that
+ * some pieces are copied and others are written in place
+ */
+static SopaDocument *
+make_document (void)
+{
+  SopaDocument *document;
+  GString *text;
+  guint i, j;
+
+  text = g_string_new ("<root>");
+
+  for (i = 0; i < 400; i++)
+    {
+      g_string_append_printf (text, "<p id=\"p%u\" title=\"a &amp; b", i);
+      if (i % 50 == 0)
+        {
+          for (j = 0; j < 2000; j++)
+            g_string_append_c (text, 'v');
+        }
+      g_string_append (text, "\">some &amp; text");
+
+      if (i % 30 == 0)
+        {
+          for (j = 0; j < 3000; j++)
+            g_string_append_c (text, 'a' + j % 26);
+        }
+
+      g_string_append (text, "</p>");
+    }
+
+  g_string_append (text, "</root>");
+
+  document = test_parse (text->str);
+  g_string_free (text, TRUE);
+
+  return document;
+}
+
+static gchar *
+write_to_memory (SopaElement *element,
+                 guint        indent_width)
+{
+  GOutputStream *stream;
+  GError *error = NULL;
+  gchar *data;
+
+  stream = g_memory_output_stream_new_resizable ();
+
+  g_assert (sopa_element_write_to_stream (element, stream, indent_width,
+                                         NULL, &error));
+  g_assert_no_error (error);
+
+  /* the markup is not nul-terminated */
+  g_assert (g_output_stream_write (stream, "", 1, NULL, &error) == 1);
+  g_assert (g_output_stream_close (stream, NULL, &error));
+
+  data = g_memory_output_stream_steal_data (G_MEMORY_OUTPUT_STREAM (stream));
+  g_object_unref (stream);
+
+  return data;
+}
+
+static void
+test_stream_sync (void)
+{
+  SopaDocument *document;
+  SopaElement *root;
+  gchar *expected, *data;
+
+  document = make_document ();
+  root = SOPA_ELEMENT (sopa_node_get_first_child (SOPA_NODE (document)));
+
+  /* the same markup as in a string, whole or from a sub-tree */
+  expected = sopa_element_to_string (SOPA_ELEMENT (document), 2);
+  data = write_to_memory (SOPA_ELEMENT (document), 2);
+  g_assert_cmpstr (data, ==, expected);
+  g_free (data);
+  g_free (expected);
+
+  expected = sopa_element_to_string (root, 0);
+  data = write_to_memory (root, 0);
+  g_assert_cmpstr (data, ==, expected);
+  g_free (data);
+  g_free (expected);
+
+  g_object_unref (document);
+}
+
+static void
+test_stream_errors (void)
+{
+  SopaDocument *document;
+  GOutputStream *stream;
+  GCancellable *cancellable;
+  GError *error = NULL;
+
+  document = test_parse ("<p>text</p>");
+
+  /* a closed stream */
+  stream = g_memory_output_stream_new_resizable ();
+  g_output_stream_close (stream, NULL, NULL);
+
+  g_assert (!sopa_element_write_to_stream (SOPA_ELEMENT (document), stream, 0,
+                                          NULL, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CLOSED);
+  g_clear_error (&error);
+  g_object_unref (stream);
+
+  /* a cancelled write */
+  stream = g_memory_output_stream_new_resizable ();
+  cancellable = g_cancellable_new ();
+  g_cancellable_cancel (cancellable);
+
+  g_assert (!sopa_element_write_to_stream (SOPA_ELEMENT (document), stream, 0,
+                                          cancellable, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_clear_error (&error);
+
+  g_object_unref (cancellable);
+  g_object_unref (stream);
+  g_object_unref (document);
+}
+
+static void
+write_done (GObject      *source,
+            GAsyncResult *result,
+            gpointer      user_data)
+{
+  GMainLoop *loop = user_data;
+  GError *error = NULL;
+
+  g_assert (sopa_element_write_to_stream_finish (SOPA_ELEMENT (source),
+                                                 result, &error));
+  g_assert_no_error (error);
+
+  g_main_loop_quit (loop);
+}
+
+static void
+test_stream_async (void)
+{
+  SopaDocument *document;
+  SopaElement *root, *p;
+  GatedStream *stream;
+  GMainLoop *loop;
+  gchar *expected;
+
+  document = make_document ();
+  root = SOPA_ELEMENT (sopa_node_get_first_child (SOPA_NODE (document)));
+  p = SOPA_ELEMENT (sopa_node_get_first_child (SOPA_NODE (root)));
+
+  expected = sopa_element_to_string (SOPA_ELEMENT (document), 2);
+
+  loop = g_main_loop_new (NULL, FALSE);
+  stream = g_object_new (gated_stream_get_type (), NULL);
+
+  sopa_element_write_to_stream_async (SOPA_ELEMENT (document),
+                                      G_OUTPUT_STREAM (stream),
+                                      2,
+                                      G_PRIORITY_DEFAULT,
+                                      NULL,
+                                      write_done,
+                                      loop);
+
+  /* the writes are held, so the tree is still being read */
+  g_test_expect_message ("Sopa", G_LOG_LEVEL_CRITICAL,
+                         "*cannot be changed while its tree is being read*");
+  sopa_element_set_attribute (p, "id", "changed");
+  g_test_assert_expected_messages ();
+
+  g_test_expect_message ("Sopa", G_LOG_LEVEL_CRITICAL,
+                         "*cannot be removed from*while its tree is being read*");
+  sopa_element_remove_child (root, SOPA_NODE (p));
+  g_test_assert_expected_messages ();
+
+  gated_stream_open (stream);
+  g_main_loop_run (loop);
+
+  g_assert_cmpstr (stream->data->str, ==, expected);
+
+  /* the tree can be changed again */
+  sopa_element_set_attribute (p, "id", "changed");
+  g_assert_cmpstr (sopa_element_get_attribute (p, "id"), ==, "changed");
+
+  g_object_unref (stream);
+  g_main_loop_unref (loop);
+  g_free (expected);
+  g_object_unref (document);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/stream/sync", test_stream_sync);
+  g_test_add_func ("/stream/errors", test_stream_errors);
+  g_test_add_func ("/stream/async", test_stream_async);
+
+  return g_test_run ();
+}
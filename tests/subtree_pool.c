@@ -0,0 +1,150 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+#define NAV_MARKUP \
+  "<div class=\"nav\"><a href=\"/\">Home</a><a href=\"/about\">About</a></div>"
+
+/* the nodes of NAV_MARKUP */
+#define NAV_N_NODES 5
+
+static gchar *
+make_page (guint n)
+{
+  return g_strdup_printf ("<html>" NAV_MARKUP "<p>page %u</p></html>", n);
+}
+
+/* parses page @n with @parser, checking it against a parse without
+ * the pool
+ */
+static SopaDocument *
+parse_page (SopaParser *parser,
+            guint       n)
+{
+  SopaDocument *document, *expected;
+  gchar *text;
+
+  text = make_page (n);
+
+  document = test_parse_with (parser, text);
+  expected = test_parse (text);
+  g_assert (sopa_node_equal (SOPA_NODE (document), SOPA_NODE (expected)));
+
+  g_object_unref (expected);
+  g_free (text);
+
+  return document;
+}
+
+static SopaNode *
+get_nav (SopaDocument *document)
+{
+  SopaNode *html = sopa_node_get_first_child (SOPA_NODE (document));
+
+  return sopa_node_get_first_child (html);
+}
+
+static void
+test_subtree_pool_share (void)
+{
+  SopaSubtreePool *pool;
+  SopaParser *parser;
+  SopaDocument *documents[5], *expected;
+  SopaNode *nav, *link;
+  guint i;
+
+  pool = sopa_subtree_pool_new (3);
+  g_assert_cmpuint (sopa_subtree_pool_get_min_nodes (pool), ==, 3);
+
+  parser = sopa_parser_new ();
+  sopa_parser_set_subtree_pool (parser, pool);
+  g_assert (sopa_parser_get_subtree_pool (parser) == pool);
+
+  /* a subtree is pooled the second time it is met */
+  documents[0] = parse_page (parser, 0);
+  g_assert_cmpuint (sopa_subtree_pool_get_n_subtrees (pool), ==, 0);
+
+  documents[1] = parse_page (parser, 1);
+  g_assert_cmpuint (sopa_subtree_pool_get_n_subtrees (pool), ==, 1);
+  g_assert_cmpuint (sopa_subtree_pool_get_n_shared_nodes (pool), ==, 0);
+
+  /* and shared from then on */
+  for (i = 2; i < G_N_ELEMENTS (documents); i++)
+    {
+      documents[i] = parse_page (parser, i);
+      g_assert_cmpuint (sopa_subtree_pool_get_n_subtrees (pool), ==, 1);
+      g_assert_cmpuint (sopa_subtree_pool_get_n_shared_nodes (pool), ==,
+                        (i - 1) * NAV_N_NODES);
+    }
+
+  /* the shared data is copied on write */
+  nav = get_nav (documents[2]);
+  link = sopa_node_get_first_child (nav);
+  sopa_element_set_attribute (SOPA_ELEMENT (link), "href", "/index");
+  sopa_text_set_content (SOPA_TEXT (sopa_node_get_first_child (link)), "Start");
+  g_assert (!sopa_node_equal (nav, get_nav (documents[3])));
+
+  g_object_unref (parse_page (parser, 5));
+  g_assert_cmpuint (sopa_subtree_pool_get_n_shared_nodes (pool), ==,
+                    4 * NAV_N_NODES);
+
+  /* the documents keep the data of a cleared pool */
+  sopa_subtree_pool_clear (pool);
+  g_assert_cmpuint (sopa_subtree_pool_get_n_subtrees (pool), ==, 0);
+
+  g_object_unref (parse_page (parser, 6));
+  g_assert_cmpuint (sopa_subtree_pool_get_n_subtrees (pool), ==, 0);
+
+  expected = test_parse (NAV_MARKUP);
+  nav = sopa_node_get_first_child (SOPA_NODE (expected));
+
+  for (i = 0; i < G_N_ELEMENTS (documents); i++)
+    {
+      g_assert (sopa_node_equal (get_nav (documents[i]), nav) == (i != 2));
+      g_object_unref (documents[i]);
+    }
+
+  g_object_unref (expected);
+
+  /* the pool outlives the parser, and the parser can drop it */
+  sopa_parser_set_subtree_pool (parser, NULL);
+  g_assert (sopa_parser_get_subtree_pool (parser) == NULL);
+
+  g_object_unref (parser);
+  sopa_subtree_pool_unref (pool);
+}
+
+static void
+test_subtree_pool_min_nodes (void)
+{
+  SopaSubtreePool *pool;
+  SopaParser *parser;
+  guint i;
+
+  /* smaller subtrees are left alone */
+  pool = sopa_subtree_pool_new (NAV_N_NODES + 1);
+
+  parser = sopa_parser_new ();
+  sopa_parser_set_subtree_pool (parser, pool);
+
+  for (i = 0; i < 4; i++)
+    g_object_unref (parse_page (parser, i));
+
+  g_assert_cmpuint (sopa_subtree_pool_get_n_subtrees (pool), ==, 0);
+  g_assert_cmpuint (sopa_subtree_pool_get_n_shared_nodes (pool), ==, 0);
+
+  g_object_unref (parser);
+  sopa_subtree_pool_unref (pool);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/subtree-pool/share", test_subtree_pool_share);
+  g_test_add_func ("/subtree-pool/min-nodes", test_subtree_pool_min_nodes);
+
+  return g_test_run ();
+}
@@ -0,0 +1,141 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static const char *item =
+  "<li class=\"item\"><a href=\"#top\">link &amp; more</a></li>"
+  "<li>two</li>";
+
+static SopaTemplate *
+make_template_len (const gchar *markup,
+                   gssize       length)
+{
+  SopaTemplate *template;
+  GError *error = NULL;
+
+  template = sopa_template_new (markup, length, &error);
+  g_assert_no_error (error);
+  g_assert (template != NULL);
+
+  return template;
+}
+
+static SopaTemplate *
+make_template (const gchar *markup)
+{
+  return make_template_len (markup, -1);
+}
+
+static void
+test_template_instantiate (void)
+{
+  SopaTemplate *template;
+  SopaDocument *document, *expected;
+  SopaNode *list, *first, *second, *link;
+
+  template = make_template (item);
+  g_assert_cmpuint (sopa_template_get_n_nodes (template), ==, 5);
+
+  document = test_parse ("<ul/>");
+  list = sopa_node_get_first_child (SOPA_NODE (document));
+
+  /* each instance appends the top-level nodes */
+  first = sopa_template_instantiate (template, SOPA_ELEMENT (list));
+  g_assert (first == sopa_node_get_first_child (list));
+  g_assert_cmpint (sopa_element_get_n_children (SOPA_ELEMENT (list)), ==, 2);
+
+  second = sopa_template_instantiate (template, SOPA_ELEMENT (list));
+  g_assert (second == sopa_node_get_child_at_index (list, 2));
+  g_assert (second != first);
+  g_assert_cmpint (sopa_element_get_n_children (SOPA_ELEMENT (list)), ==, 4);
+
+  /* the same tree as parsing the markup every time */
+  expected = test_parse ("<ul>"
+                         "<li class=\"item\"><a href=\"#top\">link &amp; more</a></li>"
+                         "<li>two</li>"
+                         "<li class=\"item\"><a href=\"#top\">link &amp; more</a></li>"
+                         "<li>two</li>"
+                         "</ul>");
+  g_assert (sopa_node_equal (SOPA_NODE (document), SOPA_NODE (expected)));
+  g_assert_cmpuint (sopa_node_get_hash (SOPA_NODE (document)), ==,
+                    sopa_node_get_hash (SOPA_NODE (expected)));
+
+  link = sopa_node_get_first_child (first);
+  g_assert (sopa_node_get_parent (link) == first);
+  g_assert_cmpstr (sopa_element_get_tag (SOPA_ELEMENT (link)), ==, "a");
+  g_assert_cmpstr (sopa_text_get_content (SOPA_TEXT (sopa_node_get_first_child (link))),
+                   ==, "link & more");
+
+  /* changing an instance leaves the others and the template alone */
+  sopa_element_set_attribute (SOPA_ELEMENT (link), "href", "#bottom");
+  sopa_text_set_content (SOPA_TEXT (sopa_node_get_first_child (link)), "changed");
+
+  link = sopa_node_get_first_child (second);
+  g_assert_cmpstr (sopa_element_get_attribute (SOPA_ELEMENT (link), "href"),
+                   ==, "#top");
+  g_assert_cmpstr (sopa_text_get_content (SOPA_TEXT (sopa_node_get_first_child (link))),
+                   ==, "link & more");
+
+  sopa_element_remove_child (SOPA_ELEMENT (list), first);
+  sopa_element_remove_child (SOPA_ELEMENT (list), sopa_node_get_first_child (list));
+  g_assert (!sopa_node_equal (SOPA_NODE (document), SOPA_NODE (expected)));
+
+  sopa_template_instantiate (template, SOPA_ELEMENT (list));
+  g_assert (sopa_node_equal (SOPA_NODE (document), SOPA_NODE (expected)));
+
+  /* the instances outlive the template */
+  sopa_template_unref (template);
+  g_assert (sopa_node_equal (SOPA_NODE (document), SOPA_NODE (expected)));
+
+  g_object_unref (expected);
+  g_object_unref (document);
+}
+
+static void
+test_template_empty (void)
+{
+  SopaTemplate *template;
+  SopaDocument *document;
+  SopaNode *list;
+
+  template = make_template ("");
+  g_assert_cmpuint (sopa_template_get_n_nodes (template), ==, 0);
+
+  document = test_parse ("<ul/>");
+  list = sopa_node_get_first_child (SOPA_NODE (document));
+
+  g_assert (sopa_template_instantiate (template, SOPA_ELEMENT (list)) == NULL);
+  g_assert (sopa_node_get_first_child (list) == NULL);
+
+  g_object_unref (document);
+  sopa_template_unref (template);
+}
+
+static void
+test_template_invalid (void)
+{
+  SopaTemplate *template;
+  GError *error = NULL;
+
+  g_assert (sopa_template_new ("<li>open", -1, &error) == NULL);
+  g_assert_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE);
+  g_clear_error (&error);
+
+  /* only @length bytes are parsed */
+  template = make_template_len ("<li/><li>open", 5);
+  g_assert_cmpuint (sopa_template_get_n_nodes (template), ==, 1);
+  sopa_template_unref (template);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/template/instantiate", test_template_instantiate);
+  g_test_add_func ("/template/empty", test_template_empty);
+  g_test_add_func ("/template/invalid", test_template_invalid);
+
+  return g_test_run ();
+}
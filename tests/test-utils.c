@@ -0,0 +1,50 @@
+#include "test-utils.h"
+
+/* parses @text with @parser, which must succeed */
+SopaDocument *
+test_parse_with (SopaParser  *parser,
+                 const gchar *text)
+{
+  SopaDocument *document;
+  GError *error = NULL;
+
+  document = sopa_parser_parse (parser, text, -1, &error);
+  g_assert_no_error (error);
+  g_assert (document != NULL);
+
+  /* every path hands out a strong reference */
+  g_assert (!g_object_is_floating (document));
+
+  return document;
+}
+
+static SopaDocument *
+parse (const gchar *text,
+       gboolean     track_offsets)
+{
+  SopaParser *parser;
+  SopaDocument *document;
+
+  parser = sopa_parser_new ();
+  sopa_parser_set_track_offsets (parser, track_offsets);
+
+  document = test_parse_with (parser, text);
+
+  g_object_unref (parser);
+
+  return document;
+}
+
+/* parses @text, which must be well formed */
+SopaDocument *
+test_parse (const gchar *text)
+{
+  return parse (text, FALSE);
+}
+
+/* parses @text, recording where each node is in it */
+SopaDocument *
+test_parse_tracked (const gchar *text)
+{
+  return parse (text, TRUE);
+}
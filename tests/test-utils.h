@@ -0,0 +1,15 @@
+#ifndef __TEST_UTILS_H__
+#define __TEST_UTILS_H__
+
+#include <sopa/sopa.h>
+
+G_BEGIN_DECLS
+
+SopaDocument *                      test_parse_with                             (SopaParser               *parser,
+                                                                                 const gchar              *text);
+SopaDocument *                      test_parse                                  (const gchar              *text);
+SopaDocument *                      test_parse_tracked                          (const gchar              *text);
+
+G_END_DECLS
+
+#endif /* __TEST_UTILS_H__ */
@@ -0,0 +1,134 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static const char *html =
+  "<body>"
+    "<h1>  The   title </h1>"
+    "<script>var a = 1;</script>"
+    "<p>Some <b>bold</b>\n\ttext &amp; <i>more</i></p>"
+    "<style>p { color: red; }</style>"
+    "<p>end</p>"
+  "</body>";
+
+static void
+test_text_content (void)
+{
+  SopaDocument *document;
+  SopaNode *body, *b;
+  gchar *text;
+  gsize length;
+
+  document = test_parse (html);
+  body = sopa_node_get_first_child (SOPA_NODE (document));
+
+  /* every text, as it is */
+  text = sopa_node_get_text_content (body, &length);
+  g_assert_cmpstr (text, ==,
+                   "  The   title var a = 1;Some bold\n\ttext & more"
+                   "p { color: red; }end");
+  g_assert_cmpuint (length, ==, strlen (text));
+  g_free (text);
+
+  /* the document, a text and an element without any */
+  text = sopa_node_get_text_content (SOPA_NODE (document), NULL);
+  g_assert_cmpstr (text, ==,
+                   "  The   title var a = 1;Some bold\n\ttext & more"
+                   "p { color: red; }end");
+  g_free (text);
+
+  b = sopa_node_get_child_at_index (sopa_node_get_child_at_index (body, 2), 1);
+  text = sopa_node_get_text_content (sopa_node_get_first_child (b), &length);
+  g_assert_cmpstr (text, ==, "bold");
+  g_assert_cmpuint (length, ==, 4);
+  g_free (text);
+
+  sopa_element_remove_all_children (SOPA_ELEMENT (b));
+  text = sopa_node_get_text_content (b, &length);
+  g_assert_cmpstr (text, ==, "");
+  g_assert_cmpuint (length, ==, 0);
+  g_free (text);
+
+  g_object_unref (document);
+}
+
+static void
+test_inner_text (void)
+{
+  SopaDocument *document;
+  SopaNode *body, *script;
+  gchar *text;
+  gsize length;
+
+  document = test_parse (html);
+  body = sopa_node_get_first_child (SOPA_NODE (document));
+
+  /* without scripts and styles, and with the white space collapsed */
+  text = sopa_node_get_inner_text (body, &length);
+  g_assert_cmpstr (text, ==, "The title Some bold text & moreend");
+  g_assert_cmpuint (length, ==, strlen (text));
+  g_free (text);
+
+  /* a script on its own has none */
+  script = sopa_node_get_child_at_index (body, 1);
+  text = sopa_node_get_inner_text (script, &length);
+  g_assert_cmpstr (text, ==, "");
+  g_assert_cmpuint (length, ==, 0);
+  g_free (text);
+
+  g_object_unref (document);
+}
+
+static void
+test_text_copy (void)
+{
+  SopaDocument *document;
+  SopaNode *body;
+  gchar buffer[64];
+  gsize length;
+
+  document = test_parse (html);
+  body = sopa_node_get_first_child (SOPA_NODE (document));
+
+  /* the length alone */
+  length = sopa_node_copy_inner_text (body, NULL, 0);
+  g_assert_cmpuint (length, ==, strlen ("The title Some bold text & moreend"));
+
+  /* into a buffer large enough */
+  memset (buffer, 'x', sizeof (buffer));
+  length = sopa_node_copy_inner_text (body, buffer, sizeof (buffer));
+  g_assert_cmpstr (buffer, ==, "The title Some bold text & moreend");
+  g_assert_cmpuint (length, ==, strlen (buffer));
+
+  /* truncated, as g_strlcpy() does */
+  memset (buffer, 'x', sizeof (buffer));
+  length = sopa_node_copy_inner_text (body, buffer, 10);
+  g_assert_cmpstr (buffer, ==, "The title");
+  g_assert_cmpuint (length, ==, strlen ("The title Some bold text & moreend"));
+  g_assert (buffer[10] == 'x');
+
+  memset (buffer, 'x', sizeof (buffer));
+  length = sopa_node_copy_text_content (body, buffer, 6);
+  g_assert_cmpstr (buffer, ==, "  The");
+  g_assert_cmpuint (length, ==, sopa_node_copy_text_content (body, NULL, 0));
+
+  /* a buffer with room for the nul only */
+  length = sopa_node_copy_text_content (body, buffer, 1);
+  g_assert_cmpstr (buffer, ==, "");
+  g_assert_cmpuint (length, >, 0);
+
+  g_object_unref (document);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/text/content", test_text_content);
+  g_test_add_func ("/text/inner-text", test_inner_text);
+  g_test_add_func ("/text/copy", test_text_copy);
+
+  return g_test_run ();
+}
@@ -0,0 +1,165 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+typedef struct
+{
+  guint first_child;
+  guint last_child;
+} Notifications;
+
+static void
+on_notify (GObject    *object,
+           GParamSpec *pspec,
+           gpointer    user_data)
+{
+  Notifications *notifications = user_data;
+
+  if (strcmp (pspec->name, "first-child") == 0)
+    notifications->first_child += 1;
+  else if (strcmp (pspec->name, "last-child") == 0)
+    notifications->last_child += 1;
+}
+
+static void
+watch (SopaNode      *node,
+       Notifications *notifications)
+{
+  memset (notifications, 0, sizeof (Notifications));
+
+  g_signal_connect (node, "notify", G_CALLBACK (on_notify), notifications);
+}
+
+static void
+add_items (SopaNode *list,
+           guint     n_items)
+{
+  guint i;
+
+  for (i = 0; i < n_items; i++)
+    sopa_element_add_child (SOPA_ELEMENT (list),
+                            SOPA_NODE (sopa_element_new ("li")));
+}
+
+static void
+test_update_coalesced (void)
+{
+  SopaDocument *document;
+  SopaNode *list, *first;
+  Notifications notifications;
+
+  document = test_parse ("<ul/>");
+  list = sopa_node_get_first_child (SOPA_NODE (document));
+  watch (list, &notifications);
+
+  /* each change notifies on its own */
+  add_items (list, 3);
+  g_assert_cmpuint (notifications.first_child, ==, 1);
+  g_assert_cmpuint (notifications.last_child, ==, 3);
+
+  /* and once per batch inside one, which can still be read */
+  memset (&notifications, 0, sizeof (Notifications));
+  first = sopa_node_get_first_child (list);
+
+  sopa_document_begin_update (document);
+
+  add_items (list, 100);
+  sopa_element_remove_child (SOPA_ELEMENT (list), first);
+  g_assert_cmpuint (sopa_element_get_n_children (SOPA_ELEMENT (list)), ==, 102);
+  g_assert (sopa_node_get_first_child (list) != first);
+
+  g_assert_cmpuint (notifications.first_child, ==, 0);
+  g_assert_cmpuint (notifications.last_child, ==, 0);
+
+  sopa_document_end_update (document);
+
+  g_assert_cmpuint (notifications.first_child, ==, 1);
+  g_assert_cmpuint (notifications.last_child, ==, 1);
+
+  g_object_unref (document);
+}
+
+static void
+test_update_unchanged (void)
+{
+  SopaDocument *document;
+  SopaNode *list;
+  SopaElement *item;
+  Notifications notifications;
+
+  document = test_parse ("<ul><li/><li/></ul>");
+  list = sopa_node_get_first_child (SOPA_NODE (document));
+  watch (list, &notifications);
+
+  /* children that are the same at the end are not notified */
+  sopa_document_begin_update (document);
+
+  item = sopa_element_new ("li");
+  sopa_element_insert_child_at_index (SOPA_ELEMENT (list), SOPA_NODE (item), 0);
+  sopa_element_remove_child (SOPA_ELEMENT (list), SOPA_NODE (item));
+
+  add_items (list, 1);
+  sopa_element_remove_child (SOPA_ELEMENT (list),
+                             sopa_node_get_last_child (list));
+
+  sopa_document_end_update (document);
+
+  g_assert_cmpuint (notifications.first_child, ==, 0);
+  g_assert_cmpuint (notifications.last_child, ==, 0);
+
+  g_object_unref (document);
+}
+
+static void
+test_update_nested (void)
+{
+  SopaDocument *document;
+  SopaNode *list, *item;
+  Notifications list_notifications, item_notifications;
+
+  document = test_parse ("<ul><li/></ul>");
+  list = sopa_node_get_first_child (SOPA_NODE (document));
+  item = sopa_node_get_first_child (list);
+  watch (list, &list_notifications);
+  watch (item, &item_notifications);
+
+  sopa_document_begin_update (document);
+  sopa_document_begin_update (document);
+
+  add_items (list, 2);
+  add_items (item, 2);
+
+  /* the notifications wait for the outermost batch */
+  sopa_document_end_update (document);
+  g_assert_cmpuint (list_notifications.last_child, ==, 0);
+  g_assert_cmpuint (item_notifications.first_child, ==, 0);
+
+  add_items (item, 1);
+
+  sopa_document_end_update (document);
+  g_assert_cmpuint (list_notifications.first_child, ==, 0);
+  g_assert_cmpuint (list_notifications.last_child, ==, 1);
+  g_assert_cmpuint (item_notifications.first_child, ==, 1);
+  g_assert_cmpuint (item_notifications.last_child, ==, 1);
+
+  /* there is no batch left to end */
+  g_test_expect_message ("Sopa", G_LOG_LEVEL_CRITICAL,
+                         "*without a matching sopa_document_begin_update()*");
+  sopa_document_end_update (document);
+  g_test_assert_expected_messages ();
+
+  g_object_unref (document);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/update/coalesced", test_update_coalesced);
+  g_test_add_func ("/update/unchanged", test_update_unchanged);
+  g_test_add_func ("/update/nested", test_update_nested);
+
+  return g_test_run ();
+}
@@ -0,0 +1,216 @@
+#include <string.h>
+#include <sopa/sopa.h>
+
+#include "test-utils.h"
+
+static const char *html =
+  "<root>"
+    "<a id=\"1\">x</a>"
+    "<b id=\"2\"/>"
+    "<a id=\"3\">y<c/></a>"
+    "text"
+    "<a id=\"4\" k=\"v\"/>"
+  "</root>";
+
+static SopaXPathResult *
+evaluate (SopaNode    *context,
+          const gchar *expression)
+{
+  SopaXPath *xpath;
+  SopaXPathResult *result;
+  GError *error = NULL;
+
+  xpath = sopa_xpath_compile (expression, &error);
+  g_assert_no_error (error);
+
+  result = sopa_xpath_evaluate (xpath, context, &error);
+  g_assert_no_error (error);
+  g_assert (result != NULL);
+
+  sopa_xpath_unref (xpath);
+
+  return result;
+}
+
+/* the ids of the selected elements and the content of the selected
+ * texts, joined
+ */
+static void
+assert_nodes (SopaNode    *context,
+              const gchar *expression,
+              const gchar *expected)
+{
+  SopaXPathResult *result;
+  GPtrArray *nodes;
+  GString *ids;
+  guint i;
+
+  result = evaluate (context, expression);
+  g_assert_cmpint (sopa_xpath_result_get_result_type (result), ==,
+                   SOPA_XPATH_RESULT_NODES);
+
+  nodes = sopa_xpath_result_get_nodes (result);
+  ids = g_string_new (NULL);
+
+  for (i = 0; i < nodes->len; i++)
+    {
+      SopaNode *node = g_ptr_array_index (nodes, i);
+
+      if (SOPA_IS_ELEMENT (node))
+        g_string_append (ids, sopa_element_get_attribute (SOPA_ELEMENT (node), "id"));
+      else if (SOPA_IS_TEXT (node))
+        g_string_append (ids, sopa_text_get_content (SOPA_TEXT (node)));
+    }
+
+  g_assert_cmpstr (ids->str, ==, expected);
+
+  g_string_free (ids, TRUE);
+  sopa_xpath_result_free (result);
+}
+
+static void
+assert_string (SopaNode    *context,
+               const gchar *expression,
+               const gchar *expected)
+{
+  SopaXPathResult *result;
+  gchar *value;
+
+  result = evaluate (context, expression);
+  value = sopa_xpath_result_get_string (result);
+  g_assert_cmpstr (value, ==, expected);
+
+  g_free (value);
+  sopa_xpath_result_free (result);
+}
+
+static void
+test_xpath_paths (void)
+{
+  SopaDocument *document;
+  SopaNode *root;
+
+  document = test_parse (html);
+  root = SOPA_NODE (document);
+
+  assert_nodes (root, "/root/a", "134");
+  assert_nodes (root, "//a[@k]", "4");
+  assert_nodes (root, "//a[position() > 1]", "34");
+  assert_nodes (root, "/root/b | /root/a[1]", "12");
+  assert_nodes (root, "//c/..", "3");
+  assert_nodes (root, "/root/b/following-sibling::a", "34");
+  assert_nodes (root, "/root/text()", "text");
+
+  /* the context of a relative path is the given node */
+  assert_nodes (sopa_node_get_first_child (root), "a[text() = 'y']", "3");
+
+  g_object_unref (document);
+}
+
+static void
+test_xpath_indexed (void)
+{
+  SopaDocument *document;
+  SopaNode *root;
+
+  document = test_parse (html);
+  root = SOPA_NODE (document);
+
+  assert_nodes (root, "/root/a[2]", "3");
+  assert_nodes (root, "/root/*[2]", "2");
+  assert_nodes (root, "/root/node()[4]", "text");
+  assert_nodes (root, "/root/a[last()]", "4");
+  assert_nodes (root, "/root/*[last()]", "4");
+  assert_nodes (root, "/root/node()[last()]", "4");
+
+  /* positions that select nothing */
+  assert_nodes (root, "/root/a[4]", "");
+  assert_nodes (root, "/root/a[0]", "");
+  assert_nodes (root, "/root/a[-1]", "");
+  assert_nodes (root, "/root/a[1.5]", "");
+  assert_nodes (root, "/root/a[4294967297]", "");
+  assert_nodes (root, "/root/a[number('x')]", "");
+  assert_nodes (root, "/root/node()[6]", "");
+
+  g_object_unref (document);
+}
+
+static void
+test_xpath_values (void)
+{
+  SopaDocument *document;
+  SopaXPathResult *result;
+  GPtrArray *values;
+  SopaNode *root;
+
+  document = test_parse (html);
+  root = SOPA_NODE (document);
+
+  result = evaluate (root, "//a/@id");
+  g_assert_cmpint (sopa_xpath_result_get_result_type (result), ==,
+                   SOPA_XPATH_RESULT_ATTRIBUTES);
+  values = sopa_xpath_result_get_attributes (result);
+  g_assert_cmpuint (values->len, ==, 3);
+  g_assert_cmpstr (g_ptr_array_index (values, 2), ==, "4");
+  sopa_xpath_result_free (result);
+
+  result = evaluate (root, "count(//a) + count(//c/ancestor::*)");
+  g_assert_cmpfloat (sopa_xpath_result_get_number (result), ==, 5);
+  sopa_xpath_result_free (result);
+
+  result = evaluate (root, "not(//d) and boolean(//c)");
+  g_assert (sopa_xpath_result_get_boolean (result));
+  sopa_xpath_result_free (result);
+
+  assert_string (root, "string(/root/a[2])", "y");
+  assert_string (root, "name(/root/*[2])", "b");
+  assert_string (root, "concat(substring-before('a-b', '-'), 'c')", "ac");
+  assert_string (root, "normalize-space('  x   y ')", "x y");
+
+  g_object_unref (document);
+}
+
+static void
+test_xpath_errors (void)
+{
+  SopaDocument *document;
+  SopaXPath *xpath;
+  SopaXPathResult *result;
+  GError *error = NULL;
+
+  xpath = sopa_xpath_compile ("/root/[", &error);
+  g_assert (xpath == NULL);
+  g_assert_error (error, SOPA_XPATH_ERROR, SOPA_XPATH_ERROR_SYNTAX);
+  g_clear_error (&error);
+
+  xpath = sopa_xpath_compile ("nope()", &error);
+  g_assert (xpath == NULL);
+  g_assert_error (error, SOPA_XPATH_ERROR, SOPA_XPATH_ERROR_UNKNOWN_FUNCTION);
+  g_clear_error (&error);
+
+  /* a number is not a node-set */
+  document = test_parse (html);
+  xpath = sopa_xpath_compile ("count(1)", &error);
+  g_assert_no_error (error);
+
+  result = sopa_xpath_evaluate (xpath, SOPA_NODE (document), &error);
+  g_assert (result == NULL);
+  g_assert_error (error, SOPA_XPATH_ERROR, SOPA_XPATH_ERROR_TYPE);
+  g_clear_error (&error);
+
+  sopa_xpath_unref (xpath);
+  g_object_unref (document);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/xpath/paths", test_xpath_paths);
+  g_test_add_func ("/xpath/indexed", test_xpath_indexed);
+  g_test_add_func ("/xpath/values", test_xpath_values);
+  g_test_add_func ("/xpath/errors", test_xpath_errors);
+
+  return g_test_run ();
+}